@@ -1,92 +1,316 @@
 #include "agent_loop.h"
 #include "agent/context_builder.h"
+#include "agent/token_budget.h"
+#include "agent/tool_runner.h"
 #include "mimi_config.h"
 #include "bus/message_bus.h"
 #include "llm/llm_proxy.h"
+#include "llm/llm_conv.h"
 #include "memory/session_mgr.h"
 #include "tools/tool_registry.h"
+#include "gateway/ws_server.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 
 static const char *TAG = "agent";
 
-#define TOOL_OUTPUT_SIZE  (8 * 1024)
+/* ── Workers, chat affinity and admission ──────────────────────── */
+
+typedef struct {
+    mimi_msg_t msg;
+    int64_t received_us;    /* popped from the inbound bus */
+} agent_job_t;
+
+typedef struct {
+    int id;
+    QueueHandle_t queue;    /* agent_job_t, filled by the dispatcher */
+    int pending;            /* jobs queued or running on this worker */
+} agent_worker_t;
+
+/*
+ * A chat stays on one worker while it has messages queued or running
+ * there, so its turns run in order; a chat with nothing in flight goes
+ * to the least loaded worker. Different chats therefore run in parallel.
+ */
+typedef struct {
+    char chat_id[32];
+    int worker;
+    int count;              /* 0 = free slot */
+} chat_route_t;
+
+/*
+ * A job whose worker queue is full is parked in the dispatcher instead of
+ * blocking it, so the next message can still go to an idle worker. The
+ * worker takes its parked jobs, in order, as its queue drains.
+ */
+typedef struct {
+    agent_job_t job;
+    int worker;
+} parked_job_t;
+
+#define PARK_SLOTS        (MIMI_AGENT_WORKERS * MIMI_AGENT_WORKER_QUEUE_LEN)
+/* One per job queued, running or parked, so a free slot always exists */
+#define ROUTE_SLOTS       (MIMI_AGENT_WORKERS * (MIMI_AGENT_WORKER_QUEUE_LEN + 1) + PARK_SLOTS)
+#define LATENCY_SAMPLES   128
+
+static agent_worker_t s_workers[MIMI_AGENT_WORKERS];
+static chat_route_t s_routes[ROUTE_SLOTS];
+static parked_job_t s_parked[PARK_SLOTS];   /* in arrival order */
+static int s_parked_count;
+static SemaphoreHandle_t s_lock;            /* routes, parked jobs, pending counts, admission, stats */
+static SemaphoreHandle_t s_admit_signal;    /* given when a turn ends */
+static SemaphoreHandle_t s_dispatch_signal; /* given when a worker goes idle or takes a parked job */
+static int s_active;                        /* turns currently admitted */
+
+static struct {
+    uint32_t latency_ms[LATENCY_SAMPLES];   /* ring of recent turn latencies */
+    int samples;
+    int next;
+    uint32_t turns;
+    uint32_t admission_waits;
+    int max_active;
+} s_stats;
+
+/* Fixed replies are built once; each send only takes a reference */
+static const char *s_working_phrases[] = {
+    "mimi\xF0\x9F\x98\x97is working...",
+    "mimi\xF0\x9F\x90\xBE is thinking...",
+    "mimi\xF0\x9F\x92\xAD is pondering...",
+    "mimi\xF0\x9F\x8C\x99 is on it...",
+    "mimi\xE2\x9C\xA8 is cooking...",
+};
+#define PHRASE_COUNT (sizeof(s_working_phrases) / sizeof(s_working_phrases[0]))
+
+static char *s_phrase_bufs[PHRASE_COUNT];
+static char *s_error_buf;
+
+static void push_shared_reply(const mimi_msg_t *msg, char *buf)
+{
+    if (!buf) return;
+    mimi_msg_t out = {0};
+    strncpy(out.channel, msg->channel, sizeof(out.channel) - 1);
+    strncpy(out.chat_id, msg->chat_id, sizeof(out.chat_id) - 1);
+    out.content = msg_buf_ref(buf);
+    if (message_bus_push_outbound(&out) != ESP_OK) {
+        msg_buf_release(out.content);
+    }
+}
 
-/* Build the assistant content array from llm_response_t for the messages history.
- * Returns a cJSON array with text and tool_use blocks. */
-static cJSON *build_assistant_content(const llm_response_t *resp)
+static int route_acquire(const char *chat_id)
 {
-    cJSON *content = cJSON_CreateArray();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    int worker = -1;
+    chat_route_t *free_slot = NULL;
+    for (int i = 0; i < ROUTE_SLOTS; i++) {
+        chat_route_t *r = &s_routes[i];
+        if (r->count == 0) {
+            if (!free_slot) free_slot = r;
+        } else if (strcmp(r->chat_id, chat_id) == 0) {
+            worker = r->worker;
+            r->count++;
+            break;
+        }
+    }
 
-    /* Text block */
-    if (resp->text && resp->text_len > 0) {
-        cJSON *text_block = cJSON_CreateObject();
-        cJSON_AddStringToObject(text_block, "type", "text");
-        cJSON_AddStringToObject(text_block, "text", resp->text);
-        cJSON_AddItemToArray(content, text_block);
+    if (worker < 0 && free_slot) {
+        worker = 0;
+        for (int i = 1; i < MIMI_AGENT_WORKERS; i++) {
+            if (s_workers[i].pending < s_workers[worker].pending) worker = i;
+        }
+        strncpy(free_slot->chat_id, chat_id, sizeof(free_slot->chat_id) - 1);
+        free_slot->chat_id[sizeof(free_slot->chat_id) - 1] = '\0';
+        free_slot->worker = worker;
+        free_slot->count = 1;
+    } else if (worker < 0) {
+        /* Untracked: a fixed worker per chat still keeps its turns in order */
+        uint32_t hash = 2166136261u;
+        for (const char *p = chat_id; *p; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        worker = hash % MIMI_AGENT_WORKERS;
+        ESP_LOGW(TAG, "Route slots full, chat %s pinned to worker %d", chat_id, worker);
     }
+    s_workers[worker].pending++;
 
-    /* Tool use blocks */
-    for (int i = 0; i < resp->call_count; i++) {
-        const llm_tool_call_t *call = &resp->calls[i];
-        cJSON *tool_block = cJSON_CreateObject();
-        cJSON_AddStringToObject(tool_block, "type", "tool_use");
-        cJSON_AddStringToObject(tool_block, "id", call->id);
-        cJSON_AddStringToObject(tool_block, "name", call->name);
+    xSemaphoreGive(s_lock);
+    return worker;
+}
 
-        cJSON *input = cJSON_Parse(call->input);
-        if (input) {
-            cJSON_AddItemToObject(tool_block, "input", input);
-        } else {
-            cJSON_AddItemToObject(tool_block, "input", cJSON_CreateObject());
+static void route_release(int worker, const char *chat_id)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < ROUTE_SLOTS; i++) {
+        chat_route_t *r = &s_routes[i];
+        if (r->count > 0 && r->worker == worker && strcmp(r->chat_id, chat_id) == 0) {
+            r->count--;
+            break;
         }
+    }
+    bool idle = --s_workers[worker].pending == 0;
+    xSemaphoreGive(s_lock);
 
-        cJSON_AddItemToArray(content, tool_block);
+    if (idle) xSemaphoreGive(s_dispatch_signal);
+}
+
+/* Queue job on its worker, or park it behind the worker's full queue */
+static void job_hand_on(int worker, const agent_job_t *job)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool behind = false;
+    for (int i = 0; i < s_parked_count && !behind; i++) {
+        behind = s_parked[i].worker == worker;
+    }
+    /* The dispatcher pops only while a park slot is free */
+    if (behind || xQueueSend(s_workers[worker].queue, job, 0) != pdTRUE) {
+        s_parked[s_parked_count].job = *job;
+        s_parked[s_parked_count].worker = worker;
+        s_parked_count++;
+        ESP_LOGI(TAG, "Worker %d queue full, parked message from %s (%d parked)",
+                 worker, job->msg.chat_id, s_parked_count);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/* Move the worker's parked jobs into the slots its queue has freed */
+static void job_unpark(int worker)
+{
+    int taken = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int kept = 0;
+    bool full = false;
+    for (int i = 0; i < s_parked_count; i++) {
+        if (s_parked[i].worker == worker && !full &&
+            xQueueSend(s_workers[worker].queue, &s_parked[i].job, 0) == pdTRUE) {
+            taken++;
+            continue;
+        }
+        if (s_parked[i].worker == worker) full = true;
+        s_parked[kept++] = s_parked[i];
     }
+    s_parked_count = kept;
+    xSemaphoreGive(s_lock);
 
-    return content;
+    if (taken) xSemaphoreGive(s_dispatch_signal);
 }
 
-/* Build the user message with tool_result blocks */
-static cJSON *build_tool_results(const llm_response_t *resp, char *tool_output, size_t tool_output_size)
+/* Some worker is idle and a park slot is free */
+static bool can_dispatch(void)
 {
-    cJSON *content = cJSON_CreateArray();
+    bool idle = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < MIMI_AGENT_WORKERS && !idle; i++) {
+        idle = s_workers[i].pending == 0;
+    }
+    bool room = s_parked_count < PARK_SLOTS;
+    xSemaphoreGive(s_lock);
+    return idle && room;
+}
+
+/* Start a turn only while enough PSRAM is free; one turn is always allowed */
+static void admission_acquire(int worker)
+{
+    bool waited = false;
+    while (1) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        size_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        if (s_active == 0 || free_psram >= MIMI_AGENT_ADMIT_MIN_PSRAM) {
+            s_active++;
+            if (s_active > s_stats.max_active) s_stats.max_active = s_active;
+            if (waited) s_stats.admission_waits++;
+            xSemaphoreGive(s_lock);
+            return;
+        }
+        xSemaphoreGive(s_lock);
+
+        if (!waited) {
+            ESP_LOGW(TAG, "Worker %d: waiting for memory (PSRAM free %d bytes, %d turns active)",
+                     worker, (int)free_psram, s_active);
+            waited = true;
+        }
+        xSemaphoreTake(s_admit_signal, pdMS_TO_TICKS(1000));
+    }
+}
 
-    for (int i = 0; i < resp->call_count; i++) {
-        const llm_tool_call_t *call = &resp->calls[i];
+static void admission_release(int64_t latency_us)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_active--;
+    s_stats.turns++;
+    s_stats.latency_ms[s_stats.next] = (uint32_t)(latency_us / 1000);
+    s_stats.next = (s_stats.next + 1) % LATENCY_SAMPLES;
+    if (s_stats.samples < LATENCY_SAMPLES) s_stats.samples++;
+    xSemaphoreGive(s_lock);
+
+    xSemaphoreGive(s_admit_signal);
+}
 
-        /* Execute tool */
-        tool_output[0] = '\0';
-        tool_registry_execute(call->name, call->input, tool_output, tool_output_size);
+static void agent_dispatch_task(void *arg)
+{
+    ESP_LOGI(TAG, "Agent dispatcher started (%d workers)", MIMI_AGENT_WORKERS);
 
-        ESP_LOGI(TAG, "Tool %s result: %d bytes", call->name, (int)strlen(tool_output));
+    while (1) {
+        /* Only pop while some worker is idle, so that waiting messages
+         * stay in the bus where the priority lanes order them. A message
+         * for a chat pinned to a busy worker queues (or parks) there and
+         * leaves the idle worker to the next message. */
+        while (!can_dispatch()) {
+            xSemaphoreTake(s_dispatch_signal, portMAX_DELAY);
+        }
+
+        agent_job_t job;
+        if (message_bus_pop_inbound(&job.msg, UINT32_MAX) != ESP_OK) continue;
+        job.received_us = esp_timer_get_time();
 
-        /* Build tool_result block */
-        cJSON *result_block = cJSON_CreateObject();
-        cJSON_AddStringToObject(result_block, "type", "tool_result");
-        cJSON_AddStringToObject(result_block, "tool_use_id", call->id);
-        cJSON_AddStringToObject(result_block, "content", tool_output);
-        cJSON_AddItemToArray(content, result_block);
+        /* Connect to the API while the worker builds the prompt */
+        llm_prewarm();
+
+        /* Parks when the chat's worker already holds
+         * MIMI_AGENT_WORKER_QUEUE_LEN of its messages; once PARK_SLOTS
+         * are parked, backpressure builds up in the inbound bus instead */
+        int worker = route_acquire(job.msg.chat_id);
+        job_hand_on(worker, &job);
     }
+}
 
-    return content;
+/* Per-call state shared with the streaming callbacks */
+typedef struct {
+    const mimi_msg_t *msg;
+    tool_batch_t *batch;
+} stream_ctx_t;
+
+/* Forward streamed text to the WebSocket client while the turn is running */
+static void on_stream_text(const char *delta, size_t len, void *ctx)
+{
+    const stream_ctx_t *sc = (const stream_ctx_t *)ctx;
+    ws_server_send_delta(sc->msg->chat_id, delta, len);
+}
+
+/* Start a tool as soon as its tool_use block has fully streamed */
+static void on_stream_tool(int index, const llm_tool_call_t *call, void *ctx)
+{
+    stream_ctx_t *sc = (stream_ctx_t *)ctx;
+    tool_batch_submit(sc->batch, index, call);
 }
 
 static void agent_loop_task(void *arg)
 {
-    ESP_LOGI(TAG, "Agent loop started on core %d", xPortGetCoreID());
+    agent_worker_t *worker = (agent_worker_t *)arg;
+    ESP_LOGI(TAG, "Agent worker %d started on core %d", worker->id, xPortGetCoreID());
 
-    /* Allocate large buffers from PSRAM */
+    /* Allocate the large per-worker prompt buffer from PSRAM */
     char *system_prompt = heap_caps_calloc(1, MIMI_CONTEXT_BUF_SIZE, MALLOC_CAP_SPIRAM);
-    char *history_json = heap_caps_calloc(1, MIMI_LLM_STREAM_BUF_SIZE, MALLOC_CAP_SPIRAM);
-    char *tool_output = heap_caps_calloc(1, TOOL_OUTPUT_SIZE, MALLOC_CAP_SPIRAM);
-
-    if (!system_prompt || !history_json || !tool_output) {
+    if (!system_prompt) {
         ESP_LOGE(TAG, "Failed to allocate PSRAM buffers");
         vTaskDelete(NULL);
         return;
@@ -95,62 +319,81 @@ static void agent_loop_task(void *arg)
     const char *tools_json = tool_registry_get_tools_json();
 
     while (1) {
-        mimi_msg_t msg;
-        esp_err_t err = message_bus_pop_inbound(&msg, UINT32_MAX);
-        if (err != ESP_OK) continue;
-
-        ESP_LOGI(TAG, "Processing message from %s:%s", msg.channel, msg.chat_id);
-
-        /* 1. Build system prompt */
-        context_build_system_prompt(system_prompt, MIMI_CONTEXT_BUF_SIZE);
-
-        /* 2. Load session history into cJSON array */
-        session_get_history_json(msg.chat_id, history_json,
-                                 MIMI_LLM_STREAM_BUF_SIZE, MIMI_AGENT_MAX_HISTORY);
-
-        cJSON *messages = cJSON_Parse(history_json);
+        agent_job_t job;
+        if (xQueueReceive(worker->queue, &job, portMAX_DELAY) != pdTRUE) continue;
+        job_unpark(worker->id);
+        mimi_msg_t msg = job.msg;
+        esp_err_t err;
+
+        admission_acquire(worker->id);
+        int64_t start_us = esp_timer_get_time();
+        msg_buf_stats_t bufs_before;
+        msg_buf_get_stats(&bufs_before);
+
+        ESP_LOGI(TAG, "Worker %d processing message from %s:%s", worker->id, msg.channel, msg.chat_id);
+
+        /* 1. Build system prompt within its sections' token shares */
+        token_budget_t budget;
+        token_budget_init(&budget);
+        budget.used[TOKEN_SEC_TOOLS] = tools_json ? token_estimate(tools_json, strlen(tools_json)) : 0;
+        budget.used[TOKEN_SEC_USER] = token_estimate(msg.content, strlen(msg.content));
+        size_t stable_len = 0;
+        context_build_system_prompt(system_prompt, MIMI_CONTEXT_BUF_SIZE, &budget, &stable_len);
+
+        /* 2. Load session history (cached for hot chats), newest messages that fit */
+        cJSON *messages = session_get_history(msg.chat_id, MIMI_AGENT_MAX_HISTORY);
         if (!messages) messages = cJSON_CreateArray();
+        context_fit_history(messages, &budget);
+        token_budget_log(&budget);
 
-        /* 3. Append current user message */
-        cJSON *user_msg = cJSON_CreateObject();
-        cJSON_AddStringToObject(user_msg, "role", "user");
-        cJSON_AddStringToObject(user_msg, "content", msg.content);
-        cJSON_AddItemToArray(messages, user_msg);
+        /* 3. Convert once to the provider's shape, append current user message */
+        llm_conv_t conv;
+        err = llm_conv_init(&conv, llm_get_provider(), messages);
+        if (err == ESP_OK) err = llm_conv_add_user(&conv, msg.content);
+        if (err != ESP_OK) ESP_LOGE(TAG, "Failed to build conversation");
 
         /* 4. ReAct loop */
         char *final_text = NULL;
         int iteration = 0;
 
-        while (iteration < MIMI_AGENT_MAX_TOOL_ITER) {
+        while (err == ESP_OK && iteration < MIMI_AGENT_MAX_TOOL_ITER) {
             /* Send "working" indicator before each API call */
-            {
-                static const char *working_phrases[] = {
-                    "mimi\xF0\x9F\x98\x97is working...",
-                    "mimi\xF0\x9F\x90\xBE is thinking...",
-                    "mimi\xF0\x9F\x92\xAD is pondering...",
-                    "mimi\xF0\x9F\x8C\x99 is on it...",
-                    "mimi\xE2\x9C\xA8 is cooking...",
-                };
-                const int phrase_count = sizeof(working_phrases) / sizeof(working_phrases[0]);
-                mimi_msg_t status = {0};
-                strncpy(status.channel, msg.channel, sizeof(status.channel) - 1);
-                strncpy(status.chat_id, msg.chat_id, sizeof(status.chat_id) - 1);
-                status.content = strdup(working_phrases[esp_random() % phrase_count]);
-                if (status.content) message_bus_push_outbound(&status);
+            push_shared_reply(&msg, s_phrase_bufs[esp_random() % PHRASE_COUNT]);
+
+            tool_batch_t batch;
+            err = tool_batch_init(&batch);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to create tool batch");
+                break;
             }
 
+            stream_ctx_t sc = { .msg = &msg, .batch = &batch };
+            llm_chat_opts_t opts = {
+                .stream = MIMI_LLM_STREAM,
+                .on_text = strcmp(msg.channel, MIMI_CHAN_WEBSOCKET) == 0 ? on_stream_text : NULL,
+                .on_tool = MIMI_AGENT_PIPELINE_TOOLS ? on_stream_tool : NULL,
+                .ctx = &sc,
+                .system_stable_len = stable_len,
+            };
             llm_response_t resp;
-            err = llm_chat_tools(system_prompt, messages, tools_json, &resp);
+            int64_t llm_start_us = esp_timer_get_time();
+            err = llm_chat_tools(system_prompt, &conv, tools_json, &opts, &resp);
+            int64_t stream_end_us = esp_timer_get_time();
 
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "LLM call failed: %s", esp_err_to_name(err));
+                /* Tools started from a partial stream still hold the batch */
+                tool_batch_wait(&batch);
+                tool_batch_free(&batch);
                 break;
             }
 
             if (!resp.tool_use) {
                 /* Normal completion — save final text and break */
+                tool_batch_wait(&batch);
+                tool_batch_free(&batch);
                 if (resp.text && resp.text_len > 0) {
-                    final_text = strdup(resp.text);
+                    final_text = msg_buf_strndup(resp.text, resp.text_len);
                 }
                 llm_response_free(&resp);
                 break;
@@ -158,24 +401,26 @@ static void agent_loop_task(void *arg)
 
             ESP_LOGI(TAG, "Tool use iteration %d: %d calls", iteration + 1, resp.call_count);
 
-            /* Append assistant message with content array */
-            cJSON *asst_msg = cJSON_CreateObject();
-            cJSON_AddStringToObject(asst_msg, "role", "assistant");
-            cJSON_AddItemToObject(asst_msg, "content", build_assistant_content(&resp));
-            cJSON_AddItemToArray(messages, asst_msg);
+            /* Append the assistant turn; only this delta is converted */
+            llm_conv_add_assistant(&conv, &resp);
+
+            /* Queue calls not already started during the stream, then collect
+             * results in call order */
+            for (int i = 0; i < resp.call_count; i++) {
+                tool_batch_submit(&batch, i, &resp.calls[i]);
+            }
+            tool_batch_wait(&batch);
+            tool_batch_log_timing(&batch, llm_start_us, stream_end_us);
 
-            /* Execute tools and append results */
-            cJSON *tool_results = build_tool_results(&resp, tool_output, TOOL_OUTPUT_SIZE);
-            cJSON *result_msg = cJSON_CreateObject();
-            cJSON_AddStringToObject(result_msg, "role", "user");
-            cJSON_AddItemToObject(result_msg, "content", tool_results);
-            cJSON_AddItemToArray(messages, result_msg);
+            cJSON *tool_results = tool_batch_results(&batch);
+            tool_batch_free(&batch);
+            llm_conv_add_tool_results(&conv, tool_results);
 
             llm_response_free(&resp);
             iteration++;
         }
 
-        cJSON_Delete(messages);
+        llm_conv_free(&conv);
 
         /* 5. Send response */
         if (final_text && final_text[0]) {
@@ -188,39 +433,119 @@ static void agent_loop_task(void *arg)
             strncpy(out.channel, msg.channel, sizeof(out.channel) - 1);
             strncpy(out.chat_id, msg.chat_id, sizeof(out.chat_id) - 1);
             out.content = final_text;  /* transfer ownership */
-            message_bus_push_outbound(&out);
+            if (message_bus_push_outbound(&out) != ESP_OK) {
+                msg_buf_release(final_text);
+            }
         } else {
             /* Error or empty response */
-            free(final_text);
-            mimi_msg_t out = {0};
-            strncpy(out.channel, msg.channel, sizeof(out.channel) - 1);
-            strncpy(out.chat_id, msg.chat_id, sizeof(out.chat_id) - 1);
-            out.content = strdup("Sorry, I encountered an error.");
-            if (out.content) {
-                message_bus_push_outbound(&out);
-            }
+            msg_buf_release(final_text);
+            push_shared_reply(&msg, s_error_buf);
         }
 
-        /* Free inbound message content */
-        free(msg.content);
-
-        /* Log memory status */
-        ESP_LOGI(TAG, "Free PSRAM: %d bytes",
+        /* Release inbound message content */
+        msg_buf_release(msg.content);
+
+        int64_t end_us = esp_timer_get_time();
+        admission_release(end_us - job.received_us);
+        route_release(worker->id, msg.chat_id);
+
+        /* Log timing, buffer traffic (process-wide) and memory status */
+        msg_buf_stats_t bufs;
+        msg_buf_get_stats(&bufs);
+        ESP_LOGI(TAG, "Worker %d turn done in %d ms (queued %d ms), msg bufs: %d slab / %d heap "
+                 "allocs, %d shared refs, free PSRAM: %d bytes",
+                 worker->id, (int)((end_us - start_us) / 1000),
+                 (int)((start_us - job.received_us) / 1000),
+                 (int)(bufs.slab_allocs - bufs_before.slab_allocs),
+                 (int)(bufs.heap_allocs - bufs_before.heap_allocs),
+                 (int)(bufs.refs - bufs_before.refs),
                  (int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
     }
 }
 
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+esp_err_t agent_get_stats(agent_stats_t *out)
+{
+    if (!s_lock) return ESP_ERR_INVALID_STATE;
+
+    uint32_t sorted[LATENCY_SAMPLES];
+    memset(out, 0, sizeof(*out));
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int n = s_stats.samples;
+    memcpy(sorted, s_stats.latency_ms, n * sizeof(uint32_t));
+    out->turns = s_stats.turns;
+    out->admission_waits = s_stats.admission_waits;
+    out->active = s_active;
+    out->max_active = s_stats.max_active;
+    for (int i = 0; i < MIMI_AGENT_WORKERS; i++) {
+        out->pending[i] = s_workers[i].pending;
+    }
+    xSemaphoreGive(s_lock);
+
+    out->samples = n;
+    if (n > 0) {
+        qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+        out->p50_ms = sorted[(n - 1) * 50 / 100];
+        out->p99_ms = sorted[(n - 1) * 99 / 100];
+        out->max_ms = sorted[n - 1];
+    }
+    return ESP_OK;
+}
+
 esp_err_t agent_loop_init(void)
 {
-    ESP_LOGI(TAG, "Agent loop initialized");
+    s_lock = xSemaphoreCreateMutex();
+    s_admit_signal = xSemaphoreCreateBinary();
+    s_dispatch_signal = xSemaphoreCreateBinary();
+    if (!s_lock || !s_admit_signal || !s_dispatch_signal) return ESP_ERR_NO_MEM;
+
+    for (int i = 0; i < MIMI_AGENT_WORKERS; i++) {
+        s_workers[i].id = i;
+        s_workers[i].queue = xQueueCreate(MIMI_AGENT_WORKER_QUEUE_LEN, sizeof(agent_job_t));
+        if (!s_workers[i].queue) return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < PHRASE_COUNT; i++) {
+        s_phrase_bufs[i] = msg_buf_strdup(s_working_phrases[i]);
+    }
+    s_error_buf = msg_buf_strdup("Sorry, I encountered an error.");
+
+    esp_err_t err = context_builder_init();
+    if (err != ESP_OK) return err;
+    err = tool_runner_init();
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Agent loop initialized (%d workers)", MIMI_AGENT_WORKERS);
     return ESP_OK;
 }
 
 esp_err_t agent_loop_start(void)
 {
+    esp_err_t err = tool_runner_start();
+    if (err != ESP_OK) return err;
+
+    for (int i = 0; i < MIMI_AGENT_WORKERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "agent_w%d", i);
+
+        /* Worker 0 keeps the agent core, further workers alternate cores */
+        BaseType_t ret = xTaskCreatePinnedToCore(
+            agent_loop_task, name,
+            MIMI_AGENT_STACK, &s_workers[i],
+            MIMI_AGENT_PRIO, NULL, (MIMI_AGENT_CORE + i) % portNUM_PROCESSORS);
+        if (ret != pdPASS) return ESP_FAIL;
+    }
+
     BaseType_t ret = xTaskCreatePinnedToCore(
-        agent_loop_task, "agent_loop",
-        MIMI_AGENT_STACK, NULL,
+        agent_dispatch_task, "agent_dispatch",
+        MIMI_AGENT_DISPATCH_STACK, NULL,
         MIMI_AGENT_PRIO, NULL, MIMI_AGENT_CORE);
 
     return (ret == pdPASS) ? ESP_OK : ESP_FAIL;
@@ -1,6 +1,20 @@
 #pragma once
 
 #include "esp_err.h"
+#include "mimi_config.h"
+#include <stdint.h>
+
+typedef struct {
+    uint32_t turns;                     /* completed since boot */
+    int samples;                        /* latencies behind the percentiles */
+    uint32_t p50_ms;                    /* turn latency, inbound pop → reply */
+    uint32_t p99_ms;
+    uint32_t max_ms;
+    uint32_t admission_waits;           /* turns delayed for lack of PSRAM */
+    int active;                         /* turns running now */
+    int max_active;
+    int pending[MIMI_AGENT_WORKERS];    /* queued + running per worker */
+} agent_stats_t;
 
 /**
  * Initialize the agent loop.
@@ -8,7 +22,14 @@
 esp_err_t agent_loop_init(void);
 
 /**
- * Start the agent loop task (runs on Core 1).
- * Consumes from inbound queue, calls Claude API, pushes to outbound queue.
+ * Start the agent dispatcher and MIMI_AGENT_WORKERS worker tasks.
+ * The dispatcher consumes the inbound queue and hands each message to a
+ * worker, keeping turns of one chat in order; workers call the Claude API
+ * and push to the outbound queue.
  */
 esp_err_t agent_loop_start(void);
+
+/**
+ * Snapshot turn latency percentiles (over the last 128 turns) and load.
+ */
+esp_err_t agent_get_stats(agent_stats_t *out);
@@ -0,0 +1,208 @@
+#include "compactor.h"
+#include "mimi_config.h"
+#include "agent/token_budget.h"
+#include "llm/llm_proxy.h"
+#include "memory/session_mgr.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+
+static const char *TAG = "compactor";
+
+static const char *SUMMARY_PROMPT =
+    "You maintain the rolling summary of a long chat between a user and an AI assistant.\n"
+    "Merge the previous summary (if any) and the conversation below into one updated summary.\n"
+    "Keep facts about the user, preferences, decisions, commitments, open tasks and anything "
+    "the assistant will need later. Drop greetings and small talk.\n"
+    "Write compact plain-text notes, at most 300 words. Output only the summary.";
+
+typedef struct {
+    char chat_id[32];
+} compact_job_t;
+
+static QueueHandle_t s_queue;
+static char s_queued[MIMI_COMPACTOR_QUEUE_LEN][32];    /* dedup, guarded by s_queued_lock */
+static portMUX_TYPE s_queued_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile int64_t s_retry_after_us;
+
+static bool queued_mark(const char *chat_id, bool add)
+{
+    bool found = false;
+    portENTER_CRITICAL(&s_queued_lock);
+    for (int i = 0; i < MIMI_COMPACTOR_QUEUE_LEN && !found; i++) {
+        if (strcmp(s_queued[i], chat_id) == 0) {
+            found = true;
+            if (!add) s_queued[i][0] = '\0';
+        }
+    }
+    if (add && !found) {
+        for (int i = 0; i < MIMI_COMPACTOR_QUEUE_LEN; i++) {
+            if (!s_queued[i][0]) {
+                strncpy(s_queued[i], chat_id, sizeof(s_queued[i]) - 1);
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&s_queued_lock);
+    return found;
+}
+
+/*
+ * "Role: text" blocks; each message is cut to its share of the input budget.
+ * The previous summary, which may carry entries the session backstop folded
+ * in, gets up to half of it first.
+ */
+static char *build_transcript(cJSON *entries)
+{
+    int count = cJSON_GetArraySize(entries);
+    int summary_max = 0;
+    cJSON *first = cJSON_GetArrayItem(entries, 0);
+    cJSON *first_role = first ? cJSON_GetObjectItem(first, "role") : NULL;
+    cJSON *first_content = first ? cJSON_GetObjectItem(first, "content") : NULL;
+    if (cJSON_IsString(first_role) && strcmp(first_role->valuestring, "summary") == 0 &&
+        cJSON_IsString(first_content)) {
+        int tokens = token_estimate(first_content->valuestring,
+                                    strlen(first_content->valuestring));
+        summary_max = tokens < MIMI_SUMMARY_INPUT_TOKENS / 2 ? tokens
+                                                               : MIMI_SUMMARY_INPUT_TOKENS / 2;
+        count--;
+    }
+    int per_msg = (MIMI_SUMMARY_INPUT_TOKENS - summary_max) / (count > 0 ? count : 1);
+
+    size_t size = 1;
+    cJSON *e;
+    cJSON_ArrayForEach(e, entries) {
+        cJSON *content = cJSON_GetObjectItem(e, "content");
+        if (cJSON_IsString(content)) size += strlen(content->valuestring) + 32;
+    }
+    char *buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!buf) return NULL;
+
+    size_t off = 0;
+    buf[0] = '\0';
+    cJSON_ArrayForEach(e, entries) {
+        cJSON *role = cJSON_GetObjectItem(e, "role");
+        cJSON *content = cJSON_GetObjectItem(e, "content");
+        if (!cJSON_IsString(role) || !cJSON_IsString(content)) continue;
+
+        const char *label = strcmp(role->valuestring, "summary") == 0 ? "Previous summary" :
+                            strcmp(role->valuestring, "assistant") == 0 ? "Assistant" : "User";
+        size_t len = strlen(content->valuestring);
+        size_t cut = token_truncate(content->valuestring, len,
+                                    e == first && summary_max ? summary_max : per_msg);
+        int n = snprintf(buf + off, size - off, "%s: %.*s%s\n\n", label, (int)cut,
+                         content->valuestring, cut < len ? " [...]" : "");
+        if (n < 0 || (size_t)n >= size - off) break;
+        off += n;
+    }
+    return buf;
+}
+
+static esp_err_t compact_chat(const char *chat_id)
+{
+    cJSON *entries = NULL;
+    session_prefix_t prefix;
+    esp_err_t err = session_read_prefix(chat_id, MIMI_SESSION_SUMMARY_KEEP, &entries, &prefix);
+    if (err == ESP_ERR_NOT_FOUND) return ESP_OK;     /* nothing old enough */
+    if (err != ESP_OK) return err;
+
+    int64_t start_us = esp_timer_get_time();
+    char *transcript = build_transcript(entries);
+    cJSON_Delete(entries);
+    if (!transcript) return ESP_ERR_NO_MEM;
+
+    cJSON *messages = cJSON_CreateArray();
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "role", "user");
+    cJSON_AddStringToObject(msg, "content", transcript);
+    cJSON_AddItemToArray(messages, msg);
+    char *messages_json = cJSON_PrintUnformatted(messages);
+    cJSON_Delete(messages);
+    free(transcript);
+
+    char *summary = heap_caps_calloc(1, MIMI_SUMMARY_MAX_BYTES, MALLOC_CAP_SPIRAM);
+    if (!messages_json || !summary) {
+        free(messages_json);
+        free(summary);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = llm_chat(SUMMARY_PROMPT, messages_json, summary, MIMI_SUMMARY_MAX_BYTES);
+    free(messages_json);
+    if (err == ESP_OK && !summary[0]) err = ESP_FAIL;
+
+    if (err == ESP_OK) {
+        err = session_replace_prefix(chat_id, &prefix, summary);
+    } else {
+        ESP_LOGW(TAG, "Summary call for %s failed: %s", chat_id, summary);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Chat %s: %d entries summarised in %d ms",
+                 chat_id, prefix.count, (int)((esp_timer_get_time() - start_us) / 1000));
+    }
+    free(summary);
+    return err;
+}
+
+static void compactor_task(void *arg)
+{
+    ESP_LOGI(TAG, "Compactor started");
+
+    while (1) {
+        compact_job_t job;
+        if (xQueueReceive(s_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+        esp_err_t err = compact_chat(job.chat_id);
+        queued_mark(job.chat_id, false);
+
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+            s_retry_after_us = esp_timer_get_time() + (int64_t)MIMI_COMPACTOR_RETRY_MS * 1000;
+            ESP_LOGW(TAG, "Compaction of %s failed (%s), pausing %d s", job.chat_id,
+                     esp_err_to_name(err), MIMI_COMPACTOR_RETRY_MS / 1000);
+        }
+    }
+}
+
+static void on_session_grown(const char *chat_id)
+{
+    compactor_request(chat_id, false);
+}
+
+esp_err_t compactor_request(const char *chat_id, bool force)
+{
+    if (!s_queue) return ESP_ERR_INVALID_STATE;
+    if (!force && esp_timer_get_time() < s_retry_after_us) return ESP_ERR_INVALID_STATE;
+    if (queued_mark(chat_id, true)) return ESP_OK;
+
+    compact_job_t job = {0};
+    strncpy(job.chat_id, chat_id, sizeof(job.chat_id) - 1);
+    if (xQueueSend(s_queue, &job, 0) != pdTRUE) {
+        queued_mark(chat_id, false);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t compactor_start(void)
+{
+    s_queue = xQueueCreate(MIMI_COMPACTOR_QUEUE_LEN, sizeof(compact_job_t));
+    if (!s_queue) return ESP_ERR_NO_MEM;
+
+    if (xTaskCreatePinnedToCore(compactor_task, "compactor",
+                                MIMI_COMPACTOR_STACK, NULL,
+                                MIMI_COMPACTOR_PRIO, NULL, MIMI_COMPACTOR_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create compactor task");
+        return ESP_FAIL;
+    }
+
+    session_set_compact_hook(on_session_grown);
+    return ESP_OK;
+}
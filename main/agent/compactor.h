@@ -0,0 +1,26 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+/**
+ * Background conversation compaction.
+ *
+ * Once a chat's session grows past MIMI_SESSION_SUMMARY_TRIGGER entries,
+ * everything but the newest MIMI_SESSION_SUMMARY_KEEP is condensed by one
+ * LLM call into a rolling summary, merged with the previous one. The
+ * summary replaces those entries in the session file and is served as the
+ * first history message, so request size and flash use stay flat.
+ *
+ * Runs on its own low-priority task; failures leave the session as it is
+ * and pause further attempts for MIMI_COMPACTOR_RETRY_MS.
+ */
+
+/** Create the job queue and task, and hook into the session manager. */
+esp_err_t compactor_start(void);
+
+/**
+ * Queue a chat for compaction (no-op if already queued).
+ * @return ESP_ERR_INVALID_STATE while paused after a failure, unless force
+ */
+esp_err_t compactor_request(const char *chat_id, bool force);
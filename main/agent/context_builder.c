@@ -4,19 +4,42 @@
 #include "skills/skill_loader.h"
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <time.h>
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 
 static const char *TAG = "context";
 
+/* snprintf at offset; the result is clamped so offset never passes size - 1 */
+static size_t append_fmt(char *buf, size_t size, size_t offset, const char *fmt, ...)
+{
+    if (offset >= size - 1) return offset;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + offset, size - offset, fmt, ap);
+    va_end(ap);
+    if (n < 0) return offset;
+    return ((size_t)n < size - offset) ? offset + n : size - 1;
+}
+
 static size_t append_file(char *buf, size_t size, size_t offset, const char *path, const char *header)
 {
     FILE *f = fopen(path, "r");
     if (!f) return offset;
 
-    if (header && offset < size - 1) {
-        offset += snprintf(buf + offset, size - offset, "\n## %s\n\n", header);
+    if (header) {
+        offset = append_fmt(buf, size, offset, "\n## %s\n\n", header);
+    }
+    if (offset >= size - 1) {
+        fclose(f);
+        return offset;
     }
 
     size_t n = fread(buf + offset, 1, size - offset - 1, f);
@@ -26,11 +49,183 @@ static size_t append_file(char *buf, size_t size, size_t offset, const char *pat
     return offset;
 }
 
-esp_err_t context_build_system_prompt(char *buf, size_t size)
+/*
+ * Charge the text appended at buf[start..end) to a section, cutting it to
+ * the tokens the section has left. Returns the new end.
+ */
+static size_t fit_section(char *buf, size_t start, size_t end,
+                          token_budget_t *budget, token_section_t sec)
+{
+    if (!budget) return end;
+
+    size_t len = end - start;
+    int tokens = token_estimate(buf + start, len);
+    int room = budget->limit[sec] - budget->used[sec];
+    if (budget->limit[sec] > 0 && tokens > room) {
+        len = token_truncate(buf + start, len, room > 0 ? room : 0);
+        tokens = token_estimate(buf + start, len);
+        buf[start + len] = '\0';
+        ESP_LOGW(TAG, "%s section cut to %d tokens", token_section_name(sec), budget->limit[sec]);
+    }
+    budget->used[sec] += tokens;
+    return start + len;
+}
+
+/* ── Section cache ─────────────────────────────────────────── */
+
+/*
+ * Each file-backed section is kept formatted (header included) in PSRAM and
+ * rebuilt only when its generation has moved since it was loaded, so a
+ * typical turn does no flash reads at all. Token cuts are still applied per
+ * turn on the copy in the prompt buffer.
+ */
+typedef struct {
+    char *text;
+    size_t cap;
+    size_t len;
+    uint32_t gen;       /* s_gen value the text was loaded at */
+    int day;            /* notes: local day the text was loaded on */
+    bool valid;
+} cached_section_t;
+
+static const token_section_t s_token_sec[CONTEXT_SRC_COUNT] = {
+    TOKEN_SEC_BOOTSTRAP, TOKEN_SEC_SKILLS, TOKEN_SEC_MEMORY, TOKEN_SEC_NOTES,
+};
+static const size_t s_section_cap[CONTEXT_SRC_COUNT] = {
+    MIMI_CONTEXT_BOOTSTRAP_MAX, MIMI_CONTEXT_SKILLS_MAX,
+    MIMI_CONTEXT_MEMORY_MAX, MIMI_CONTEXT_NOTES_MAX,
+};
+
+static cached_section_t s_sections[CONTEXT_SRC_COUNT];
+static volatile uint32_t s_gen[CONTEXT_SRC_COUNT];
+static portMUX_TYPE s_gen_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_lock;
+static context_stats_t s_stats;
+
+static int local_day(void)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return tm.tm_year * 366 + tm.tm_yday;
+}
+
+static size_t load_bootstrap(char *buf, size_t size)
 {
     size_t off = 0;
+    off = append_file(buf, size, off, MIMI_SOUL_FILE, "Personality");
+    off = append_file(buf, size, off, MIMI_USER_FILE, "User Info");
+    off = append_file(buf, size, off, MIMI_AGENTS_FILE, "Agent Rules");
+    return off;
+}
+
+static size_t load_memory(char *buf, size_t size)
+{
+    size_t off = append_fmt(buf, size, 0, "\n## Long-term Memory\n\n");
+    if (memory_read_long_term(buf + off, size - off - 1) != ESP_OK || !buf[off]) return 0;
+    return append_fmt(buf, size, off + strlen(buf + off), "\n");
+}
+
+static size_t load_notes(char *buf, size_t size)
+{
+    size_t off = append_fmt(buf, size, 0, "\n## Recent Notes\n\n");
+    if (memory_read_recent(buf + off, size - off - 1, 3) != ESP_OK || !buf[off]) return 0;
+    return append_fmt(buf, size, off + strlen(buf + off), "\n");
+}
+
+static size_t load_skills(char *buf, size_t size)
+{
+    size_t off = append_fmt(buf, size, 0,
+        "\n## Available Skills\n\n"
+        "Available skills (use read_file to load full instructions):\n");
+    size_t n = skill_loader_build_summary(buf + off, size - off - 1);
+    if (n == 0) return 0;
+    return append_fmt(buf, size, off + n, "\n");
+}
+
+static size_t (*const s_loaders[CONTEXT_SRC_COUNT])(char *, size_t) = {
+    load_bootstrap, load_skills, load_memory, load_notes,
+};
+
+/* Reload a section if it is stale. Caller holds s_lock. Returns true if reloaded. */
+static bool section_refresh(context_source_t src, int day)
+{
+    cached_section_t *sec = &s_sections[src];
+    uint32_t gen = s_gen[src];
+    if (sec->valid && sec->gen == gen && (src != CONTEXT_SRC_NOTES || sec->day == day)) {
+        return false;
+    }
+
+    if (!sec->text) {
+        sec->text = heap_caps_malloc(s_section_cap[src], MALLOC_CAP_SPIRAM);
+        if (!sec->text) {
+            ESP_LOGE(TAG, "No memory for prompt section %d", src);
+            sec->len = 0;
+            return false;
+        }
+        sec->cap = s_section_cap[src];
+    }
+
+    sec->text[0] = '\0';
+    sec->len = s_loaders[src](sec->text, sec->cap);
+    sec->text[sec->len] = '\0';
+    /* A bump while loading moved s_gen past gen, so the next build reloads */
+    sec->gen = gen;
+    sec->day = day;
+    sec->valid = true;
+    s_stats.reloads[src]++;
+    return true;
+}
+
+esp_err_t context_builder_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    return s_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
 
-    off += snprintf(buf + off, size - off,
+void context_invalidate(context_source_t src)
+{
+    portENTER_CRITICAL(&s_gen_mux);
+    for (int i = 0; i < CONTEXT_SRC_COUNT; i++) {
+        if (src == CONTEXT_SRC_COUNT || src == (context_source_t)i) s_gen[i]++;
+    }
+    portEXIT_CRITICAL(&s_gen_mux);
+}
+
+void context_invalidate_path(const char *path)
+{
+    if (!path) return;
+
+    if (strcmp(path, MIMI_SOUL_FILE) == 0 || strcmp(path, MIMI_USER_FILE) == 0 ||
+        strcmp(path, MIMI_AGENTS_FILE) == 0) {
+        context_invalidate(CONTEXT_SRC_BOOTSTRAP);
+    } else if (strcmp(path, MIMI_MEMORY_FILE) == 0) {
+        context_invalidate(CONTEXT_SRC_MEMORY);
+    } else if (strncmp(path, MIMI_SPIFFS_MEMORY_DIR "/", sizeof(MIMI_SPIFFS_MEMORY_DIR)) == 0) {
+        context_invalidate(CONTEXT_SRC_NOTES);
+    } else if (strncmp(path, MIMI_SKILLS_PREFIX, strlen(MIMI_SKILLS_PREFIX)) == 0) {
+        context_invalidate(CONTEXT_SRC_SKILLS);
+    }
+}
+
+void context_get_stats(context_stats_t *out)
+{
+    if (s_lock) xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    if (s_lock) xSemaphoreGive(s_lock);
+}
+
+/* ── System prompt ─────────────────────────────────────────── */
+
+esp_err_t context_build_system_prompt(char *buf, size_t size, token_budget_t *budget,
+                                      size_t *stable_len)
+{
+    if (!s_lock) return ESP_ERR_INVALID_STATE;
+
+    int64_t t0 = esp_timer_get_time();
+    size_t off = 0;
+
+    off = append_fmt(buf, size, off,
         "# DOT\n\n"
         "You are DOT, an experimental technician assistant by AiSync Services, running on an ESP32-S3 device.\n"
         "You communicate through Telegram and WebSocket.\n\n"
@@ -64,38 +259,106 @@ esp_err_t context_build_system_prompt(char *buf, size_t size)
         "Skills are specialized instruction files stored in /spiffs/skills/.\n"
         "When a task matches a skill, read the full skill file for detailed instructions.\n"
         "You can create new skills using write_file to /spiffs/skills/<name>.md.\n");
+    off = fit_section(buf, 0, off, budget, TOKEN_SEC_BASE);
 
-    /* Bootstrap files */
-    off = append_file(buf, size, off, MIMI_SOUL_FILE, "Personality");
-    off = append_file(buf, size, off, MIMI_USER_FILE, "User Info");
-    off = append_file(buf, size, off, MIMI_AGENTS_FILE, "Agent Rules");
+    /* File-backed sections, from cache unless their source changed */
+    int day = local_day();
+    int reloaded = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < CONTEXT_SRC_COUNT; i++) {
+        if (i == CONTEXT_SRC_MEMORY && stable_len) *stable_len = off;
+        if (section_refresh(i, day)) reloaded++;
 
-    /* Long-term memory */
-    char mem_buf[4096];
-    if (memory_read_long_term(mem_buf, sizeof(mem_buf)) == ESP_OK && mem_buf[0]) {
-        off += snprintf(buf + off, size - off, "\n## Long-term Memory\n\n%s\n", mem_buf);
+        const cached_section_t *sec = &s_sections[i];
+        if (sec->len == 0 || off >= size - 1) continue;
+        size_t start = off;
+        size_t n = sec->len < size - 1 - off ? sec->len : size - 1 - off;
+        memcpy(buf + off, sec->text, n);
+        off += n;
+        buf[off] = '\0';
+        off = fit_section(buf, start, off, budget, s_token_sec[i]);
     }
 
-    /* Recent daily notes (last 3 days) */
-    char recent_buf[4096];
-    if (memory_read_recent(recent_buf, sizeof(recent_buf), 3) == ESP_OK && recent_buf[0]) {
-        off += snprintf(buf + off, size - off, "\n## Recent Notes\n\n%s\n", recent_buf);
+    int64_t us = esp_timer_get_time() - t0;
+    if (reloaded) {
+        s_stats.cold_builds++;
+        s_stats.cold_us += us;
+    } else {
+        s_stats.warm_builds++;
+        s_stats.warm_us += us;
     }
+    s_stats.last_us = us;
+    xSemaphoreGive(s_lock);
 
-    /* Skills */
-    char skills_buf[2048];
-    size_t skills_len = skill_loader_build_summary(skills_buf, sizeof(skills_buf));
-    if (skills_len > 0) {
-        off += snprintf(buf + off, size - off,
-            "\n## Available Skills\n\n"
-            "Available skills (use read_file to load full instructions):\n%s\n",
-            skills_buf);
+    if (off >= size - 1) {
+        ESP_LOGW(TAG, "System prompt truncated at %d bytes", (int)size);
     }
-
-    ESP_LOGI(TAG, "System prompt built: %d bytes", (int)off);
+    ESP_LOGI(TAG, "System prompt built: %d bytes in %lld us (%d sections reloaded)",
+             (int)off, (long long)us, reloaded);
     return ESP_OK;
 }
 
+static int message_tokens(const cJSON *msg)
+{
+    cJSON *content = cJSON_GetObjectItem(msg, "content");
+    const char *text = cJSON_IsString(content) ? content->valuestring : "";
+    return token_estimate(text, strlen(text)) + MIMI_TOKEN_MSG_OVERHEAD;
+}
+
+/* The compactor's summary of older turns, served as the first message */
+static bool is_summary(const cJSON *msg)
+{
+    cJSON *content = cJSON_GetObjectItem(msg, "content");
+    return cJSON_IsString(content) &&
+           strncmp(content->valuestring, MIMI_SESSION_SUMMARY_PREFIX,
+                   strlen(MIMI_SESSION_SUMMARY_PREFIX)) == 0;
+}
+
+int context_fit_history(cJSON *history, token_budget_t *budget)
+{
+    int count = cJSON_GetArraySize(history);
+    int room = token_budget_remaining(budget);
+    int spent = 0;
+    int keep = 0;
+
+    /* The summary stands in for every older turn: charged first, never dropped */
+    int first = 0;
+    if (count > 0 && is_summary(cJSON_GetArrayItem(history, 0))) {
+        spent = message_tokens(cJSON_GetArrayItem(history, 0));
+        if (spent > room) {
+            ESP_LOGW(TAG, "History summary (%d tokens) exceeds the %d tokens left", spent, room);
+        }
+        first = 1;
+    }
+
+    /* Then verbatim turns, newest first, until the next would not fit */
+    for (int i = count - 1; i >= first; i--) {
+        int tokens = message_tokens(cJSON_GetArrayItem(history, i));
+        if (spent + tokens > room) break;
+        spent += tokens;
+        keep++;
+    }
+
+    int drop = count - first - keep;
+    for (int i = 0; i < drop; i++) {
+        cJSON_DeleteItemFromArray(history, first);
+    }
+
+    /* The conversation must open with a user turn (the summary is one) */
+    while (first == 0 && cJSON_GetArraySize(history) > 0) {
+        cJSON *msg = cJSON_GetArrayItem(history, 0);
+        cJSON *role = cJSON_GetObjectItem(msg, "role");
+        if (cJSON_IsString(role) && strcmp(role->valuestring, "user") == 0) break;
+        spent -= message_tokens(msg);
+        cJSON_DeleteItemFromArray(history, 0);
+    }
+
+    budget->used[TOKEN_SEC_HISTORY] += spent;
+    budget->history_avail = count;
+    budget->history_msgs = cJSON_GetArraySize(history);
+    return budget->history_msgs;
+}
+
 esp_err_t context_build_messages(const char *history_json, const char *user_message,
                                  char *buf, size_t size)
 {
@@ -1,16 +1,80 @@
 #pragma once
 
 #include "esp_err.h"
+#include "cJSON.h"
+#include "agent/token_budget.h"
 #include <stddef.h>
+#include <stdint.h>
+
+/*
+ * File-backed system prompt sections, cached between turns, in prompt order.
+ * Rarely edited sections come first so the prompt prefix stays byte-stable
+ * for provider-side prompt caching.
+ */
+typedef enum {
+    CONTEXT_SRC_BOOTSTRAP = 0,  /* SOUL.md, USER.md, AGENTS.md */
+    CONTEXT_SRC_SKILLS,         /* skill summaries */
+    CONTEXT_SRC_MEMORY,         /* MEMORY.md (first volatile section) */
+    CONTEXT_SRC_NOTES,          /* recent daily notes */
+    CONTEXT_SRC_COUNT,
+} context_source_t;
+
+typedef struct {
+    uint32_t warm_builds;       /* prompts built entirely from cache */
+    uint32_t cold_builds;       /* prompts that reloaded at least one section */
+    int64_t warm_us;            /* total build time of warm builds */
+    int64_t cold_us;            /* total build time of cold builds */
+    int64_t last_us;
+    uint32_t reloads[CONTEXT_SRC_COUNT];
+} context_stats_t;
+
+/**
+ * Initialize the prompt section cache. Call before building prompts.
+ */
+esp_err_t context_builder_init(void);
+
+/**
+ * Mark a section stale so the next prompt build reloads it from flash.
+ * CONTEXT_SRC_COUNT marks every section stale.
+ */
+void context_invalidate(context_source_t src);
+
+/**
+ * Mark stale whichever section is backed by path (no-op for other files).
+ * Call after writing a file on SPIFFS.
+ */
+void context_invalidate_path(const char *path);
+
+/**
+ * Copy prompt build counters and timings.
+ */
+void context_get_stats(context_stats_t *out);
 
 /**
  * Build the system prompt from bootstrap files (SOUL.md, USER.md)
  * and memory context (MEMORY.md + recent daily notes).
+ * File-backed sections come from the section cache and are reloaded only
+ * when invalidated (or, for daily notes, when the date changes).
+ * Each section is charged to budget and cut to its token share.
+ *
+ * @param buf         Output buffer (caller allocates, recommend MIMI_CONTEXT_BUF_SIZE)
+ * @param size        Buffer size
+ * @param budget      Turn budget, or NULL for no token limits
+ * @param stable_len  Output: length of the prefix built from rarely edited
+ *                    sections (before memory and notes), or NULL
+ */
+esp_err_t context_build_system_prompt(char *buf, size_t size, token_budget_t *budget,
+                                      size_t *stable_len);
+
+/**
+ * Trim a history array (oldest first) to the newest messages that fit in
+ * the tokens the budget has left, then charge them to the history section.
+ * A leading compactor summary is always kept and charged first. Call
+ * after every other section has been charged.
  *
- * @param buf   Output buffer (caller allocates, recommend MIMI_CONTEXT_BUF_SIZE)
- * @param size  Buffer size
+ * @return number of messages kept
  */
-esp_err_t context_build_system_prompt(char *buf, size_t size);
+int context_fit_history(cJSON *history, token_budget_t *budget);
 
 /**
  * Build the complete messages JSON array for LLM call.
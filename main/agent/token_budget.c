@@ -0,0 +1,112 @@
+#include "token_budget.h"
+#include "mimi_config.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_log.h"
+
+static const char *TAG = "tokens";
+
+static const char *s_section_names[TOKEN_SEC_COUNT] = {
+    "base", "tools", "bootstrap", "memory", "notes", "skills", "user", "history",
+};
+
+/* Running count: finished tokens plus the current word run */
+typedef struct {
+    int tokens;
+    int run;        /* length of the current alphanumeric run */
+} tok_state_t;
+
+static inline int state_total(const tok_state_t *st)
+{
+    return st->tokens + (st->run + MIMI_TOKEN_CHARS_PER_TOKEN - 1) / MIMI_TOKEN_CHARS_PER_TOKEN;
+}
+
+static void state_feed(tok_state_t *st, unsigned char c)
+{
+    if (c < 0x80 && isalnum(c)) {
+        st->run++;
+        return;
+    }
+    st->tokens = state_total(st);
+    st->run = 0;
+    if (c >= 0x80) {
+        if ((c & 0xC0) != 0x80) st->tokens++;   /* one per code point */
+    } else if (!isspace(c)) {
+        st->tokens++;                           /* punctuation */
+    }
+}
+
+int token_estimate(const char *text, size_t len)
+{
+    tok_state_t st = {0};
+    for (size_t i = 0; i < len; i++) {
+        state_feed(&st, (unsigned char)text[i]);
+    }
+    return state_total(&st);
+}
+
+size_t token_truncate(const char *text, size_t len, int max_tokens)
+{
+    if (max_tokens <= 0) return 0;
+
+    tok_state_t st = {0};
+    size_t cut = 0;         /* last code point boundary within budget */
+    size_t soft = 0;        /* last line break or space within budget */
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        bool boundary = ((c & 0xC0) != 0x80);
+        if (boundary) {
+            if (state_total(&st) > max_tokens) break;
+            cut = i;
+            if (c == '\n' || c == ' ') soft = i;
+        }
+        state_feed(&st, c);
+    }
+    if (state_total(&st) <= max_tokens) return len;
+
+    /* Prefer a clean break unless it would waste most of the room */
+    return (soft > cut / 2) ? soft : cut;
+}
+
+void token_budget_init(token_budget_t *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->total = MIMI_CONTEXT_TOKEN_BUDGET;
+    b->limit[TOKEN_SEC_BOOTSTRAP] = b->total * MIMI_TOKEN_SHARE_BOOTSTRAP / 100;
+    b->limit[TOKEN_SEC_MEMORY] = b->total * MIMI_TOKEN_SHARE_MEMORY / 100;
+    b->limit[TOKEN_SEC_NOTES] = b->total * MIMI_TOKEN_SHARE_NOTES / 100;
+    b->limit[TOKEN_SEC_SKILLS] = b->total * MIMI_TOKEN_SHARE_SKILLS / 100;
+}
+
+int token_budget_remaining(const token_budget_t *b)
+{
+    int used = 0;
+    for (int i = 0; i < TOKEN_SEC_COUNT; i++) used += b->used[i];
+    return b->total - used;
+}
+
+const char *token_section_name(token_section_t sec)
+{
+    return sec < TOKEN_SEC_COUNT ? s_section_names[sec] : "?";
+}
+
+void token_budget_log(const token_budget_t *b)
+{
+    char line[256];
+    size_t off = 0;
+    for (int i = 0; i < TOKEN_SEC_COUNT && off < sizeof(line); i++) {
+        int n = b->limit[i] > 0 ?
+            snprintf(line + off, sizeof(line) - off, " %s %d/%d,", s_section_names[i],
+                     b->used[i], b->limit[i]) :
+            snprintf(line + off, sizeof(line) - off, " %s %d,", s_section_names[i], b->used[i]);
+        if (n > 0) off += n;
+    }
+    if (off > 0 && off < sizeof(line)) line[off - 1] = '\0';
+
+    ESP_LOGI(TAG, "Input ~%d/%d tokens (%d of %d history msgs):%s",
+             b->total - token_budget_remaining(b), b->total,
+             b->history_msgs, b->history_avail, line);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * On-device input token estimate and per-turn token budget.
+ *
+ * The estimate needs no vocabulary: a run of ASCII letters and digits
+ * counts one token per MIMI_TOKEN_CHARS_PER_TOKEN characters, every
+ * punctuation mark one token and every non-ASCII code point one token.
+ * That tracks BPE counts closely enough for budgeting and errs high for
+ * code and CJK text.
+ */
+
+typedef enum {
+    TOKEN_SEC_BASE = 0,     /* fixed instructions */
+    TOKEN_SEC_TOOLS,        /* tool schemas */
+    TOKEN_SEC_BOOTSTRAP,    /* SOUL.md, USER.md, AGENTS.md */
+    TOKEN_SEC_MEMORY,       /* MEMORY.md */
+    TOKEN_SEC_NOTES,        /* recent daily notes */
+    TOKEN_SEC_SKILLS,       /* skill summary */
+    TOKEN_SEC_USER,         /* current message */
+    TOKEN_SEC_HISTORY,      /* session history */
+    TOKEN_SEC_COUNT
+} token_section_t;
+
+typedef struct {
+    int total;                      /* input tokens allowed for the turn */
+    int limit[TOKEN_SEC_COUNT];     /* per-section cap, 0 = uncapped */
+    int used[TOKEN_SEC_COUNT];
+    int history_msgs;               /* history messages kept */
+    int history_avail;              /* history messages offered */
+} token_budget_t;
+
+/** Estimate the tokens of len bytes of UTF-8 text. */
+int token_estimate(const char *text, size_t len);
+
+/**
+ * Length in bytes of the longest prefix estimated at most max_tokens,
+ * ending at a line break or space when one is close, never inside a
+ * UTF-8 sequence.
+ */
+size_t token_truncate(const char *text, size_t len, int max_tokens);
+
+/** Start a budget of MIMI_CONTEXT_TOKEN_BUDGET with the configured section shares. */
+void token_budget_init(token_budget_t *b);
+
+/** Tokens not yet spent by any section. */
+int token_budget_remaining(const token_budget_t *b);
+
+const char *token_section_name(token_section_t sec);
+
+/** Log the per-section spend of a turn. */
+void token_budget_log(const token_budget_t *b);
@@ -0,0 +1,438 @@
+#include "tool_runner.h"
+#include "mimi_config.h"
+#include "tools/tool_registry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+static const char *TAG = "tool_runner";
+
+#define TOOL_OUTPUT_SIZE  (8 * 1024)
+
+typedef enum {
+    JOB_HELD = 0,           /* waiting for earlier calls it must follow */
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_TIMED_OUT,          /* given up on by the batch, worker still owns a ref */
+    JOB_SKIPPED,            /* given up on before it ran: a call it follows timed out */
+} job_state_t;
+
+/*
+ * A job is shared by the batch and the worker, and freed by whichever
+ * drops the last reference. This lets the agent move on from a tool that
+ * timed out while the worker is still blocked inside it.
+ *
+ * Calls of one response that conflict (see calls_conflict()) run in call
+ * order: a job is held until every earlier job it conflicts with has left
+ * its worker, which then queues it. A held job keeps the worker's
+ * reference until then.
+ */
+struct tool_job {
+    llm_tool_call_t call;   /* private copy, input owned by the job */
+    tool_access_t access;
+    tool_batch_t *batch;
+    char *output;           /* tool result text (heap) */
+    job_state_t state;
+    int refs;
+    int worker;
+    int waits;              /* earlier conflicting jobs not yet settled */
+    bool settled;           /* its worker is done with it (ran or skipped) */
+    tool_job_t *followers[MIMI_MAX_TOOL_CALLS];     /* later jobs held for it */
+    int follower_count;
+    int64_t queued_us;
+    int64_t start_us;
+    int64_t end_us;
+};
+
+static QueueHandle_t s_job_queue;
+static SemaphoreHandle_t s_lock;    /* guards jobs, and the worker counts below */
+
+/*
+ * A tool cannot be interrupted, so a worker running one that timed out
+ * stays blocked in it. Spares (up to MIMI_TOOL_RUNNER_SPARES) keep
+ * MIMI_TOOL_RUNNER_WORKERS free for new jobs meanwhile, and a worker
+ * beyond that count exits once its stuck tool returns.
+ */
+static int s_workers;               /* worker tasks alive */
+static int s_stuck;                 /* of them, running a job that timed out */
+static int s_next_worker;           /* id of the next worker task */
+
+static void tool_worker_task(void *arg);
+
+/* Write-after-write, or a read and a write of the same file */
+static bool calls_conflict(const tool_access_t *a, const tool_access_t *b)
+{
+    if (a->exclusive && b->exclusive) return true;
+    if (!a->exclusive && !b->exclusive) return false;
+
+    const tool_access_t *w = a->exclusive ? a : b;
+    const tool_access_t *r = a->exclusive ? b : a;
+    if (!w->path[0]) return false;
+    if (r->prefix) return strncmp(w->path, r->path, strlen(r->path)) == 0;
+    return strcmp(w->path, r->path) == 0;
+}
+
+static esp_err_t worker_spawn(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int id = s_next_worker++;
+    s_workers++;
+    xSemaphoreGive(s_lock);
+
+    char name[16];
+    snprintf(name, sizeof(name), "tool_worker%d", id);
+
+    /* Alternate cores so concurrent tools really run in parallel */
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        tool_worker_task, name,
+        MIMI_TOOL_RUNNER_STACK, (void *)(intptr_t)id,
+        MIMI_TOOL_RUNNER_PRIO, NULL, id % portNUM_PROCESSORS);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start %s", name);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_workers--;
+        xSemaphoreGive(s_lock);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void job_release(tool_job_t *job)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool last = (--job->refs == 0);
+    xSemaphoreGive(s_lock);
+
+    if (last) {
+        free(job->call.input);
+        free(job->output);
+        free(job);
+    }
+}
+
+/* The worker is done with job: queue the followers it was the last to hold */
+static void job_settle(tool_job_t *job)
+{
+    tool_job_t *ready[MIMI_MAX_TOOL_CALLS];
+    int n = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job->settled = true;
+    for (int i = 0; i < job->follower_count; i++) {
+        tool_job_t *f = job->followers[i];
+        if (--f->waits > 0) continue;
+        if (f->state == JOB_HELD) {
+            /* Its timeout runs from here */
+            f->state = JOB_QUEUED;
+            f->queued_us = esp_timer_get_time();
+        }
+        /* A skipped one is still passed on, for the worker to release */
+        ready[n++] = f;
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int i = 0; i < n; i++) {
+        xQueueSend(s_job_queue, &ready[i], portMAX_DELAY);
+    }
+}
+
+static void tool_worker_task(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    char *scratch = heap_caps_calloc(1, TOOL_OUTPUT_SIZE, MALLOC_CAP_SPIRAM);
+    if (!scratch) {
+        ESP_LOGE(TAG, "Worker %d: failed to allocate output buffer", id);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_workers--;
+        xSemaphoreGive(s_lock);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Tool worker %d started on core %d", id, xPortGetCoreID());
+
+    while (1) {
+        tool_job_t *job;
+        if (xQueueReceive(s_job_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool skip = (job->state == JOB_TIMED_OUT || job->state == JOB_SKIPPED);
+        if (!skip) {
+            job->state = JOB_RUNNING;
+            job->worker = id;
+            job->start_us = esp_timer_get_time();
+        }
+        xSemaphoreGive(s_lock);
+
+        if (skip) {
+            /* Batch gave up on it before it ran */
+            job_settle(job);
+            job_release(job);
+            continue;
+        }
+
+        scratch[0] = '\0';
+        tool_registry_execute(job->call.name, job->call.input, scratch, TOOL_OUTPUT_SIZE);
+        char *output = strdup(scratch);
+        int64_t end_us = esp_timer_get_time();
+
+        ESP_LOGI(TAG, "Worker %d: tool %s result: %d bytes in %d ms", id, job->call.name,
+                 (int)strlen(scratch), (int)((end_us - job->start_us) / 1000));
+
+        bool retire = false;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        job->end_us = end_us;
+        if (job->state == JOB_RUNNING) {
+            job->output = output;
+            job->state = JOB_DONE;
+            xSemaphoreGive(job->batch->done);
+        } else {
+            ESP_LOGW(TAG, "Worker %d: discarding late result of %s", id, job->call.name);
+            free(output);
+            s_stuck--;
+            retire = s_workers > MIMI_TOOL_RUNNER_WORKERS;
+            if (retire) s_workers--;
+        }
+        xSemaphoreGive(s_lock);
+
+        job_settle(job);
+        job_release(job);
+
+        if (retire) {
+            /* A spare took this worker's place while it was stuck */
+            ESP_LOGI(TAG, "Worker %d retired", id);
+            free(scratch);
+            vTaskDelete(NULL);
+            return;
+        }
+    }
+}
+
+esp_err_t tool_runner_init(void)
+{
+    s_job_queue = xQueueCreate(MIMI_MAX_TOOL_CALLS * MIMI_AGENT_WORKERS * 2, sizeof(tool_job_t *));
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_job_queue || !s_lock) {
+        ESP_LOGE(TAG, "Failed to create job queue");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t tool_runner_start(void)
+{
+    for (int i = 0; i < MIMI_TOOL_RUNNER_WORKERS; i++) {
+        if (worker_spawn() != ESP_OK) return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Tool runner started (%d workers, timeout %d ms)",
+             MIMI_TOOL_RUNNER_WORKERS, MIMI_TOOL_TIMEOUT_MS);
+    return ESP_OK;
+}
+
+/* ── Batches ──────────────────────────────────────────────────── */
+
+esp_err_t tool_batch_init(tool_batch_t *batch)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->done = xSemaphoreCreateCounting(MIMI_MAX_TOOL_CALLS, 0);
+    return batch->done ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t tool_batch_submit(tool_batch_t *batch, int index, const llm_tool_call_t *call)
+{
+    if (index < 0 || index >= MIMI_MAX_TOOL_CALLS) return ESP_ERR_INVALID_ARG;
+    if (batch->jobs[index]) return ESP_OK;  /* already running */
+
+    tool_job_t *job = calloc(1, sizeof(tool_job_t));
+    if (!job) return ESP_ERR_NO_MEM;
+
+    job->call = *call;
+    job->call.input = call->input ? strdup(call->input) : NULL;
+    job->call.input_len = job->call.input ? call->input_len : 0;
+    tool_registry_access(call->name, job->call.input, &job->access);
+    job->batch = batch;
+    job->refs = 2;  /* batch + worker */
+    job->worker = -1;
+    job->queued_us = esp_timer_get_time();
+
+    /* Calls arrive in index order, so only earlier ones are in the batch */
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < index; i++) {
+        tool_job_t *prev = batch->jobs[i];
+        if (!prev || prev->settled || !calls_conflict(&prev->access, &job->access)) continue;
+        prev->followers[prev->follower_count++] = job;
+        job->waits++;
+    }
+    job->state = job->waits ? JOB_HELD : JOB_QUEUED;
+    batch->jobs[index] = job;
+    batch->submitted++;
+    xSemaphoreGive(s_lock);
+
+    if (job->state == JOB_HELD) {
+        ESP_LOGI(TAG, "Holding tool %s (#%d) behind %d earlier call(s)",
+                 call->name, index, job->waits);
+        return ESP_OK;
+    }
+    xQueueSend(s_job_queue, &job, portMAX_DELAY);
+    ESP_LOGI(TAG, "Queued tool %s (#%d)", call->name, index);
+    return ESP_OK;
+}
+
+/* Some earlier job that job follows timed out and still holds it */
+static bool job_blocked(const tool_batch_t *batch, int index)
+{
+    const tool_job_t *job = batch->jobs[index];
+    for (int i = 0; i < index; i++) {
+        const tool_job_t *prev = batch->jobs[i];
+        if (prev && !prev->settled && (prev->state == JOB_TIMED_OUT || prev->state == JOB_SKIPPED) &&
+            calls_conflict(&prev->access, &job->access)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tool_batch_wait(tool_batch_t *batch)
+{
+    const int64_t timeout_us = (int64_t)MIMI_TOOL_TIMEOUT_MS * 1000;
+
+    while (batch->completed < batch->submitted) {
+        /* A job's clock runs from when it started, or from when it was
+         * queued if no worker has picked it up yet. A held job waits on
+         * the clocks of the calls it follows. */
+        int64_t now = esp_timer_get_time();
+        int64_t wait_us = timeout_us;
+        int spares = 0;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < MIMI_MAX_TOOL_CALLS; i++) {
+            tool_job_t *job = batch->jobs[i];
+            if (!job) continue;
+            if (job->state == JOB_HELD) {
+                if (job_blocked(batch, i)) {
+                    ESP_LOGW(TAG, "Tool %s not run: an earlier call timed out", job->call.name);
+                    job->state = JOB_SKIPPED;
+                    batch->completed++;
+                }
+                continue;
+            }
+            if (job->state != JOB_QUEUED && job->state != JOB_RUNNING) continue;
+
+            int64_t since = (job->state == JOB_RUNNING) ? job->start_us : job->queued_us;
+            int64_t left = since + timeout_us - now;
+            if (left <= 0) {
+                ESP_LOGW(TAG, "Tool %s timed out after %d ms (%s)", job->call.name,
+                         MIMI_TOOL_TIMEOUT_MS, job->state == JOB_RUNNING ? "running" : "queued");
+                if (job->state == JOB_RUNNING) {
+                    s_stuck++;
+                    if (s_workers - s_stuck + spares < MIMI_TOOL_RUNNER_WORKERS &&
+                        s_workers + spares < MIMI_TOOL_RUNNER_WORKERS + MIMI_TOOL_RUNNER_SPARES) {
+                        spares++;
+                    }
+                }
+                job->state = JOB_TIMED_OUT;
+                batch->completed++;
+                /* Followers are now blocked: look again at once */
+                wait_us = 0;
+            } else if (left < wait_us) {
+                wait_us = left;
+            }
+        }
+        xSemaphoreGive(s_lock);
+
+        for (int i = 0; i < spares; i++) {
+            if (worker_spawn() == ESP_OK) ESP_LOGW(TAG, "Started a spare tool worker");
+        }
+
+        if (batch->completed >= batch->submitted) break;
+
+        if (xSemaphoreTake(batch->done, pdMS_TO_TICKS(wait_us / 1000) + 1) == pdTRUE) {
+            batch->completed++;
+        }
+    }
+}
+
+cJSON *tool_batch_results(const tool_batch_t *batch)
+{
+    cJSON *content = cJSON_CreateArray();
+
+    for (int i = 0; i < MIMI_MAX_TOOL_CALLS; i++) {
+        const tool_job_t *job = batch->jobs[i];
+        if (!job) continue;
+
+        char err_text[96];
+        const char *text = job->output;
+        if (job->state == JOB_TIMED_OUT) {
+            snprintf(err_text, sizeof(err_text), "Error: tool '%s' timed out after %d seconds",
+                     job->call.name, MIMI_TOOL_TIMEOUT_MS / 1000);
+            text = err_text;
+        } else if (job->state == JOB_SKIPPED) {
+            snprintf(err_text, sizeof(err_text),
+                     "Error: tool '%s' not run, an earlier call it depends on timed out",
+                     job->call.name);
+            text = err_text;
+        } else if (!text) {
+            text = "Error: out of memory";
+        }
+
+        cJSON *result_block = cJSON_CreateObject();
+        cJSON_AddStringToObject(result_block, "type", "tool_result");
+        cJSON_AddStringToObject(result_block, "tool_use_id", job->call.id);
+        cJSON_AddStringToObject(result_block, "content", text);
+        cJSON_AddItemToArray(content, result_block);
+    }
+
+    return content;
+}
+
+void tool_batch_log_timing(const tool_batch_t *batch, int64_t llm_start_us, int64_t stream_end_us)
+{
+    int64_t busy_us = 0;
+    int64_t overlap_us = 0;
+    int64_t last_end_us = stream_end_us;
+    int timed_out = 0;
+
+    for (int i = 0; i < MIMI_MAX_TOOL_CALLS; i++) {
+        const tool_job_t *job = batch->jobs[i];
+        if (!job) continue;
+        if (job->state != JOB_DONE) {
+            timed_out++;
+            continue;
+        }
+
+        busy_us += job->end_us - job->start_us;
+        if (job->start_us < stream_end_us) {
+            int64_t end = job->end_us < stream_end_us ? job->end_us : stream_end_us;
+            overlap_us += end - job->start_us;
+        }
+        if (job->end_us > last_end_us) last_end_us = job->end_us;
+    }
+
+    /* busy > wall time after the stream means tools ran in parallel */
+    ESP_LOGI(TAG, "Turn timing: llm %d ms, tools %d ms busy, %d ms overlapped with stream, "
+             "%d ms waited after stream, %d timed out",
+             (int)((stream_end_us - llm_start_us) / 1000), (int)(busy_us / 1000),
+             (int)(overlap_us / 1000), (int)((last_end_us - stream_end_us) / 1000), timed_out);
+}
+
+void tool_batch_free(tool_batch_t *batch)
+{
+    for (int i = 0; i < MIMI_MAX_TOOL_CALLS; i++) {
+        if (batch->jobs[i]) {
+            job_release(batch->jobs[i]);
+            batch->jobs[i] = NULL;
+        }
+    }
+    if (batch->done) {
+        vSemaphoreDelete(batch->done);
+        batch->done = NULL;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "esp_err.h"
+#include "llm/llm_proxy.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "cJSON.h"
+#include <stdint.h>
+
+/**
+ * Background tool execution.
+ *
+ * A small pool of workers, one per core, executes the tool calls of an
+ * LLM response concurrently. The agent submits each call as soon as its
+ * tool_use block is complete, so tools run while the rest of the response
+ * is still streaming. Results are collected in call order once the
+ * response has ended; a tool that exceeds MIMI_TOOL_TIMEOUT_MS is
+ * reported as an error and left to finish in the background, while a
+ * spare worker takes its worker's place.
+ *
+ * Calls that conflict run one after another in call order: exclusive
+ * tools among themselves, and an exclusive tool with any call naming the
+ * same file (or, for list_dir, a prefix of it). A call whose predecessor
+ * timed out is not run.
+ */
+
+typedef struct tool_job tool_job_t;
+
+typedef struct {
+    tool_job_t *jobs[MIMI_MAX_TOOL_CALLS];  /* indexed like llm_response_t.calls */
+    int submitted;
+    int completed;                          /* finished or timed out */
+    SemaphoreHandle_t done;                 /* given once per finished job */
+} tool_batch_t;
+
+/** Create the job queue and lock. */
+esp_err_t tool_runner_init(void);
+
+/** Start the tool worker tasks. */
+esp_err_t tool_runner_start(void);
+
+/** Prepare an empty batch for one LLM response. */
+esp_err_t tool_batch_init(tool_batch_t *batch);
+
+/**
+ * Queue call number `index` of the response for execution. The call is
+ * copied, so the response may be freed while the tool runs.
+ * Calls must be submitted in index order; submitting an index twice is
+ * a no-op.
+ */
+esp_err_t tool_batch_submit(tool_batch_t *batch, int index, const llm_tool_call_t *call);
+
+/** Block until every submitted job has finished or timed out. */
+void tool_batch_wait(tool_batch_t *batch);
+
+/**
+ * Build the tool_result content array in call order.
+ * Call after tool_batch_wait().
+ */
+cJSON *tool_batch_results(const tool_batch_t *batch);
+
+/**
+ * Log how much tool time overlapped with the LLM response.
+ * @param llm_start_us   esp_timer time at which the request was sent
+ * @param stream_end_us  esp_timer time at which the response ended
+ */
+void tool_batch_log_timing(const tool_batch_t *batch, int64_t llm_start_us, int64_t stream_end_us);
+
+/** Release the batch's jobs and semaphore. */
+void tool_batch_free(tool_batch_t *batch);
@@ -1,59 +1,334 @@
 #include "message_bus.h"
 #include "mimi_config.h"
+#include "bus/spill_journal.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "bus";
 
-static QueueHandle_t s_inbound_queue;
-static QueueHandle_t s_outbound_queue;
+typedef struct {
+    mimi_msg_t msg;
+    int64_t enqueued_us;
+} inbound_item_t;
+
+static const char *s_lane_names[MIMI_PRIO_COUNT] = { "interactive", "scheduled", "system" };
+static const int s_lane_weights[MIMI_PRIO_COUNT] = {
+    MIMI_BUS_WEIGHT_INTERACTIVE, MIMI_BUS_WEIGHT_SCHEDULED, MIMI_BUS_WEIGHT_SYSTEM,
+};
+
+static QueueHandle_t s_inbound_lanes[MIMI_PRIO_COUNT];
+static SemaphoreHandle_t s_inbound_items;   /* counts messages across all lanes */
+static int s_lane_credits[MIMI_PRIO_COUNT]; /* consumer side only */
+static SemaphoreHandle_t s_spill_lock;      /* lane admission vs. flash journal */
 
 esp_err_t message_bus_init(void)
 {
-    s_inbound_queue = xQueueCreate(MIMI_BUS_QUEUE_LEN, sizeof(mimi_msg_t));
-    s_outbound_queue = xQueueCreate(MIMI_BUS_QUEUE_LEN, sizeof(mimi_msg_t));
+    esp_err_t err = msg_buf_init();
+    if (err != ESP_OK) return err;
 
-    if (!s_inbound_queue || !s_outbound_queue) {
+    for (int i = 0; i < MIMI_PRIO_COUNT; i++) {
+        s_inbound_lanes[i] = xQueueCreate(MIMI_BUS_QUEUE_LEN, sizeof(inbound_item_t));
+        if (!s_inbound_lanes[i]) {
+            ESP_LOGE(TAG, "Failed to create message queues");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_inbound_items = xSemaphoreCreateCounting(MIMI_BUS_QUEUE_LEN * MIMI_PRIO_COUNT, 0);
+    s_spill_lock = xSemaphoreCreateMutex();
+
+    if (!s_inbound_items || !s_spill_lock) {
         ESP_LOGE(TAG, "Failed to create message queues");
         return ESP_ERR_NO_MEM;
     }
 
-    ESP_LOGI(TAG, "Message bus initialized (queue depth %d)", MIMI_BUS_QUEUE_LEN);
+    /* Messages spilled before a reboot drain on the first pop */
+    err = spill_journal_init();
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Message bus initialized (queue depth %d, %d inbound lanes)",
+             MIMI_BUS_QUEUE_LEN, MIMI_PRIO_COUNT);
     return ESP_OK;
 }
 
 esp_err_t message_bus_push_inbound(const mimi_msg_t *msg)
 {
-    if (xQueueSend(s_inbound_queue, msg, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        ESP_LOGW(TAG, "Inbound queue full, dropping message");
-        return ESP_ERR_NO_MEM;
+    int lane = msg->priority < MIMI_PRIO_COUNT ? msg->priority : MIMI_PRIO_SYSTEM;
+    inbound_item_t item = {
+        .msg = *msg,
+        .enqueued_us = esp_timer_get_time(),
+    };
+    item.msg.priority = lane;
+
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+
+    /* Above the high watermark, or while older messages of this lane are
+     * still on flash, append to the journal so lane order is kept */
+    bool spill = spill_journal_pending(lane) > 0 ||
+                 uxQueueMessagesWaiting(s_inbound_lanes[lane]) >= MIMI_BUS_SPILL_HIGH;
+    if (!spill && xQueueSend(s_inbound_lanes[lane], &item, 0) == pdTRUE) {
+        xSemaphoreGive(s_spill_lock);
+        xSemaphoreGive(s_inbound_items);
+        return ESP_OK;
     }
+
+    esp_err_t err = spill_journal_append(&item.msg, item.enqueued_us);
+    int spilled = spill_journal_total();
+    xSemaphoreGive(s_spill_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Inbound %s lane full and spill failed, dropping message",
+                 s_lane_names[lane]);
+        return err;
+    }
+    ESP_LOGW(TAG, "Inbound %s lane busy, spilled to flash (%d pending)",
+             s_lane_names[lane], spilled);
+    msg_buf_release(msg->content);  /* the journal holds a copy */
     return ESP_OK;
 }
 
+/*
+ * Move spilled messages back into the lanes: once the lane of the oldest
+ * record has drained to the low watermark, refill in journal order until
+ * a record's lane reaches the high watermark.
+ */
+static void spill_drain(void)
+{
+    if (spill_journal_total() == 0) return;
+
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+    int lane = spill_journal_head_lane();
+    int moved = 0;
+    if (lane >= 0 && uxQueueMessagesWaiting(s_inbound_lanes[lane]) <= MIMI_BUS_SPILL_LOW) {
+        while ((lane = spill_journal_head_lane()) >= 0 &&
+               uxQueueMessagesWaiting(s_inbound_lanes[lane]) < MIMI_BUS_SPILL_HIGH) {
+            /* Age keeps counting from the original push, for anti-starvation */
+            inbound_item_t item;
+            if (spill_journal_peek(&item.msg, &item.enqueued_us) != ESP_OK) break;
+            if (xQueueSend(s_inbound_lanes[lane], &item, 0) != pdTRUE) {
+                msg_buf_release(item.msg.content);
+                break;
+            }
+            /* Only now that the lane holds it */
+            spill_journal_advance();
+            xSemaphoreGive(s_inbound_items);
+            moved++;
+        }
+    }
+    int left = spill_journal_total();
+    xSemaphoreGive(s_spill_lock);
+
+    if (moved > 0) {
+        ESP_LOGI(TAG, "Drained %d spilled messages (%d left on flash)", moved, left);
+    }
+}
+
+/* Pick the lane to serve next; every lane that is non-empty is a candidate */
+static int pick_lane(void)
+{
+    int64_t now = esp_timer_get_time();
+    bool ready[MIMI_PRIO_COUNT];
+
+    for (int i = 0; i < MIMI_PRIO_COUNT; i++) {
+        inbound_item_t head;
+        ready[i] = (xQueuePeek(s_inbound_lanes[i], &head, 0) == pdTRUE);
+
+        /* Anti-starvation: an old background message jumps the weights */
+        if (ready[i] && i != MIMI_PRIO_INTERACTIVE &&
+            now - head.enqueued_us >= (int64_t)MIMI_BUS_STARVE_MS * 1000) {
+            ESP_LOGW(TAG, "Serving %s lane after %d ms wait", s_lane_names[i],
+                     (int)((now - head.enqueued_us) / 1000));
+            return i;
+        }
+    }
+
+    /* Weighted round-robin: highest priority lane with credit left;
+     * refill credits once no ready lane has any */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MIMI_PRIO_COUNT; i++) {
+            if (ready[i] && s_lane_credits[i] > 0) {
+                s_lane_credits[i]--;
+                return i;
+            }
+        }
+        for (int i = 0; i < MIMI_PRIO_COUNT; i++) {
+            s_lane_credits[i] = s_lane_weights[i];
+        }
+    }
+    return -1;
+}
+
 esp_err_t message_bus_pop_inbound(mimi_msg_t *msg, uint32_t timeout_ms)
 {
     TickType_t ticks = (timeout_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
-    if (xQueueReceive(s_inbound_queue, msg, ticks) != pdTRUE) {
-        return ESP_ERR_TIMEOUT;
+    while (1) {
+        spill_drain();
+
+        /* With messages on flash, wake up periodically to keep draining */
+        bool retry = (ticks == portMAX_DELAY && spill_journal_total() > 0);
+        if (xSemaphoreTake(s_inbound_items, retry ? pdMS_TO_TICKS(1000) : ticks) == pdTRUE) break;
+        if (!retry) return ESP_ERR_TIMEOUT;
+    }
+
+    /* The counter guarantees a message is queued in some lane */
+    inbound_item_t item;
+    int lane = pick_lane();
+    if (lane < 0 || xQueueReceive(s_inbound_lanes[lane], &item, 0) != pdTRUE) {
+        for (lane = 0; lane < MIMI_PRIO_COUNT; lane++) {
+            if (xQueueReceive(s_inbound_lanes[lane], &item, 0) == pdTRUE) break;
+        }
+        if (lane == MIMI_PRIO_COUNT) return ESP_ERR_TIMEOUT;
     }
+
+    *msg = item.msg;
     return ESP_OK;
 }
 
-esp_err_t message_bus_push_outbound(const mimi_msg_t *msg)
+/* ── Outbound: per-channel queue + worker ──────────────────────── */
+
+typedef struct {
+    mimi_msg_t msg;
+    int64_t enqueued_us;
+} outbound_item_t;
+
+typedef struct {
+    char channel[16];
+    mimi_outbound_handler_t handler;
+    QueueHandle_t queue;
+    uint32_t delivered;
+    uint32_t dropped;
+    int max_depth;
+    uint64_t total_latency_us;
+    int64_t max_latency_us;
+} outbound_sub_t;
+
+static outbound_sub_t s_subs[MIMI_BUS_MAX_CHANNELS];
+static int s_sub_count;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static outbound_sub_t *find_sub(const char *channel)
+{
+    for (int i = 0; i < s_sub_count; i++) {
+        if (strcmp(s_subs[i].channel, channel) == 0) return &s_subs[i];
+    }
+    return NULL;
+}
+
+static void outbound_worker_task(void *arg)
 {
-    if (xQueueSend(s_outbound_queue, msg, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        ESP_LOGW(TAG, "Outbound queue full, dropping message");
+    outbound_sub_t *sub = (outbound_sub_t *)arg;
+    ESP_LOGI(TAG, "Outbound worker for '%s' started", sub->channel);
+
+    while (1) {
+        outbound_item_t item;
+        if (xQueueReceive(sub->queue, &item, portMAX_DELAY) != pdTRUE) continue;
+
+        ESP_LOGI(TAG, "Dispatching response to %s:%s", item.msg.channel, item.msg.chat_id);
+        sub->handler(&item.msg);
+        msg_buf_release(item.msg.content);
+
+        int64_t latency_us = esp_timer_get_time() - item.enqueued_us;
+        portENTER_CRITICAL(&s_stats_lock);
+        sub->delivered++;
+        sub->total_latency_us += latency_us;
+        if (latency_us > sub->max_latency_us) sub->max_latency_us = latency_us;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+}
+
+esp_err_t message_bus_subscribe_outbound(const char *channel, mimi_outbound_handler_t handler)
+{
+    if (!channel || !handler) return ESP_ERR_INVALID_ARG;
+    if (find_sub(channel)) return ESP_ERR_INVALID_STATE;
+    if (s_sub_count >= MIMI_BUS_MAX_CHANNELS) {
+        ESP_LOGE(TAG, "Outbound routing table full");
         return ESP_ERR_NO_MEM;
     }
+
+    outbound_sub_t *sub = &s_subs[s_sub_count];
+    memset(sub, 0, sizeof(*sub));
+    strncpy(sub->channel, channel, sizeof(sub->channel) - 1);
+    sub->handler = handler;
+    sub->queue = xQueueCreate(MIMI_BUS_QUEUE_LEN, sizeof(outbound_item_t));
+    if (!sub->queue) return ESP_ERR_NO_MEM;
+
+    char name[16];
+    snprintf(name, sizeof(name), "out_%.11s", channel);
+    if (xTaskCreatePinnedToCore(outbound_worker_task, name,
+                                MIMI_OUTBOUND_STACK, sub,
+                                MIMI_OUTBOUND_PRIO, NULL, MIMI_OUTBOUND_CORE) != pdPASS) {
+        vQueueDelete(sub->queue);
+        return ESP_FAIL;
+    }
+
+    /* Publish only once the worker exists */
+    s_sub_count++;
     return ESP_OK;
 }
 
-esp_err_t message_bus_pop_outbound(mimi_msg_t *msg, uint32_t timeout_ms)
+esp_err_t message_bus_push_outbound(const mimi_msg_t *msg)
 {
-    TickType_t ticks = (timeout_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
-    if (xQueueReceive(s_outbound_queue, msg, ticks) != pdTRUE) {
-        return ESP_ERR_TIMEOUT;
+    outbound_sub_t *sub = find_sub(msg->channel);
+    if (!sub) {
+        ESP_LOGW(TAG, "No outbound subscriber for channel '%s', dropping message", msg->channel);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    outbound_item_t item = {
+        .msg = *msg,
+        .enqueued_us = esp_timer_get_time(),
+    };
+    if (xQueueSend(sub->queue, &item, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        ESP_LOGW(TAG, "Outbound '%s' queue full, dropping message", sub->channel);
+        portENTER_CRITICAL(&s_stats_lock);
+        sub->dropped++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        return ESP_ERR_NO_MEM;
     }
+
+    int depth = (int)uxQueueMessagesWaiting(sub->queue);
+    portENTER_CRITICAL(&s_stats_lock);
+    if (depth > sub->max_depth) sub->max_depth = depth;
+    portEXIT_CRITICAL(&s_stats_lock);
     return ESP_OK;
 }
+
+int message_bus_get_outbound_stats(mimi_outbound_stats_t *out, int max)
+{
+    int n = 0;
+    for (int i = 0; i < s_sub_count && n < max; i++, n++) {
+        outbound_sub_t *sub = &s_subs[i];
+        mimi_outbound_stats_t *st = &out[n];
+        memset(st, 0, sizeof(*st));
+        strncpy(st->channel, sub->channel, sizeof(st->channel) - 1);
+        st->depth = (int)uxQueueMessagesWaiting(sub->queue);
+
+        portENTER_CRITICAL(&s_stats_lock);
+        st->delivered = sub->delivered;
+        st->dropped = sub->dropped;
+        st->max_depth = sub->max_depth;
+        st->avg_latency_ms = sub->delivered ?
+            (uint32_t)(sub->total_latency_us / sub->delivered / 1000) : 0;
+        st->max_latency_ms = (uint32_t)(sub->max_latency_us / 1000);
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    return n;
+}
+
+int message_bus_inbound_depth(mimi_prio_t prio)
+{
+    if (prio >= MIMI_PRIO_COUNT || !s_inbound_lanes[prio]) return 0;
+    return (int)uxQueueMessagesWaiting(s_inbound_lanes[prio]);
+}
+
+int message_bus_spilled_count(void)
+{
+    if (!s_spill_lock) return 0;
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+    int n = spill_journal_total();
+    xSemaphoreGive(s_spill_lock);
+    return n;
+}
@@ -3,6 +3,7 @@
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "bus/msg_buf.h"
 
 /* Channel identifiers */
 #define MIMI_CHAN_TELEGRAM   "telegram"
@@ -10,38 +11,84 @@
 #define MIMI_CHAN_CLI        "cli"
 #define MIMI_CHAN_SYSTEM     "system"
 
+/* Inbound priority classes, each with its own lane */
+typedef enum {
+    MIMI_PRIO_INTERACTIVE = 0,  /* human messages (default for zeroed msgs) */
+    MIMI_PRIO_SCHEDULED,        /* cron job firings */
+    MIMI_PRIO_SYSTEM,           /* heartbeat and other housekeeping */
+    MIMI_PRIO_COUNT,
+} mimi_prio_t;
+
 /* Message types on the bus */
 typedef struct {
     char channel[16];       /* "telegram", "websocket", "cli" */
     char chat_id[32];       /* Telegram chat_id or WS client id */
-    char *content;          /* Heap-allocated message text (caller must free) */
+    char *content;          /* msg_buf payload (release with msg_buf_release) */
+    uint8_t priority;       /* mimi_prio_t, inbound only */
 } mimi_msg_t;
 
 /**
- * Initialize the message bus (inbound + outbound FreeRTOS queues).
+ * Initialize the message bus (inbound lanes; outbound queues are created
+ * per channel by message_bus_subscribe_outbound()).
  */
 esp_err_t message_bus_init(void);
 
 /**
- * Push a message to the inbound queue (towards Agent Loop).
- * The bus takes ownership of msg->content.
+ * Push a message to the inbound lane for msg->priority (towards Agent Loop).
+ * Once the lane holds MIMI_BUS_SPILL_HIGH messages, further pushes go to a
+ * flash journal and are drained back in order as the lane empties.
+ * The bus takes ownership of msg->content on success; on failure the
+ * caller still owns it.
  */
 esp_err_t message_bus_push_inbound(const mimi_msg_t *msg);
 
 /**
- * Pop a message from the inbound queue (blocking).
- * Caller must free msg->content when done.
+ * Pop the next inbound message (blocking).
+ * Lanes are served by weighted round-robin (MIMI_BUS_WEIGHT_*), higher
+ * priority first; a background message that has waited longer than
+ * MIMI_BUS_STARVE_MS is served next regardless of weights.
+ * Caller must msg_buf_release() msg->content when done.
  */
 esp_err_t message_bus_pop_inbound(mimi_msg_t *msg, uint32_t timeout_ms);
 
 /**
- * Push a message to the outbound queue (towards channels).
- * The bus takes ownership of msg->content.
+ * Outbound delivery handler for one channel. Runs on that channel's own
+ * worker task; the bus releases msg->content after it returns.
+ */
+typedef void (*mimi_outbound_handler_t)(const mimi_msg_t *msg);
+
+typedef struct {
+    char channel[16];
+    uint32_t delivered;
+    uint32_t dropped;           /* channel queue full */
+    int depth;                  /* queued now */
+    int max_depth;
+    uint32_t avg_latency_ms;    /* push → handler returned */
+    uint32_t max_latency_ms;
+} mimi_outbound_stats_t;
+
+/**
+ * Route outbound messages for `channel` to `handler`. Each channel gets
+ * its own queue and worker, so a slow channel never delays another.
+ * Call during startup, before messages for the channel are pushed.
+ */
+esp_err_t message_bus_subscribe_outbound(const char *channel, mimi_outbound_handler_t handler);
+
+/**
+ * Push a message to its channel's outbound queue.
+ * The bus takes ownership of msg->content on success; on failure the
+ * caller still owns it. ESP_ERR_NOT_FOUND if nobody subscribed.
  */
 esp_err_t message_bus_push_outbound(const mimi_msg_t *msg);
 
 /**
- * Pop a message from the outbound queue (blocking).
- * Caller must free msg->content when done.
+ * Snapshot per-channel outbound statistics.
+ * @return number of entries written (at most max)
  */
-esp_err_t message_bus_pop_outbound(mimi_msg_t *msg, uint32_t timeout_ms);
+int message_bus_get_outbound_stats(mimi_outbound_stats_t *out, int max);
+
+/** Number of messages waiting in an inbound lane. */
+int message_bus_inbound_depth(mimi_prio_t prio);
+
+/** Number of inbound messages waiting in the flash spill journal. */
+int message_bus_spilled_count(void);
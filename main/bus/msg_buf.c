@@ -0,0 +1,178 @@
+#include "msg_buf.h"
+#include "mimi_config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "msg_buf";
+
+#define MSG_BUF_MAGIC   0x4d42      /* "MB" */
+#define CLASS_HEAP      0xff
+
+typedef struct {
+    int32_t refs;
+    uint16_t magic;
+    uint8_t cls;                /* slab class, or CLASS_HEAP */
+    uint8_t reserved;
+    uint32_t slot;
+} msg_buf_hdr_t;
+
+typedef struct {
+    size_t payload;             /* usable bytes incl. NUL */
+    size_t count;
+    size_t stride;
+    uint8_t *base;
+    uint16_t *free_slots;       /* stack of free slot indices */
+    size_t free_top;
+} slab_class_t;
+
+static slab_class_t s_classes[] = {
+    { .payload = MIMI_MSG_BUF_SMALL_SIZE, .count = MIMI_MSG_BUF_SMALL_COUNT },
+    { .payload = MIMI_MSG_BUF_LARGE_SIZE, .count = MIMI_MSG_BUF_LARGE_COUNT },
+};
+#define CLASS_COUNT (sizeof(s_classes) / sizeof(s_classes[0]))
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static msg_buf_stats_t s_stats;
+
+esp_err_t msg_buf_init(void)
+{
+    for (size_t c = 0; c < CLASS_COUNT; c++) {
+        slab_class_t *sc = &s_classes[c];
+        if (sc->base) continue;
+
+        sc->stride = (sizeof(msg_buf_hdr_t) + sc->payload + 3) & ~(size_t)3;
+        sc->base = heap_caps_malloc(sc->stride * sc->count, MALLOC_CAP_SPIRAM);
+        sc->free_slots = heap_caps_malloc(sc->count * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+        if (!sc->base || !sc->free_slots) {
+            ESP_LOGE(TAG, "Failed to allocate %d x %d byte slab", (int)sc->count, (int)sc->payload);
+            return ESP_ERR_NO_MEM;
+        }
+        for (size_t i = 0; i < sc->count; i++) {
+            sc->free_slots[i] = (uint16_t)(sc->count - 1 - i);
+        }
+        sc->free_top = sc->count;
+    }
+
+    ESP_LOGI(TAG, "Message buffers: %d x %d B + %d x %d B in PSRAM",
+             (int)s_classes[0].count, (int)s_classes[0].payload,
+             (int)s_classes[1].count, (int)s_classes[1].payload);
+    return ESP_OK;
+}
+
+static msg_buf_hdr_t *hdr_of(char *buf)
+{
+    msg_buf_hdr_t *hdr = (msg_buf_hdr_t *)buf - 1;
+    if (hdr->magic != MSG_BUF_MAGIC) {
+        ESP_LOGE(TAG, "Not a msg_buf: %p", buf);
+        abort();
+    }
+    return hdr;
+}
+
+char *msg_buf_alloc(size_t len)
+{
+    msg_buf_hdr_t *hdr = NULL;
+    bool from_slab = false;
+
+    portENTER_CRITICAL(&s_lock);
+    for (size_t c = 0; c < CLASS_COUNT; c++) {
+        slab_class_t *sc = &s_classes[c];
+        if (len + 1 > sc->payload || sc->free_top == 0) continue;
+
+        uint16_t slot = sc->free_slots[--sc->free_top];
+        hdr = (msg_buf_hdr_t *)(sc->base + (size_t)slot * sc->stride);
+        hdr->cls = (uint8_t)c;
+        hdr->slot = slot;
+        from_slab = true;
+        break;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (!hdr) {
+        hdr = heap_caps_malloc(sizeof(msg_buf_hdr_t) + len + 1, MALLOC_CAP_SPIRAM);
+        if (!hdr) {
+            portENTER_CRITICAL(&s_lock);
+            s_stats.failures++;
+            portEXIT_CRITICAL(&s_lock);
+            return NULL;
+        }
+        hdr->cls = CLASS_HEAP;
+        hdr->slot = 0;
+    }
+    hdr->refs = 1;
+    hdr->magic = MSG_BUF_MAGIC;
+
+    portENTER_CRITICAL(&s_lock);
+    if (from_slab) {
+        s_stats.slab_allocs++;
+    } else {
+        s_stats.heap_allocs++;
+    }
+    s_stats.in_use++;
+    if (s_stats.in_use > s_stats.peak_in_use) s_stats.peak_in_use = s_stats.in_use;
+    portEXIT_CRITICAL(&s_lock);
+
+    char *buf = (char *)(hdr + 1);
+    buf[0] = '\0';
+    return buf;
+}
+
+char *msg_buf_strndup(const char *s, size_t len)
+{
+    char *buf = msg_buf_alloc(len);
+    if (!buf) return NULL;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+char *msg_buf_strdup(const char *s)
+{
+    return msg_buf_strndup(s, strlen(s));
+}
+
+char *msg_buf_ref(char *buf)
+{
+    if (!buf) return NULL;
+    msg_buf_hdr_t *hdr = hdr_of(buf);
+
+    portENTER_CRITICAL(&s_lock);
+    hdr->refs++;
+    s_stats.refs++;
+    portEXIT_CRITICAL(&s_lock);
+    return buf;
+}
+
+void msg_buf_release(char *buf)
+{
+    if (!buf) return;
+    msg_buf_hdr_t *hdr = hdr_of(buf);
+
+    portENTER_CRITICAL(&s_lock);
+    bool last = (--hdr->refs == 0);
+    if (last) {
+        hdr->magic = 0;
+        if (hdr->cls != CLASS_HEAP) {
+            slab_class_t *sc = &s_classes[hdr->cls];
+            sc->free_slots[sc->free_top++] = (uint16_t)hdr->slot;
+        }
+        s_stats.releases++;
+        s_stats.in_use--;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (last && hdr->cls == CLASS_HEAP) {
+        heap_caps_free(hdr);
+    }
+}
+
+void msg_buf_get_stats(msg_buf_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Refcounted message payloads for the bus.
+ *
+ * mimi_msg_t.content is a msg_buf: a NUL-terminated char * carved from a
+ * PSRAM slab (heap fallback for oversized payloads). Handing a payload to
+ * another consumer takes a reference instead of a copy; the last
+ * msg_buf_release() returns it to the slab. Never free() a msg_buf.
+ */
+
+typedef struct {
+    uint32_t slab_allocs;       /* served from a slab */
+    uint32_t heap_allocs;       /* slab class full or payload too large */
+    uint32_t refs;              /* extra references taken (copies avoided) */
+    uint32_t releases;          /* buffers returned */
+    uint32_t in_use;
+    uint32_t peak_in_use;
+    uint32_t failures;
+} msg_buf_stats_t;
+
+/** Allocate the slabs. Called by message_bus_init(). */
+esp_err_t msg_buf_init(void);
+
+/** Allocate a buffer for len bytes plus NUL (refcount 1), or NULL. */
+char *msg_buf_alloc(size_t len);
+
+/** Copy a string into a new buffer (refcount 1), or NULL. */
+char *msg_buf_strdup(const char *s);
+
+/** Copy at most len bytes of s into a new buffer (refcount 1), or NULL. */
+char *msg_buf_strndup(const char *s, size_t len);
+
+/** Take another reference; returns buf for convenience. NULL-safe. */
+char *msg_buf_ref(char *buf);
+
+/** Drop a reference, freeing the buffer with the last one. NULL-safe. */
+void msg_buf_release(char *buf);
+
+/** Snapshot the allocation counters. */
+void msg_buf_get_stats(msg_buf_stats_t *out);
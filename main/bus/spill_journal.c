@@ -0,0 +1,284 @@
+#include "spill_journal.h"
+#include "mimi_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+static const char *TAG = "spill";
+
+#define SPILL_MAGIC 0x5351      /* "SQ"; "SP" records had no enqueue time */
+
+/* Compaction writes TMP, renames it to NEW once complete, then swaps NEW in */
+#define SPILL_TMP_FILE  MIMI_BUS_SPILL_FILE ".tmp"
+#define SPILL_NEW_FILE  MIMI_BUS_SPILL_FILE ".new"
+
+/* On-flash record header, followed by len bytes of content (no NUL) */
+typedef struct {
+    uint16_t magic;
+    uint8_t priority;
+    uint8_t reserved;
+    char channel[16];
+    char chat_id[32];
+    uint32_t len;
+    int64_t enqueued_us;        /* first push, esp_timer clock of that boot */
+} spill_rec_t;
+
+static long s_head;             /* offset of the oldest unconsumed record */
+static long s_size;             /* journal file size */
+static long s_recovered_end;    /* records before this offset are from an earlier boot */
+static spill_rec_t s_head_rec;  /* cached header at s_head, valid if s_total > 0 */
+static int s_pending[MIMI_PRIO_COUNT];
+static int s_total;
+
+static void journal_reset(void)
+{
+    remove(MIMI_BUS_SPILL_FILE);
+    remove(MIMI_BUS_SPILL_POS_FILE);
+    s_head = 0;
+    s_size = 0;
+    s_recovered_end = 0;
+    s_total = 0;
+    memset(s_pending, 0, sizeof(s_pending));
+}
+
+static bool read_header(FILE *f, long offset, spill_rec_t *rec)
+{
+    if (fseek(f, offset, SEEK_SET) != 0) return false;
+    if (fread(rec, sizeof(*rec), 1, f) != 1) return false;
+    return rec->magic == SPILL_MAGIC && rec->priority < MIMI_PRIO_COUNT &&
+           offset + (long)sizeof(*rec) + (long)rec->len <= s_size;
+}
+
+static void save_head(void)
+{
+    FILE *f = fopen(MIMI_BUS_SPILL_POS_FILE, "w");
+    if (!f) {
+        ESP_LOGW(TAG, "Cannot persist journal position");
+        return;
+    }
+    fprintf(f, "%ld\n", s_head);
+    fclose(f);
+}
+
+/* Put a complete NEW journal in place; it starts at the head record.
+ * SPIFFS rename does not replace an existing file. */
+static bool swap_in_new(void)
+{
+    remove(MIMI_BUS_SPILL_POS_FILE);
+    remove(MIMI_BUS_SPILL_FILE);
+    return rename(SPILL_NEW_FILE, MIMI_BUS_SPILL_FILE) == 0;
+}
+
+/*
+ * Drop the consumed records in front of s_head by rewriting the pending
+ * ones to a new file. Run once they make up half the journal, so each
+ * byte is copied at most once on average.
+ */
+static void journal_compact(void)
+{
+    FILE *src = fopen(MIMI_BUS_SPILL_FILE, "rb");
+    FILE *dst = src ? fopen(SPILL_TMP_FILE, "wb") : NULL;
+    bool ok = dst && fseek(src, s_head, SEEK_SET) == 0;
+
+    char chunk[512];
+    for (long left = s_size - s_head; ok && left > 0; ) {
+        size_t n = left < (long)sizeof(chunk) ? (size_t)left : sizeof(chunk);
+        ok = fread(chunk, 1, n, src) == n && fwrite(chunk, 1, n, dst) == n;
+        left -= n;
+    }
+    if (src) fclose(src);
+    if (dst && fclose(dst) != 0) ok = false;
+
+    if (!ok || rename(SPILL_TMP_FILE, SPILL_NEW_FILE) != 0) {
+        ESP_LOGW(TAG, "Journal compaction failed");
+        remove(SPILL_TMP_FILE);
+        return;
+    }
+    if (!swap_in_new()) {
+        /* Retried by the next init, which finds NEW complete */
+        ESP_LOGE(TAG, "Cannot replace journal with its compacted copy");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Compacted journal: %ld -> %ld bytes", s_size, s_size - s_head);
+    s_size -= s_head;
+    s_recovered_end = s_recovered_end > s_head ? s_recovered_end - s_head : 0;
+    s_head = 0;
+}
+
+esp_err_t spill_journal_init(void)
+{
+    /* A compaction interrupted after NEW was complete: it holds exactly
+     * the pending records, and the old position no longer applies */
+    struct stat st;
+    remove(SPILL_TMP_FILE);
+    if (stat(SPILL_NEW_FILE, &st) == 0 && !swap_in_new()) {
+        ESP_LOGE(TAG, "Cannot finish journal compaction");
+    }
+
+    if (stat(MIMI_BUS_SPILL_FILE, &st) != 0 || st.st_size == 0) {
+        journal_reset();
+        return ESP_OK;
+    }
+    s_size = st.st_size;
+
+    s_head = 0;
+    FILE *pf = fopen(MIMI_BUS_SPILL_POS_FILE, "r");
+    if (pf) {
+        if (fscanf(pf, "%ld", &s_head) != 1) s_head = 0;
+        fclose(pf);
+    }
+
+    FILE *f = fopen(MIMI_BUS_SPILL_FILE, "rb");
+    if (!f) {
+        journal_reset();
+        return ESP_OK;
+    }
+
+    /* Count pending records per lane; a torn tail record is ignored */
+    long off = s_head;
+    spill_rec_t rec;
+    while (off < s_size && read_header(f, off, &rec)) {
+        if (s_total == 0) s_head_rec = rec;
+        s_pending[rec.priority]++;
+        s_total++;
+        off += sizeof(rec) + rec.len;
+    }
+    fclose(f);
+
+    if (s_total == 0) {
+        journal_reset();
+    } else {
+        s_size = off;
+        s_recovered_end = off;
+        ESP_LOGI(TAG, "Recovered %d spilled messages from flash", s_total);
+    }
+    return ESP_OK;
+}
+
+esp_err_t spill_journal_append(const mimi_msg_t *msg, int64_t enqueued_us)
+{
+    spill_rec_t rec = {
+        .magic = SPILL_MAGIC,
+        .priority = msg->priority,
+        .len = (uint32_t)strlen(msg->content),
+        .enqueued_us = enqueued_us,
+    };
+    memcpy(rec.channel, msg->channel, sizeof(rec.channel));
+    memcpy(rec.chat_id, msg->chat_id, sizeof(rec.chat_id));
+
+    long rec_size = sizeof(rec) + rec.len;
+    if (s_size + rec_size > MIMI_BUS_SPILL_MAX_BYTES && s_head > 0) {
+        journal_compact();
+    }
+    if (s_size + rec_size > MIMI_BUS_SPILL_MAX_BYTES) {
+        ESP_LOGW(TAG, "Journal full (%ld bytes)", s_size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    FILE *f = fopen(MIMI_BUS_SPILL_FILE, "ab");
+    if (!f) {
+        ESP_LOGE(TAG, "Cannot open %s", MIMI_BUS_SPILL_FILE);
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+              fwrite(msg->content, 1, rec.len, f) == rec.len;
+    fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "Journal write failed");
+        return ESP_FAIL;
+    }
+
+    if (s_total == 0) s_head_rec = rec;
+    s_size += rec_size;
+    s_pending[rec.priority]++;
+    s_total++;
+    return ESP_OK;
+}
+
+int spill_journal_head_lane(void)
+{
+    return s_total > 0 ? s_head_rec.priority : -1;
+}
+
+int spill_journal_pending(int lane)
+{
+    return (lane >= 0 && lane < MIMI_PRIO_COUNT) ? s_pending[lane] : 0;
+}
+
+int spill_journal_total(void)
+{
+    return s_total;
+}
+
+esp_err_t spill_journal_peek(mimi_msg_t *msg, int64_t *enqueued_us)
+{
+    if (s_total == 0) return ESP_ERR_NOT_FOUND;
+
+    FILE *f = fopen(MIMI_BUS_SPILL_FILE, "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "Journal vanished, dropping %d messages", s_total);
+        journal_reset();
+        return ESP_FAIL;
+    }
+
+    spill_rec_t rec = s_head_rec;
+    char *content = msg_buf_alloc(rec.len);
+    if (!content) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+    bool ok = fseek(f, s_head + sizeof(rec), SEEK_SET) == 0 &&
+              fread(content, 1, rec.len, f) == rec.len;
+    fclose(f);
+    if (!ok) {
+        msg_buf_release(content);
+        ESP_LOGE(TAG, "Journal corrupt, dropping %d messages", s_total);
+        journal_reset();
+        return ESP_FAIL;
+    }
+    content[rec.len] = '\0';
+
+    memset(msg, 0, sizeof(*msg));
+    memcpy(msg->channel, rec.channel, sizeof(msg->channel));
+    msg->channel[sizeof(msg->channel) - 1] = '\0';
+    memcpy(msg->chat_id, rec.chat_id, sizeof(msg->chat_id));
+    msg->chat_id[sizeof(msg->chat_id) - 1] = '\0';
+    msg->priority = rec.priority;
+    msg->content = content;
+
+    /* The timer restarted with the boot: waited since boot, at least */
+    *enqueued_us = s_head < s_recovered_end ? 0 : rec.enqueued_us;
+    return ESP_OK;
+}
+
+void spill_journal_advance(void)
+{
+    if (s_total == 0) return;
+
+    s_head += sizeof(s_head_rec) + s_head_rec.len;
+    s_pending[s_head_rec.priority]--;
+    s_total--;
+
+    /* Fully drained: truncate instead of growing forever */
+    if (s_total == 0) {
+        journal_reset();
+        return;
+    }
+
+    FILE *f = fopen(MIMI_BUS_SPILL_FILE, "rb");
+    bool ok = f && read_header(f, s_head, &s_head_rec);
+    if (f) fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "Journal corrupt, dropping %d messages", s_total);
+        journal_reset();
+        return;
+    }
+
+    if (s_head > s_size / 2) {
+        journal_compact();
+    }
+    save_head();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "esp_err.h"
+#include "bus/message_bus.h"
+
+/**
+ * Append-only flash journal for inbound messages that do not fit in the
+ * bus lanes. Records are consumed strictly in append order; the read
+ * position is persisted, so pending records survive a reboot.
+ *
+ * Not thread-safe: the message bus serializes all calls.
+ */
+
+/** Load the journal left by a previous boot, if any. */
+esp_err_t spill_journal_init(void);
+
+/**
+ * Append a message (content is copied to flash, caller keeps ownership).
+ * enqueued_us is when it was first pushed, returned again by peek.
+ * @return ESP_ERR_NO_MEM if the journal would exceed MIMI_BUS_SPILL_MAX_BYTES
+ */
+esp_err_t spill_journal_append(const mimi_msg_t *msg, int64_t enqueued_us);
+
+/** Lane (mimi_prio_t) of the oldest pending record, or -1 if empty. */
+int spill_journal_head_lane(void);
+
+/** Pending records for one lane. */
+int spill_journal_pending(int lane);
+
+/** Pending records across all lanes. */
+int spill_journal_total(void);
+
+/**
+ * Read the oldest record into msg; content is a new msg_buf owned by the
+ * caller. The record stays in the journal until spill_journal_advance(),
+ * so call that only once the message has been handed on. enqueued_us is
+ * 0 for records left by an earlier boot.
+ */
+esp_err_t spill_journal_peek(mimi_msg_t *msg, int64_t *enqueued_us);
+
+/**
+ * Consume the oldest record and persist the new read position. Compacts
+ * the file once consumed records make up half of it.
+ */
+void spill_journal_advance(void);
@@ -3,14 +3,22 @@
 #include "wifi/wifi_manager.h"
 #include "telegram/telegram_bot.h"
 #include "llm/llm_proxy.h"
+#include "llm/llm_health.h"
 #include "memory/memory_store.h"
 #include "memory/session_mgr.h"
 #include "proxy/http_proxy.h"
+#include "net/tls_cache.h"
+#include "net/http_transport.h"
 #include "tools/tool_web_search.h"
 #include "skills/skill_loader.h"
 #include "cron/cron_service.h"
 #include "heartbeat/heartbeat.h"
 #include "tools/tool_registry.h"
+#include "agent/agent_loop.h"
+#include "agent/compactor.h"
+#include "agent/context_builder.h"
+#include "bus/message_bus.h"
+#include "bus/msg_buf.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -126,6 +134,27 @@ static int cmd_set_model_provider(int argc, char **argv)
     return 0;
 }
 
+/* --- set_fallback command --- */
+static struct {
+    struct arg_str *key;
+    struct arg_str *model;
+    struct arg_end *end;
+} fallback_args;
+
+static int cmd_set_fallback(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&fallback_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, fallback_args.end, argv[0]);
+        return 1;
+    }
+    const char *key = fallback_args.key->count ? fallback_args.key->sval[0] : "";
+    const char *model = fallback_args.model->count ? fallback_args.model->sval[0] : "";
+    llm_set_fallback(key, model);
+    printf(key[0] ? "Fallback provider set.\n" : "Fallback provider cleared.\n");
+    return 0;
+}
+
 /* --- memory_read command --- */
 static int cmd_memory_read(int argc, char **argv)
 {
@@ -190,6 +219,31 @@ static int cmd_session_clear(int argc, char **argv)
     return 0;
 }
 
+/* --- session_compact command --- */
+static struct {
+    struct arg_str *chat_id;
+    struct arg_end *end;
+} session_compact_args;
+
+static int cmd_session_compact(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&session_compact_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, session_compact_args.end, argv[0]);
+        return 1;
+    }
+    if (session_flush() != ESP_OK) {
+        printf("Session not fully written to flash, compacting what is there.\n");
+    }
+    esp_err_t err = compactor_request(session_compact_args.chat_id->sval[0], true);
+    if (err != ESP_OK) {
+        printf("Compactor not running (%s).\n", esp_err_to_name(err));
+        return 1;
+    }
+    printf("Compaction queued.\n");
+    return 0;
+}
+
 /* --- heap_info command --- */
 static int cmd_heap_info(int argc, char **argv)
 {
@@ -199,6 +253,220 @@ static int cmd_heap_info(int argc, char **argv)
            (int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
     printf("Total free:    %d bytes\n",
            (int)esp_get_free_heap_size());
+
+    msg_buf_stats_t mb;
+    msg_buf_get_stats(&mb);
+    printf("Msg buffers:   %u in use (peak %u), %u slab / %u heap allocs, "
+           "%u shared refs, %u failures\n",
+           (unsigned)mb.in_use, (unsigned)mb.peak_in_use, (unsigned)mb.slab_allocs,
+           (unsigned)mb.heap_allocs, (unsigned)mb.refs, (unsigned)mb.failures);
+
+    session_cache_stats_t sc;
+    session_get_cache_stats(&sc);
+    printf("Session cache: %d chats, %u hits / %u misses, %d appends pending\n",
+           sc.cached, (unsigned)sc.hits, (unsigned)sc.misses, sc.pending);
+    return 0;
+}
+
+/* --- agent_stats command --- */
+static int cmd_agent_stats(int argc, char **argv)
+{
+    agent_stats_t st;
+    if (agent_get_stats(&st) != ESP_OK) {
+        printf("Agent not initialized.\n");
+        return 1;
+    }
+
+    printf("Turns:        %u (latency over last %d)\n", (unsigned)st.turns, st.samples);
+    printf("Latency p50:  %u ms\n", (unsigned)st.p50_ms);
+    printf("Latency p99:  %u ms\n", (unsigned)st.p99_ms);
+    printf("Latency max:  %u ms\n", (unsigned)st.max_ms);
+    printf("Active turns: %d (max %d)\n", st.active, st.max_active);
+    printf("Memory waits: %u\n", (unsigned)st.admission_waits);
+    for (int i = 0; i < MIMI_AGENT_WORKERS; i++) {
+        printf("Worker %d:     %d pending\n", i, st.pending[i]);
+    }
+    return 0;
+}
+
+/* --- llm_stats command --- */
+static int cmd_llm_stats(int argc, char **argv)
+{
+    llm_usage_stats_t st;
+    llm_get_usage_stats(&st);
+
+    printf("LLM calls:     %u\n", (unsigned)st.calls);
+    printf("Prompt cache:  %u hits / %u misses\n",
+           (unsigned)st.cache_hits, (unsigned)st.cache_misses);
+    printf("Input tokens:  %llu uncached, %llu cache read, %llu cache write\n",
+           (unsigned long long)st.input_tokens, (unsigned long long)st.cache_read_tokens,
+           (unsigned long long)st.cache_write_tokens);
+    printf("Output tokens: %llu\n", (unsigned long long)st.output_tokens);
+    uint64_t total_in = st.input_tokens + st.cache_read_tokens + st.cache_write_tokens;
+    if (total_in > 0) {
+        printf("Cached share:  %u%% of input\n",
+               (unsigned)(st.cache_read_tokens * 100 / total_in));
+    }
+    static const char *providers[LLM_PROVIDER_COUNT] = { "anthropic", "openai" };
+    for (int i = 0; i < LLM_PROVIDER_COUNT; i++) {
+        const llm_build_stats_t *b = &st.build[i];
+        if (b->requests == 0) continue;
+        printf("Build %-9s %u requests, avg %llu us, max %u us\n", providers[i],
+               (unsigned)b->requests, (unsigned long long)(b->total_us / b->requests),
+               (unsigned)b->max_us);
+    }
+    const llm_conn_stats_t *c = &st.conn;
+    printf("Connections:   %u new (%u pre-warmed), %u reused, %u stale\n",
+           (unsigned)c->handshakes, (unsigned)c->prewarmed, (unsigned)c->reused,
+           (unsigned)c->stale);
+    if (c->handshakes) {
+        printf("Handshake avg: %llu ms\n",
+               (unsigned long long)(c->handshake_us / c->handshakes / 1000));
+    }
+    if (c->responses) {
+        printf("First byte:    avg %llu ms (connect %llu ms, server %llu ms)\n",
+               (unsigned long long)(c->ttfb_us / c->responses / 1000),
+               (unsigned long long)(c->ttfb_connect_us / c->responses / 1000),
+               (unsigned long long)(c->ttfb_server_us / c->responses / 1000));
+    }
+    return 0;
+}
+
+/* --- llm_health command --- */
+static int cmd_llm_health(int argc, char **argv)
+{
+    static const char *providers[LLM_PROVIDER_COUNT] = { "anthropic", "openai" };
+    static const char *states[] = { "closed", "OPEN", "half-open" };
+    for (int i = 0; i < LLM_PROVIDER_COUNT; i++) {
+        llm_health_stats_t st;
+        llm_health_get_stats((llm_provider_t)i, &st);
+        uint32_t total = st.ok + st.failed;
+        printf("%-9s breaker %s (opened %u times)\n", providers[i], states[st.state],
+               (unsigned)st.opens);
+        printf("  Attempts:    %u ok, %u failed", (unsigned)st.ok, (unsigned)st.failed);
+        if (total) printf(" (%u%% success)", (unsigned)(st.ok * 100 / total));
+        printf("\n");
+        printf("  Retries:     %u, failovers in: %u, hedges: %u (%u won)\n",
+               (unsigned)st.retries, (unsigned)st.failovers, (unsigned)st.hedges,
+               (unsigned)st.hedge_wins);
+        if (st.samples) {
+            printf("  First byte:  p50 %u ms, p90 %u ms, p99 %u ms, max %u ms (last %d)\n",
+                   (unsigned)st.ttfb_p50_ms, (unsigned)st.ttfb_p90_ms,
+                   (unsigned)st.ttfb_p99_ms, (unsigned)st.ttfb_max_ms, st.samples);
+        }
+    }
+    return 0;
+}
+
+/* --- http_stats command --- */
+static int cmd_http_stats(int argc, char **argv)
+{
+    http_enc_stats_t st[MIMI_HTTP_ENC_ENDPOINTS];
+    int n = http_transport_get_enc_stats(st, MIMI_HTTP_ENC_ENDPOINTS);
+    if (n == 0) {
+        printf("No responses yet.\n");
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        const http_enc_stats_t *e = &st[i];
+        printf("%s\n", e->endpoint);
+        printf("  %u responses (%u compressed), %llu bytes on air, %llu decoded",
+               (unsigned)e->responses, (unsigned)e->compressed,
+               (unsigned long long)e->wire_bytes, (unsigned long long)e->body_bytes);
+        if (e->body_bytes > e->wire_bytes) {
+            printf(", %u%% saved",
+                   (unsigned)((e->body_bytes - e->wire_bytes) * 100 / e->body_bytes));
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/* --- tls_stats command --- */
+static int cmd_tls_stats(int argc, char **argv)
+{
+    tls_cache_stats_t st;
+    tls_cache_get_stats(&st);
+
+    printf("Handshakes:    %u full, %u resumed, %u failed\n",
+           (unsigned)st.full, (unsigned)st.resumed, (unsigned)st.failed);
+    if (st.full) {
+        printf("Full avg:      %llu ms\n", (unsigned long long)(st.full_us / st.full / 1000));
+    }
+    if (st.resumed) {
+        printf("Resumed avg:   %llu ms\n",
+               (unsigned long long)(st.resumed_us / st.resumed / 1000));
+    }
+    printf("Time saved:    %llu ms\n", (unsigned long long)(st.saved_us / 1000));
+    printf("Cached hosts:  %d / %d\n", st.hosts, MIMI_TLS_CACHE_HOSTS);
+    return 0;
+}
+
+/* --- context_stats command --- */
+static int cmd_context_stats(int argc, char **argv)
+{
+    static const char *names[CONTEXT_SRC_COUNT] = { "bootstrap", "skills", "memory", "notes" };
+    context_stats_t st;
+    context_get_stats(&st);
+
+    printf("Prompt builds: %u cached, %u with reloads, last %lld us\n",
+           (unsigned)st.warm_builds, (unsigned)st.cold_builds, (long long)st.last_us);
+    if (st.warm_builds) {
+        printf("Cached avg:    %lld us\n", (long long)(st.warm_us / st.warm_builds));
+    }
+    if (st.cold_builds) {
+        printf("Reload avg:    %lld us\n", (long long)(st.cold_us / st.cold_builds));
+    }
+    for (int i = 0; i < CONTEXT_SRC_COUNT; i++) {
+        printf("Section %-9s %u reloads\n", names[i], (unsigned)st.reloads[i]);
+    }
+    return 0;
+}
+
+/* --- context_reload command --- */
+static int cmd_context_reload(int argc, char **argv)
+{
+    context_invalidate(CONTEXT_SRC_COUNT);
+    printf("Prompt sections will be reloaded on the next turn.\n");
+    return 0;
+}
+
+/* --- bus_stats command --- */
+static int cmd_bus_stats(int argc, char **argv)
+{
+    static const char *lanes[MIMI_PRIO_COUNT] = { "interactive", "scheduled", "system" };
+    for (int i = 0; i < MIMI_PRIO_COUNT; i++) {
+        printf("Inbound %-12s %d queued\n", lanes[i], message_bus_inbound_depth(i));
+    }
+    printf("Inbound spilled      %d on flash\n", message_bus_spilled_count());
+
+    mimi_outbound_stats_t st[MIMI_BUS_MAX_CHANNELS];
+    int n = message_bus_get_outbound_stats(st, MIMI_BUS_MAX_CHANNELS);
+    for (int i = 0; i < n; i++) {
+        printf("Outbound %-11s %d queued (max %d), %u sent, %u dropped, latency avg %u ms / max %u ms\n",
+               st[i].channel, st[i].depth, st[i].max_depth,
+               (unsigned)st[i].delivered, (unsigned)st[i].dropped,
+               (unsigned)st[i].avg_latency_ms, (unsigned)st[i].max_latency_ms);
+    }
+    return 0;
+}
+
+/* --- proxy_stats command --- */
+static int cmd_proxy_stats(int argc, char **argv)
+{
+    if (!http_proxy_is_enabled()) {
+        printf("No proxy configured\n");
+        return 0;
+    }
+    proxy_stats_t st;
+    http_proxy_get_stats(&st);
+    printf("Tunnels:       %u opened, %u reused, %u stale, %u failed\n",
+           (unsigned)st.opened, (unsigned)st.reused, (unsigned)st.stale, (unsigned)st.failed);
+    if (st.opened) {
+        printf("Open avg:      %llu ms (TCP + CONNECT + TLS)\n",
+               (unsigned long long)(st.open_us / st.opened / 1000));
+    }
+    printf("Idle kept:     %d / %d\n", st.idle, MIMI_PROXY_TUNNEL_POOL);
     return 0;
 }
 
@@ -464,6 +732,8 @@ static int cmd_config_show(int argc, char **argv)
     print_config("API Key",    MIMI_NVS_LLM,    MIMI_NVS_KEY_API_KEY,  MIMI_SECRET_API_KEY,    true);
     print_config("Model",      MIMI_NVS_LLM,    MIMI_NVS_KEY_MODEL,    MIMI_SECRET_MODEL,      false);
     print_config("Provider",   MIMI_NVS_LLM,    MIMI_NVS_KEY_PROVIDER, MIMI_SECRET_MODEL_PROVIDER, false);
+    print_config("FB Key",     MIMI_NVS_LLM,    MIMI_NVS_KEY_FB_API_KEY, MIMI_SECRET_FALLBACK_API_KEY, true);
+    print_config("FB Model",   MIMI_NVS_LLM,    MIMI_NVS_KEY_FB_MODEL, MIMI_SECRET_FALLBACK_MODEL, false);
     print_config("Proxy Host", MIMI_NVS_PROXY,  MIMI_NVS_KEY_PROXY_HOST, MIMI_SECRET_PROXY_HOST, false);
     print_config("Proxy Port", MIMI_NVS_PROXY,  MIMI_NVS_KEY_PROXY_PORT, MIMI_SECRET_PROXY_PORT, false);
     print_config("Search Key", MIMI_NVS_SEARCH, MIMI_NVS_KEY_API_KEY,  MIMI_SECRET_SEARCH_KEY, true);
@@ -541,6 +811,9 @@ static int cmd_tool_exec(int argc, char **argv)
 static int cmd_restart(int argc, char **argv)
 {
     printf("Restarting...\n");
+    if (session_flush() != ESP_OK) {
+        printf("Some session entries could not be saved.\n");
+    }
     esp_restart();
     return 0;  /* unreachable */
 }
@@ -633,6 +906,18 @@ esp_err_t serial_cli_init(void)
     };
     esp_console_cmd_register(&provider_cmd);
 
+    /* set_fallback */
+    fallback_args.key = arg_str0(NULL, NULL, "<key>", "API key of the other provider (omit to clear)");
+    fallback_args.model = arg_str0(NULL, NULL, "<model>", "Its model (default: provider default)");
+    fallback_args.end = arg_end(2);
+    esp_console_cmd_t fallback_cmd = {
+        .command = "set_fallback",
+        .help = "Fail over to the other LLM provider with this key [and model]",
+        .func = &cmd_set_fallback,
+        .argtable = &fallback_args,
+    };
+    esp_console_cmd_register(&fallback_cmd);
+
     /* skill_list */
     esp_console_cmd_t skill_list_cmd = {
         .command = "skill_list",
@@ -701,6 +986,17 @@ esp_err_t serial_cli_init(void)
     };
     esp_console_cmd_register(&sess_clear_cmd);
 
+    /* session_compact */
+    session_compact_args.chat_id = arg_str1(NULL, NULL, "<chat_id>", "Chat ID to compact");
+    session_compact_args.end = arg_end(1);
+    esp_console_cmd_t sess_compact_cmd = {
+        .command = "session_compact",
+        .help = "Summarise a chat's older turns now (rolling summary)",
+        .func = &cmd_session_compact,
+        .argtable = &session_compact_args,
+    };
+    esp_console_cmd_register(&sess_compact_cmd);
+
     /* heap_info */
     esp_console_cmd_t heap_cmd = {
         .command = "heap_info",
@@ -709,6 +1005,70 @@ esp_err_t serial_cli_init(void)
     };
     esp_console_cmd_register(&heap_cmd);
 
+    /* agent_stats */
+    esp_console_cmd_t agent_stats_cmd = {
+        .command = "agent_stats",
+        .help = "Show agent turn latency (p50/p99) and worker load",
+        .func = &cmd_agent_stats,
+    };
+    esp_console_cmd_register(&agent_stats_cmd);
+
+    /* llm_stats */
+    esp_console_cmd_t llm_stats_cmd = {
+        .command = "llm_stats",
+        .help = "Show LLM token usage, prompt cache, request build and connection stats",
+        .func = &cmd_llm_stats,
+    };
+    esp_console_cmd_register(&llm_stats_cmd);
+
+    /* llm_health */
+    esp_console_cmd_t llm_health_cmd = {
+        .command = "llm_health",
+        .help = "Show per-provider circuit breakers, retries, failovers, hedges and latency",
+        .func = &cmd_llm_health,
+    };
+    esp_console_cmd_register(&llm_health_cmd);
+
+    /* http_stats */
+    esp_console_cmd_t http_stats_cmd = {
+        .command = "http_stats",
+        .help = "Show response bytes on air vs decoded (gzip savings) per endpoint",
+        .func = &cmd_http_stats,
+    };
+    esp_console_cmd_register(&http_stats_cmd);
+
+    /* tls_stats */
+    esp_console_cmd_t tls_stats_cmd = {
+        .command = "tls_stats",
+        .help = "Show TLS handshakes: full vs resumed and time saved",
+        .func = &cmd_tls_stats,
+    };
+    esp_console_cmd_register(&tls_stats_cmd);
+
+    /* context_stats */
+    esp_console_cmd_t context_stats_cmd = {
+        .command = "context_stats",
+        .help = "Show system prompt build times (cached vs reloaded)",
+        .func = &cmd_context_stats,
+    };
+    esp_console_cmd_register(&context_stats_cmd);
+
+    /* context_reload */
+    esp_console_cmd_t context_reload_cmd = {
+        .command = "context_reload",
+        .help = "Reload SOUL/USER/AGENTS, memory, notes and skills on the next turn",
+        .func = &cmd_context_reload,
+    };
+    esp_console_cmd_register(&context_reload_cmd);
+
+    /* bus_stats */
+    esp_console_cmd_t bus_stats_cmd = {
+        .command = "bus_stats",
+        .help = "Show inbound lane depth and per-channel outbound stats",
+        .func = &cmd_bus_stats,
+    };
+    esp_console_cmd_register(&bus_stats_cmd);
+
     /* set_search_key */
     search_key_args.key = arg_str1(NULL, NULL, "<key>", "Brave Search API key");
     search_key_args.end = arg_end(1);
@@ -732,6 +1092,14 @@ esp_err_t serial_cli_init(void)
     };
     esp_console_cmd_register(&proxy_cmd);
 
+    /* proxy_stats */
+    esp_console_cmd_t proxy_stats_cmd = {
+        .command = "proxy_stats",
+        .help = "Show CONNECT tunnels opened, reused and kept",
+        .func = &cmd_proxy_stats,
+    };
+    esp_console_cmd_register(&proxy_stats_cmd);
+
     /* clear_proxy */
     esp_console_cmd_t clear_proxy_cmd = {
         .command = "clear_proxy",
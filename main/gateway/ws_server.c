@@ -130,9 +130,9 @@ static esp_err_t ws_handler(httpd_req_t *req)
         mimi_msg_t msg = {0};
         strncpy(msg.channel, MIMI_CHAN_WEBSOCKET, sizeof(msg.channel) - 1);
         strncpy(msg.chat_id, chat_id, sizeof(msg.chat_id) - 1);
-        msg.content = strdup(content->valuestring);
-        if (msg.content) {
-            message_bus_push_inbound(&msg);
+        msg.content = msg_buf_strdup(content->valuestring);
+        if (msg.content && message_bus_push_inbound(&msg) != ESP_OK) {
+            msg_buf_release(msg.content);
         }
     }
 
@@ -189,7 +189,7 @@ static const char DASHBOARD_HTML[] =
 "const wsStatus=document.getElementById('ws-status');"
 "const statusDot=document.getElementById('status-dot');"
 "const ipInfo=document.getElementById('ip-info');"
-"let ws,typing=null;"
+"let ws,typing=null,live=null;"
 ""
 "function connect(){"
 "const host=location.host||'192.168.1.209:18789';"
@@ -212,7 +212,9 @@ static const char DASHBOARD_HTML[] =
 "ws.onerror=()=>{};"
 "ws.onmessage=(e)=>{"
 "clearTyping();"
-"try{const d=JSON.parse(e.data);if(d.content)addMsg('dot',d.content);}catch(x){addMsg('dot',e.data);}"
+"try{const d=JSON.parse(e.data);"
+"if(d.type==='delta'){addDelta(d.content||'');return;}"
+"endLive();if(d.content)addMsg('dot',d.content);}catch(x){endLive();addMsg('dot',e.data);}"
 "};"
 "}"
 ""
@@ -224,6 +226,15 @@ static const char DASHBOARD_HTML[] =
 "chat.scrollTop=chat.scrollHeight;"
 "}"
 ""
+"function addDelta(t){"
+"if(!live){live=document.createElement('div');live.className='msg dot';"
+"live.innerHTML='<div class=\"name\">DOT</div>';live.appendChild(document.createTextNode(''));chat.appendChild(live);}"
+"live.lastChild.textContent+=t;"
+"chat.scrollTop=chat.scrollHeight;"
+"}"
+""
+"function endLive(){if(live){live.remove();live=null;}}"
+""
 "function escHtml(t){const d=document.createElement('span');d.textContent=t;return d.innerHTML;}"
 ""
 "function showTyping(){"
@@ -294,7 +305,7 @@ esp_err_t ws_server_start(void)
     return ESP_OK;
 }
 
-esp_err_t ws_server_send(const char *chat_id, const char *text)
+static esp_err_t ws_send_json(const char *chat_id, const char *type, const char *text)
 {
     if (!s_server) return ESP_ERR_INVALID_STATE;
 
@@ -306,7 +317,7 @@ esp_err_t ws_server_send(const char *chat_id, const char *text)
 
     /* Build response JSON */
     cJSON *resp = cJSON_CreateObject();
-    cJSON_AddStringToObject(resp, "type", "response");
+    cJSON_AddStringToObject(resp, "type", type);
     cJSON_AddStringToObject(resp, "content", text);
     cJSON_AddStringToObject(resp, "chat_id", chat_id);
 
@@ -332,6 +343,23 @@ esp_err_t ws_server_send(const char *chat_id, const char *text)
     return ret;
 }
 
+esp_err_t ws_server_send(const char *chat_id, const char *text)
+{
+    return ws_send_json(chat_id, "response", text);
+}
+
+esp_err_t ws_server_send_delta(const char *chat_id, const char *text, size_t len)
+{
+    char *chunk = malloc(len + 1);
+    if (!chunk) return ESP_ERR_NO_MEM;
+    memcpy(chunk, text, len);
+    chunk[len] = '\0';
+
+    esp_err_t ret = ws_send_json(chat_id, "delta", chunk);
+    free(chunk);
+    return ret;
+}
+
 esp_err_t ws_server_stop(void)
 {
     if (s_server) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "esp_err.h"
+#include <stddef.h>
 
 /**
  * Initialize and start the WebSocket server on MIMI_WS_PORT.
@@ -8,7 +9,8 @@
  *
  * Protocol:
  *   Inbound:  {"type":"message","content":"hello","chat_id":"ws_client1"}
- *   Outbound: {"type":"response","content":"Hi!","chat_id":"ws_client1"}
+ *   Outbound: {"type":"delta","content":"H","chat_id":"ws_client1"}     (streamed text, optional)
+ *             {"type":"response","content":"Hi!","chat_id":"ws_client1"} (final text)
  */
 esp_err_t ws_server_start(void);
 
@@ -19,6 +21,15 @@ esp_err_t ws_server_start(void);
  */
 esp_err_t ws_server_send(const char *chat_id, const char *text);
 
+/**
+ * Send a partial text delta of a response that is still being generated.
+ * The final "response" message follows and carries the complete text.
+ * @param chat_id  Client identifier
+ * @param text     Delta text (need not be NUL-terminated)
+ * @param len      Delta length in bytes
+ */
+esp_err_t ws_server_send_delta(const char *chat_id, const char *text, size_t len);
+
 /**
  * Stop the WebSocket server.
  */
@@ -0,0 +1,412 @@
+#include "llm_conv.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "llm_conv";
+
+/* ── OpenAI: one Anthropic-shaped message → native messages ───── */
+
+static void append_text(char **buf, size_t *off, const char *text)
+{
+    size_t tlen = strlen(text);
+    char *tmp = realloc(*buf, *off + tlen + 1);
+    if (!tmp) return;
+    *buf = tmp;
+    memcpy(*buf + *off, text, tlen);
+    *off += tlen;
+    (*buf)[*off] = '\0';
+}
+
+static bool block_is(const cJSON *block, const char *type)
+{
+    const char *t = cJSON_GetStringValue(cJSON_GetObjectItem(block, "type"));
+    return t && strcmp(t, type) == 0;
+}
+
+static cJSON *openai_tool_call(const char *id, const char *name, const char *args)
+{
+    cJSON *tc = cJSON_CreateObject();
+    if (id) cJSON_AddStringToObject(tc, "id", id);
+    cJSON_AddStringToObject(tc, "type", "function");
+    cJSON *func = cJSON_CreateObject();
+    cJSON_AddStringToObject(func, "name", name);
+    cJSON_AddStringToObject(func, "arguments", args);
+    cJSON_AddItemToObject(tc, "function", func);
+    return tc;
+}
+
+static void openai_assistant(cJSON *out, const cJSON *content)
+{
+    cJSON *m = cJSON_CreateObject();
+    cJSON_AddStringToObject(m, "role", "assistant");
+
+    char *text_buf = NULL;
+    size_t off = 0;
+    cJSON *tool_calls = NULL;
+    const cJSON *block;
+    cJSON_ArrayForEach(block, content) {
+        if (block_is(block, "text")) {
+            const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(block, "text"));
+            if (text) append_text(&text_buf, &off, text);
+        } else if (block_is(block, "tool_use")) {
+            const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(block, "name"));
+            if (!name) continue;
+            cJSON *input = cJSON_GetObjectItem(block, "input");
+            char *args = input ? cJSON_PrintUnformatted(input) : NULL;
+            if (!tool_calls) tool_calls = cJSON_CreateArray();
+            cJSON_AddItemToArray(tool_calls, openai_tool_call(
+                cJSON_GetStringValue(cJSON_GetObjectItem(block, "id")), name, args ? args : "{}"));
+            free(args);
+        }
+    }
+    cJSON_AddStringToObject(m, "content", text_buf ? text_buf : "");
+    if (tool_calls) cJSON_AddItemToObject(m, "tool_calls", tool_calls);
+    cJSON_AddItemToArray(out, m);
+    free(text_buf);
+}
+
+/* tool_result blocks become role=tool messages, text blocks one user message */
+static void openai_user(cJSON *out, const cJSON *content)
+{
+    char *text_buf = NULL;
+    size_t off = 0;
+    const cJSON *block;
+    cJSON_ArrayForEach(block, content) {
+        if (block_is(block, "tool_result")) {
+            const char *tool_id = cJSON_GetStringValue(cJSON_GetObjectItem(block, "tool_use_id"));
+            const char *tcontent = cJSON_GetStringValue(cJSON_GetObjectItem(block, "content"));
+            if (!tool_id) continue;
+            cJSON *tm = cJSON_CreateObject();
+            cJSON_AddStringToObject(tm, "role", "tool");
+            cJSON_AddStringToObject(tm, "tool_call_id", tool_id);
+            cJSON_AddStringToObject(tm, "content", tcontent ? tcontent : "");
+            cJSON_AddItemToArray(out, tm);
+        } else if (block_is(block, "text")) {
+            const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(block, "text"));
+            if (text) append_text(&text_buf, &off, text);
+        }
+    }
+    if (text_buf) {
+        cJSON *um = cJSON_CreateObject();
+        cJSON_AddStringToObject(um, "role", "user");
+        cJSON_AddStringToObject(um, "content", text_buf);
+        cJSON_AddItemToArray(out, um);
+    }
+    free(text_buf);
+}
+
+/* Consumes msg: string content is already valid OpenAI and is moved as-is */
+static void openai_append(cJSON *out, cJSON *msg)
+{
+    const char *role = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "role"));
+    cJSON *content = cJSON_GetObjectItem(msg, "content");
+
+    if (role && cJSON_IsString(content)) {
+        cJSON_AddItemToArray(out, msg);
+        return;
+    }
+    if (role && cJSON_IsArray(content)) {
+        if (strcmp(role, "assistant") == 0) {
+            openai_assistant(out, content);
+        } else if (strcmp(role, "user") == 0) {
+            openai_user(out, content);
+        }
+    }
+    cJSON_Delete(msg);
+}
+
+/* ── Anthropic: native OpenAI messages → content blocks ─────── */
+
+static void anthropic_assistant(cJSON *out, const cJSON *msg)
+{
+    cJSON *content = cJSON_CreateArray();
+    const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "content"));
+    if (text && text[0]) {
+        cJSON *text_block = cJSON_CreateObject();
+        cJSON_AddStringToObject(text_block, "type", "text");
+        cJSON_AddStringToObject(text_block, "text", text);
+        cJSON_AddItemToArray(content, text_block);
+    }
+
+    const cJSON *tc;
+    cJSON_ArrayForEach(tc, cJSON_GetObjectItem(msg, "tool_calls")) {
+        cJSON *func = cJSON_GetObjectItem(tc, "function");
+        const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(func, "name"));
+        if (!name) continue;
+        const char *args = cJSON_GetStringValue(cJSON_GetObjectItem(func, "arguments"));
+        cJSON *input = args ? cJSON_Parse(args) : NULL;
+
+        cJSON *tool_block = cJSON_CreateObject();
+        cJSON_AddStringToObject(tool_block, "type", "tool_use");
+        const char *id = cJSON_GetStringValue(cJSON_GetObjectItem(tc, "id"));
+        cJSON_AddStringToObject(tool_block, "id", id ? id : "");
+        cJSON_AddStringToObject(tool_block, "name", name);
+        cJSON_AddItemToObject(tool_block, "input", input ? input : cJSON_CreateObject());
+        cJSON_AddItemToArray(content, tool_block);
+    }
+
+    /* Anthropic rejects empty assistant turns */
+    if (!content->child) {
+        cJSON_Delete(content);
+        return;
+    }
+    cJSON *m = cJSON_CreateObject();
+    cJSON_AddStringToObject(m, "role", "assistant");
+    cJSON_AddItemToObject(m, "content", content);
+    cJSON_AddItemToArray(out, m);
+}
+
+/* Consecutive role=tool messages become one user turn of tool_result blocks */
+static void anthropic_tool_result(cJSON *out, const cJSON *msg)
+{
+    const char *tool_id = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "tool_call_id"));
+    const char *tcontent = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "content"));
+    if (!tool_id) return;
+
+    cJSON *block = cJSON_CreateObject();
+    cJSON_AddStringToObject(block, "type", "tool_result");
+    cJSON_AddStringToObject(block, "tool_use_id", tool_id);
+    cJSON_AddStringToObject(block, "content", tcontent ? tcontent : "");
+
+    cJSON *last = cJSON_GetArrayItem(out, cJSON_GetArraySize(out) - 1);
+    cJSON *last_content = cJSON_GetObjectItem(last, "content");
+    if (cJSON_IsArray(last_content) && block_is(last_content->child, "tool_result")) {
+        cJSON_AddItemToArray(last_content, block);
+        return;
+    }
+    cJSON *um = cJSON_CreateObject();
+    cJSON_AddStringToObject(um, "role", "user");
+    cJSON *content = cJSON_AddArrayToObject(um, "content");
+    cJSON_AddItemToArray(content, block);
+    cJSON_AddItemToArray(out, um);
+}
+
+/* Consumes msg */
+static void anthropic_append(cJSON *out, cJSON *msg)
+{
+    const char *role = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "role"));
+    if (role && strcmp(role, "tool") == 0) {
+        anthropic_tool_result(out, msg);
+    } else if (role && strcmp(role, "assistant") == 0) {
+        anthropic_assistant(out, msg);
+    } else if (role) {
+        cJSON_AddItemToArray(out, msg);
+        return;
+    }
+    cJSON_Delete(msg);
+}
+
+/* ── Conversation ─────────────────────────────────────────────── */
+
+esp_err_t llm_conv_init(llm_conv_t *conv, llm_provider_t provider, cJSON *history)
+{
+    int64_t start_us = esp_timer_get_time();
+    conv->provider = provider;
+    conv->build_us = 0;
+
+    if (!cJSON_IsArray(history)) {
+        cJSON_Delete(history);
+        history = NULL;
+    }
+
+    if (provider == LLM_PROVIDER_ANTHROPIC || !history) {
+        conv->messages = history ? history : cJSON_CreateArray();
+    } else {
+        conv->messages = cJSON_CreateArray();
+        while (conv->messages && history->child) {
+            openai_append(conv->messages, cJSON_DetachItemFromArray(history, 0));
+        }
+        cJSON_Delete(history);
+    }
+
+    conv->build_us = esp_timer_get_time() - start_us;
+    return conv->messages ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void llm_conv_free(llm_conv_t *conv)
+{
+    cJSON_Delete(conv->messages);
+    conv->messages = NULL;
+}
+
+esp_err_t llm_conv_add_user(llm_conv_t *conv, const char *text)
+{
+    cJSON *msg = cJSON_CreateObject();
+    if (!msg) return ESP_ERR_NO_MEM;
+    cJSON_AddStringToObject(msg, "role", "user");
+    cJSON_AddStringToObject(msg, "content", text);
+    cJSON_AddItemToArray(conv->messages, msg);
+    return ESP_OK;
+}
+
+/* Anthropic: text and tool_use blocks; tool input is stored as a tree */
+static cJSON *anthropic_assistant_content(const llm_response_t *resp)
+{
+    cJSON *content = cJSON_CreateArray();
+
+    if (resp->text && resp->text_len > 0) {
+        cJSON *text_block = cJSON_CreateObject();
+        cJSON_AddStringToObject(text_block, "type", "text");
+        cJSON_AddStringToObject(text_block, "text", resp->text);
+        cJSON_AddItemToArray(content, text_block);
+    }
+
+    for (int i = 0; i < resp->call_count; i++) {
+        const llm_tool_call_t *call = &resp->calls[i];
+        cJSON *tool_block = cJSON_CreateObject();
+        cJSON_AddStringToObject(tool_block, "type", "tool_use");
+        cJSON_AddStringToObject(tool_block, "id", call->id);
+        cJSON_AddStringToObject(tool_block, "name", call->name);
+
+        cJSON *input = call->input ? cJSON_Parse(call->input) : NULL;
+        cJSON_AddItemToObject(tool_block, "input", input ? input : cJSON_CreateObject());
+        cJSON_AddItemToArray(content, tool_block);
+    }
+    return content;
+}
+
+esp_err_t llm_conv_add_assistant(llm_conv_t *conv, const llm_response_t *resp)
+{
+    int64_t start_us = esp_timer_get_time();
+    cJSON *msg = cJSON_CreateObject();
+    if (!msg) return ESP_ERR_NO_MEM;
+    cJSON_AddStringToObject(msg, "role", "assistant");
+
+    if (conv->provider == LLM_PROVIDER_ANTHROPIC) {
+        cJSON_AddItemToObject(msg, "content", anthropic_assistant_content(resp));
+    } else {
+        /* Arguments go back exactly as the model sent them */
+        cJSON_AddStringToObject(msg, "content", resp->text ? resp->text : "");
+        if (resp->call_count > 0) {
+            cJSON *tool_calls = cJSON_AddArrayToObject(msg, "tool_calls");
+            for (int i = 0; i < resp->call_count; i++) {
+                const llm_tool_call_t *call = &resp->calls[i];
+                cJSON_AddItemToArray(tool_calls, openai_tool_call(
+                    call->id, call->name, call->input ? call->input : "{}"));
+            }
+        }
+    }
+    cJSON_AddItemToArray(conv->messages, msg);
+
+    conv->build_us += esp_timer_get_time() - start_us;
+    return ESP_OK;
+}
+
+esp_err_t llm_conv_add_tool_results(llm_conv_t *conv, cJSON *results)
+{
+    int64_t start_us = esp_timer_get_time();
+    cJSON *msg = cJSON_CreateObject();
+    if (!msg) {
+        cJSON_Delete(results);
+        return ESP_ERR_NO_MEM;
+    }
+    cJSON_AddStringToObject(msg, "role", "user");
+    cJSON_AddItemToObject(msg, "content", results);
+
+    if (conv->provider == LLM_PROVIDER_ANTHROPIC) {
+        cJSON_AddItemToArray(conv->messages, msg);
+    } else {
+        openai_append(conv->messages, msg);
+    }
+
+    conv->build_us += esp_timer_get_time() - start_us;
+    return ESP_OK;
+}
+
+esp_err_t llm_conv_convert(const llm_conv_t *conv, llm_provider_t provider, llm_conv_t *out)
+{
+    int64_t start_us = esp_timer_get_time();
+    cJSON *copy = cJSON_Duplicate(conv->messages, 1);
+    if (!copy) return ESP_ERR_NO_MEM;
+
+    out->provider = provider;
+    if (provider == conv->provider) {
+        out->messages = copy;
+    } else if (conv->provider == LLM_PROVIDER_ANTHROPIC) {
+        /* The shape llm_conv_init() converts from */
+        esp_err_t err = llm_conv_init(out, provider, copy);
+        if (err != ESP_OK) return err;
+    } else {
+        out->messages = cJSON_CreateArray();
+        while (out->messages && copy->child) {
+            anthropic_append(out->messages, cJSON_DetachItemFromArray(copy, 0));
+        }
+        cJSON_Delete(copy);
+        if (!out->messages) return ESP_ERR_NO_MEM;
+    }
+    out->build_us = esp_timer_get_time() - start_us;
+    return ESP_OK;
+}
+
+/* ── Tools ────────────────────────────────────────────────────── */
+
+static const char *s_tools_src;     /* string the cached conversion was built from */
+static char *s_tools_openai;
+static portMUX_TYPE s_tools_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static char *convert_tools_openai(const char *tools_json)
+{
+    cJSON *arr = cJSON_Parse(tools_json);
+    if (!arr || !cJSON_IsArray(arr)) {
+        cJSON_Delete(arr);
+        return NULL;
+    }
+    cJSON *out = cJSON_CreateArray();
+    cJSON *tool;
+    cJSON_ArrayForEach(tool, arr) {
+        cJSON *name = cJSON_GetObjectItem(tool, "name");
+        cJSON *desc = cJSON_GetObjectItem(tool, "description");
+        cJSON *schema = cJSON_GetObjectItem(tool, "input_schema");
+        if (!name || !cJSON_IsString(name)) continue;
+
+        cJSON *func = cJSON_CreateObject();
+        cJSON_AddStringToObject(func, "name", name->valuestring);
+        if (desc && cJSON_IsString(desc)) {
+            cJSON_AddStringToObject(func, "description", desc->valuestring);
+        }
+        if (schema) {
+            cJSON_AddItemToObject(func, "parameters", cJSON_Duplicate(schema, 1));
+        }
+
+        cJSON *wrap = cJSON_CreateObject();
+        cJSON_AddStringToObject(wrap, "type", "function");
+        cJSON_AddItemToObject(wrap, "function", func);
+        cJSON_AddItemToArray(out, wrap);
+    }
+    cJSON_Delete(arr);
+
+    char *json = cJSON_PrintUnformatted(out);
+    cJSON_Delete(out);
+    return json;
+}
+
+const char *llm_conv_tools(llm_provider_t provider, const char *tools_json, char **owned)
+{
+    *owned = NULL;
+    if (!tools_json || provider == LLM_PROVIDER_ANTHROPIC) return tools_json;
+
+    portENTER_CRITICAL(&s_tools_mux);
+    const char *cached = (s_tools_src == tools_json) ? s_tools_openai : NULL;
+    bool claimed = (s_tools_src == NULL);
+    if (claimed) s_tools_src = tools_json;
+    portEXIT_CRITICAL(&s_tools_mux);
+    if (cached) return cached;
+
+    char *json = convert_tools_openai(tools_json);
+    if (!json) return NULL;
+
+    if (claimed) {
+        /* Built once; concurrent first callers use their own copy */
+        portENTER_CRITICAL(&s_tools_mux);
+        s_tools_openai = json;
+        portEXIT_CRITICAL(&s_tools_mux);
+        ESP_LOGI(TAG, "OpenAI tools converted once (%d bytes)", (int)strlen(json));
+        return json;
+    }
+    *owned = json;
+    return json;
+}
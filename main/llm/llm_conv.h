@@ -0,0 +1,57 @@
+#pragma once
+
+#include "esp_err.h"
+#include "llm/llm_proxy.h"
+#include "cJSON.h"
+#include <stdint.h>
+
+/**
+ * Conversation history in the provider's native message shape.
+ *
+ * The history is converted once when the conversation is created; every
+ * later append (user text, assistant reply, tool results) is stored
+ * directly in the target shape, so the per-call conversion cost is
+ * proportional to what was added since the previous call. Anthropic
+ * history is kept as-is. For OpenAI, tool calls keep their raw argument
+ * strings and tool results become role=tool messages.
+ */
+
+struct llm_conv {
+    llm_provider_t provider;    /* shape of messages */
+    cJSON *messages;            /* owned; array in the provider's format */
+    int64_t build_us;           /* conversion time since the last request */
+};
+
+/**
+ * Take ownership of an Anthropic-shaped message array (as returned by
+ * session_get_history()) and convert it for provider. NULL starts empty.
+ */
+esp_err_t llm_conv_init(llm_conv_t *conv, llm_provider_t provider, cJSON *history);
+
+void llm_conv_free(llm_conv_t *conv);
+
+esp_err_t llm_conv_add_user(llm_conv_t *conv, const char *text);
+
+/** Append the assistant turn of resp: its text and tool calls. */
+esp_err_t llm_conv_add_assistant(llm_conv_t *conv, const llm_response_t *resp);
+
+/**
+ * Append tool results, given as an Anthropic tool_result content array
+ * (tool_batch_results()). Takes ownership of results.
+ */
+esp_err_t llm_conv_add_tool_results(llm_conv_t *conv, cJSON *results);
+
+/**
+ * Copy of conv converted to another provider's shape, for a call that
+ * fails over to that provider. The conversation itself is unchanged;
+ * out is freed with llm_conv_free().
+ */
+esp_err_t llm_conv_convert(const llm_conv_t *conv, llm_provider_t provider, llm_conv_t *out);
+
+/**
+ * Tools array for the provider. Anthropic uses tools_json as-is. For
+ * OpenAI the first string seen (the registry's, which never changes) is
+ * converted once and cached; any other string is converted into *owned,
+ * which the caller frees.
+ */
+const char *llm_conv_tools(llm_provider_t provider, const char *tools_json, char **owned);
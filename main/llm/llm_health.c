@@ -0,0 +1,136 @@
+#include "llm_health.h"
+#include "mimi_config.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "llm_health";
+
+typedef struct {
+    int fails;                  /* failed attempts in a row */
+    int64_t open_until_us;      /* 0 = closed */
+    bool probing;               /* half-open and the probe is out */
+    llm_health_stats_t stats;
+    uint32_t ttfb_ms[MIMI_LLM_LATENCY_SAMPLES];     /* ring of recent successes */
+    int ttfb_next;
+} provider_health_t;
+
+static provider_health_t s_health[LLM_PROVIDER_COUNT];
+static portMUX_TYPE s_health_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *provider_name(llm_provider_t provider)
+{
+    return provider == LLM_PROVIDER_OPENAI ? "openai" : "anthropic";
+}
+
+bool llm_health_allow(llm_provider_t provider, bool *probe)
+{
+    provider_health_t *h = &s_health[provider];
+    int64_t now_us = esp_timer_get_time();
+    bool allow = true;
+
+    *probe = false;
+    portENTER_CRITICAL(&s_health_mux);
+    if (h->open_until_us && now_us < h->open_until_us) {
+        allow = false;
+    } else if (h->open_until_us) {
+        /* Half-open: one attempt at a time finds out */
+        allow = !h->probing;
+        *probe = allow;
+        h->probing = true;
+    }
+    portEXIT_CRITICAL(&s_health_mux);
+    return allow;
+}
+
+void llm_health_record(llm_provider_t provider, bool probe, llm_outcome_t outcome,
+                       int64_t first_byte_us)
+{
+    provider_health_t *h = &s_health[provider];
+    bool opened = false, closed = false;
+    int fails;
+
+    portENTER_CRITICAL(&s_health_mux);
+    /* Attempts let through before the breaker opened say nothing of the probe */
+    if (probe) h->probing = false;
+    if (outcome == LLM_OUTCOME_OK) {
+        closed = h->open_until_us != 0;
+        h->fails = 0;
+        h->open_until_us = 0;
+        h->stats.ok++;
+        if (first_byte_us > 0) {
+            h->ttfb_ms[h->ttfb_next] = (uint32_t)(first_byte_us / 1000);
+            h->ttfb_next = (h->ttfb_next + 1) % MIMI_LLM_LATENCY_SAMPLES;
+            if (h->stats.samples < MIMI_LLM_LATENCY_SAMPLES) h->stats.samples++;
+        }
+    } else if (outcome == LLM_OUTCOME_FAILED) {
+        h->stats.failed++;
+        h->fails++;
+        bool trip = h->open_until_us ? probe : h->fails >= MIMI_LLM_BREAKER_FAILS;
+        if (trip) {
+            h->open_until_us = esp_timer_get_time() + MIMI_LLM_BREAKER_OPEN_MS * 1000LL;
+            h->stats.opens++;
+            opened = true;
+        }
+    }
+    fails = h->fails;
+    portEXIT_CRITICAL(&s_health_mux);
+
+    if (opened) {
+        ESP_LOGW(TAG, "%s: %d failures in a row, skipping it for %d s",
+                 provider_name(provider), fails, MIMI_LLM_BREAKER_OPEN_MS / 1000);
+    } else if (closed) {
+        ESP_LOGI(TAG, "%s: probe succeeded, back in use", provider_name(provider));
+    }
+}
+
+void llm_health_note(llm_provider_t provider, llm_note_t note)
+{
+    llm_health_stats_t *st = &s_health[provider].stats;
+    portENTER_CRITICAL(&s_health_mux);
+    switch (note) {
+    case LLM_NOTE_RETRY:     st->retries++; break;
+    case LLM_NOTE_FAILOVER:  st->failovers++; break;
+    case LLM_NOTE_HEDGE:     st->hedges++; break;
+    case LLM_NOTE_HEDGE_WIN: st->hedge_wins++; break;
+    }
+    portEXIT_CRITICAL(&s_health_mux);
+}
+
+static uint32_t percentile(const uint32_t *sorted, int n, int pct)
+{
+    int i = (n * pct + 99) / 100 - 1;
+    return sorted[i < 0 ? 0 : i];
+}
+
+void llm_health_get_stats(llm_provider_t provider, llm_health_stats_t *out)
+{
+    provider_health_t *h = &s_health[provider];
+    uint32_t ms[MIMI_LLM_LATENCY_SAMPLES];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_health_mux);
+    *out = h->stats;
+    memcpy(ms, h->ttfb_ms, sizeof(ms));
+    if (!h->open_until_us) {
+        out->state = LLM_BREAKER_CLOSED;
+    } else {
+        out->state = now_us < h->open_until_us ? LLM_BREAKER_OPEN : LLM_BREAKER_HALF_OPEN;
+    }
+    portEXIT_CRITICAL(&s_health_mux);
+
+    int n = out->samples;
+    if (n == 0) return;
+    for (int i = 1; i < n; i++) {
+        uint32_t v = ms[i];
+        int j = i;
+        for (; j > 0 && ms[j - 1] > v; j--) ms[j] = ms[j - 1];
+        ms[j] = v;
+    }
+    out->ttfb_p50_ms = percentile(ms, n, 50);
+    out->ttfb_p90_ms = percentile(ms, n, 90);
+    out->ttfb_p99_ms = percentile(ms, n, 99);
+    out->ttfb_max_ms = ms[n - 1];
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "esp_err.h"
+#include "llm/llm_proxy.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Per-provider circuit breakers and call outcome stats.
+ *
+ * MIMI_LLM_BREAKER_FAILS failed attempts in a row open a provider's
+ * breaker: calls skip it (failing over, or failing fast) for
+ * MIMI_LLM_BREAKER_OPEN_MS. Then one attempt is let through as a probe;
+ * its success closes the breaker, its failure opens it again.
+ */
+
+typedef enum {
+    LLM_OUTCOME_OK = 0,
+    LLM_OUTCOME_FAILED,     /* the provider failed: counts against its breaker */
+    LLM_OUTCOME_NEUTRAL,    /* rejected request or abandoned hedge: not held against it */
+} llm_outcome_t;
+
+typedef enum {
+    LLM_NOTE_RETRY = 0,     /* attempt repeated on the same provider */
+    LLM_NOTE_FAILOVER,      /* attempt moved here from the other provider */
+    LLM_NOTE_HEDGE,         /* duplicate attempt sent here by a slow call */
+    LLM_NOTE_HEDGE_WIN,     /* ... and answered first */
+} llm_note_t;
+
+typedef enum {
+    LLM_BREAKER_CLOSED = 0,
+    LLM_BREAKER_OPEN,
+    LLM_BREAKER_HALF_OPEN,  /* open time over, next attempt probes */
+} llm_breaker_state_t;
+
+typedef struct {
+    uint32_t ok;                /* attempts answered */
+    uint32_t failed;            /* attempts the provider failed (not rejected requests) */
+    uint32_t retries;
+    uint32_t failovers;
+    uint32_t hedges;
+    uint32_t hedge_wins;
+    uint32_t opens;             /* times the breaker opened */
+    llm_breaker_state_t state;
+    int samples;                /* successful attempts behind the percentiles */
+    uint32_t ttfb_p50_ms;       /* time to first byte of recent successes */
+    uint32_t ttfb_p90_ms;
+    uint32_t ttfb_p99_ms;
+    uint32_t ttfb_max_ms;
+} llm_health_stats_t;
+
+/**
+ * May an attempt go to provider now? The first attempt after the open
+ * time claims the probe of the half-open breaker: *probe is set for it
+ * and only for it. Every true must be followed by llm_health_record().
+ */
+bool llm_health_allow(llm_provider_t provider, bool *probe);
+
+/**
+ * Record an attempt allowed by llm_health_allow(), passing back its
+ * probe. Only the probe's outcome settles a half-open breaker; a NEUTRAL
+ * one lets the next attempt probe instead.
+ */
+void llm_health_record(llm_provider_t provider, bool probe, llm_outcome_t outcome,
+                       int64_t first_byte_us);
+
+void llm_health_note(llm_provider_t provider, llm_note_t note);
+
+void llm_health_get_stats(llm_provider_t provider, llm_health_stats_t *out);
@@ -0,0 +1,183 @@
+#include "llm_json.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static void flush(llm_json_writer_t *w)
+{
+    if (w->used == 0 || w->err != ESP_OK) return;
+    if (w->sink) {
+        w->err = w->sink(w->buf, w->used, w->ctx);
+    }
+    w->used = 0;
+}
+
+void llm_json_init(llm_json_writer_t *w, llm_json_sink_t sink, void *ctx)
+{
+    w->sink = sink;
+    w->ctx = ctx;
+    w->total = 0;
+    w->used = 0;
+    w->err = ESP_OK;
+}
+
+void llm_json_raw(llm_json_writer_t *w, const char *data, size_t len)
+{
+    if (w->err != ESP_OK) return;
+    w->total += len;
+    if (!w->sink) return;
+
+    while (len > 0) {
+        size_t room = sizeof(w->buf) - w->used;
+        size_t n = len < room ? len : room;
+        memcpy(w->buf + w->used, data, n);
+        w->used += n;
+        data += n;
+        len -= n;
+        if (w->used == sizeof(w->buf)) {
+            flush(w);
+            if (w->err != ESP_OK) return;
+        }
+    }
+}
+
+void llm_json_lit(llm_json_writer_t *w, const char *lit)
+{
+    llm_json_raw(w, lit, strlen(lit));
+}
+
+void llm_json_string_n(llm_json_writer_t *w, const char *str, size_t len)
+{
+    llm_json_raw(w, "\"", 1);
+
+    /* Copy runs of plain bytes in one go, escape the rest */
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+        const char *esc = NULL;
+        char ubuf[8];
+        switch (c) {
+        case '"':  esc = "\\\""; break;
+        case '\\': esc = "\\\\"; break;
+        case '\b': esc = "\\b"; break;
+        case '\f': esc = "\\f"; break;
+        case '\n': esc = "\\n"; break;
+        case '\r': esc = "\\r"; break;
+        case '\t': esc = "\\t"; break;
+        default:
+            if (c < 0x20) {
+                snprintf(ubuf, sizeof(ubuf), "\\u%04x", c);
+                esc = ubuf;
+            }
+            break;
+        }
+        if (!esc) continue;
+
+        llm_json_raw(w, str + run, i - run);
+        llm_json_lit(w, esc);
+        run = i + 1;
+    }
+    llm_json_raw(w, str + run, len - run);
+
+    llm_json_raw(w, "\"", 1);
+}
+
+void llm_json_string(llm_json_writer_t *w, const char *str)
+{
+    llm_json_string_n(w, str ? str : "", str ? strlen(str) : 0);
+}
+
+void llm_json_key(llm_json_writer_t *w, const char *key)
+{
+    llm_json_string(w, key);
+    llm_json_raw(w, ":", 1);
+}
+
+void llm_json_int(llm_json_writer_t *w, int value)
+{
+    char num[16];
+    int n = snprintf(num, sizeof(num), "%d", value);
+    llm_json_raw(w, num, n);
+}
+
+static void write_number(llm_json_writer_t *w, const cJSON *item)
+{
+    double d = item->valuedouble;
+    char num[32];
+    int n;
+
+    /* Same formatting as cJSON's printer */
+    if (isnan(d) || isinf(d)) {
+        n = snprintf(num, sizeof(num), "null");
+    } else if (d == (double)item->valueint) {
+        n = snprintf(num, sizeof(num), "%d", item->valueint);
+    } else {
+        n = snprintf(num, sizeof(num), "%1.15g", d);
+        double back = 0;
+        if (sscanf(num, "%lg", &back) != 1 || back != d) {
+            n = snprintf(num, sizeof(num), "%1.17g", d);
+        }
+    }
+    llm_json_raw(w, num, n);
+}
+
+void llm_json_members(llm_json_writer_t *w, const cJSON *object)
+{
+    for (const cJSON *child = object->child; child; child = child->next) {
+        if (child != object->child) llm_json_raw(w, ",", 1);
+        llm_json_key(w, child->string ? child->string : "");
+        llm_json_item(w, child);
+    }
+}
+
+void llm_json_item(llm_json_writer_t *w, const cJSON *item)
+{
+    if (!item) {
+        llm_json_lit(w, "null");
+        return;
+    }
+
+    switch (item->type & 0xFF) {
+    case cJSON_False:
+        llm_json_lit(w, "false");
+        break;
+    case cJSON_True:
+        llm_json_lit(w, "true");
+        break;
+    case cJSON_NULL:
+        llm_json_lit(w, "null");
+        break;
+    case cJSON_Number:
+        write_number(w, item);
+        break;
+    case cJSON_String:
+        llm_json_string(w, item->valuestring);
+        break;
+    case cJSON_Raw:
+        if (item->valuestring) llm_json_lit(w, item->valuestring);
+        break;
+    case cJSON_Array:
+        llm_json_raw(w, "[", 1);
+        for (const cJSON *child = item->child; child; child = child->next) {
+            if (child != item->child) llm_json_raw(w, ",", 1);
+            llm_json_item(w, child);
+        }
+        llm_json_raw(w, "]", 1);
+        break;
+    case cJSON_Object:
+        llm_json_raw(w, "{", 1);
+        llm_json_members(w, item);
+        llm_json_raw(w, "}", 1);
+        break;
+    default:
+        llm_json_lit(w, "null");
+        break;
+    }
+}
+
+esp_err_t llm_json_finish(llm_json_writer_t *w)
+{
+    flush(w);
+    return w->err;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "esp_err.h"
+#include "cJSON.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Streaming JSON writer for request bodies.
+ *
+ * Output goes through a small fixed buffer to a sink, so a request can be
+ * serialised straight from the caller's cJSON trees and strings into the
+ * connection without building the body in memory. With a NULL sink the
+ * writer only counts bytes: run the same write sequence twice, once to get
+ * the Content-Length and once to send.
+ *
+ * Errors are sticky: after a sink failure every call is a no-op and
+ * llm_json_finish() returns the error.
+ */
+
+#define LLM_JSON_BUF_SIZE 1024
+
+/** Receives buffered output; returns ESP_OK or an error to abort the write. */
+typedef esp_err_t (*llm_json_sink_t)(const char *data, size_t len, void *ctx);
+
+typedef struct {
+    llm_json_sink_t sink;   /* NULL = count only */
+    void *ctx;
+    size_t total;           /* bytes written so far */
+    size_t used;            /* bytes pending in buf */
+    esp_err_t err;
+    char buf[LLM_JSON_BUF_SIZE];
+} llm_json_writer_t;
+
+void llm_json_init(llm_json_writer_t *w, llm_json_sink_t sink, void *ctx);
+
+/** Append bytes verbatim (must already be valid JSON in context). */
+void llm_json_raw(llm_json_writer_t *w, const char *data, size_t len);
+
+/** Append a NUL-terminated literal verbatim, e.g. "{" or ",". */
+void llm_json_lit(llm_json_writer_t *w, const char *lit);
+
+/** Append a quoted, escaped string of len bytes. */
+void llm_json_string_n(llm_json_writer_t *w, const char *str, size_t len);
+
+/** Append a quoted, escaped NUL-terminated string. */
+void llm_json_string(llm_json_writer_t *w, const char *str);
+
+/** Append "key": */
+void llm_json_key(llm_json_writer_t *w, const char *key);
+
+void llm_json_int(llm_json_writer_t *w, int value);
+
+/** Serialise a cJSON value, compact, as cJSON_PrintUnformatted() would. */
+void llm_json_item(llm_json_writer_t *w, const cJSON *item);
+
+/**
+ * Serialise the members of a cJSON object without the surrounding braces,
+ * so the caller can add members of its own before closing it.
+ */
+void llm_json_members(llm_json_writer_t *w, const cJSON *object);
+
+/**
+ * Flush pending output.
+ * @return ESP_OK, or the first error returned by the sink
+ */
+esp_err_t llm_json_finish(llm_json_writer_t *w);
@@ -1,13 +1,24 @@
 #include "llm_proxy.h"
 #include "mimi_config.h"
+#include "llm/llm_sse.h"
+#include "llm/llm_json.h"
+#include "llm/llm_sax.h"
+#include "llm/llm_conv.h"
+#include "llm/llm_health.h"
 #include "proxy/http_proxy.h"
+#include "net/http_transport.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
 #include "esp_log.h"
 #include "esp_http_client.h"
-#include "esp_crt_bundle.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "nvs.h"
 #include "cJSON.h"
 
@@ -19,6 +30,8 @@ static const char *TAG = "llm";
 static char s_api_key[LLM_API_KEY_MAX_LEN] = {0};
 static char s_model[LLM_MODEL_MAX_LEN] = MIMI_LLM_DEFAULT_MODEL;
 static char s_provider[16] = MIMI_LLM_PROVIDER_DEFAULT;
+static char s_fb_api_key[LLM_API_KEY_MAX_LEN] = {0};    /* the other provider's */
+static char s_fb_model[LLM_MODEL_MAX_LEN] = {0};
 
 static void safe_copy(char *dst, size_t dst_size, const char *src)
 {
@@ -32,77 +45,83 @@ static void safe_copy(char *dst, size_t dst_size, const char *src)
     dst[n] = '\0';
 }
 
-/* ── Response buffer ──────────────────────────────────────────── */
-
-typedef struct {
-    char *data;
-    size_t len;
-    size_t cap;
-} resp_buf_t;
+/* ── Provider helpers ──────────────────────────────────────────── */
 
-static esp_err_t resp_buf_init(resp_buf_t *rb, size_t initial_cap)
+static bool provider_is_openai(void)
 {
-    rb->data = heap_caps_calloc(1, initial_cap, MALLOC_CAP_SPIRAM);
-    if (!rb->data) return ESP_ERR_NO_MEM;
-    rb->len = 0;
-    rb->cap = initial_cap;
-    return ESP_OK;
+    return strcmp(s_provider, "openai") == 0;
 }
 
-static esp_err_t resp_buf_append(resp_buf_t *rb, const char *data, size_t len)
+llm_provider_t llm_get_provider(void)
 {
-    while (rb->len + len >= rb->cap) {
-        size_t new_cap = rb->cap * 2;
-        char *tmp = heap_caps_realloc(rb->data, new_cap, MALLOC_CAP_SPIRAM);
-        if (!tmp) return ESP_ERR_NO_MEM;
-        rb->data = tmp;
-        rb->cap = new_cap;
-    }
-    memcpy(rb->data + rb->len, data, len);
-    rb->len += len;
-    rb->data[rb->len] = '\0';
-    return ESP_OK;
+    return provider_is_openai() ? LLM_PROVIDER_OPENAI : LLM_PROVIDER_ANTHROPIC;
 }
 
-static void resp_buf_free(resp_buf_t *rb)
+static const char *provider_host(llm_provider_t provider)
 {
-    free(rb->data);
-    rb->data = NULL;
-    rb->len = 0;
-    rb->cap = 0;
+    return provider == LLM_PROVIDER_OPENAI ? "api.openai.com" : "api.anthropic.com";
 }
 
-/* ── HTTP event handler (for esp_http_client direct path) ─────── */
-
-static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+static const char *provider_path(llm_provider_t provider)
 {
-    resp_buf_t *rb = (resp_buf_t *)evt->user_data;
-    if (evt->event_id == HTTP_EVENT_ON_DATA) {
-        resp_buf_append(rb, (const char *)evt->data, evt->data_len);
-    }
-    return ESP_OK;
+    return provider == LLM_PROVIDER_OPENAI ? "/v1/chat/completions" : "/v1/messages";
 }
 
-/* ── Provider helpers ──────────────────────────────────────────── */
-
-static bool provider_is_openai(void)
+static const char *provider_name(llm_provider_t provider)
 {
-    return strcmp(s_provider, "openai") == 0;
+    return provider == LLM_PROVIDER_OPENAI ? "openai" : "anthropic";
 }
 
-static const char *llm_api_url(void)
+static const char *llm_api_host(void)
 {
-    return provider_is_openai() ? MIMI_OPENAI_API_URL : MIMI_LLM_API_URL;
+    return provider_host(llm_get_provider());
 }
 
-static const char *llm_api_host(void)
+/* ── Targets ──────────────────────────────────────────────────── */
+
+/*
+ * Where an attempt goes: the configured provider, or the other one once
+ * a fallback key is set.
+ */
+typedef struct {
+    llm_provider_t provider;
+    const char *api_key;
+    const char *model;
+    const char *host;
+    const char *path;
+    int port;
+    bool tls;
+} llm_target_t;
+
+static void target_primary(llm_target_t *t)
 {
-    return provider_is_openai() ? "api.openai.com" : "api.anthropic.com";
+    *t = (llm_target_t){
+        .provider = llm_get_provider(),
+        .api_key = s_api_key,
+        .model = s_model,
+        .host = llm_api_host(),
+        .path = provider_path(llm_get_provider()),
+        .port = 443,
+        .tls = true,
+    };
 }
 
-static const char *llm_api_path(void)
+static bool target_fallback(llm_target_t *t)
 {
-    return provider_is_openai() ? "/v1/chat/completions" : "/v1/messages";
+    if (s_fb_api_key[0] == '\0') return false;
+    llm_provider_t provider = provider_is_openai() ? LLM_PROVIDER_ANTHROPIC : LLM_PROVIDER_OPENAI;
+    const char *model = provider == LLM_PROVIDER_OPENAI ? MIMI_OPENAI_DEFAULT_MODEL
+                                                        : MIMI_LLM_DEFAULT_MODEL;
+    *t = (llm_target_t){
+        .provider = provider,
+        .api_key = s_fb_api_key,
+        .model = s_fb_model[0] ? s_fb_model : model,
+        .host = provider_host(provider),
+        .path = provider_path(provider),
+        .port = 443,
+        .tls = true,
+    };
+    return true;
 }
 
 /* ── Init ─────────────────────────────────────────────────────── */
@@ -119,6 +138,12 @@ esp_err_t llm_proxy_init(void)
     if (MIMI_SECRET_MODEL_PROVIDER[0] != '\0') {
         safe_copy(s_provider, sizeof(s_provider), MIMI_SECRET_MODEL_PROVIDER);
     }
+    if (MIMI_SECRET_FALLBACK_API_KEY[0] != '\0') {
+        safe_copy(s_fb_api_key, sizeof(s_fb_api_key), MIMI_SECRET_FALLBACK_API_KEY);
+    }
+    if (MIMI_SECRET_FALLBACK_MODEL[0] != '\0') {
+        safe_copy(s_fb_model, sizeof(s_fb_model), MIMI_SECRET_FALLBACK_MODEL);
+    }
 
     /* NVS overrides take highest priority (set via CLI) */
     nvs_handle_t nvs;
@@ -138,669 +163,1418 @@ esp_err_t llm_proxy_init(void)
         if (nvs_get_str(nvs, MIMI_NVS_KEY_PROVIDER, provider_tmp, &len) == ESP_OK && provider_tmp[0]) {
             safe_copy(s_provider, sizeof(s_provider), provider_tmp);
         }
+        len = sizeof(tmp);
+        memset(tmp, 0, sizeof(tmp));
+        if (nvs_get_str(nvs, MIMI_NVS_KEY_FB_API_KEY, tmp, &len) == ESP_OK && tmp[0]) {
+            safe_copy(s_fb_api_key, sizeof(s_fb_api_key), tmp);
+        }
+        len = sizeof(model_tmp);
+        memset(model_tmp, 0, sizeof(model_tmp));
+        if (nvs_get_str(nvs, MIMI_NVS_KEY_FB_MODEL, model_tmp, &len) == ESP_OK && model_tmp[0]) {
+            safe_copy(s_fb_model, sizeof(s_fb_model), model_tmp);
+        }
         nvs_close(nvs);
     }
 
     if (s_api_key[0]) {
         ESP_LOGI(TAG, "LLM proxy initialized (provider: %s, model: %s)", s_provider, s_model);
+        llm_target_t fb;
+        if (target_fallback(&fb)) {
+            ESP_LOGI(TAG, "Fallback: %s, model %s", provider_name(fb.provider), fb.model);
+        }
     } else {
         ESP_LOGW(TAG, "No API key. Use CLI: set_api_key <KEY>");
     }
     return ESP_OK;
 }
 
-/* ── Direct path: esp_http_client ───────────────────────────── */
+/* ── Request body: streamed straight into the connection ──────── */
 
-static esp_err_t llm_http_direct(const char *post_data, resp_buf_t *rb, int *out_status)
+/*
+ * A request is described by references to the caller's data and written
+ * twice with llm_json: once to count the Content-Length, once into the
+ * connection. Neither the conversation nor the body is ever copied.
+ */
+typedef struct {
+    const llm_target_t *target;
+    const char *system_prompt;
+    size_t stable_len;          /* Anthropic: system prefix with its own breakpoint */
+    const cJSON *messages;      /* in the provider's format (llm_conv_t) */
+    const char *tools_json;     /* tools array in the provider's format, or NULL */
+    bool openai;
+    bool stream;
+    bool cache;                 /* emit Anthropic cache_control breakpoints */
+    int64_t build_us;           /* history conversion time, for the build stats */
+} llm_request_t;
+
+static const char CACHE_CONTROL[] = "\"cache_control\":{\"type\":\"ephemeral\"}";
+
+static void write_system_block(llm_json_writer_t *w, const char *text, size_t len)
 {
-    esp_http_client_config_t config = {
-        .url = llm_api_url(),
-        .event_handler = http_event_handler,
-        .user_data = rb,
-        .timeout_ms = 120 * 1000,
-        .buffer_size = 4096,
-        .buffer_size_tx = 4096,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-    };
+    llm_json_lit(w, "{\"type\":\"text\",\"text\":");
+    llm_json_string_n(w, text, len);
+    llm_json_lit(w, ",");
+    llm_json_lit(w, CACHE_CONTROL);
+    llm_json_lit(w, "}");
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) return ESP_FAIL;
+/*
+ * Anthropic system prompt as text blocks: the stable prefix and the rest,
+ * each ending in a breakpoint, so an edit to memory or notes still reuses
+ * the cached tools + stable prefix.
+ */
+static void write_system_anthropic(llm_json_writer_t *w, const llm_request_t *req)
+{
+    const char *sys = req->system_prompt;
+    size_t total = strlen(sys);
 
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    if (provider_is_openai()) {
-        if (s_api_key[0]) {
-            char auth[LLM_API_KEY_MAX_LEN + 16];
-            snprintf(auth, sizeof(auth), "Bearer %s", s_api_key);
-            esp_http_client_set_header(client, "Authorization", auth);
+    if (!req->cache || total == 0) {
+        llm_json_string_n(w, sys, total);
+        return;
+    }
+
+    size_t stable_len = req->stable_len < total ? req->stable_len : 0;
+    llm_json_lit(w, "[");
+    if (stable_len > 0) {
+        write_system_block(w, sys, stable_len);
+        llm_json_lit(w, ",");
+    }
+    write_system_block(w, sys + stable_len, total - stable_len);
+    llm_json_lit(w, "]");
+}
+
+/*
+ * Breakpoint on the last message: the next call in the ReAct loop, and the
+ * next turn, find everything before it in the cache. String content is
+ * written as the equivalent single text block so it can carry the marker.
+ */
+static void write_marked_message(llm_json_writer_t *w, const cJSON *msg)
+{
+    llm_json_lit(w, "{");
+    for (const cJSON *child = msg->child; child; child = child->next) {
+        if (child != msg->child) llm_json_lit(w, ",");
+        llm_json_key(w, child->string ? child->string : "");
+
+        if (!child->string || strcmp(child->string, "content") != 0) {
+            llm_json_item(w, child);
+        } else if (cJSON_IsString(child) && child->valuestring[0]) {
+            llm_json_lit(w, "[{\"type\":\"text\",\"text\":");
+            llm_json_string(w, child->valuestring);
+            llm_json_lit(w, ",");
+            llm_json_lit(w, CACHE_CONTROL);
+            llm_json_lit(w, "}]");
+        } else if (cJSON_IsArray(child) && child->child) {
+            llm_json_lit(w, "[");
+            for (const cJSON *block = child->child; block; block = block->next) {
+                if (block != child->child) llm_json_lit(w, ",");
+                if (block->next || !cJSON_IsObject(block)) {
+                    llm_json_item(w, block);
+                    continue;
+                }
+                llm_json_lit(w, "{");
+                llm_json_members(w, block);
+                if (block->child) llm_json_lit(w, ",");
+                llm_json_lit(w, CACHE_CONTROL);
+                llm_json_lit(w, "}");
+            }
+            llm_json_lit(w, "]");
+        } else {
+            llm_json_item(w, child);
+        }
+    }
+    llm_json_lit(w, "}");
+}
+
+static void write_messages(llm_json_writer_t *w, const llm_request_t *req)
+{
+    llm_json_lit(w, "[");
+    /* OpenAI carries the system prompt as the first message */
+    bool sep = false;
+    if (req->openai && req->system_prompt && req->system_prompt[0]) {
+        llm_json_lit(w, "{\"role\":\"system\",\"content\":");
+        llm_json_string(w, req->system_prompt);
+        llm_json_lit(w, "}");
+        sep = true;
+    }
+    for (const cJSON *msg = req->messages ? req->messages->child : NULL; msg; msg = msg->next) {
+        if (sep) llm_json_lit(w, ",");
+        sep = true;
+        if (req->cache && !msg->next && cJSON_IsObject(msg)) {
+            write_marked_message(w, msg);
+        } else {
+            llm_json_item(w, msg);
+        }
+    }
+    llm_json_lit(w, "]");
+}
+
+/* The prebuilt tools array, with a breakpoint spliced into the last tool */
+static void write_tools_anthropic(llm_json_writer_t *w, const llm_request_t *req)
+{
+    const char *tools = req->tools_json;
+    size_t len = strlen(tools);
+    const char *last = req->cache ? strrchr(tools, '}') : NULL;
+    if (!last) {
+        llm_json_raw(w, tools, len);
+        return;
+    }
+    llm_json_raw(w, tools, last - tools);
+    llm_json_lit(w, ",");
+    llm_json_lit(w, CACHE_CONTROL);
+    llm_json_raw(w, last, len - (last - tools));
+}
+
+static esp_err_t request_write(llm_json_writer_t *w, const llm_request_t *req)
+{
+    llm_json_lit(w, "{");
+    llm_json_key(w, "model");
+    llm_json_string(w, req->target->model);
+    llm_json_lit(w, ",");
+    llm_json_key(w, "max_tokens");
+    llm_json_int(w, MIMI_LLM_MAX_TOKENS);
+    if (req->stream) {
+        llm_json_lit(w, ",\"stream\":true");
+    }
+
+    if (req->openai) {
+        if (req->stream) {
+            llm_json_lit(w, ",\"stream_options\":{\"include_usage\":true}");
+        }
+        llm_json_lit(w, ",");
+        llm_json_key(w, "messages");
+        write_messages(w, req);
+        if (req->tools_json) {
+            llm_json_lit(w, ",");
+            llm_json_key(w, "tools");
+            llm_json_lit(w, req->tools_json);
+            llm_json_lit(w, ",\"tool_choice\":\"auto\"");
         }
     } else {
-        esp_http_client_set_header(client, "x-api-key", s_api_key);
-        esp_http_client_set_header(client, "anthropic-version", MIMI_LLM_API_VERSION);
+        /* Cache prefix order is tools, system, messages */
+        if (req->tools_json) {
+            llm_json_lit(w, ",");
+            llm_json_key(w, "tools");
+            write_tools_anthropic(w, req);
+        }
+        llm_json_lit(w, ",");
+        llm_json_key(w, "system");
+        write_system_anthropic(w, req);
+        llm_json_lit(w, ",");
+        llm_json_key(w, "messages");
+        write_messages(w, req);
     }
-    esp_http_client_set_post_field(client, post_data, strlen(post_data));
 
-    esp_err_t err = esp_http_client_perform(client);
-    *out_status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
-    return err;
+    llm_json_lit(w, "}");
+    return llm_json_finish(w);
 }
 
-/* ── Proxy path: manual HTTP over CONNECT tunnel ────────────── */
+static size_t request_length(const llm_request_t *req)
+{
+    llm_json_writer_t *w = malloc(sizeof(llm_json_writer_t));
+    if (!w) return 0;
+    llm_json_init(w, NULL, NULL);
+    request_write(w, req);
+    size_t len = w->total;
+    free(w);
+    return len;
+}
 
-static esp_err_t llm_http_via_proxy(const char *post_data, resp_buf_t *rb, int *out_status)
+/* http_body_writer_t: the transport checks the length against the count */
+static esp_err_t request_send(http_sink_t sink, void *sink_ctx, void *ctx)
 {
-    proxy_conn_t *conn = proxy_conn_open(llm_api_host(), 443, 30000);
-    if (!conn) return ESP_ERR_HTTP_CONNECT;
+    llm_json_writer_t *w = malloc(sizeof(llm_json_writer_t));
+    if (!w) return ESP_ERR_NO_MEM;
+    llm_json_init(w, sink, sink_ctx);
+    esp_err_t err = request_write(w, (const llm_request_t *)ctx);
+    free(w);
+    return err;
+}
+
+/* ── Request head ─────────────────────────────────────────────── */
 
-    int body_len = strlen(post_data);
-    char header[1024];
-    int hlen = 0;
-    if (provider_is_openai()) {
-        hlen = snprintf(header, sizeof(header),
-            "POST %s HTTP/1.1\r\n"
-            "Host: %s\r\n"
+static int build_api_headers(const llm_target_t *t, char *headers, size_t size)
+{
+    if (t->provider == LLM_PROVIDER_OPENAI) {
+        return snprintf(headers, size,
             "Content-Type: application/json\r\n"
-            "Authorization: Bearer %s\r\n"
-            "Content-Length: %d\r\n"
-            "Connection: close\r\n\r\n",
-            llm_api_path(), llm_api_host(), s_api_key, body_len);
-    } else {
-        hlen = snprintf(header, sizeof(header),
-            "POST %s HTTP/1.1\r\n"
-            "Host: %s\r\n"
+            "Authorization: Bearer %s\r\n",
+            t->api_key);
+    }
+    return snprintf(headers, size,
             "Content-Type: application/json\r\n"
             "x-api-key: %s\r\n"
-            "anthropic-version: %s\r\n"
-            "Content-Length: %d\r\n"
-            "Connection: close\r\n\r\n",
-            llm_api_path(), llm_api_host(), s_api_key, MIMI_LLM_API_VERSION, body_len);
+            "anthropic-version: %s\r\n",
+            t->api_key, MIMI_LLM_API_VERSION);
+}
+
+/* ── Connection stats ─────────────────────────────────────────── */
+
+static llm_conn_stats_t s_conn_stats;
+static portMUX_TYPE s_conn_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void conn_record_handshake(int64_t us, bool prewarm)
+{
+    portENTER_CRITICAL(&s_conn_mux);
+    s_conn_stats.handshakes++;
+    s_conn_stats.handshake_us += us;
+    if (prewarm) s_conn_stats.prewarmed++;
+    portEXIT_CRITICAL(&s_conn_mux);
+}
+
+/* Time to first byte, split into connecting, sending and server time */
+static void conn_record(const http_result_t *res)
+{
+    if (res->connect_us) conn_record_handshake(res->connect_us, false);
+
+    portENTER_CRITICAL(&s_conn_mux);
+    if (res->reused) s_conn_stats.reused++;
+    s_conn_stats.stale += res->stale;
+    if (res->first_byte_us) {
+        s_conn_stats.responses++;
+        s_conn_stats.ttfb_us += res->first_byte_us;
+        s_conn_stats.ttfb_connect_us += res->connect_us;
+        s_conn_stats.ttfb_server_us += res->first_byte_us - res->sent_us;
     }
+    portEXIT_CRITICAL(&s_conn_mux);
 
-    if (proxy_conn_write(conn, header, hlen) < 0 ||
-        proxy_conn_write(conn, post_data, body_len) < 0) {
-        proxy_conn_close(conn);
-        return ESP_ERR_HTTP_WRITE_DATA;
+    if (res->first_byte_us) {
+        ESP_LOGI(TAG, "First byte after %d ms (connect %d ms, server %d ms)",
+                 (int)(res->first_byte_us / 1000), (int)(res->connect_us / 1000),
+                 (int)((res->first_byte_us - res->sent_us) / 1000));
     }
+}
+
+/* ── Pre-warming ──────────────────────────────────────────────── */
 
-    /* Read full response into buffer */
-    char tmp[4096];
+/*
+ * The API connection is opened while the worker is still building the
+ * prompt; the request then waits for that handshake instead of starting
+ * a second one.
+ */
+static TaskHandle_t s_warm_task;
+
+static void warm_task(void *arg)
+{
     while (1) {
-        int n = proxy_conn_read(conn, tmp, sizeof(tmp), 120000);
-        if (n <= 0) break;
-        if (resp_buf_append(rb, tmp, n) != ESP_OK) break;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t us = 0;
+        if (http_transport_prewarm(llm_api_host(), 443, true, &us) == ESP_OK &&
+            us > 0) {
+            conn_record_handshake(us, true);
+            ESP_LOGI(TAG, "Pre-warmed connection to %s in %d ms",
+                     llm_api_host(), (int)(us / 1000));
+        }
     }
-    proxy_conn_close(conn);
+}
 
-    /* Parse status line */
-    *out_status = 0;
-    if (rb->len > 5 && strncmp(rb->data, "HTTP/", 5) == 0) {
-        const char *sp = strchr(rb->data, ' ');
-        if (sp) *out_status = atoi(sp + 1);
+void llm_prewarm(void)
+{
+    if (s_warm_task && s_api_key[0] && !http_proxy_is_enabled()) {
+        xTaskNotifyGive(s_warm_task);
     }
+}
 
-    /* Strip HTTP headers, keep body only */
-    char *body = strstr(rb->data, "\r\n\r\n");
-    if (body) {
-        body += 4;
-        size_t blen = rb->len - (body - rb->data);
-        memmove(rb->data, body, blen);
-        rb->len = blen;
-        rb->data[rb->len] = '\0';
+esp_err_t llm_proxy_start(void)
+{
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        warm_task, "llm_warm", MIMI_LLM_WARM_STACK, NULL,
+        MIMI_LLM_WARM_PRIO, &s_warm_task, MIMI_LLM_WARM_CORE);
+    return (ret == pdPASS) ? ESP_OK : ESP_FAIL;
+}
+
+/* ── Usage ────────────────────────────────────────────────────── */
+
+static llm_usage_stats_t s_usage;
+static portMUX_TYPE s_usage_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void usage_take(cJSON *obj, const char *key, int *out)
+{
+    cJSON *v = cJSON_GetObjectItem(obj, key);
+    if (cJSON_IsNumber(v)) *out = v->valueint;
+}
+
+static void usage_parse_anthropic(cJSON *usage, llm_usage_t *u)
+{
+    if (!cJSON_IsObject(usage)) return;
+    usage_take(usage, "input_tokens", &u->input_tokens);
+    usage_take(usage, "cache_read_input_tokens", &u->cache_read_tokens);
+    usage_take(usage, "cache_creation_input_tokens", &u->cache_write_tokens);
+    usage_take(usage, "output_tokens", &u->output_tokens);
+}
+
+static void usage_parse_openai(cJSON *usage, llm_usage_t *u)
+{
+    if (!cJSON_IsObject(usage)) return;
+    int prompt = 0;
+    usage_take(usage, "prompt_tokens", &prompt);
+    usage_take(cJSON_GetObjectItem(usage, "prompt_tokens_details"), "cached_tokens",
+               &u->cache_read_tokens);
+    /* prompt_tokens includes the cached part */
+    u->input_tokens = prompt - u->cache_read_tokens;
+    usage_take(usage, "completion_tokens", &u->output_tokens);
+}
+
+static void usage_record(const llm_usage_t *u)
+{
+    portENTER_CRITICAL(&s_usage_mux);
+    s_usage.calls++;
+    if (u->cache_read_tokens > 0) {
+        s_usage.cache_hits++;
+    } else {
+        s_usage.cache_misses++;
     }
+    s_usage.input_tokens += u->input_tokens;
+    s_usage.cache_read_tokens += u->cache_read_tokens;
+    s_usage.cache_write_tokens += u->cache_write_tokens;
+    s_usage.output_tokens += u->output_tokens;
+    portEXIT_CRITICAL(&s_usage_mux);
+
+    ESP_LOGI(TAG, "Usage: %d input, %d cache read, %d cache write, %d output tokens",
+             u->input_tokens, u->cache_read_tokens, u->cache_write_tokens, u->output_tokens);
+}
 
-    return ESP_OK;
+static void build_record(llm_provider_t provider, int64_t us)
+{
+    llm_build_stats_t *b = &s_usage.build[provider];
+    portENTER_CRITICAL(&s_usage_mux);
+    b->requests++;
+    b->total_us += us;
+    if (us > b->max_us) b->max_us = (uint32_t)us;
+    portEXIT_CRITICAL(&s_usage_mux);
+}
+
+void llm_get_usage_stats(llm_usage_stats_t *out)
+{
+    portENTER_CRITICAL(&s_usage_mux);
+    *out = s_usage;
+    portEXIT_CRITICAL(&s_usage_mux);
+    portENTER_CRITICAL(&s_conn_mux);
+    out->conn = s_conn_stats;
+    portEXIT_CRITICAL(&s_conn_mux);
 }
 
 /* ── Shared HTTP dispatch ─────────────────────────────────────── */
 
-static esp_err_t llm_http_call(const char *post_data, resp_buf_t *rb, int *out_status)
+/* Count the body and fill hreq; headers must outlive the request */
+static esp_err_t llm_http_prepare(const llm_request_t *req, char *headers, size_t headers_size,
+                                  http_header_cb_t on_header, http_body_cb_t on_body,
+                                  void *ctx, http_request_t *hreq)
 {
-    if (http_proxy_is_enabled()) {
-        return llm_http_via_proxy(post_data, rb, out_status);
-    } else {
-        return llm_http_direct(post_data, rb, out_status);
+    const llm_target_t *t = req->target;
+    int64_t start_us = esp_timer_get_time();
+    size_t body_len = request_length(req);
+    if (body_len == 0) return ESP_ERR_NO_MEM;
+    int64_t build_us = req->build_us + (esp_timer_get_time() - start_us);
+    build_record(t->provider, build_us);
+
+    ESP_LOGI(TAG, "Calling LLM API (provider: %s, model: %s, stream: %s, body: %d bytes, "
+             "built in %d us)", provider_name(t->provider), t->model, req->stream ? "yes" : "no",
+             (int)body_len, (int)build_us);
+
+    build_api_headers(t, headers, headers_size);
+    *hreq = (http_request_t){
+        .method = "POST",
+        .host = t->host,
+        .port = t->port,
+        .tls = t->tls,
+        .path = t->path,
+        .headers = headers,
+        .body_len = body_len,
+        .write_body = request_send,
+        .body_ctx = (void *)req,
+        .timeout_ms = MIMI_LLM_TIMEOUT_MS,
+        .on_header = on_header,
+        .on_body = on_body,
+        .ctx = ctx,
+        /* A compressed event stream could hold deltas back until a block fills */
+        .identity = req->stream,
+    };
+    return ESP_OK;
+}
+
+static esp_err_t llm_http_call(const llm_request_t *req, http_header_cb_t on_header,
+                               http_body_cb_t on_body, void *ctx, http_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    char headers[512];
+    http_request_t hreq;
+    esp_err_t err = llm_http_prepare(req, headers, sizeof(headers), on_header, on_body, ctx, &hreq);
+    if (err != ESP_OK) return err;
+
+    err = http_transport_request(&hreq, res);
+    conn_record(res);
+    return err;
+}
+
+/* ── Streaming: SSE events → llm_response_t ───────────────────── */
+
+typedef struct {
+    llm_response_t *resp;
+    const llm_chat_opts_t *opts;
+    llm_sse_t sse;
+    size_t text_cap;
+    size_t input_cap[MIMI_MAX_TOOL_CALLS];
+    int open_call;          /* calls[] slot receiving input deltas, -1 if none */
+    int oa_index;           /* OpenAI tool_calls[].index of open_call */
+    int status;
+    char err_body[512];     /* start of a non-200 body, for the log */
+    size_t err_len;
+    uint32_t retry_after_ms;    /* from a 429 / 503 / 529, 0 = not given */
+    bool openai;            /* response shape */
+    bool finished;          /* message_stop / finish_reason seen */
+    bool failed;
+    bool delivered;         /* a callback already passed part of it on */
+} llm_stream_t;
+
+/* What a failed attempt tells the retry logic */
+typedef struct {
+    int status;             /* 0 = no response */
+    uint32_t retry_after_ms;
+    bool delivered;
+    int64_t first_byte_us;
+} llm_attempt_t;
+
+static void attempt_fill(llm_attempt_t *a, const llm_stream_t *st, const http_result_t *res)
+{
+    a->status = res->status;
+    a->retry_after_ms = st->retry_after_ms;
+    a->delivered = st->delivered;
+    a->first_byte_us = res->first_byte_us;
+}
+
+/* http_header_cb_t; ctx is the response builder or starts with one */
+static void retry_after_header(const char *name, const char *value, void *ctx)
+{
+    llm_stream_t *st = (llm_stream_t *)ctx;
+    if (strcasecmp(name, "retry-after-ms") == 0) {
+        st->retry_after_ms = (uint32_t)atoi(value);
+    } else if (strcasecmp(name, "retry-after") == 0 && !st->retry_after_ms) {
+        /* Seconds; an HTTP date reads as 0 and falls back to backoff */
+        st->retry_after_ms = (uint32_t)atoi(value) * 1000;
     }
 }
 
-/* ── Parse text from JSON response ────────────────────────────── */
+static bool stream_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap) return true;
+    size_t new_cap = *cap ? *cap : 256;
+    while (new_cap < need) new_cap *= 2;
+    char *tmp = realloc(*buf, new_cap);
+    if (!tmp) return false;
+    *buf = tmp;
+    *cap = new_cap;
+    return true;
+}
 
-static void extract_text_anthropic(cJSON *root, char *buf, size_t size)
+static void stream_text(llm_stream_t *st, const char *text, size_t n)
 {
-    buf[0] = '\0';
-    cJSON *content = cJSON_GetObjectItem(root, "content");
-    if (!content || !cJSON_IsArray(content)) return;
+    llm_response_t *resp = st->resp;
+    if (n == 0) return;
+
+    if (!stream_reserve(&resp->text, &st->text_cap, resp->text_len + n + 1)) {
+        st->failed = true;
+        return;
+    }
+    memcpy(resp->text + resp->text_len, text, n);
+    resp->text_len += n;
+    resp->text[resp->text_len] = '\0';
 
-    size_t off = 0;
-    cJSON *block;
-    cJSON_ArrayForEach(block, content) {
-        cJSON *btype = cJSON_GetObjectItem(block, "type");
-        if (!btype || strcmp(btype->valuestring, "text") != 0) continue;
-        cJSON *text = cJSON_GetObjectItem(block, "text");
-        if (!text || !cJSON_IsString(text)) continue;
-        size_t tlen = strlen(text->valuestring);
-        size_t copy = (tlen < size - off - 1) ? tlen : size - off - 1;
-        memcpy(buf + off, text->valuestring, copy);
-        off += copy;
+    if (st->opts->on_text) {
+        st->delivered = true;
+        st->opts->on_text(text, n, st->opts->ctx);
     }
-    buf[off] = '\0';
 }
 
-static void extract_text_openai(cJSON *root, char *buf, size_t size)
+static void stream_open_call(llm_stream_t *st, const char *id, const char *name)
 {
-    buf[0] = '\0';
-    cJSON *choices = cJSON_GetObjectItem(root, "choices");
-    if (!choices || !cJSON_IsArray(choices)) return;
-    cJSON *choice0 = cJSON_GetArrayItem(choices, 0);
-    if (!choice0) return;
-    cJSON *message = cJSON_GetObjectItem(choice0, "message");
-    if (!message) return;
-    cJSON *content = cJSON_GetObjectItem(message, "content");
-    if (!content || !cJSON_IsString(content)) return;
-    strncpy(buf, content->valuestring, size - 1);
-    buf[size - 1] = '\0';
-}
-
-static cJSON *convert_tools_openai(const char *tools_json)
-{
-    if (!tools_json) return NULL;
-    cJSON *arr = cJSON_Parse(tools_json);
-    if (!arr || !cJSON_IsArray(arr)) {
-        cJSON_Delete(arr);
-        return NULL;
-    }
-    cJSON *out = cJSON_CreateArray();
-    cJSON *tool;
-    cJSON_ArrayForEach(tool, arr) {
-        cJSON *name = cJSON_GetObjectItem(tool, "name");
-        cJSON *desc = cJSON_GetObjectItem(tool, "description");
-        cJSON *schema = cJSON_GetObjectItem(tool, "input_schema");
-        if (!name || !cJSON_IsString(name)) continue;
-
-        cJSON *func = cJSON_CreateObject();
-        cJSON_AddStringToObject(func, "name", name->valuestring);
-        if (desc && cJSON_IsString(desc)) {
-            cJSON_AddStringToObject(func, "description", desc->valuestring);
-        }
-        if (schema) {
-            cJSON_AddItemToObject(func, "parameters", cJSON_Duplicate(schema, 1));
-        }
+    llm_response_t *resp = st->resp;
+    st->open_call = -1;
+    if (resp->call_count >= MIMI_MAX_TOOL_CALLS) return;
+
+    llm_tool_call_t *call = &resp->calls[resp->call_count];
+    safe_copy(call->id, sizeof(call->id), id);
+    safe_copy(call->name, sizeof(call->name), name);
+    st->open_call = resp->call_count++;
+}
+
+static void stream_input(llm_stream_t *st, const char *part, size_t n)
+{
+    if (st->open_call < 0) return;
+    llm_tool_call_t *call = &st->resp->calls[st->open_call];
+    if (n == 0) return;
 
-        cJSON *wrap = cJSON_CreateObject();
-        cJSON_AddStringToObject(wrap, "type", "function");
-        cJSON_AddItemToObject(wrap, "function", func);
-        cJSON_AddItemToArray(out, wrap);
+    if (!stream_reserve(&call->input, &st->input_cap[st->open_call], call->input_len + n + 1)) {
+        st->failed = true;
+        return;
     }
-    cJSON_Delete(arr);
-    return out;
+    memcpy(call->input + call->input_len, part, n);
+    call->input_len += n;
+    call->input[call->input_len] = '\0';
 }
 
-static cJSON *convert_messages_openai(const char *system_prompt, cJSON *messages)
+static void stream_close_call(llm_stream_t *st)
 {
-    cJSON *out = cJSON_CreateArray();
-    if (system_prompt && system_prompt[0]) {
-        cJSON *sys = cJSON_CreateObject();
-        cJSON_AddStringToObject(sys, "role", "system");
-        cJSON_AddStringToObject(sys, "content", system_prompt);
-        cJSON_AddItemToArray(out, sys);
+    if (st->open_call < 0) return;
+    llm_tool_call_t *call = &st->resp->calls[st->open_call];
+    if (!call->input) {
+        /* Tools without arguments stream no input deltas at all */
+        call->input = strdup("{}");
+        call->input_len = call->input ? 2 : 0;
+    }
+    if (st->opts->on_tool && !st->failed) {
+        st->delivered = true;
+        st->opts->on_tool(st->open_call, call, st->opts->ctx);
     }
+    st->open_call = -1;
+}
 
-    if (!messages || !cJSON_IsArray(messages)) return out;
+static void stream_event_anthropic(llm_stream_t *st, cJSON *ev)
+{
+    const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(ev, "type"));
+    if (!type) return;
+
+    if (strcmp(type, "content_block_delta") == 0) {
+        cJSON *delta = cJSON_GetObjectItem(ev, "delta");
+        const char *dtype = cJSON_GetStringValue(cJSON_GetObjectItem(delta, "type"));
+        if (!dtype) return;
+        if (strcmp(dtype, "text_delta") == 0) {
+            const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(delta, "text"));
+            if (text) stream_text(st, text, strlen(text));
+        } else if (strcmp(dtype, "input_json_delta") == 0) {
+            const char *part = cJSON_GetStringValue(cJSON_GetObjectItem(delta, "partial_json"));
+            if (part) stream_input(st, part, strlen(part));
+        }
+    } else if (strcmp(type, "content_block_start") == 0) {
+        cJSON *block = cJSON_GetObjectItem(ev, "content_block");
+        const char *btype = cJSON_GetStringValue(cJSON_GetObjectItem(block, "type"));
+        if (btype && strcmp(btype, "tool_use") == 0) {
+            stream_open_call(st,
+                             cJSON_GetStringValue(cJSON_GetObjectItem(block, "id")),
+                             cJSON_GetStringValue(cJSON_GetObjectItem(block, "name")));
+        }
+    } else if (strcmp(type, "content_block_stop") == 0) {
+        stream_close_call(st);
+    } else if (strcmp(type, "message_start") == 0) {
+        cJSON *message = cJSON_GetObjectItem(ev, "message");
+        usage_parse_anthropic(cJSON_GetObjectItem(message, "usage"), &st->resp->usage);
+    } else if (strcmp(type, "message_delta") == 0) {
+        cJSON *delta = cJSON_GetObjectItem(ev, "delta");
+        const char *stop = cJSON_GetStringValue(cJSON_GetObjectItem(delta, "stop_reason"));
+        if (stop) st->resp->tool_use = (strcmp(stop, "tool_use") == 0);
+        /* Cumulative output count */
+        usage_take(cJSON_GetObjectItem(ev, "usage"), "output_tokens",
+                   &st->resp->usage.output_tokens);
+    } else if (strcmp(type, "message_stop") == 0) {
+        st->finished = true;
+    } else if (strcmp(type, "error") == 0) {
+        cJSON *error = cJSON_GetObjectItem(ev, "error");
+        const char *msg = cJSON_GetStringValue(cJSON_GetObjectItem(error, "message"));
+        ESP_LOGE(TAG, "Stream error: %s", msg ? msg : "(unknown)");
+        st->failed = true;
+    }
+}
 
-    cJSON *msg;
-    cJSON_ArrayForEach(msg, messages) {
-        cJSON *role = cJSON_GetObjectItem(msg, "role");
-        cJSON *content = cJSON_GetObjectItem(msg, "content");
-        if (!role || !cJSON_IsString(role)) continue;
+static void stream_event_openai(llm_stream_t *st, cJSON *ev)
+{
+    /* With include_usage the last chunk carries usage and no choices */
+    usage_parse_openai(cJSON_GetObjectItem(ev, "usage"), &st->resp->usage);
 
-        if (content && cJSON_IsString(content)) {
-            cJSON *m = cJSON_CreateObject();
-            cJSON_AddStringToObject(m, "role", role->valuestring);
-            cJSON_AddStringToObject(m, "content", content->valuestring);
-            cJSON_AddItemToArray(out, m);
-            continue;
-        }
+    cJSON *choice0 = cJSON_GetArrayItem(cJSON_GetObjectItem(ev, "choices"), 0);
+    if (!choice0) return;
 
-        if (!content || !cJSON_IsArray(content)) continue;
-
-        if (strcmp(role->valuestring, "assistant") == 0) {
-            cJSON *m = cJSON_CreateObject();
-            cJSON_AddStringToObject(m, "role", "assistant");
-
-            /* collect text */
-            char *text_buf = NULL;
-            size_t off = 0;
-            cJSON *block;
-            cJSON *tool_calls = NULL;
-            cJSON_ArrayForEach(block, content) {
-                cJSON *btype = cJSON_GetObjectItem(block, "type");
-                if (btype && cJSON_IsString(btype) && strcmp(btype->valuestring, "text") == 0) {
-                    cJSON *text = cJSON_GetObjectItem(block, "text");
-                    if (text && cJSON_IsString(text)) {
-                        size_t tlen = strlen(text->valuestring);
-                        char *tmp = realloc(text_buf, off + tlen + 1);
-                        if (tmp) {
-                            text_buf = tmp;
-                            memcpy(text_buf + off, text->valuestring, tlen);
-                            off += tlen;
-                            text_buf[off] = '\0';
-                        }
-                    }
-                } else if (btype && cJSON_IsString(btype) && strcmp(btype->valuestring, "tool_use") == 0) {
-                    if (!tool_calls) tool_calls = cJSON_CreateArray();
-                    cJSON *id = cJSON_GetObjectItem(block, "id");
-                    cJSON *name = cJSON_GetObjectItem(block, "name");
-                    cJSON *input = cJSON_GetObjectItem(block, "input");
-                    if (!name || !cJSON_IsString(name)) continue;
-
-                    cJSON *tc = cJSON_CreateObject();
-                    if (id && cJSON_IsString(id)) {
-                        cJSON_AddStringToObject(tc, "id", id->valuestring);
-                    }
-                    cJSON_AddStringToObject(tc, "type", "function");
-                    cJSON *func = cJSON_CreateObject();
-                    cJSON_AddStringToObject(func, "name", name->valuestring);
-                    if (input) {
-                        char *args = cJSON_PrintUnformatted(input);
-                        if (args) {
-                            cJSON_AddStringToObject(func, "arguments", args);
-                            free(args);
-                        }
-                    }
-                    cJSON_AddItemToObject(tc, "function", func);
-                    cJSON_AddItemToArray(tool_calls, tc);
-                }
-            }
-            if (text_buf) {
-                cJSON_AddStringToObject(m, "content", text_buf);
-            } else {
-                cJSON_AddStringToObject(m, "content", "");
-            }
-            if (tool_calls) {
-                cJSON_AddItemToObject(m, "tool_calls", tool_calls);
-            }
-            cJSON_AddItemToArray(out, m);
-            free(text_buf);
-        } else if (strcmp(role->valuestring, "user") == 0) {
-            /* tool_result blocks become role=tool */
-            cJSON *block;
-            bool has_user_text = false;
-            char *text_buf = NULL;
-            size_t off = 0;
-            cJSON_ArrayForEach(block, content) {
-                cJSON *btype = cJSON_GetObjectItem(block, "type");
-                if (btype && cJSON_IsString(btype) && strcmp(btype->valuestring, "tool_result") == 0) {
-                    cJSON *tool_id = cJSON_GetObjectItem(block, "tool_use_id");
-                    cJSON *tcontent = cJSON_GetObjectItem(block, "content");
-                    if (!tool_id || !cJSON_IsString(tool_id)) continue;
-                    cJSON *tm = cJSON_CreateObject();
-                    cJSON_AddStringToObject(tm, "role", "tool");
-                    cJSON_AddStringToObject(tm, "tool_call_id", tool_id->valuestring);
-                    if (tcontent && cJSON_IsString(tcontent)) {
-                        cJSON_AddStringToObject(tm, "content", tcontent->valuestring);
-                    } else {
-                        cJSON_AddStringToObject(tm, "content", "");
-                    }
-                    cJSON_AddItemToArray(out, tm);
-                } else if (btype && cJSON_IsString(btype) && strcmp(btype->valuestring, "text") == 0) {
-                    cJSON *text = cJSON_GetObjectItem(block, "text");
-                    if (text && cJSON_IsString(text)) {
-                        size_t tlen = strlen(text->valuestring);
-                        char *tmp = realloc(text_buf, off + tlen + 1);
-                        if (tmp) {
-                            text_buf = tmp;
-                            memcpy(text_buf + off, text->valuestring, tlen);
-                            off += tlen;
-                            text_buf[off] = '\0';
-                        }
-                        has_user_text = true;
-                    }
-                }
-            }
-            if (has_user_text) {
-                cJSON *um = cJSON_CreateObject();
-                cJSON_AddStringToObject(um, "role", "user");
-                cJSON_AddStringToObject(um, "content", text_buf);
-                cJSON_AddItemToArray(out, um);
-            }
-            free(text_buf);
+    cJSON *delta = cJSON_GetObjectItem(choice0, "delta");
+    const char *content = cJSON_GetStringValue(cJSON_GetObjectItem(delta, "content"));
+    if (content) stream_text(st, content, strlen(content));
+
+    /* Tool calls arrive as fragments keyed by index; a new index starts a new call */
+    cJSON *tc;
+    cJSON_ArrayForEach(tc, cJSON_GetObjectItem(delta, "tool_calls")) {
+        cJSON *idx = cJSON_GetObjectItem(tc, "index");
+        int index = cJSON_IsNumber(idx) ? idx->valueint : 0;
+        cJSON *func = cJSON_GetObjectItem(tc, "function");
+        if (index != st->oa_index) {
+            stream_close_call(st);
+            st->oa_index = index;
+            stream_open_call(st,
+                             cJSON_GetStringValue(cJSON_GetObjectItem(tc, "id")),
+                             cJSON_GetStringValue(cJSON_GetObjectItem(func, "name")));
         }
+        const char *args = cJSON_GetStringValue(cJSON_GetObjectItem(func, "arguments"));
+        if (args) stream_input(st, args, strlen(args));
     }
 
-    return out;
+    const char *finish = cJSON_GetStringValue(cJSON_GetObjectItem(choice0, "finish_reason"));
+    if (finish) {
+        stream_close_call(st);
+        st->resp->tool_use = (strcmp(finish, "tool_calls") == 0) || st->resp->call_count > 0;
+        st->finished = true;
+    }
 }
 
-/* ── Public: simple chat (backward compat) ────────────────────── */
-
-esp_err_t llm_chat(const char *system_prompt, const char *messages_json,
-                   char *response_buf, size_t buf_size)
+static void stream_on_event(const char *event, char *data, size_t len, void *ctx)
 {
-    if (s_api_key[0] == '\0') {
-        snprintf(response_buf, buf_size, "Error: No API key configured");
-        return ESP_ERR_INVALID_STATE;
-    }
+    llm_stream_t *st = (llm_stream_t *)ctx;
+    if (st->failed) return;
 
-    /* Build request body (non-streaming) */
-    cJSON *body = cJSON_CreateObject();
-    cJSON_AddStringToObject(body, "model", s_model);
-    cJSON_AddNumberToObject(body, "max_tokens", MIMI_LLM_MAX_TOKENS);
+    if (strcmp(data, "[DONE]") == 0) {
+        st->finished = true;
+        return;
+    }
 
-    if (provider_is_openai()) {
-        cJSON *messages = cJSON_Parse(messages_json);
-        if (!messages) {
-            messages = cJSON_CreateArray();
-            cJSON *msg = cJSON_CreateObject();
-            cJSON_AddStringToObject(msg, "role", "user");
-            cJSON_AddStringToObject(msg, "content", messages_json);
-            cJSON_AddItemToArray(messages, msg);
-        }
-        cJSON *openai_msgs = convert_messages_openai(system_prompt, messages);
-        cJSON_Delete(messages);
-        cJSON_AddItemToObject(body, "messages", openai_msgs);
+    cJSON *ev = cJSON_Parse(data);
+    if (!ev) {
+        ESP_LOGW(TAG, "Unparseable stream event '%s' (%d bytes)",
+                 event[0] ? event : "message", (int)len);
+        return;
+    }
+    if (st->openai) {
+        stream_event_openai(st, ev);
     } else {
-        cJSON_AddStringToObject(body, "system", system_prompt);
-        cJSON *messages = cJSON_Parse(messages_json);
-        if (messages) {
-            cJSON_AddItemToObject(body, "messages", messages);
-        } else {
-            cJSON *arr = cJSON_CreateArray();
-            cJSON *msg = cJSON_CreateObject();
-            cJSON_AddStringToObject(msg, "role", "user");
-            cJSON_AddStringToObject(msg, "content", messages_json);
-            cJSON_AddItemToArray(arr, msg);
-            cJSON_AddItemToObject(body, "messages", arr);
-        }
+        stream_event_anthropic(st, ev);
     }
+    cJSON_Delete(ev);
+}
 
-    char *post_data = cJSON_PrintUnformatted(body);
-    cJSON_Delete(body);
-    if (!post_data) {
-        snprintf(response_buf, buf_size, "Error: Failed to build request");
-        return ESP_ERR_NO_MEM;
-    }
+static esp_err_t stream_on_body(const char *data, size_t len, int status, void *ctx)
+{
+    llm_stream_t *st = (llm_stream_t *)ctx;
+    st->status = status;
 
-    ESP_LOGI(TAG, "Calling LLM API (provider: %s, model: %s, body: %d bytes)",
-             s_provider, s_model, (int)strlen(post_data));
+    if (status != 200) {
+        size_t room = sizeof(st->err_body) - 1 - st->err_len;
+        size_t n = len < room ? len : room;
+        memcpy(st->err_body + st->err_len, data, n);
+        st->err_len += n;
+        st->err_body[st->err_len] = '\0';
+        return ESP_OK;
+    }
 
-    resp_buf_t rb;
-    if (resp_buf_init(&rb, MIMI_LLM_STREAM_BUF_SIZE) != ESP_OK) {
-        free(post_data);
-        snprintf(response_buf, buf_size, "Error: Out of memory");
-        return ESP_ERR_NO_MEM;
+    if (llm_sse_feed(&st->sse, data, len) != ESP_OK) {
+        st->failed = true;
     }
+    return st->failed ? ESP_FAIL : ESP_OK;
+}
 
-    int status = 0;
-    esp_err_t err = llm_http_call(post_data, &rb, &status);
-    free(post_data);
+static esp_err_t llm_chat_stream(const llm_request_t *req, const llm_chat_opts_t *opts,
+                                 llm_response_t *resp, llm_attempt_t *a)
+{
+    llm_stream_t *st = calloc(1, sizeof(llm_stream_t));
+    if (!st) return ESP_ERR_NO_MEM;
+    st->resp = resp;
+    st->opts = opts;
+    st->open_call = -1;
+    st->oa_index = -1;
+    st->openai = req->openai;
+    llm_sse_init(&st->sse, MIMI_LLM_STREAM_BUF_SIZE, stream_on_event, st);
+
+    http_result_t res;
+    esp_err_t err = llm_http_call(req, retry_after_header, stream_on_body, st, &res);
+    int status = res.status;
+    /* Stream-level failures are reported through st->failed */
+    if (st->failed) err = ESP_OK;
 
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
-        resp_buf_free(&rb);
-        snprintf(response_buf, buf_size, "Error: HTTP request failed (%s)",
-                 esp_err_to_name(err));
-        return err;
+    } else if (status != 200) {
+        ESP_LOGE(TAG, "API error %d: %s", status, st->err_body);
+        err = ESP_FAIL;
+    } else if (st->failed || !st->finished) {
+        ESP_LOGE(TAG, "Stream %s", st->failed ? "failed" : "ended before completion");
+        err = ESP_FAIL;
     }
+    if (st->sse.dropped > 0) {
+        ESP_LOGW(TAG, "Dropped %d oversized stream events", st->sse.dropped);
+    }
+    attempt_fill(a, st, &res);
 
-    if (status != 200) {
-        ESP_LOGE(TAG, "API returned status %d", status);
-        snprintf(response_buf, buf_size, "API error (HTTP %d): %.200s",
-                 status, rb.data ? rb.data : "");
-        resp_buf_free(&rb);
-        return ESP_FAIL;
+    llm_sse_free(&st->sse);
+    free(st);
+    return err;
+}
+
+/* ── Non-streaming: JSON events → llm_response_t ─────────────── */
+
+/*
+ * The response body is parsed as it arrives, filling the same
+ * llm_response_t builder as the stream path, so it is never buffered
+ * whole. Tool input is captured as raw JSON bytes.
+ */
+
+typedef struct {
+    llm_stream_t b;         /* response builder shared with the stream path */
+    llm_sax_t sax;
+    char block_type[16];    /* Anthropic: type of the content block being read */
+    char stop[24];          /* stop_reason / finish_reason */
+    int prompt_tokens;      /* OpenAI: includes cached tokens */
+} llm_json_resp_t;
+
+static const llm_chat_opts_t s_no_opts;
+
+static void append_field(char *dst, size_t size, const char *data, size_t len)
+{
+    size_t cur = strlen(dst);
+    size_t n = len < size - 1 - cur ? len : size - 1 - cur;
+    memcpy(dst + cur, data, n);
+    dst[cur + n] = '\0';
+}
+
+/* Anthropic: a block becomes a call slot on its first id / name / input */
+static llm_tool_call_t *block_call(llm_json_resp_t *jr)
+{
+    if (jr->b.open_call < 0) stream_open_call(&jr->b, NULL, NULL);
+    return jr->b.open_call >= 0 ? &jr->b.resp->calls[jr->b.open_call] : NULL;
+}
+
+/* Anthropic: a block with an id that is not tool_use (e.g. server tools) */
+static void block_discard(llm_json_resp_t *jr)
+{
+    int slot = jr->b.open_call;
+    llm_tool_call_t *call = &jr->b.resp->calls[slot];
+    free(call->input);
+    memset(call, 0, sizeof(*call));
+    jr->b.input_cap[slot] = 0;
+    jr->b.resp->call_count--;
+    jr->b.open_call = -1;
+}
+
+static void json_on_start(llm_sax_t *p, bool is_array, void *ctx)
+{
+    llm_json_resp_t *jr = (llm_json_resp_t *)ctx;
+    if (is_array) return;
+
+    if (jr->b.openai) {
+        if (llm_sax_path_is(p, "choices.0.message.tool_calls.*")) {
+            stream_open_call(&jr->b, NULL, NULL);
+        }
+    } else if (llm_sax_path_is(p, "content.*")) {
+        jr->block_type[0] = '\0';
+    } else if (llm_sax_path_is(p, "content.*.input")) {
+        if (block_call(jr)) llm_sax_capture(p);
     }
+}
 
-    /* Parse JSON response */
-    cJSON *root = cJSON_Parse(rb.data);
-    resp_buf_free(&rb);
+static void json_on_end(llm_sax_t *p, bool is_array, void *ctx)
+{
+    llm_json_resp_t *jr = (llm_json_resp_t *)ctx;
+    if (is_array) return;
 
-    if (!root) {
-        snprintf(response_buf, buf_size, "Error: Failed to parse response");
-        return ESP_FAIL;
+    if (jr->b.openai) {
+        if (llm_sax_path_is(p, "choices.0.message.tool_calls.*")) {
+            stream_close_call(&jr->b);
+        }
+    } else if (llm_sax_path_is(p, "content.*") && jr->b.open_call >= 0) {
+        if (strcmp(jr->block_type, "tool_use") == 0) {
+            stream_close_call(&jr->b);
+        } else {
+            block_discard(jr);
+        }
     }
+}
 
-    if (provider_is_openai()) {
-        extract_text_openai(root, response_buf, buf_size);
-    } else {
-        extract_text_anthropic(root, response_buf, buf_size);
+static void json_on_string(llm_sax_t *p, const char *data, size_t len, bool done, void *ctx)
+{
+    llm_json_resp_t *jr = (llm_json_resp_t *)ctx;
+    llm_tool_call_t *call;
+
+    if (jr->b.openai) {
+        if (llm_sax_path_is(p, "choices.0.message.content")) {
+            stream_text(&jr->b, data, len);
+        } else if (llm_sax_path_is(p, "choices.0.finish_reason")) {
+            append_field(jr->stop, sizeof(jr->stop), data, len);
+        } else if (jr->b.open_call >= 0) {
+            call = &jr->b.resp->calls[jr->b.open_call];
+            if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.id")) {
+                append_field(call->id, sizeof(call->id), data, len);
+            } else if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.function.name")) {
+                append_field(call->name, sizeof(call->name), data, len);
+            } else if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.function.arguments")) {
+                stream_input(&jr->b, data, len);
+            }
+        }
+        return;
     }
-    cJSON_Delete(root);
 
-    if (response_buf[0] == '\0') {
-        snprintf(response_buf, buf_size, "No response from LLM API");
-    } else {
-        ESP_LOGI(TAG, "LLM response: %d bytes", (int)strlen(response_buf));
+    if (llm_sax_path_is(p, "content.*.text")) {
+        stream_text(&jr->b, data, len);
+    } else if (llm_sax_path_is(p, "content.*.type")) {
+        append_field(jr->block_type, sizeof(jr->block_type), data, len);
+    } else if (llm_sax_path_is(p, "content.*.id")) {
+        if ((call = block_call(jr))) append_field(call->id, sizeof(call->id), data, len);
+    } else if (llm_sax_path_is(p, "content.*.name")) {
+        if ((call = block_call(jr))) append_field(call->name, sizeof(call->name), data, len);
+    } else if (llm_sax_path_is(p, "stop_reason")) {
+        append_field(jr->stop, sizeof(jr->stop), data, len);
     }
+}
 
-    return ESP_OK;
+static void json_on_scalar(llm_sax_t *p, const char *tok, size_t len, void *ctx)
+{
+    llm_json_resp_t *jr = (llm_json_resp_t *)ctx;
+    llm_usage_t *u = &jr->b.resp->usage;
+
+    if (jr->b.openai) {
+        if (llm_sax_path_is(p, "usage.prompt_tokens")) {
+            jr->prompt_tokens = atoi(tok);
+        } else if (llm_sax_path_is(p, "usage.completion_tokens")) {
+            u->output_tokens = atoi(tok);
+        } else if (llm_sax_path_is(p, "usage.prompt_tokens_details.cached_tokens")) {
+            u->cache_read_tokens = atoi(tok);
+        }
+        return;
+    }
+
+    if (llm_sax_path_is(p, "usage.input_tokens")) {
+        u->input_tokens = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.cache_read_input_tokens")) {
+        u->cache_read_tokens = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.cache_creation_input_tokens")) {
+        u->cache_write_tokens = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.output_tokens")) {
+        u->output_tokens = atoi(tok);
+    }
 }
 
-/* ── Public: chat with tools (non-streaming) ──────────────────── */
+static void json_on_raw(llm_sax_t *p, const char *data, size_t len, void *ctx)
+{
+    stream_input(&((llm_json_resp_t *)ctx)->b, data, len);
+}
 
-void llm_response_free(llm_response_t *resp)
+static const llm_sax_handler_t s_json_handler = {
+    .on_start = json_on_start,
+    .on_end = json_on_end,
+    .on_string = json_on_string,
+    .on_scalar = json_on_scalar,
+    .on_raw = json_on_raw,
+};
+
+static esp_err_t json_on_body(const char *data, size_t len, int status, void *ctx)
 {
-    free(resp->text);
-    resp->text = NULL;
-    resp->text_len = 0;
-    for (int i = 0; i < resp->call_count; i++) {
-        free(resp->calls[i].input);
-        resp->calls[i].input = NULL;
+    llm_json_resp_t *jr = (llm_json_resp_t *)ctx;
+    jr->b.status = status;
+
+    if (status != 200) {
+        size_t room = sizeof(jr->b.err_body) - 1 - jr->b.err_len;
+        size_t n = len < room ? len : room;
+        memcpy(jr->b.err_body + jr->b.err_len, data, n);
+        jr->b.err_len += n;
+        jr->b.err_body[jr->b.err_len] = '\0';
+        return ESP_OK;
     }
-    resp->call_count = 0;
-    resp->tool_use = false;
+
+    if (llm_sax_feed(&jr->sax, data, len) != ESP_OK) jr->b.failed = true;
+    return jr->b.failed ? ESP_FAIL : ESP_OK;
 }
 
-esp_err_t llm_chat_tools(const char *system_prompt,
-                         cJSON *messages,
-                         const char *tools_json,
-                         llm_response_t *resp)
+static llm_json_resp_t *json_begin(const llm_request_t *req, llm_response_t *resp)
 {
-    memset(resp, 0, sizeof(*resp));
+    llm_json_resp_t *jr = calloc(1, sizeof(llm_json_resp_t));
+    if (!jr) return NULL;
+    jr->b.resp = resp;
+    jr->b.opts = &s_no_opts;
+    jr->b.open_call = -1;
+    jr->b.openai = req->openai;
+    llm_sax_init(&jr->sax, &s_json_handler, jr);
+    return jr;
+}
 
-    if (s_api_key[0] == '\0') return ESP_ERR_INVALID_STATE;
+/* Outcome of the exchange behind jr; frees jr */
+static esp_err_t json_end(llm_json_resp_t *jr, esp_err_t err, const http_result_t *res,
+                          llm_attempt_t *a)
+{
+    llm_response_t *resp = jr->b.resp;
+    /* Parse failures are reported through b.failed */
+    if (jr->b.failed) err = ESP_OK;
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
+    } else if (res->status != 200) {
+        ESP_LOGE(TAG, "API error %d: %s", res->status, jr->b.err_body);
+        err = ESP_FAIL;
+    } else if (jr->b.failed || llm_sax_finish(&jr->sax) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to parse API response JSON (%d bytes)", (int)jr->sax.bytes);
+        err = ESP_FAIL;
+    } else if (jr->b.openai) {
+        stream_close_call(&jr->b);
+        resp->tool_use = strcmp(jr->stop, "tool_calls") == 0 || resp->call_count > 0;
+        resp->usage.input_tokens = jr->prompt_tokens - resp->usage.cache_read_tokens;
+    } else {
+        resp->tool_use = strcmp(jr->stop, "tool_use") == 0;
+    }
+    attempt_fill(a, &jr->b, res);
 
-    /* Build request body (non-streaming) */
-    cJSON *body = cJSON_CreateObject();
-    cJSON_AddStringToObject(body, "model", s_model);
-    cJSON_AddNumberToObject(body, "max_tokens", MIMI_LLM_MAX_TOKENS);
+    free(jr);
+    return err;
+}
 
-    if (provider_is_openai()) {
-        cJSON *openai_msgs = convert_messages_openai(system_prompt, messages);
-        cJSON_AddItemToObject(body, "messages", openai_msgs);
+static esp_err_t llm_chat_json(const llm_request_t *req, llm_response_t *resp, llm_attempt_t *a)
+{
+    llm_json_resp_t *jr = json_begin(req, resp);
+    if (!jr) return ESP_ERR_NO_MEM;
 
-        if (tools_json) {
-            cJSON *tools = convert_tools_openai(tools_json);
-            if (tools) {
-                cJSON_AddItemToObject(body, "tools", tools);
-                cJSON_AddStringToObject(body, "tool_choice", "auto");
-            }
-        }
-    } else {
-        cJSON_AddStringToObject(body, "system", system_prompt);
+    http_result_t res;
+    esp_err_t err = llm_http_call(req, retry_after_header, json_on_body, jr, &res);
+    return json_end(jr, err, &res, a);
+}
 
-        /* Deep-copy messages so caller keeps ownership */
-        cJSON *msgs_copy = cJSON_Duplicate(messages, 1);
-        cJSON_AddItemToObject(body, "messages", msgs_copy);
+/* ── Calls: retries, failover, hedging ────────────────────────── */
 
-        /* Add tools array if provided */
-        if (tools_json) {
-            cJSON *tools = cJSON_Parse(tools_json);
-            if (tools) {
-                cJSON_AddItemToObject(body, "tools", tools);
+/*
+ * A call makes up to MIMI_LLM_MAX_ATTEMPTS attempts. After a failure the
+ * other provider (when a fallback key is set) is tried first, since it
+ * needs no wait; otherwise the same provider is retried after a jittered
+ * exponential backoff, or after the Retry-After the server asked for.
+ * Providers whose circuit breaker is open are skipped (llm_health). An
+ * attempt whose text or tool calls already reached the caller is never
+ * repeated.
+ */
+
+typedef struct {
+    const char *system_prompt;
+    size_t stable_len;
+    llm_conv_t *conv;                   /* in the configured provider's shape */
+    llm_conv_t alt;                     /* copy for the other provider, made on failover */
+    const char *tools_json;             /* Anthropic shape */
+    const char *tools[LLM_PROVIDER_COUNT];
+    char *owned_tools[LLM_PROVIDER_COUNT];
+    bool tools_ready[LLM_PROVIDER_COUNT];
+    const llm_chat_opts_t *opts;        /* NULL for a non-streaming call */
+    int64_t build_us;
+} llm_call_t;
+
+typedef enum {
+    FAIL_NONE = 0,
+    FAIL_TRANSIENT,         /* no answer, cut short, 408, 429, 5xx: try again */
+    FAIL_PROVIDER,          /* 401 / 403 / 404: only the other provider can help */
+    FAIL_REQUEST,           /* refused as malformed or too large, or never sent */
+} fail_kind_t;
+
+static fail_kind_t classify(esp_err_t err, const llm_attempt_t *a)
+{
+    if (err == ESP_OK) return FAIL_NONE;
+    if (err == ESP_ERR_NO_MEM || err == ESP_ERR_INVALID_SIZE) return FAIL_REQUEST;
+    int status = a->status;
+    if (status == 401 || status == 403 || status == 404) return FAIL_PROVIDER;
+    if (status == 0 || status == 200 || status == 408 || status == 429 || status >= 500) {
+        return FAIL_TRANSIENT;
+    }
+    return FAIL_REQUEST;
+}
+
+static llm_outcome_t outcome_of(fail_kind_t kind)
+{
+    if (kind == FAIL_NONE) return LLM_OUTCOME_OK;
+    return kind == FAIL_REQUEST ? LLM_OUTCOME_NEUTRAL : LLM_OUTCOME_FAILED;
+}
+
+/* Request for target t, converting the conversation on first use */
+static esp_err_t call_request(llm_call_t *call, const llm_target_t *t, llm_request_t *req)
+{
+    const llm_conv_t *conv = call->conv;
+    if (t->provider != conv->provider) {
+        if (!call->alt.messages) {
+            esp_err_t err = llm_conv_convert(call->conv, t->provider, &call->alt);
+            if (err != ESP_OK) {
+                llm_conv_free(&call->alt);
+                return err;
             }
+            call->build_us += call->alt.build_us;
         }
+        conv = &call->alt;
+    }
+    if (!call->tools_ready[t->provider]) {
+        call->tools[t->provider] = llm_conv_tools(t->provider, call->tools_json,
+                                                  &call->owned_tools[t->provider]);
+        call->tools_ready[t->provider] = true;
     }
 
-    char *post_data = cJSON_PrintUnformatted(body);
-    cJSON_Delete(body);
-    if (!post_data) return ESP_ERR_NO_MEM;
+    bool openai = t->provider == LLM_PROVIDER_OPENAI;
+    *req = (llm_request_t){
+        .target = t,
+        .system_prompt = call->system_prompt,
+        .stable_len = call->stable_len,
+        .messages = conv->messages,
+        .tools_json = call->tools[t->provider],
+        .openai = openai,
+        .stream = call->opts && call->opts->stream,
+        .cache = MIMI_LLM_PROMPT_CACHE && !openai,
+        .build_us = call->build_us,
+    };
+    call->build_us = 0;
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Calling LLM API with tools (provider: %s, model: %s, body: %d bytes)",
-             s_provider, s_model, (int)strlen(post_data));
+static void call_free(llm_call_t *call)
+{
+    llm_conv_free(&call->alt);
+    for (int i = 0; i < LLM_PROVIDER_COUNT; i++) free(call->owned_tools[i]);
+}
+
+/* probe: this attempt holds the provider's breaker probe (llm_health_allow) */
+static esp_err_t attempt_once(llm_call_t *call, const llm_target_t *t, bool probe,
+                              llm_response_t *resp, llm_attempt_t *a)
+{
+    llm_request_t req;
+    esp_err_t err = call_request(call, t, &req);
+    if (err == ESP_OK && req.stream) {
+        err = llm_chat_stream(&req, call->opts, resp, a);
+    } else if (err == ESP_OK) {
+        err = llm_chat_json(&req, resp, a);
+    }
+    llm_health_record(t->provider, probe, outcome_of(classify(err, a)), a->first_byte_us);
+    return err;
+}
 
-    /* HTTP call */
-    resp_buf_t rb;
-    if (resp_buf_init(&rb, MIMI_LLM_STREAM_BUF_SIZE) != ESP_OK) {
-        free(post_data);
-        return ESP_ERR_NO_MEM;
+/*
+ * Hedging: a non-streaming attempt that has no answer after
+ * MIMI_LLM_HEDGE_MS is sent a second time, to the other provider if it is
+ * available. Both legs run on http_io; the first to see a 200 wins and
+ * the other is abandoned. Streaming calls are not hedged, since their
+ * callbacks must run on the caller's task as the answer arrives.
+ */
+
+typedef struct hedge hedge_t;
+
+typedef struct {
+    hedge_t *h;
+    int index;
+    const llm_target_t *target;
+    bool probe;                 /* holds the target's breaker probe */
+    llm_request_t req;
+    llm_json_resp_t *jr;
+    llm_response_t resp;
+    char headers[512];
+    http_request_t hreq;
+    volatile bool cancel;
+    bool submitted;
+    volatile bool finished;
+    esp_err_t err;
+    http_result_t res;
+} hedge_leg_t;
+
+struct hedge {
+    hedge_leg_t legs[2];
+    int winner;                 /* leg that saw a 200 first, -1 = none yet */
+    portMUX_TYPE mux;
+    SemaphoreHandle_t done;     /* given once per finished leg */
+};
+
+static esp_err_t hedge_on_body(const char *data, size_t len, int status, void *ctx)
+{
+    hedge_leg_t *leg = (hedge_leg_t *)ctx;
+    hedge_t *h = leg->h;
+    if (status == 200) {
+        portENTER_CRITICAL(&h->mux);
+        if (h->winner < 0) h->winner = leg->index;
+        bool won = h->winner == leg->index;
+        portEXIT_CRITICAL(&h->mux);
+        if (!won) return ESP_FAIL;
+        h->legs[1 - leg->index].cancel = true;
     }
+    return json_on_body(data, len, status, leg->jr);
+}
+
+static void hedge_on_header(const char *name, const char *value, void *ctx)
+{
+    retry_after_header(name, value, ((hedge_leg_t *)ctx)->jr);
+}
 
-    int status = 0;
-    esp_err_t err = llm_http_call(post_data, &rb, &status);
-    free(post_data);
+static void hedge_on_done(esp_err_t err, const http_result_t *res, void *ctx)
+{
+    hedge_leg_t *leg = (hedge_leg_t *)ctx;
+    leg->err = err;
+    leg->res = *res;
+    leg->finished = true;
+    xSemaphoreGive(leg->h->done);
+}
 
+static esp_err_t hedge_submit(llm_call_t *call, hedge_leg_t *leg, uint32_t delay_ms)
+{
+    esp_err_t err = call_request(call, leg->target, &leg->req);
+    if (err != ESP_OK) return err;
+    leg->jr = json_begin(&leg->req, &leg->resp);
+    if (!leg->jr) return ESP_ERR_NO_MEM;
+    err = llm_http_prepare(&leg->req, leg->headers, sizeof(leg->headers),
+                           hedge_on_header, hedge_on_body, leg, &leg->hreq);
+    leg->hreq.cancel = &leg->cancel;
+    if (err == ESP_OK) err = http_transport_submit(&leg->hreq, delay_ms, hedge_on_done, leg);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
-        resp_buf_free(&rb);
+        free(leg->jr);
+        leg->jr = NULL;
         return err;
     }
+    leg->submitted = true;
+    return ESP_OK;
+}
 
-    if (status != 200) {
-        ESP_LOGE(TAG, "API error %d: %.500s", status, rb.data ? rb.data : "");
-        resp_buf_free(&rb);
-        return ESP_FAIL;
+static esp_err_t attempt_hedged(llm_call_t *call, const llm_target_t *t, bool probe,
+                                const llm_target_t *alt, llm_response_t *resp, llm_attempt_t *a)
+{
+    hedge_t *h = calloc(1, sizeof(hedge_t));
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(2, 0);
+    if (!h || !done) {
+        free(h);
+        if (done) vSemaphoreDelete(done);
+        return attempt_once(call, t, probe, resp, a);
+    }
+    h->winner = -1;
+    h->done = done;
+    portMUX_INITIALIZE(&h->mux);
+    for (int i = 0; i < 2; i++) {
+        h->legs[i].h = h;
+        h->legs[i].index = i;
+    }
+    h->legs[0].target = t;
+    h->legs[0].probe = probe;
+    h->legs[1].target = alt;
+
+    if (hedge_submit(call, &h->legs[0], 0) != ESP_OK) {
+        /* No http_io task (yet): plain attempt */
+        free(h);
+        vSemaphoreDelete(done);
+        return attempt_once(call, t, probe, resp, a);
+    }
+    int submitted = 1;
+    if (llm_health_allow(alt->provider, &h->legs[1].probe)) {
+        if (hedge_submit(call, &h->legs[1], MIMI_LLM_HEDGE_MS) == ESP_OK) {
+            submitted++;
+        } else {
+            llm_health_record(alt->provider, h->legs[1].probe, LLM_OUTCOME_NEUTRAL, 0);
+        }
     }
 
-    /* Parse full JSON response */
-    cJSON *root = cJSON_Parse(rb.data);
-    resp_buf_free(&rb);
-
-    if (!root) {
-        ESP_LOGE(TAG, "Failed to parse API response JSON");
-        return ESP_FAIL;
+    /* Until the winner's response is complete, or every leg has failed */
+    int64_t hedge_at_us = esp_timer_get_time() + MIMI_LLM_HEDGE_MS * 1000LL;
+    int finished = 0;
+    while (finished < submitted) {
+        xSemaphoreTake(done, portMAX_DELAY);
+        finished++;
+        int winner = h->winner;
+        if (winner >= 0 && h->legs[winner].finished) break;
+        /* A quick failure before the hedge is due is left to the retry logic */
+        if (winner < 0 && esp_timer_get_time() < hedge_at_us) h->legs[1].cancel = true;
+    }
+    h->legs[0].cancel = true;
+    h->legs[1].cancel = true;
+    while (finished < submitted) {
+        xSemaphoreTake(done, portMAX_DELAY);
+        finished++;
     }
 
-    if (provider_is_openai()) {
-        cJSON *choices = cJSON_GetObjectItem(root, "choices");
-        cJSON *choice0 = choices && cJSON_IsArray(choices) ? cJSON_GetArrayItem(choices, 0) : NULL;
-        if (choice0) {
-            cJSON *finish = cJSON_GetObjectItem(choice0, "finish_reason");
-            if (finish && cJSON_IsString(finish)) {
-                resp->tool_use = (strcmp(finish->valuestring, "tool_calls") == 0);
-            }
+    int pick = h->winner >= 0 ? h->winner : 0;
+    esp_err_t err = ESP_FAIL;
+    for (int i = 0; i < 2; i++) {
+        hedge_leg_t *leg = &h->legs[i];
+        if (!leg->submitted) continue;
+
+        llm_attempt_t la = {0};
+        /* Cancelled, or cut off by the other leg's 200: no verdict on the provider */
+        bool abandoned = leg->err == ESP_ERR_NOT_FINISHED ||
+                         (h->winner >= 0 && h->winner != i && leg->res.status == 200);
+        esp_err_t leg_err = leg->err;
+        if (abandoned) {
+            free(leg->jr);
+            llm_health_record(leg->target->provider, leg->probe, LLM_OUTCOME_NEUTRAL, 0);
+        } else {
+            leg_err = json_end(leg->jr, leg->err, &leg->res, &la);
+            llm_health_record(leg->target->provider, leg->probe,
+                              outcome_of(classify(leg_err, &la)), la.first_byte_us);
+        }
+        if (leg->err != ESP_ERR_NOT_FINISHED) conn_record(&leg->res);
+        if (i == 1 && leg->err != ESP_ERR_NOT_FINISHED) {
+            llm_health_note(leg->target->provider, LLM_NOTE_HEDGE);
+            if (h->winner == 1) llm_health_note(leg->target->provider, LLM_NOTE_HEDGE_WIN);
+        }
 
-            cJSON *message = cJSON_GetObjectItem(choice0, "message");
-            if (message) {
-                cJSON *content = cJSON_GetObjectItem(message, "content");
-                if (content && cJSON_IsString(content)) {
-                    size_t tlen = strlen(content->valuestring);
-                    resp->text = calloc(1, tlen + 1);
-                    if (resp->text) {
-                        memcpy(resp->text, content->valuestring, tlen);
-                        resp->text_len = tlen;
-                    }
-                }
+        if (i == pick) {
+            *resp = leg->resp;
+            *a = la;
+            err = leg_err;
+        } else {
+            llm_response_free(&leg->resp);
+        }
+    }
+    if (h->winner == 1) {
+        ESP_LOGI(TAG, "Hedged request to %s answered first", provider_name(alt->provider));
+    }
+    free(h);
+    vSemaphoreDelete(done);
+    return err;
+}
 
-                cJSON *tool_calls = cJSON_GetObjectItem(message, "tool_calls");
-                if (tool_calls && cJSON_IsArray(tool_calls)) {
-                    cJSON *tc;
-                    cJSON_ArrayForEach(tc, tool_calls) {
-                        if (resp->call_count >= MIMI_MAX_TOOL_CALLS) break;
-                        llm_tool_call_t *call = &resp->calls[resp->call_count];
-                        cJSON *id = cJSON_GetObjectItem(tc, "id");
-                        cJSON *func = cJSON_GetObjectItem(tc, "function");
-                        if (id && cJSON_IsString(id)) {
-                            strncpy(call->id, id->valuestring, sizeof(call->id) - 1);
-                        }
-                        if (func) {
-                            cJSON *name = cJSON_GetObjectItem(func, "name");
-                            cJSON *args = cJSON_GetObjectItem(func, "arguments");
-                            if (name && cJSON_IsString(name)) {
-                                strncpy(call->name, name->valuestring, sizeof(call->name) - 1);
-                            }
-                            if (args && cJSON_IsString(args)) {
-                                call->input = strdup(args->valuestring);
-                                if (call->input) {
-                                    call->input_len = strlen(call->input);
-                                }
-                            }
-                        }
-                        resp->call_count++;
-                    }
-                    if (resp->call_count > 0) {
-                        resp->tool_use = true;
-                    }
-                }
-            }
+/* Exponential backoff with jitter, unless the server said how long to wait */
+static uint32_t retry_delay_ms(int retry, uint32_t retry_after_ms)
+{
+    if (retry_after_ms) return retry_after_ms;
+    uint32_t cap = MIMI_LLM_BACKOFF_BASE_MS << (retry < 5 ? retry : 5);
+    if (cap > MIMI_LLM_BACKOFF_MAX_MS) cap = MIMI_LLM_BACKOFF_MAX_MS;
+    /* Workers failing together would otherwise retry together */
+    return cap / 2 + esp_random() % (cap / 2 + 1);
+}
+
+static esp_err_t llm_call_run(llm_call_t *call, llm_response_t *resp)
+{
+    llm_target_t targets[2];
+    target_primary(&targets[0]);
+    int count = target_fallback(&targets[1]) ? 2 : 1;
+    bool hedge = MIMI_LLM_HEDGE_MS > 0 && !(call->opts && call->opts->stream);
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    fail_kind_t kind = FAIL_NONE;
+    llm_attempt_t a = {0};
+    int prev = -1, retries = 0;
+    for (int n = 0; n < MIMI_LLM_MAX_ATTEMPTS; n++) {
+        /* After a failure the other provider goes first: it needs no wait */
+        int prefer = (prev >= 0 && count == 2) ? 1 - prev : 0;
+        int cur = -1;
+        bool probe = false;
+        if (llm_health_allow(targets[prefer].provider, &probe)) {
+            cur = prefer;
+        } else if (count == 2 && llm_health_allow(targets[1 - prefer].provider, &probe)) {
+            cur = 1 - prefer;
         }
-    } else {
-        /* stop_reason */
-        cJSON *stop_reason = cJSON_GetObjectItem(root, "stop_reason");
-        if (stop_reason && cJSON_IsString(stop_reason)) {
-            resp->tool_use = (strcmp(stop_reason->valuestring, "tool_use") == 0);
+        if (cur < 0) {
+            ESP_LOGE(TAG, "No LLM provider available (circuit breaker open)");
+            break;
         }
-
-        /* Iterate content blocks */
-        cJSON *content = cJSON_GetObjectItem(root, "content");
-        if (content && cJSON_IsArray(content)) {
-            /* Accumulate total text length first */
-            size_t total_text = 0;
-            cJSON *block;
-            cJSON_ArrayForEach(block, content) {
-                cJSON *btype = cJSON_GetObjectItem(block, "type");
-                if (btype && strcmp(btype->valuestring, "text") == 0) {
-                    cJSON *text = cJSON_GetObjectItem(block, "text");
-                    if (text && cJSON_IsString(text)) {
-                        total_text += strlen(text->valuestring);
-                    }
+        const llm_target_t *t = &targets[cur];
+
+        if (cur == prev) {
+            uint32_t delay_ms = retry_delay_ms(retries++, a.retry_after_ms);
+            if (kind == FAIL_PROVIDER || delay_ms > MIMI_LLM_RETRY_AFTER_MAX_MS) {
+                if (kind != FAIL_PROVIDER) {
+                    ESP_LOGE(TAG, "%s asks to wait %d s, giving up",
+                             provider_name(t->provider), (int)(delay_ms / 1000));
                 }
+                llm_health_record(t->provider, probe, LLM_OUTCOME_NEUTRAL, 0);
+                break;
             }
+            ESP_LOGW(TAG, "Retrying %s in %d ms", provider_name(t->provider), (int)delay_ms);
+            vTaskDelay(pdMS_TO_TICKS(delay_ms));
+            llm_health_note(t->provider, LLM_NOTE_RETRY);
+        } else if (prev >= 0) {
+            ESP_LOGW(TAG, "Failing over from %s to %s (model %s)",
+                     provider_name(targets[prev].provider), provider_name(t->provider), t->model);
+            llm_health_note(t->provider, LLM_NOTE_FAILOVER);
+        }
 
-            /* Allocate and copy text */
-            if (total_text > 0) {
-                resp->text = calloc(1, total_text + 1);
-                if (resp->text) {
-                    cJSON_ArrayForEach(block, content) {
-                        cJSON *btype = cJSON_GetObjectItem(block, "type");
-                        if (!btype || strcmp(btype->valuestring, "text") != 0) continue;
-                        cJSON *text = cJSON_GetObjectItem(block, "text");
-                        if (!text || !cJSON_IsString(text)) continue;
-                        size_t tlen = strlen(text->valuestring);
-                        memcpy(resp->text + resp->text_len, text->valuestring, tlen);
-                        resp->text_len += tlen;
-                    }
-                    resp->text[resp->text_len] = '\0';
-                }
-            }
+        memset(&a, 0, sizeof(a));
+        memset(resp, 0, sizeof(*resp));
+        const llm_target_t *alt = &targets[count == 2 ? 1 - cur : cur];
+        err = hedge ? attempt_hedged(call, t, probe, alt, resp, &a)
+                    : attempt_once(call, t, probe, resp, &a);
+        kind = classify(err, &a);
+        if (kind == FAIL_NONE) return ESP_OK;
+
+        llm_response_free(resp);
+        if (kind == FAIL_REQUEST || a.delivered) break;
+        prev = cur;
+    }
+    return err;
+}
 
-            /* Extract tool_use blocks */
-            cJSON_ArrayForEach(block, content) {
-                cJSON *btype = cJSON_GetObjectItem(block, "type");
-                if (!btype || strcmp(btype->valuestring, "tool_use") != 0) continue;
-                if (resp->call_count >= MIMI_MAX_TOOL_CALLS) break;
+/* ── Public: chat with tools ──────────────────────────────────── */
 
-                llm_tool_call_t *call = &resp->calls[resp->call_count];
+void llm_response_free(llm_response_t *resp)
+{
+    free(resp->text);
+    resp->text = NULL;
+    resp->text_len = 0;
+    for (int i = 0; i < resp->call_count; i++) {
+        free(resp->calls[i].input);
+        resp->calls[i].input = NULL;
+    }
+    resp->call_count = 0;
+    resp->tool_use = false;
+}
 
-                cJSON *id = cJSON_GetObjectItem(block, "id");
-                if (id && cJSON_IsString(id)) {
-                    strncpy(call->id, id->valuestring, sizeof(call->id) - 1);
-                }
+esp_err_t llm_chat_tools(const char *system_prompt,
+                         llm_conv_t *conv,
+                         const char *tools_json,
+                         const llm_chat_opts_t *opts,
+                         llm_response_t *resp)
+{
+    memset(resp, 0, sizeof(*resp));
 
-                cJSON *name = cJSON_GetObjectItem(block, "name");
-                if (name && cJSON_IsString(name)) {
-                    strncpy(call->name, name->valuestring, sizeof(call->name) - 1);
-                }
+    if (s_api_key[0] == '\0') return ESP_ERR_INVALID_STATE;
+    if (conv->provider != llm_get_provider()) {
+        ESP_LOGE(TAG, "Provider changed during the conversation");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-                cJSON *input = cJSON_GetObjectItem(block, "input");
-                if (input) {
-                    char *input_str = cJSON_PrintUnformatted(input);
-                    if (input_str) {
-                        call->input = input_str;
-                        call->input_len = strlen(input_str);
-                    }
-                }
+    bool stream = opts && opts->stream;
+    llm_call_t call = {
+        .system_prompt = system_prompt,
+        .stable_len = opts ? opts->system_stable_len : 0,
+        .conv = conv,
+        .tools_json = tools_json,
+        .opts = opts,
+        .build_us = conv->build_us,
+    };
+    conv->build_us = 0;
 
-                resp->call_count++;
-            }
-        }
+    /*
+     * The body is serialised from the conversation, already in the
+     * provider's shape, directly into the connection.
+     */
+    esp_err_t err = llm_call_run(&call, resp);
+    call_free(&call);
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Response: %d bytes text, %d tool calls, stop=%s%s",
+             (int)resp->text_len, resp->call_count,
+             resp->tool_use ? "tool_use" : "end_turn", stream ? " (streamed)" : "");
+    usage_record(&resp->usage);
+    return ESP_OK;
+}
+
+/* ── Public: simple chat (backward compat) ────────────────────── */
+
+esp_err_t llm_chat(const char *system_prompt, const char *messages_json,
+                   char *response_buf, size_t buf_size)
+{
+    if (s_api_key[0] == '\0') {
+        snprintf(response_buf, buf_size, "Error: No API key configured");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    cJSON_Delete(root);
+    llm_conv_t conv;
+    cJSON *messages = cJSON_Parse(messages_json);
+    esp_err_t err = llm_conv_init(&conv, llm_get_provider(), cJSON_IsArray(messages) ? messages : NULL);
+    if (err == ESP_OK && !cJSON_IsArray(messages)) {
+        err = llm_conv_add_user(&conv, messages_json);
+    }
+    if (!cJSON_IsArray(messages)) cJSON_Delete(messages);
+    if (err != ESP_OK) {
+        llm_conv_free(&conv);
+        snprintf(response_buf, buf_size, "Error: out of memory");
+        return err;
+    }
 
-    ESP_LOGI(TAG, "Response: %d bytes text, %d tool calls, stop=%s",
-             (int)resp->text_len, resp->call_count,
-             resp->tool_use ? "tool_use" : "end_turn");
+    /* Request body (non-streaming), written straight into the connection */
+    llm_call_t call = {
+        .system_prompt = system_prompt,
+        .conv = &conv,
+        .build_us = conv.build_us,
+    };
 
-    return ESP_OK;
+    llm_response_t resp;
+    memset(&resp, 0, sizeof(resp));
+    err = llm_call_run(&call, &resp);
+    call_free(&call);
+    llm_conv_free(&conv);
+
+    if (err != ESP_OK) {
+        snprintf(response_buf, buf_size, "Error: LLM request failed (%s)", esp_err_to_name(err));
+    } else if (resp.text_len == 0) {
+        snprintf(response_buf, buf_size, "No response from LLM API");
+        err = ESP_ERR_NOT_FOUND;
+    } else {
+        safe_copy(response_buf, buf_size, resp.text);
+        ESP_LOGI(TAG, "LLM response: %d bytes", (int)resp.text_len);
+    }
+    llm_response_free(&resp);
+    return err;
 }
 
 /* ── NVS helpers ──────────────────────────────────────────────── */
@@ -843,3 +1617,32 @@ esp_err_t llm_set_provider(const char *provider)
     ESP_LOGI(TAG, "Provider set to: %s", s_provider);
     return ESP_OK;
 }
+
+esp_err_t llm_set_fallback(const char *api_key, const char *model)
+{
+    nvs_handle_t nvs;
+    ESP_ERROR_CHECK(nvs_open(MIMI_NVS_LLM, NVS_READWRITE, &nvs));
+    if (api_key[0]) {
+        ESP_ERROR_CHECK(nvs_set_str(nvs, MIMI_NVS_KEY_FB_API_KEY, api_key));
+    } else {
+        nvs_erase_key(nvs, MIMI_NVS_KEY_FB_API_KEY);
+    }
+    if (model && model[0]) {
+        ESP_ERROR_CHECK(nvs_set_str(nvs, MIMI_NVS_KEY_FB_MODEL, model));
+    } else {
+        nvs_erase_key(nvs, MIMI_NVS_KEY_FB_MODEL);
+    }
+    ESP_ERROR_CHECK(nvs_commit(nvs));
+    nvs_close(nvs);
+
+    safe_copy(s_fb_api_key, sizeof(s_fb_api_key), api_key);
+    safe_copy(s_fb_model, sizeof(s_fb_model), model ? model : "");
+
+    llm_target_t fb;
+    if (target_fallback(&fb)) {
+        ESP_LOGI(TAG, "Fallback set to: %s (model %s)", provider_name(fb.provider), fb.model);
+    } else {
+        ESP_LOGI(TAG, "Fallback cleared");
+    }
+    return ESP_OK;
+}
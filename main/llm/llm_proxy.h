@@ -4,14 +4,33 @@
 #include "cJSON.h"
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "mimi_config.h"
 
+typedef enum {
+    LLM_PROVIDER_ANTHROPIC = 0,
+    LLM_PROVIDER_OPENAI,
+    LLM_PROVIDER_COUNT,
+} llm_provider_t;
+
 /**
  * Initialize the LLM proxy. Reads API key and model from build-time secrets, then NVS.
  */
 esp_err_t llm_proxy_init(void);
 
+/**
+ * Start the task that opens API connections ahead of requests.
+ */
+esp_err_t llm_proxy_start(void);
+
+/**
+ * Make sure a connection to the API is open or being opened, without
+ * blocking. Call when a request is about to be built, so the TCP and TLS
+ * handshakes overlap with prompt assembly. No-op behind a proxy.
+ */
+void llm_prewarm(void);
+
 /**
  * Save the LLM API key to NVS.
  */
@@ -22,11 +41,22 @@ esp_err_t llm_set_api_key(const char *api_key);
  */
 esp_err_t llm_set_provider(const char *provider);
 
+/**
+ * The configured provider. Changes take effect with the next conversation.
+ */
+llm_provider_t llm_get_provider(void);
+
 /**
  * Save the model identifier to NVS.
  */
 esp_err_t llm_set_model(const char *model);
 
+/**
+ * Set the key (and optionally the model) of the other provider and save
+ * them to NVS. Failed calls then fail over to it; an empty key clears it.
+ */
+esp_err_t llm_set_fallback(const char *api_key, const char *model);
+
 /**
  * Send a chat completion request to the configured LLM API (non-streaming).
  *
@@ -48,26 +78,110 @@ typedef struct {
     size_t input_len;
 } llm_tool_call_t;
 
+typedef struct {
+    int input_tokens;           /* input not served from the prompt cache */
+    int cache_read_tokens;      /* input read from the provider's prompt cache */
+    int cache_write_tokens;     /* input written to the prompt cache */
+    int output_tokens;
+} llm_usage_t;
+
 typedef struct {
     char *text;                                  /* accumulated text blocks */
     size_t text_len;
     llm_tool_call_t calls[MIMI_MAX_TOOL_CALLS];
     int call_count;
     bool tool_use;                               /* stop_reason == "tool_use" */
+    llm_usage_t usage;                           /* token counts reported by the API */
 } llm_response_t;
 
 void llm_response_free(llm_response_t *resp);
 
+typedef struct {
+    uint32_t requests;
+    uint64_t total_us;          /* history conversion + body length count */
+    uint32_t max_us;
+} llm_build_stats_t;
+
+typedef struct {
+    uint32_t handshakes;        /* new connections: TCP connect + TLS handshake */
+    uint32_t reused;            /* requests sent on a kept-alive connection */
+    uint32_t prewarmed;         /* connections opened ahead of a request */
+    uint32_t stale;             /* kept connections found closed by the server */
+    uint64_t handshake_us;      /* total time spent connecting */
+    uint32_t responses;         /* responses whose first byte arrived */
+    uint64_t ttfb_us;           /* request start → first response byte, summed */
+    uint64_t ttfb_connect_us;   /* part of ttfb_us spent connecting */
+    uint64_t ttfb_server_us;    /* part of ttfb_us waiting after the request was sent */
+} llm_conn_stats_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t cache_hits;        /* calls that read part of the prompt from cache */
+    uint32_t cache_misses;      /* calls that read nothing from cache */
+    uint64_t input_tokens;
+    uint64_t cache_read_tokens;
+    uint64_t cache_write_tokens;
+    uint64_t output_tokens;
+    llm_build_stats_t build[LLM_PROVIDER_COUNT];    /* request building time */
+    llm_conn_stats_t conn;                          /* connections and time to first byte */
+} llm_usage_stats_t;
+
+/**
+ * Copy token usage, prompt cache, request building and connection counters.
+ */
+void llm_get_usage_stats(llm_usage_stats_t *out);
+
+/* ── Streaming ─────────────────────────────────────────────────── */
+
+/**
+ * Called with each text delta as it arrives (not NUL-terminated).
+ * Runs on the task that called llm_chat_tools().
+ */
+typedef void (*llm_text_cb_t)(const char *delta, size_t len, void *ctx);
+
 /**
- * Send a chat completion request with tools to the configured LLM API (non-streaming).
+ * Called once per tool call as soon as its block has fully arrived, while
+ * the rest of the response may still be streaming. `index` is the call's
+ * slot in llm_response_t.calls; the call is only valid during the callback.
+ */
+typedef void (*llm_tool_cb_t)(int index, const llm_tool_call_t *call, void *ctx);
+
+typedef struct {
+    bool stream;            /* request "stream": true and parse server-sent events */
+    llm_text_cb_t on_text;  /* optional text delta callback (stream mode only) */
+    llm_tool_cb_t on_tool;  /* optional completed tool call callback (stream mode only) */
+    void *ctx;              /* passed to callbacks */
+    size_t system_stable_len;   /* leading bytes of system_prompt that stay identical
+                                   across turns; gets its own cache breakpoint */
+} llm_chat_opts_t;
+
+/* History in the provider's native shape, see llm/llm_conv.h */
+typedef struct llm_conv llm_conv_t;
+
+/**
+ * Send a chat completion request with tools to the configured LLM API.
+ *
+ * In stream mode the response is parsed event by event into resp, so the
+ * raw body is never buffered; text deltas are reported through on_text.
+ * The resulting llm_response_t is identical in both modes.
+ *
+ * With Anthropic, cache_control breakpoints are placed after the tools, the
+ * stable system prefix, the whole system prompt and the last message, so
+ * later calls in a turn and the next turn reuse the provider's prompt cache.
+ *
+ * The conversation must have been created for the configured provider;
+ * after a provider switch it fails with ESP_ERR_INVALID_STATE.
  *
  * @param system_prompt  System prompt string
- * @param messages       cJSON array of messages (caller owns)
- * @param tools_json     Pre-built JSON string of tools array, or NULL for no tools
+ * @param conv           Conversation so far (caller owns)
+ * @param tools_json     Pre-built Anthropic JSON string of tools array
+ *                       (converted for OpenAI), or NULL for no tools
+ * @param opts           Streaming options, or NULL for a non-streaming request
  * @param resp           Output: structured response with text and tool calls
  * @return ESP_OK on success
  */
 esp_err_t llm_chat_tools(const char *system_prompt,
-                         cJSON *messages,
+                         llm_conv_t *conv,
                          const char *tools_json,
+                         const llm_chat_opts_t *opts,
                          llm_response_t *resp);
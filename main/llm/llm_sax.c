@@ -0,0 +1,412 @@
+#include "llm_sax.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    S_VALUE = 0,        /* expecting a value */
+    S_VALUE_OR_END,     /* after '[' */
+    S_KEY_OR_END,       /* after '{' */
+    S_KEY,              /* after ',' in an object */
+    S_COLON,
+    S_AFTER,            /* after a member / element */
+    S_STRING,
+    S_ESC,
+    S_HEX,
+    S_TOKEN,
+    S_DONE,
+} sax_state_t;
+
+static bool is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void fail(llm_sax_t *p)
+{
+    p->err = ESP_ERR_INVALID_RESPONSE;
+}
+
+void llm_sax_init(llm_sax_t *p, const llm_sax_handler_t *h, void *ctx)
+{
+    memset(p, 0, sizeof(*p));
+    p->h = h;
+    p->ctx = ctx;
+    p->state = S_VALUE;
+    p->capture_depth = -1;
+}
+
+void llm_sax_capture(llm_sax_t *p)
+{
+    p->capture_req = true;
+}
+
+/* ── String bytes ──────────────────────────────────────────── */
+
+static void flush_str(llm_sax_t *p, bool done)
+{
+    if (p->h->on_string) p->h->on_string(p, p->str, p->str_len, done, p->ctx);
+    p->str_len = 0;
+}
+
+static void put_byte(llm_sax_t *p, char c)
+{
+    if (p->in_key) {
+        llm_sax_frame_t *f = &p->frames[p->depth - 1];
+        if (p->key_len < sizeof(f->key) - 1) {
+            f->key[p->key_len++] = c;
+            f->key[p->key_len] = '\0';
+        } else {
+            f->key_long = true;
+        }
+        return;
+    }
+    p->str[p->str_len++] = c;
+    if (p->str_len == sizeof(p->str)) flush_str(p, false);
+}
+
+static void put_codepoint(llm_sax_t *p, unsigned cp)
+{
+    if (cp < 0x80) {
+        put_byte(p, (char)cp);
+    } else if (cp < 0x800) {
+        put_byte(p, (char)(0xC0 | (cp >> 6)));
+        put_byte(p, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        put_byte(p, (char)(0xE0 | (cp >> 12)));
+        put_byte(p, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        put_byte(p, (char)(0x80 | (cp & 0x3F)));
+    } else {
+        put_byte(p, (char)(0xF0 | (cp >> 18)));
+        put_byte(p, (char)(0x80 | ((cp >> 12) & 0x3F)));
+        put_byte(p, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        put_byte(p, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+/* A high surrogate not followed by a low one becomes U+FFFD */
+static void drop_high(llm_sax_t *p)
+{
+    if (p->high) {
+        put_codepoint(p, 0xFFFD);
+        p->high = 0;
+    }
+}
+
+static void put_escape_u(llm_sax_t *p, unsigned cp)
+{
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        drop_high(p);
+        p->high = cp;
+    } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        if (p->high) {
+            put_codepoint(p, 0x10000 + ((p->high - 0xD800) << 10) + (cp - 0xDC00));
+            p->high = 0;
+        } else {
+            put_codepoint(p, 0xFFFD);
+        }
+    } else {
+        drop_high(p);
+        put_codepoint(p, cp);
+    }
+}
+
+/* ── Structure ─────────────────────────────────────────────── */
+
+static void value_done(llm_sax_t *p)
+{
+    p->state = (p->depth == 0) ? S_DONE : S_AFTER;
+    if (p->depth == 0) p->done = true;
+}
+
+static void open_container(llm_sax_t *p, bool is_array)
+{
+    if (p->depth >= LLM_SAX_MAX_DEPTH) {
+        fail(p);
+        return;
+    }
+    p->capture_req = false;
+    if (p->h->on_start) p->h->on_start(p, is_array, p->ctx);
+
+    llm_sax_frame_t *f = &p->frames[p->depth++];
+    f->is_array = is_array;
+    f->index = 0;
+    f->key[0] = '\0';
+    f->key_long = false;
+    p->state = is_array ? S_VALUE_OR_END : S_KEY_OR_END;
+}
+
+static void close_container(llm_sax_t *p, bool is_array)
+{
+    if (p->depth == 0 || p->frames[p->depth - 1].is_array != is_array) {
+        fail(p);
+        return;
+    }
+    p->depth--;
+    if (p->h->on_end) p->h->on_end(p, is_array, p->ctx);
+    value_done(p);
+}
+
+static void finish_token(llm_sax_t *p)
+{
+    p->tok[p->tok_len] = '\0';
+    char c = p->tok[0];
+    bool ok;
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        char *end = NULL;
+        strtod(p->tok, &end);
+        ok = end && *end == '\0';
+    } else {
+        ok = strcmp(p->tok, "true") == 0 || strcmp(p->tok, "false") == 0 ||
+             strcmp(p->tok, "null") == 0;
+    }
+    if (!ok) {
+        fail(p);
+        return;
+    }
+    if (p->h->on_scalar) p->h->on_scalar(p, p->tok, p->tok_len, p->ctx);
+    value_done(p);
+}
+
+static bool token_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '-' || c == '+' || c == '.';
+}
+
+/* Start of a value; returns false if c cannot start one */
+static bool value_start(llm_sax_t *p, char c)
+{
+    if (c == '{') {
+        open_container(p, false);
+    } else if (c == '[') {
+        open_container(p, true);
+    } else if (c == '"') {
+        p->in_key = false;
+        p->str_len = 0;
+        p->state = S_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+        p->tok[0] = c;
+        p->tok_len = 1;
+        p->state = S_TOKEN;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int hex_val(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+esp_err_t llm_sax_feed(llm_sax_t *p, const char *data, size_t len)
+{
+    size_t raw_from = 0;
+    size_t i = 0;
+
+    while (i < len && p->err == ESP_OK) {
+        char c = data[i];
+
+        switch (p->state) {
+        case S_VALUE:
+        case S_VALUE_OR_END:
+            if (is_ws(c)) break;
+            if (p->state == S_VALUE_OR_END && c == ']') {
+                close_container(p, true);
+                break;
+            }
+            if (!value_start(p, c)) {
+                fail(p);
+            } else if (p->capture_req) {
+                /* on_start asked for this container's source bytes */
+                p->capture_req = false;
+                if (p->capture_depth < 0) {
+                    p->capture_depth = p->depth - 1;
+                    raw_from = i;
+                }
+            }
+            break;
+
+        case S_KEY_OR_END:
+        case S_KEY:
+            if (is_ws(c)) break;
+            if (p->state == S_KEY_OR_END && c == '}') {
+                close_container(p, false);
+            } else if (c == '"') {
+                p->in_key = true;
+                p->key_len = 0;
+                p->frames[p->depth - 1].key[0] = '\0';
+                p->frames[p->depth - 1].key_long = false;
+                p->state = S_STRING;
+            } else {
+                fail(p);
+            }
+            break;
+
+        case S_COLON:
+            if (is_ws(c)) break;
+            if (c == ':') {
+                p->state = S_VALUE;
+            } else {
+                fail(p);
+            }
+            break;
+
+        case S_AFTER:
+            if (is_ws(c)) break;
+            if (c == ',') {
+                llm_sax_frame_t *f = &p->frames[p->depth - 1];
+                if (f->is_array) {
+                    f->index++;
+                    p->state = S_VALUE;
+                } else {
+                    p->state = S_KEY;
+                }
+            } else if (c == '}' || c == ']') {
+                close_container(p, c == ']');
+            } else {
+                fail(p);
+            }
+            break;
+
+        case S_STRING:
+            if (c == '"') {
+                drop_high(p);
+                if (p->in_key) {
+                    p->state = S_COLON;
+                } else {
+                    flush_str(p, true);
+                    value_done(p);
+                }
+            } else if (c == '\\') {
+                p->state = S_ESC;
+            } else if (!p->in_key && !p->high) {
+                /* Plain run of a value: copy up to the next quote or escape at once */
+                size_t end = i + 1;
+                while (end < len && data[end] != '"' && data[end] != '\\') end++;
+                for (size_t from = i; from < end; ) {
+                    size_t n = end - from;
+                    size_t room = sizeof(p->str) - p->str_len;
+                    if (n > room) n = room;
+                    memcpy(p->str + p->str_len, data + from, n);
+                    p->str_len += n;
+                    from += n;
+                    if (p->str_len == sizeof(p->str)) flush_str(p, false);
+                }
+                i = end - 1;
+            } else {
+                drop_high(p);
+                put_byte(p, c);
+            }
+            break;
+
+        case S_ESC: {
+            char out = 0;
+            switch (c) {
+            case '"':  out = '"'; break;
+            case '\\': out = '\\'; break;
+            case '/':  out = '/'; break;
+            case 'b':  out = '\b'; break;
+            case 'f':  out = '\f'; break;
+            case 'n':  out = '\n'; break;
+            case 'r':  out = '\r'; break;
+            case 't':  out = '\t'; break;
+            case 'u':
+                p->hex_len = 0;
+                p->state = S_HEX;
+                break;
+            default:
+                fail(p);
+                break;
+            }
+            if (out) {
+                drop_high(p);
+                put_byte(p, out);
+                p->state = S_STRING;
+            }
+            break;
+        }
+
+        case S_HEX:
+            if (hex_val(c) < 0) {
+                fail(p);
+                break;
+            }
+            p->hex[p->hex_len++] = c;
+            if (p->hex_len == 4) {
+                unsigned cp = 0;
+                for (int k = 0; k < 4; k++) cp = (cp << 4) | hex_val(p->hex[k]);
+                put_escape_u(p, cp);
+                p->state = S_STRING;
+            }
+            break;
+
+        case S_TOKEN:
+            if (token_char(c)) {
+                if (p->tok_len >= sizeof(p->tok) - 1) {
+                    fail(p);
+                } else {
+                    p->tok[p->tok_len++] = c;
+                }
+                break;
+            }
+            /* The delimiter belongs to the enclosing structure: reprocess it */
+            finish_token(p);
+            continue;
+
+        case S_DONE:
+            if (!is_ws(c)) fail(p);
+            break;
+        }
+
+        /* The captured container closed on this byte */
+        if (p->capture_depth >= 0 && p->depth == p->capture_depth && p->err == ESP_OK) {
+            if (p->h->on_raw) p->h->on_raw(p, data + raw_from, i + 1 - raw_from, p->ctx);
+            p->capture_depth = -1;
+        }
+        i++;
+    }
+
+    if (p->err == ESP_OK && p->capture_depth >= 0 && len > raw_from) {
+        if (p->h->on_raw) p->h->on_raw(p, data + raw_from, len - raw_from, p->ctx);
+    }
+    p->bytes += len;
+    return p->err;
+}
+
+esp_err_t llm_sax_finish(llm_sax_t *p)
+{
+    if (p->err == ESP_OK && p->state == S_TOKEN && p->depth == 0) {
+        finish_token(p);
+    }
+    if (p->err == ESP_OK && !p->done) fail(p);
+    return p->err;
+}
+
+bool llm_sax_path_is(const llm_sax_t *p, const char *pattern)
+{
+    const char *seg = pattern;
+    for (int d = 0; d < p->depth; d++) {
+        if (!seg) return false;
+        const char *dot = strchr(seg, '.');
+        size_t n = dot ? (size_t)(dot - seg) : strlen(seg);
+
+        if (!(n == 1 && seg[0] == '*')) {
+            const llm_sax_frame_t *f = &p->frames[d];
+            if (f->is_array) {
+                char idx[12];
+                int m = snprintf(idx, sizeof(idx), "%d", f->index);
+                if ((size_t)m != n || memcmp(idx, seg, n) != 0) return false;
+            } else {
+                if (f->key_long || strlen(f->key) != n || memcmp(f->key, seg, n) != 0) return false;
+            }
+        }
+        seg = dot ? dot + 1 : NULL;
+    }
+    return seg == NULL || (p->depth == 0 && seg[0] == '\0');
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Incremental, event-driven JSON parser.
+ *
+ * Bytes are fed in arbitrary slices as they arrive from the network and
+ * reported as events, so a response is never held in memory as a whole.
+ * String values are unescaped and delivered in chunks of up to
+ * LLM_SAX_CHUNK bytes. Keys are kept per nesting level so handlers can
+ * match the path of a value with llm_sax_path_is(); a key longer than
+ * LLM_SAX_KEY_LEN - 1 bytes only matches "*".
+ *
+ * Working memory is the fixed-size llm_sax_t; nesting deeper than
+ * LLM_SAX_MAX_DEPTH is a parse error.
+ */
+
+#define LLM_SAX_MAX_DEPTH 16
+#define LLM_SAX_KEY_LEN   32
+#define LLM_SAX_CHUNK     128
+
+typedef struct llm_sax llm_sax_t;
+
+typedef struct {
+    /* Object or array opened; the path still names the container itself */
+    void (*on_start)(llm_sax_t *p, bool is_array, void *ctx);
+    /* Object or array closed; same path as its on_start */
+    void (*on_end)(llm_sax_t *p, bool is_array, void *ctx);
+    /* Part of a string value; done is set on the last part (len may be 0) */
+    void (*on_string)(llm_sax_t *p, const char *data, size_t len, bool done, void *ctx);
+    /* Number, true, false or null, as its source text (NUL-terminated) */
+    void (*on_scalar)(llm_sax_t *p, const char *tok, size_t len, void *ctx);
+    /* Source bytes of a container selected with llm_sax_capture() */
+    void (*on_raw)(llm_sax_t *p, const char *data, size_t len, void *ctx);
+} llm_sax_handler_t;
+
+typedef struct {
+    char key[LLM_SAX_KEY_LEN];  /* current member key (objects) */
+    int index;                  /* current element index (arrays) */
+    bool is_array;
+    bool key_long;              /* key did not fit: matches no named segment */
+} llm_sax_frame_t;
+
+struct llm_sax {
+    const llm_sax_handler_t *h;
+    void *ctx;
+    llm_sax_frame_t frames[LLM_SAX_MAX_DEPTH];
+    int depth;                  /* open containers */
+    int state;
+    bool in_key;                /* string being read is a member key */
+    bool done;                  /* root value complete */
+    esp_err_t err;              /* sticky */
+    char str[LLM_SAX_CHUNK];    /* pending string value bytes */
+    size_t str_len;
+    size_t key_len;
+    char tok[32];               /* number / literal being read */
+    size_t tok_len;
+    char hex[4];
+    int hex_len;
+    unsigned high;              /* pending UTF-16 high surrogate, 0 if none */
+    bool capture_req;
+    int capture_depth;          /* depth outside the captured container, -1 if none */
+    size_t bytes;               /* total bytes fed */
+};
+
+void llm_sax_init(llm_sax_t *p, const llm_sax_handler_t *h, void *ctx);
+
+/**
+ * Feed raw bytes.
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE once the input is malformed
+ */
+esp_err_t llm_sax_feed(llm_sax_t *p, const char *data, size_t len);
+
+/**
+ * Check that a complete JSON value was seen.
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE if malformed or truncated
+ */
+esp_err_t llm_sax_finish(llm_sax_t *p);
+
+/**
+ * From on_start only: deliver the container's source bytes, brackets
+ * included, through on_raw. Events for its contents are still reported.
+ */
+void llm_sax_capture(llm_sax_t *p);
+
+/**
+ * Match the path of the current value against a dotted pattern. Segments
+ * are member keys, array indexes, or "*" for any key or index, e.g.
+ * "content.*.text" or "choices.0.message.tool_calls.*". The pattern must
+ * cover the whole path.
+ */
+bool llm_sax_path_is(const llm_sax_t *p, const char *pattern);
@@ -0,0 +1,130 @@
+#include "llm_sse.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define SSE_INITIAL_CAP 512
+
+static bool buf_reserve(char **buf, size_t *cap, size_t need, size_t max)
+{
+    if (need <= *cap) return true;
+    if (need > max + 1) return false;
+
+    size_t new_cap = *cap ? *cap : SSE_INITIAL_CAP;
+    while (new_cap < need) new_cap *= 2;
+    if (new_cap > max + 1) new_cap = max + 1;
+
+    char *tmp = realloc(*buf, new_cap);
+    if (!tmp) return false;
+    *buf = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+void llm_sse_init(llm_sse_t *sse, size_t max_event, llm_sse_event_cb_t cb, void *ctx)
+{
+    memset(sse, 0, sizeof(*sse));
+    sse->max_event = max_event;
+    sse->cb = cb;
+    sse->ctx = ctx;
+}
+
+static void dispatch_event(llm_sse_t *sse)
+{
+    if (sse->overflow) {
+        sse->dropped++;
+    } else if (sse->data_len > 0) {
+        sse->data[sse->data_len] = '\0';
+        sse->cb(sse->event, sse->data, sse->data_len, sse->ctx);
+    }
+    sse->data_len = 0;
+    sse->event[0] = '\0';
+    sse->overflow = false;
+}
+
+static esp_err_t process_line(llm_sse_t *sse, const char *line, size_t len)
+{
+    if (len > 0 && line[len - 1] == '\r') len--;
+
+    if (len == 0) {
+        dispatch_event(sse);
+        return ESP_OK;
+    }
+    if (line[0] == ':') return ESP_OK;  /* comment / keep-alive */
+
+    const char *colon = memchr(line, ':', len);
+    size_t name_len = colon ? (size_t)(colon - line) : len;
+    const char *value = colon ? colon + 1 : line + len;
+    size_t value_len = len - (value - line);
+    if (value_len > 0 && value[0] == ' ') {
+        value++;
+        value_len--;
+    }
+
+    if (name_len == 5 && memcmp(line, "event", 5) == 0) {
+        size_t n = value_len < sizeof(sse->event) - 1 ? value_len : sizeof(sse->event) - 1;
+        memcpy(sse->event, value, n);
+        sse->event[n] = '\0';
+    } else if (name_len == 4 && memcmp(line, "data", 4) == 0) {
+        if (sse->overflow) return ESP_OK;
+        size_t need = sse->data_len + (sse->data_len ? 1 : 0) + value_len + 1;
+        if (need > sse->max_event + 1) {
+            sse->overflow = true;
+            return ESP_OK;
+        }
+        if (!buf_reserve(&sse->data, &sse->data_cap, need, sse->max_event)) {
+            return ESP_ERR_NO_MEM;
+        }
+        if (sse->data_len) sse->data[sse->data_len++] = '\n';
+        memcpy(sse->data + sse->data_len, value, value_len);
+        sse->data_len += value_len;
+    }
+    /* id / retry / unknown fields are ignored */
+    return ESP_OK;
+}
+
+esp_err_t llm_sse_feed(llm_sse_t *sse, const char *buf, size_t len)
+{
+    while (len > 0) {
+        const char *nl = memchr(buf, '\n', len);
+        size_t take = nl ? (size_t)(nl - buf) : len;
+
+        if (sse->skip_line || sse->line_len + take > sse->max_event) {
+            /* Oversized line: discard until its end, then drop the event */
+            sse->skip_line = true;
+            sse->overflow = true;
+            sse->line_len = 0;
+        } else if (take > 0) {
+            if (!buf_reserve(&sse->line, &sse->line_cap, sse->line_len + take + 1, sse->max_event)) {
+                return ESP_ERR_NO_MEM;
+            }
+            memcpy(sse->line + sse->line_len, buf, take);
+            sse->line_len += take;
+        }
+
+        if (!nl) break;
+
+        esp_err_t err = ESP_OK;
+        if (sse->skip_line) {
+            sse->skip_line = false;
+        } else {
+            err = process_line(sse, sse->line ? sse->line : "", sse->line_len);
+        }
+        sse->line_len = 0;
+        if (err != ESP_OK) return err;
+
+        buf = nl + 1;
+        len -= take + 1;
+    }
+    return ESP_OK;
+}
+
+void llm_sse_free(llm_sse_t *sse)
+{
+    free(sse->line);
+    free(sse->data);
+    sse->line = NULL;
+    sse->data = NULL;
+    sse->line_len = sse->line_cap = 0;
+    sse->data_len = sse->data_cap = 0;
+}
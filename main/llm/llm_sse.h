@@ -0,0 +1,51 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Incremental server-sent events (text/event-stream) framer.
+ *
+ * Bytes are fed in arbitrary slices as they arrive from the network; every
+ * complete event (terminated by a blank line) is delivered to the callback.
+ * Multiple "data:" lines of one event are joined with '\n'. Comment lines
+ * and the id/retry fields are ignored.
+ *
+ * Working memory is bounded by max_event: an event larger than that is
+ * dropped and counted, the stream itself continues.
+ */
+
+typedef void (*llm_sse_event_cb_t)(const char *event, char *data, size_t len, void *ctx);
+
+typedef struct {
+    char *line;             /* current, not yet terminated line */
+    size_t line_len;
+    size_t line_cap;
+    char *data;             /* data of the event being assembled */
+    size_t data_len;
+    size_t data_cap;
+    size_t max_event;
+    char event[32];         /* "event:" field, empty if none */
+    bool overflow;          /* current event exceeded max_event */
+    bool skip_line;         /* discarding the rest of an oversized line */
+    int dropped;            /* events dropped due to overflow */
+    llm_sse_event_cb_t cb;
+    void *ctx;
+} llm_sse_t;
+
+/**
+ * Initialize a framer. No memory is allocated until data arrives.
+ *
+ * @param max_event  Upper bound for one line and for one event's data
+ */
+void llm_sse_init(llm_sse_t *sse, size_t max_event, llm_sse_event_cb_t cb, void *ctx);
+
+/**
+ * Feed raw body bytes.
+ * @return ESP_OK, or ESP_ERR_NO_MEM if a buffer could not be grown
+ */
+esp_err_t llm_sse_feed(llm_sse_t *sse, const char *buf, size_t len);
+
+/** Release the framer's buffers. */
+void llm_sse_free(llm_sse_t *sse);
@@ -1,116 +1,683 @@
 #include "session_mgr.h"
 #include "mimi_config.h"
+#include "bus/msg_buf.h"
+#include "memory/session_rec.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 
 static const char *TAG = "session";
 
 static void session_path(const char *chat_id, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/tg_%s.bin", MIMI_SPIFFS_SESSION_DIR, chat_id);
+}
+
+/* Pre-binary session file, migrated on first use */
+static void legacy_path(const char *chat_id, char *buf, size_t size)
 {
     snprintf(buf, size, "%s/tg_%s.jsonl", MIMI_SPIFFS_SESSION_DIR, chat_id);
 }
 
-esp_err_t session_mgr_init(void)
+static void index_path(const char *chat_id, char *buf, size_t size)
 {
-    ESP_LOGI(TAG, "Session manager initialized at %s", MIMI_SPIFFS_SESSION_DIR);
-    return ESP_OK;
+    snprintf(buf, size, "%s/tg_%s.idx", MIMI_SPIFFS_SESSION_DIR, chat_id);
 }
 
-esp_err_t session_append(const char *chat_id, const char *role, const char *content)
+static long file_size(const char *path)
 {
-    char path[64];
-    session_path(chat_id, path, sizeof(path));
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
 
-    FILE *f = fopen(path, "a");
-    if (!f) {
-        ESP_LOGE(TAG, "Cannot open session file %s", path);
-        return ESP_FAIL;
+/* Copy src from offset to its end into dst */
+static bool copy_from(FILE *src, long offset, FILE *dst)
+{
+    if (fseek(src, offset, SEEK_SET) != 0) return false;
+    char chunk[512];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), src)) > 0) {
+        if (fwrite(chunk, 1, n, dst) != n) return false;
+    }
+    return true;
+}
+
+/* Swap a fully written temp file in and re-index it */
+static bool replace_file(const char *tmp_path, const char *path, const char *idx_path)
+{
+    /* SPIFFS rename does not replace an existing file */
+    if (remove(path) != 0 || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    session_index_rebuild(path, idx_path);
+    return true;
+}
+
+static void temp_path(const char *chat_id, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/tg_%s.tmp", MIMI_SPIFFS_SESSION_DIR, chat_id);
+}
+
+/* Whether the first record is a rolling summary */
+static bool starts_with_summary(FILE *f)
+{
+    int role;
+    uint32_t ts, len;
+    return fseek(f, 0, SEEK_SET) == 0 && session_rec_read_header(f, &role, &ts, &len) &&
+           role == SESSION_ROLE_SUMMARY;
+}
+
+/*
+ * Keep only the newest MIMI_SESSION_KEEP_MSGS entries once a session has
+ * grown past MIMI_SESSION_COMPACT_MSGS, so file size stays bounded even
+ * when summaries cannot be produced. The older entries are folded, cut
+ * short, into the summary record rather than lost; the compactor
+ * condenses them on its next successful run. Returns whether the file
+ * was rewritten.
+ */
+static bool session_compact(const char *chat_id, const char *path,
+                            const char *idx_path, int entries)
+{
+    FILE *ix = fopen(idx_path, "rb");
+    if (!ix) return false;
+    int dropped = entries - MIMI_SESSION_KEEP_MSGS;
+    uint32_t keep_off;
+    bool ok = session_index_read(ix, dropped, &keep_off);
+    fclose(ix);
+    if (!ok) return false;
+
+    char tmp_path[64];
+    temp_path(chat_id, tmp_path, sizeof(tmp_path));
+
+    char *summary = heap_caps_calloc(1, MIMI_SESSION_FOLD_MAX_BYTES, MALLOC_CAP_SPIRAM);
+    FILE *src = summary ? fopen(path, "rb") : NULL;
+    FILE *dst = src ? fopen(tmp_path, "wb") : NULL;
+    if (!dst) {
+        if (src) fclose(src);
+        free(summary);
+        ESP_LOGW(TAG, "Cannot compact session %s", chat_id);
+        return false;
     }
 
-    cJSON *obj = cJSON_CreateObject();
-    cJSON_AddStringToObject(obj, "role", role);
-    cJSON_AddStringToObject(obj, "content", content);
-    cJSON_AddNumberToObject(obj, "ts", (double)time(NULL));
+    ok = session_rec_fold(src, dropped, summary, MIMI_SESSION_FOLD_MAX_BYTES) &&
+         session_rec_write(dst, SESSION_ROLE_SUMMARY, (uint32_t)time(NULL), summary) > 0 &&
+         copy_from(src, keep_off, dst);
+    fclose(src);
+    if (fclose(dst) != 0) ok = false;
+    size_t summary_len = strlen(summary);
+    free(summary);
 
-    char *line = cJSON_PrintUnformatted(obj);
-    cJSON_Delete(obj);
+    if (!ok || !replace_file(tmp_path, path, idx_path)) {
+        ESP_LOGW(TAG, "Compaction of session %s failed", chat_id);
+        remove(tmp_path);
+        return false;
+    }
+    ESP_LOGI(TAG, "Compacted session %s: %d -> %d entries, %d folded into a %d byte summary",
+             chat_id, entries, MIMI_SESSION_KEEP_MSGS + 1, dropped, (int)summary_len);
+    return true;
+}
+
+/* ── Migration ─────────────────────────────────────────────────
+ * Sessions written by older firmware as JSON lines are converted to the
+ * record format the first time the chat is loaded or appended to.
+ */
+
+/* Called with s_io_lock held */
+static void migrate_legacy(const char *chat_id, const char *path, const char *idx_path)
+{
+    if (file_size(path) >= 0) return;
+
+    char legacy[64];
+    legacy_path(chat_id, legacy, sizeof(legacy));
+    long legacy_size = file_size(legacy);
+    if (legacy_size < 0) return;
+
+    char tmp_path[64];
+    temp_path(chat_id, tmp_path, sizeof(tmp_path));
+    FILE *src = fopen(legacy, "r");
+    FILE *dst = src ? fopen(tmp_path, "wb") : NULL;
+    if (!dst) {
+        if (src) fclose(src);
+        ESP_LOGW(TAG, "Cannot migrate session %s", chat_id);
+        return;
+    }
 
-    if (line) {
-        fprintf(f, "%s\n", line);
-        free(line);
+    /* getline: legacy lines have no length bound either */
+    char *line = NULL;
+    size_t cap = 0;
+    long written = 0;
+    int count = 0;
+    bool ok = true;
+    while (ok && getline(&line, &cap, src) > 0) {
+        cJSON *obj = cJSON_Parse(line);
+        if (!obj) continue;
+        cJSON *role = cJSON_GetObjectItem(obj, "role");
+        cJSON *content = cJSON_GetObjectItem(obj, "content");
+        cJSON *ts = cJSON_GetObjectItem(obj, "ts");
+        int code = cJSON_IsString(role) ? session_role_code(role->valuestring) : -1;
+        /* A summary can only lead the file */
+        if (code == SESSION_ROLE_SUMMARY && count > 0) code = -1;
+        if (code >= 0 && cJSON_IsString(content)) {
+            uint32_t when = cJSON_IsNumber(ts) ? (uint32_t)ts->valuedouble : 0;
+            size_t n = session_rec_write(dst, code, when, content->valuestring);
+            ok = n > 0;
+            written += n;
+            count++;
+        }
+        cJSON_Delete(obj);
     }
+    free(line);
+    fclose(src);
+    fclose(dst);
 
+    if (!ok || rename(tmp_path, path) != 0) {
+        ESP_LOGW(TAG, "Migration of session %s failed", chat_id);
+        remove(tmp_path);
+        return;
+    }
+    remove(legacy);
+    remove(idx_path);   /* held JSON line offsets */
+    session_index_rebuild(path, idx_path);
+    ESP_LOGI(TAG, "Migrated session %s to records: %d entries, %ld -> %ld bytes",
+             chat_id, count, legacy_size, written);
+}
+
+/* ── Write-behind persistence ──────────────────────────────────
+ * Appends are queued and written by a flusher task that group-commits
+ * every pending entry of a chat with one open of its file and index.
+ */
+
+typedef struct pending_rec {
+    struct pending_rec *next;
+    char chat_id[32];
+    int role;
+    time_t ts;
+    char *content;          /* msg_buf reference, released once written */
+    bool unwritten;         /* last flush failed, kept for the next */
+} pending_rec_t;
+
+/* ── History cache ─────────────────────────────────────────────
+ * Recent history of the hottest chats, kept in PSRAM so a busy chat
+ * builds its messages without touching flash.
+ */
+
+typedef struct {
+    int role;
+    char *content;              /* PSRAM */
+} hist_msg_t;
+
+typedef struct {
+    char chat_id[32];
+    char *summary;                            /* rolling summary (PSRAM), or NULL */
+    hist_msg_t msgs[MIMI_SESSION_MAX_MSGS];   /* ring, oldest at head */
+    int head;
+    int count;
+    uint32_t last_used;
+    bool valid;
+} hist_cache_t;
+
+static hist_cache_t *s_cache;               /* MIMI_SESSION_CACHE_CHATS entries */
+static uint32_t s_use_tick;
+static uint32_t s_hits, s_misses;
+static pending_rec_t *s_pending_head, *s_pending_tail;
+static int s_pending_count;
+static SemaphoreHandle_t s_lock;            /* cache + pending list */
+static SemaphoreHandle_t s_io_lock;         /* session files; taken before s_lock */
+static TaskHandle_t s_flush_task;
+static session_compact_hook_t s_compact_hook;
+
+static void cache_drop_msgs(hist_cache_t *c)
+{
+    for (int i = 0; i < c->count; i++) {
+        free(c->msgs[(c->head + i) % MIMI_SESSION_MAX_MSGS].content);
+    }
+    free(c->summary);
+    c->summary = NULL;
+    c->head = 0;
+    c->count = 0;
+}
+
+/* Append a message whose PSRAM buffer the cache takes over */
+static void cache_push_owned(hist_cache_t *c, int role, char *content)
+{
+    int slot;
+    if (c->count == MIMI_SESSION_MAX_MSGS) {
+        slot = c->head;
+        free(c->msgs[slot].content);
+        c->head = (c->head + 1) % MIMI_SESSION_MAX_MSGS;
+    } else {
+        slot = (c->head + c->count) % MIMI_SESSION_MAX_MSGS;
+        c->count++;
+    }
+    c->msgs[slot].role = role;
+    c->msgs[slot].content = content;
+}
+
+static void cache_push(hist_cache_t *c, int role, const char *content)
+{
+    size_t len = strlen(content);
+    char *copy = heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM);
+    if (!copy) {
+        /* Incomplete history would be worse than a reload */
+        ESP_LOGW(TAG, "Cache out of PSRAM, dropping %s", c->chat_id);
+        cache_drop_msgs(c);
+        c->valid = false;
+        return;
+    }
+    memcpy(copy, content, len + 1);
+    cache_push_owned(c, role, copy);
+}
+
+static hist_cache_t *cache_find(const char *chat_id)
+{
+    for (int i = 0; i < MIMI_SESSION_CACHE_CHATS; i++) {
+        if (s_cache[i].valid && strcmp(s_cache[i].chat_id, chat_id) == 0) {
+            s_cache[i].last_used = ++s_use_tick;
+            return &s_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Free slot, or the least recently used chat */
+static hist_cache_t *cache_victim(void)
+{
+    hist_cache_t *victim = &s_cache[0];
+    for (int i = 0; i < MIMI_SESSION_CACHE_CHATS; i++) {
+        if (!s_cache[i].valid) return &s_cache[i];
+        if (s_cache[i].last_used < victim->last_used) victim = &s_cache[i];
+    }
+    cache_drop_msgs(victim);
+    victim->valid = false;
+    return victim;
+}
+
+/* Read the tail of the session file into c. Called with s_io_lock held. */
+static void load_from_flash(const char *chat_id, hist_cache_t *c)
+{
+    char path[64], idx_path[64];
+    session_path(chat_id, path, sizeof(path));
+    index_path(chat_id, idx_path, sizeof(idx_path));
+    migrate_legacy(chat_id, path, idx_path);
+    int64_t start_us = esp_timer_get_time();
+
+    long fsize = file_size(path);
+    FILE *f = fsize > 0 ? fopen(path, "rb") : NULL;
+    if (!f) return;     /* No history yet */
+
+    /* The rolling summary is kept apart so the ring never pushes it out */
+    long tail_off = session_index_tail_offset(path, idx_path, fsize, MIMI_SESSION_MAX_MSGS);
+    bool summary = starts_with_summary(f);
+
+    /* Seek to the tail, then read only the records from there on */
+    if (fseek(f, summary ? 0 : tail_off, SEEK_SET) != 0) {
+        fseek(f, 0, SEEK_SET);
+        tail_off = 0;
+    }
+
+    /* Records beyond the ring size push the oldest out */
+    int loaded = 0;
+    int role;
+    uint32_t ts, len;
+    while (session_rec_read_header(f, &role, &ts, &len)) {
+        char *content = heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM);
+        if (!content) {
+            ESP_LOGW(TAG, "No PSRAM for a %u byte message of %s", (unsigned)len, chat_id);
+            break;
+        }
+        if (fread(content, 1, len, f) != len) {
+            free(content);
+            break;      /* torn tail */
+        }
+        content[len] = '\0';
+        if (role == SESSION_ROLE_SUMMARY) {
+            free(c->summary);
+            c->summary = content;
+            /* Continue at the tail unless the summary is part of it */
+            if (tail_off > ftell(f)) fseek(f, tail_off, SEEK_SET);
+            continue;
+        }
+        cache_push_owned(c, role, content);
+        loaded++;
+    }
     fclose(f);
-    return ESP_OK;
+
+    ESP_LOGD(TAG, "Loaded %d messages from %ld of %ld bytes in %d us",
+             loaded, fsize - tail_off, fsize, (int)(esp_timer_get_time() - start_us));
 }
 
-esp_err_t session_get_history_json(const char *chat_id, char *buf, size_t size, int max_msgs)
+/* Cached history for chat_id, loading it on a miss. Returns with s_lock held. */
+static hist_cache_t *cache_acquire(const char *chat_id)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    hist_cache_t *c = cache_find(chat_id);
+    if (c) {
+        s_hits++;
+        return c;
+    }
+    xSemaphoreGive(s_lock);
+
+    /* Holding s_io_lock, every append is either in the file or still on
+     * the pending list, never in flight between the two. The file is read
+     * without s_lock so other chats keep hitting the cache meanwhile. */
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    hist_cache_t loaded = { .valid = true };
+    strncpy(loaded.chat_id, chat_id, sizeof(loaded.chat_id) - 1);
+    load_from_flash(chat_id, &loaded);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_misses++;
+    c = cache_find(chat_id);
+    if (c) {
+        cache_drop_msgs(&loaded);
+    } else {
+        for (pending_rec_t *p = s_pending_head; p; p = p->next) {
+            if (strcmp(p->chat_id, chat_id) == 0) cache_push(&loaded, p->role, p->content);
+        }
+        c = cache_victim();
+        *c = loaded;
+        c->valid = true;
+        c->last_used = ++s_use_tick;
+    }
+    xSemaphoreGive(s_io_lock);
+    return c;
+}
+
+/*
+ * Write every pending record of one chat as one group commit: all of
+ * them, or on failure none, so a torn group never hides later records.
+ * Called with s_io_lock held.
+ */
+static bool write_chat(const char *chat_id, pending_rec_t *list)
 {
-    char path[64];
+    char path[64], idx_path[64];
     session_path(chat_id, path, sizeof(path));
+    index_path(chat_id, idx_path, sizeof(idx_path));
+    migrate_legacy(chat_id, path, idx_path);
 
-    FILE *f = fopen(path, "r");
+    FILE *f = fopen(path, "ab");
     if (!f) {
-        /* No history yet */
-        snprintf(buf, size, "[]");
-        return ESP_OK;
+        ESP_LOGE(TAG, "Cannot open session file %s", path);
+        return false;
     }
+    fseek(f, 0, SEEK_END);
+    long start = ftell(f);
+    long off = start;
 
-    /* Read all lines into a ring buffer of cJSON objects */
-    cJSON *messages[MIMI_SESSION_MAX_MSGS];
-    int count = 0;
-    int write_idx = 0;
+    /* A missing index while the session already has entries is rebuilt
+     * after the write instead */
+    long idx_size = file_size(idx_path);
+    bool rebuild = (off > 0 && idx_size <= 0);
+    FILE *ix = rebuild ? NULL : fopen(idx_path, off > 0 ? "ab" : "wb");
+    if (!ix) rebuild = true;
+    int entries = (off > 0 && idx_size > 0) ? (int)(idx_size / (long)sizeof(uint32_t)) : 0;
 
-    char line[2048];
-    while (fgets(line, sizeof(line), f)) {
-        /* Strip newline */
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
-        if (line[0] == '\0') continue;
+    bool ok = true;
+    for (pending_rec_t *p = list; p && ok; p = p->next) {
+        if (strcmp(p->chat_id, chat_id) != 0) continue;
 
-        cJSON *obj = cJSON_Parse(line);
-        if (!obj) continue;
+        uint32_t off32 = (uint32_t)off;
+        size_t n = session_rec_write(f, p->role, (uint32_t)p->ts, p->content);
+        ok = n > 0;
+        if (ok && ix && fwrite(&off32, sizeof(off32), 1, ix) != 1) {
+            fclose(ix);
+            ix = NULL;
+            rebuild = true;
+        }
+        off += n;
+        entries++;
+    }
+    if (fclose(f) != 0) ok = false;
+    if (ix && fclose(ix) != 0) rebuild = true;
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Writing session %s failed, keeping its entries pending", chat_id);
+        truncate(path, start);
+        session_index_rebuild(path, idx_path);
+        return false;
+    }
 
-        /* Ring buffer: overwrite oldest if full */
-        if (count >= max_msgs) {
-            cJSON_Delete(messages[write_idx]);
+    if (rebuild) {
+        /* Dropped index is rebuilt from the file */
+        entries = session_index_rebuild(path, idx_path);
+    }
+    if (entries > MIMI_SESSION_COMPACT_MSGS) {
+        if (session_compact(chat_id, path, idx_path, entries)) {
+            /* The cached summary is stale now; reload on next use */
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            hist_cache_t *c = cache_find(chat_id);
+            if (c) {
+                cache_drop_msgs(c);
+                c->valid = false;
+            }
+            xSemaphoreGive(s_lock);
         }
-        messages[write_idx] = obj;
-        write_idx = (write_idx + 1) % max_msgs;
-        if (count < max_msgs) count++;
+    } else if (entries > MIMI_SESSION_SUMMARY_TRIGGER && s_compact_hook) {
+        s_compact_hook(chat_id);
     }
-    fclose(f);
+    return true;
+}
+
+static void rec_free(pending_rec_t *rec)
+{
+    msg_buf_release(rec->content);
+    free(rec);
+}
+
+static esp_err_t flush_pending(void)
+{
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    pending_rec_t *list = s_pending_head;
+    int count = s_pending_count;
+    s_pending_head = s_pending_tail = NULL;
+    s_pending_count = 0;
+    xSemaphoreGive(s_lock);
+
+    for (pending_rec_t *p = list; p; p = p->next) p->unwritten = false;
+
+    int64_t start_us = esp_timer_get_time();
+    int chats = 0;
+    int failed = 0;
+    /* One group commit per chat, in order of first appearance */
+    for (pending_rec_t *p = list; p; p = p->next) {
+        bool seen = false;
+        for (pending_rec_t *q = list; q != p; q = q->next) {
+            if (strcmp(q->chat_id, p->chat_id) == 0) {
+                seen = true;
+                break;
+            }
+        }
+        if (seen) continue;
+        chats++;
+        if (write_chat(p->chat_id, list)) continue;
+        for (pending_rec_t *q = p; q; q = q->next) {
+            if (strcmp(q->chat_id, p->chat_id) == 0) {
+                q->unwritten = true;
+                failed++;
+            }
+        }
+    }
+
+    /* Unwritten records go back in front of those appended meanwhile,
+     * for the next flush to retry */
+    pending_rec_t *kept = NULL, *kept_tail = NULL, *written = NULL;
+    while (list) {
+        pending_rec_t *next = list->next;
+        if (list->unwritten) {
+            list->next = NULL;
+            if (kept_tail) {
+                kept_tail->next = list;
+            } else {
+                kept = list;
+            }
+            kept_tail = list;
+        } else {
+            list->next = written;
+            written = list;
+        }
+        list = next;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (kept) {
+        kept_tail->next = s_pending_head;
+        s_pending_head = kept;
+        if (!s_pending_tail) s_pending_tail = kept_tail;
+        s_pending_count += failed;
+    }
+    /* Bound what a failing flash can pin: drop the oldest beyond the cap */
+    int dropped = 0;
+    while (s_pending_count > MIMI_SESSION_PENDING_MAX) {
+        pending_rec_t *old = s_pending_head;
+        s_pending_head = old->next;
+        if (!s_pending_head) s_pending_tail = NULL;
+        s_pending_count--;
+        old->next = written;
+        written = old;
+        dropped++;
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_io_lock);
+
+    if (count > 0) {
+        ESP_LOGI(TAG, "Flushed %d entries for %d chats in %d ms", count - failed, chats,
+                 (int)((esp_timer_get_time() - start_us) / 1000));
+    }
+    if (dropped > 0) {
+        ESP_LOGE(TAG, "Session writes failing, dropped %d oldest unwritten entries", dropped);
+    }
+
+    while (written) {
+        pending_rec_t *next = written->next;
+        rec_free(written);
+        written = next;
+    }
+    return failed > 0 ? ESP_FAIL : ESP_OK;
+}
+
+static void session_flush_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MIMI_SESSION_FLUSH_MS));
+        flush_pending();
+    }
+}
+
+esp_err_t session_mgr_init(void)
+{
+    s_cache = heap_caps_calloc(MIMI_SESSION_CACHE_CHATS, sizeof(hist_cache_t), MALLOC_CAP_SPIRAM);
+    s_lock = xSemaphoreCreateMutex();
+    s_io_lock = xSemaphoreCreateMutex();
+    if (!s_cache || !s_lock || !s_io_lock) {
+        ESP_LOGE(TAG, "Failed to allocate session cache");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(session_flush_task, "session_flush",
+                                MIMI_SESSION_FLUSH_STACK, NULL,
+                                MIMI_SESSION_FLUSH_PRIO, &s_flush_task,
+                                MIMI_SESSION_FLUSH_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create session flusher");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Session manager initialized at %s (cache %d chats, flush every %d ms)",
+             MIMI_SPIFFS_SESSION_DIR, MIMI_SESSION_CACHE_CHATS, MIMI_SESSION_FLUSH_MS);
+    return ESP_OK;
+}
+
+esp_err_t session_append(const char *chat_id, const char *role, char *content)
+{
+    /* Summaries are only written by session_replace_prefix() */
+    int code = session_role_code(role);
+    if (code < 0 || code == SESSION_ROLE_SUMMARY) return ESP_ERR_INVALID_ARG;
+
+    pending_rec_t *rec = heap_caps_calloc(1, sizeof(*rec), MALLOC_CAP_SPIRAM);
+    if (!rec) {
+        ESP_LOGE(TAG, "No memory to queue session entry for %s", chat_id);
+        return ESP_ERR_NO_MEM;
+    }
+    strncpy(rec->chat_id, chat_id, sizeof(rec->chat_id) - 1);
+    rec->role = code;
+    rec->ts = time(NULL);
+    /* The bus payload is shared until written rather than copied */
+    rec->content = msg_buf_ref(content);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    /* Only a chat that is already cached is updated; otherwise the next
+     * load picks the entry up from the pending list or the file */
+    hist_cache_t *c = cache_find(chat_id);
+    if (c) cache_push(c, code, content);
+
+    if (s_pending_tail) {
+        s_pending_tail->next = rec;
+    } else {
+        s_pending_head = rec;
+    }
+    s_pending_tail = rec;
+    bool kick = (++s_pending_count >= MIMI_SESSION_FLUSH_BATCH);
+    xSemaphoreGive(s_lock);
+
+    if (kick) xTaskNotifyGive(s_flush_task);
+    return ESP_OK;
+}
+
+esp_err_t session_flush(void)
+{
+    return s_lock ? flush_pending() : ESP_ERR_INVALID_STATE;
+}
+
+cJSON *session_get_history(const char *chat_id, int max_msgs)
+{
+    if (max_msgs > MIMI_SESSION_MAX_MSGS) max_msgs = MIMI_SESSION_MAX_MSGS;
 
-    /* Build JSON array with only role + content */
     cJSON *arr = cJSON_CreateArray();
-    int start = (count < max_msgs) ? 0 : write_idx;
-    for (int i = 0; i < count; i++) {
-        int idx = (start + i) % max_msgs;
-        cJSON *src = messages[idx];
+    hist_cache_t *c = cache_acquire(chat_id);
 
-        cJSON *entry = cJSON_CreateObject();
-        cJSON *role = cJSON_GetObjectItem(src, "role");
-        cJSON *content = cJSON_GetObjectItem(src, "content");
-        if (role && content) {
-            cJSON_AddStringToObject(entry, "role", role->valuestring);
-            cJSON_AddStringToObject(entry, "content", content->valuestring);
+    /* Older turns condensed by the compactor stand in as the first message */
+    if (c->summary) {
+        size_t len = strlen(MIMI_SESSION_SUMMARY_PREFIX) + strlen(c->summary) + 1;
+        char *text = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+        if (text) {
+            snprintf(text, len, "%s%s", MIMI_SESSION_SUMMARY_PREFIX, c->summary);
+            cJSON *entry = cJSON_CreateObject();
+            cJSON_AddStringToObject(entry, "role", "user");
+            cJSON_AddStringToObject(entry, "content", text);
+            cJSON_AddItemToArray(arr, entry);
+            free(text);
         }
-        cJSON_AddItemToArray(arr, entry);
     }
 
-    /* Cleanup ring buffer */
-    int cleanup_start = (count < max_msgs) ? 0 : write_idx;
-    for (int i = 0; i < count; i++) {
-        int idx = (cleanup_start + i) % max_msgs;
-        cJSON_Delete(messages[idx]);
+    int skip = c->count > max_msgs ? c->count - max_msgs : 0;
+    for (int i = skip; i < c->count; i++) {
+        hist_msg_t *m = &c->msgs[(c->head + i) % MIMI_SESSION_MAX_MSGS];
+        cJSON *entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "role", session_role_names[m->role]);
+        cJSON_AddStringToObject(entry, "content", m->content);
+        cJSON_AddItemToArray(arr, entry);
     }
+    xSemaphoreGive(s_lock);
+    return arr;
+}
 
+esp_err_t session_get_history_json(const char *chat_id, char *buf, size_t size, int max_msgs)
+{
+    cJSON *arr = session_get_history(chat_id, max_msgs);
     char *json_str = cJSON_PrintUnformatted(arr);
     cJSON_Delete(arr);
 
@@ -125,12 +692,169 @@ esp_err_t session_get_history_json(const char *chat_id, char *buf, size_t size,
     return ESP_OK;
 }
 
+void session_get_cache_stats(session_cache_stats_t *out)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    out->hits = s_hits;
+    out->misses = s_misses;
+    out->pending = s_pending_count;
+    out->cached = 0;
+    for (int i = 0; i < MIMI_SESSION_CACHE_CHATS; i++) {
+        if (s_cache[i].valid) out->cached++;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/* ── Rolling summary support ─────────────────────────────────── */
+
+void session_set_compact_hook(session_compact_hook_t hook)
+{
+    s_compact_hook = hook;
+}
+
+esp_err_t session_read_prefix(const char *chat_id, int keep, cJSON **out,
+                              session_prefix_t *prefix)
+{
+    char path[64], idx_path[64];
+    session_path(chat_id, path, sizeof(path));
+    index_path(chat_id, idx_path, sizeof(idx_path));
+    *out = NULL;
+
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    migrate_legacy(chat_id, path, idx_path);
+
+    /* Validates (or rebuilds) the index before it is trusted */
+    long fsize = file_size(path);
+    if (fsize > 0) session_index_tail_offset(path, idx_path, fsize, keep);
+    int entries = (int)(file_size(idx_path) / (long)sizeof(uint32_t));
+    int count = entries - keep;
+
+    FILE *ix = count >= 2 ? fopen(idx_path, "rb") : NULL;
+    uint32_t end;
+    bool ok = ix && session_index_read(ix, count, &end);
+    if (ix) fclose(ix);
+    FILE *f = ok ? fopen(path, "rb") : NULL;
+    if (!f) {
+        xSemaphoreGive(s_io_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    cJSON *arr = cJSON_CreateArray();
+    int role;
+    uint32_t ts, len;
+    while (ftell(f) < (long)end && session_rec_read_header(f, &role, &ts, &len)) {
+        char *content = heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM);
+        if (!content || fread(content, 1, len, f) != len) {
+            free(content);
+            ok = false;
+            break;
+        }
+        content[len] = '\0';
+        cJSON *entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "role", session_role_names[role]);
+        cJSON_AddStringToObject(entry, "content", content);
+        cJSON_AddItemToArray(arr, entry);
+        free(content);
+    }
+    fclose(f);
+    xSemaphoreGive(s_io_lock);
+
+    if (!ok) {
+        cJSON_Delete(arr);
+        return ESP_FAIL;
+    }
+    prefix->count = count;
+    prefix->end = end;
+    *out = arr;
+    return ESP_OK;
+}
+
+esp_err_t session_replace_prefix(const char *chat_id, const session_prefix_t *prefix,
+                                 const char *summary)
+{
+    char path[64], idx_path[64], tmp_path[64];
+    session_path(chat_id, path, sizeof(path));
+    index_path(chat_id, idx_path, sizeof(idx_path));
+    temp_path(chat_id, tmp_path, sizeof(tmp_path));
+
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+
+    /* Appends only add to the end; anything else means another rewrite won */
+    FILE *ix = fopen(idx_path, "rb");
+    uint32_t end;
+    bool same = ix && session_index_read(ix, prefix->count, &end) && end == prefix->end;
+    if (ix) fclose(ix);
+    if (!same) {
+        xSemaphoreGive(s_io_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    FILE *src = fopen(path, "rb");
+    FILE *dst = src ? fopen(tmp_path, "wb") : NULL;
+    bool ok = dst &&
+              session_rec_write(dst, SESSION_ROLE_SUMMARY, (uint32_t)time(NULL), summary) > 0 &&
+              copy_from(src, prefix->end, dst);
+    if (src) fclose(src);
+    if (dst) fclose(dst);
+    ok = ok && replace_file(tmp_path, path, idx_path);
+    if (!ok) remove(tmp_path);
+
+    /* Cached turns may include replaced ones; reload on next use */
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    hist_cache_t *c = cache_find(chat_id);
+    if (c) {
+        cache_drop_msgs(c);
+        c->valid = false;
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_io_lock);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Summary rewrite of session %s failed", chat_id);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Session %s: %d entries (%u bytes) replaced by a %d byte summary",
+             chat_id, prefix->count, (unsigned)prefix->end, (int)strlen(summary));
+    return ESP_OK;
+}
+
 esp_err_t session_clear(const char *chat_id)
 {
-    char path[64];
+    char path[64], idx_path[64], legacy[64];
     session_path(chat_id, path, sizeof(path));
+    index_path(chat_id, idx_path, sizeof(idx_path));
+    legacy_path(chat_id, legacy, sizeof(legacy));
+
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    hist_cache_t *c = cache_find(chat_id);
+    if (c) {
+        cache_drop_msgs(c);
+        c->valid = false;
+    }
+
+    /* Unlink this chat's unwritten entries */
+    pending_rec_t **pp = &s_pending_head;
+    s_pending_tail = NULL;
+    while (*pp) {
+        pending_rec_t *p = *pp;
+        if (strcmp(p->chat_id, chat_id) == 0) {
+            *pp = p->next;
+            rec_free(p);
+            s_pending_count--;
+        } else {
+            s_pending_tail = p;
+            pp = &p->next;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    remove(idx_path);
+    int ret = remove(path);
+    if (remove(legacy) == 0) ret = 0;
+    xSemaphoreGive(s_io_lock);
 
-    if (remove(path) == 0) {
+    if (ret == 0) {
         ESP_LOGI(TAG, "Session %s cleared", chat_id);
         return ESP_OK;
     }
@@ -152,7 +876,8 @@ void session_list(void)
     struct dirent *entry;
     int count = 0;
     while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, "tg_") && strstr(entry->d_name, ".jsonl")) {
+        if (strstr(entry->d_name, "tg_") &&
+            (strstr(entry->d_name, ".bin") || strstr(entry->d_name, ".jsonl"))) {
             ESP_LOGI(TAG, "  Session: %s", entry->d_name);
             count++;
         }
@@ -1,20 +1,31 @@
 #pragma once
 
 #include "esp_err.h"
+#include "cJSON.h"
 #include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t hits;              /* history served from the PSRAM cache */
+    uint32_t misses;            /* history loaded from flash */
+    int cached;                 /* chats currently cached */
+    int pending;                /* appends not yet written to flash */
+} session_cache_stats_t;
 
 /**
- * Initialize session manager.
+ * Initialize session manager: allocate the history cache and start the
+ * write-behind flusher.
  */
 esp_err_t session_mgr_init(void);
 
 /**
- * Append a message to a session file (JSONL format).
+ * Append a message to a session. The cached history is updated at once;
+ * the session file is written by the flusher within MIMI_SESSION_FLUSH_MS.
  * @param chat_id   Session identifier (e.g., "12345")
- * @param role      "user" or "assistant"
- * @param content   Message text
+ * @param role      "user", "assistant" or "system" (ESP_ERR_INVALID_ARG otherwise)
+ * @param content   Message text, a msg_buf; a reference is held until written
  */
-esp_err_t session_append(const char *chat_id, const char *role, const char *content);
+esp_err_t session_append(const char *chat_id, const char *role, char *content);
 
 /**
  * Load session history as a JSON array string suitable for LLM messages.
@@ -29,7 +40,24 @@ esp_err_t session_append(const char *chat_id, const char *role, const char *cont
 esp_err_t session_get_history_json(const char *chat_id, char *buf, size_t size, int max_msgs);
 
 /**
- * Clear a session (delete the file).
+ * Load the last max_msgs messages as a new cJSON array of
+ * {"role","content"} objects, from the PSRAM cache when the chat is hot.
+ * Caller owns the array.
+ */
+cJSON *session_get_history(const char *chat_id, int max_msgs);
+
+/**
+ * Write all pending appends to flash now (e.g. before a restart).
+ * Entries of a chat whose write fails stay pending and are retried by
+ * the next flush; ESP_FAIL reports that some are still unwritten.
+ */
+esp_err_t session_flush(void);
+
+/** Snapshot history cache counters. */
+void session_get_cache_stats(session_cache_stats_t *out);
+
+/**
+ * Clear a session (delete its record file, index and any legacy JSONL).
  */
 esp_err_t session_clear(const char *chat_id);
 
@@ -37,3 +65,35 @@ esp_err_t session_clear(const char *chat_id);
  * List all session files (prints to log).
  */
 void session_list(void);
+
+/* ── Rolling summaries ─────────────────────────────────────────── */
+
+/** Identifies the entries read by session_read_prefix(). */
+typedef struct {
+    int count;          /* entries in the prefix */
+    uint32_t end;       /* file offset just past them */
+} session_prefix_t;
+
+/**
+ * Called by the flusher after writing to a chat that has grown past
+ * MIMI_SESSION_SUMMARY_TRIGGER entries. Must not block.
+ */
+typedef void (*session_compact_hook_t)(const char *chat_id);
+
+void session_set_compact_hook(session_compact_hook_t hook);
+
+/**
+ * Read every entry of a chat except the newest keep, oldest first, as a new
+ * cJSON array of {"role","content"}; an earlier summary has role "summary".
+ * @return ESP_ERR_NOT_FOUND if fewer than two entries would be replaced
+ */
+esp_err_t session_read_prefix(const char *chat_id, int keep, cJSON **out,
+                              session_prefix_t *prefix);
+
+/**
+ * Replace the prefix read by session_read_prefix() with one summary entry.
+ * The summary is served as the first history message from then on.
+ * @return ESP_ERR_INVALID_STATE if the file was rewritten in between
+ */
+esp_err_t session_replace_prefix(const char *chat_id, const session_prefix_t *prefix,
+                                 const char *summary);
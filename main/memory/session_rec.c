@@ -0,0 +1,206 @@
+#include "session_rec.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+static const char *TAG = "session";
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* ── Records ─────────────────────────────────────────────────── */
+
+#define REC_MAGIC       0xA5
+#define REC_HDR_MAX     (2 + 5 + 5)
+
+const char *const session_role_names[SESSION_ROLE_COUNT] = {
+    "user", "assistant", "system", "summary",
+};
+
+int session_role_code(const char *role)
+{
+    for (int i = 0; i < SESSION_ROLE_COUNT; i++) {
+        if (strcmp(role, session_role_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static size_t varint_put(uint8_t *p, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool varint_get(FILE *f, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return false;
+        *v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+static size_t rec_encode_header(uint8_t *hdr, int role, uint32_t ts, uint32_t len)
+{
+    size_t n = 0;
+    hdr[n++] = REC_MAGIC;
+    hdr[n++] = (uint8_t)role;
+    n += varint_put(hdr + n, ts);
+    n += varint_put(hdr + n, len);
+    return n;
+}
+
+/* Read one record header; false at end of file or on a torn record */
+bool session_rec_read_header(FILE *f, int *role, uint32_t *ts, uint32_t *len)
+{
+    if (getc(f) != REC_MAGIC) return false;
+    int r = getc(f);
+    if (r == EOF || r >= SESSION_ROLE_COUNT) return false;
+    *role = r;
+    return varint_get(f, ts) && varint_get(f, len);
+}
+
+/* Append one record; returns bytes written, 0 on failure */
+size_t session_rec_write(FILE *f, int role, uint32_t ts, const char *content)
+{
+    uint32_t len = (uint32_t)strlen(content);
+    uint8_t hdr[REC_HDR_MAX];
+    size_t hlen = rec_encode_header(hdr, role, ts, len);
+    if (fwrite(hdr, 1, hlen, f) != hlen || fwrite(content, 1, len, f) != len) return 0;
+    return hlen + len;
+}
+
+/* ── Folding ─────────────────────────────────────────────────── */
+
+/*
+ * Read up to max bytes of a len-byte record body into out, backing off so
+ * a cut never ends inside a UTF-8 sequence, and skip the rest.
+ */
+static bool read_cut(FILE *f, uint32_t len, char *out, size_t max, size_t *kept)
+{
+    size_t take = len < max ? len : max;
+    if (fread(out, 1, take, f) != take) return false;
+    *kept = take;
+    if (take == len) return true;
+
+    int next = getc(f);
+    if (next == EOF) return false;
+    if ((next & 0xC0) == 0x80) {
+        while (*kept > 0 && ((uint8_t)out[*kept - 1] & 0xC0) == 0x80) (*kept)--;
+        if (*kept > 0) (*kept)--;      /* the lead byte */
+    }
+    return fseek(f, (long)(len - take - 1), SEEK_CUR) == 0;
+}
+
+/* Fold count records into plain-text notes appended to out */
+bool session_rec_fold(FILE *f, int count, char *out, size_t size)
+{
+    size_t off = strlen(out);
+    for (int i = 0; i < count; i++) {
+        int role;
+        uint32_t ts, len;
+        if (!session_rec_read_header(f, &role, &ts, &len)) return false;
+
+        size_t room = size - off - 1;
+        size_t kept;
+        if (role == SESSION_ROLE_SUMMARY) {
+            /* The previous summary keeps at most half, the notes share the rest */
+            if (!read_cut(f, len, out + off, room > 2 ? (room - 2) / 2 : 0, &kept)) return false;
+            off += kept;
+            off += snprintf(out + off, size - off, "\n\n");
+            continue;
+        }
+
+        const char *label = role == SESSION_ROLE_ASSISTANT ? "Assistant" :
+                            role == SESSION_ROLE_SYSTEM ? "System" : "User";
+        /* Label, ": ", " [...]" and the newline come out of each share */
+        size_t share = room / (size_t)(count - i);
+        size_t extra = strlen(label) + 9;
+        if (share < extra + 1) {
+            if (fseek(f, len, SEEK_CUR) != 0) return false;
+            continue;
+        }
+        off += snprintf(out + off, size - off, "%s: ", label);
+        if (!read_cut(f, len, out + off, share - extra, &kept)) return false;
+        off += kept;
+        off += snprintf(out + off, size - off, "%s\n", kept < len ? " [...]" : "");
+    }
+    out[off] = '\0';
+    return true;
+}
+
+/* ── Tail index ──────────────────────────────────────────────── */
+
+/* Rebuild the index from the record file. Returns the entry count, or -1. */
+int session_index_rebuild(const char *path, const char *idx_path)
+{
+    long size = file_size(path);
+    FILE *f = size >= 0 ? fopen(path, "rb") : NULL;
+    if (!f) return -1;
+    FILE *ix = fopen(idx_path, "wb");
+    if (!ix) {
+        fclose(f);
+        return -1;
+    }
+
+    /* Headers only; content is skipped with a seek */
+    uint32_t off = 0;
+    int count = 0;
+    int role;
+    uint32_t ts, len;
+    while (session_rec_read_header(f, &role, &ts, &len)) {
+        long end = ftell(f) + (long)len;
+        if (end > size || fseek(f, end, SEEK_SET) != 0) break;  /* torn tail */
+        fwrite(&off, sizeof(off), 1, ix);
+        count++;
+        off = (uint32_t)end;
+    }
+    fclose(f);
+    fclose(ix);
+
+    ESP_LOGI(TAG, "Rebuilt index %s (%d entries)", idx_path, count);
+    return count;
+}
+
+/* Read index entry i; false if the index is short */
+bool session_index_read(FILE *ix, int i, uint32_t *off)
+{
+    return fseek(ix, (long)i * sizeof(uint32_t), SEEK_SET) == 0 &&
+           fread(off, sizeof(*off), 1, ix) == 1;
+}
+
+/*
+ * Offset of the entry max_msgs from the end, validating the index against
+ * the record file size first. Entries appended without an index update are
+ * still after this offset, so the caller's tail read picks them up.
+ */
+long session_index_tail_offset(const char *path, const char *idx_path,
+                               long size, int max_msgs)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int entries = (int)(file_size(idx_path) / (long)sizeof(uint32_t));
+        FILE *ix = entries > 0 ? fopen(idx_path, "rb") : NULL;
+        if (ix) {
+            uint32_t last, start;
+            int first = entries > max_msgs ? entries - max_msgs : 0;
+            bool ok = session_index_read(ix, entries - 1, &last) && (long)last < size &&
+                      session_index_read(ix, first, &start);
+            fclose(ix);
+            if (ok) return (long)start;
+        }
+        if (attempt == 0 && session_index_rebuild(path, idx_path) < 0) break;
+    }
+    return 0;   /* fall back to a full scan */
+}
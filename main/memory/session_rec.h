@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * On-flash format of session files, shared by the session manager and
+ * the host tests.
+ *
+ * tg_<chat>.bin is a sequence of length-prefixed records:
+ *   0xA5 | role | varint ts | varint len | content[len]
+ * Varints are LEB128, so a typical header is 9 bytes instead of the
+ * repeated JSON keys, and content needs no escaping or size limit.
+ *
+ * tg_<chat>.idx holds one uint32_t offset per record, so loading the
+ * last N messages seeks straight to them instead of parsing the whole
+ * file. A missing or stale index (older firmware, interrupted append) is
+ * rebuilt with a single scan.
+ */
+
+/* A summary record replaces older turns and is only ever the first record */
+enum {
+    SESSION_ROLE_USER,
+    SESSION_ROLE_ASSISTANT,
+    SESSION_ROLE_SYSTEM,
+    SESSION_ROLE_SUMMARY,
+    SESSION_ROLE_COUNT
+};
+
+extern const char *const session_role_names[SESSION_ROLE_COUNT];
+
+/** Role code for a role name, or -1. */
+int session_role_code(const char *role);
+
+/** Read one record header; false at end of file or on a torn record. */
+bool session_rec_read_header(FILE *f, int *role, uint32_t *ts, uint32_t *len);
+
+/** Append one record; returns bytes written, 0 on failure. */
+size_t session_rec_write(FILE *f, int role, uint32_t ts, const char *content);
+
+/**
+ * Fold the next count records of f into plain-text notes appended to the
+ * string in out: a summary record's text first, cut to half the room
+ * left, then one "User: ..." line per message. Each message gets an equal
+ * share of what remains and is cut to it, so out stays within size.
+ * False on a torn record.
+ */
+bool session_rec_fold(FILE *f, int count, char *out, size_t size);
+
+/** Rebuild the index from the record file. Returns the entry count, or -1. */
+int session_index_rebuild(const char *path, const char *idx_path);
+
+/** Read index entry i; false if the index is short. */
+bool session_index_read(FILE *ix, int i, uint32_t *off);
+
+/**
+ * Offset of the entry max_msgs from the end of the size-byte record file,
+ * validating the index against it first (and rebuilding a stale one).
+ * Entries appended without an index update are still after this offset,
+ * so the caller's tail read picks them up. 0 means read the whole file.
+ */
+long session_index_tail_offset(const char *path, const char *idx_path,
+                               long size, int max_msgs);
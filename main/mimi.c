@@ -15,11 +15,14 @@
 #include "telegram/telegram_bot.h"
 #include "llm/llm_proxy.h"
 #include "agent/agent_loop.h"
+#include "agent/compactor.h"
 #include "memory/memory_store.h"
 #include "memory/session_mgr.h"
 #include "gateway/ws_server.h"
 #include "cli/serial_cli.h"
 #include "proxy/http_proxy.h"
+#include "net/tls_cache.h"
+#include "net/http_transport.h"
 #include "tools/tool_registry.h"
 #include "display/display.h"
 #include "buttons/button_driver.h"
@@ -71,29 +74,20 @@ static esp_err_t init_spiffs(void)
     return ESP_OK;
 }
 
-/* Outbound dispatch task: reads from outbound queue and routes to channels */
-static void outbound_dispatch_task(void *arg)
+/* Outbound handlers: each runs on its channel's own bus worker */
+static void outbound_telegram(const mimi_msg_t *msg)
 {
-    ESP_LOGI(TAG, "Outbound dispatch started");
-
-    while (1) {
-        mimi_msg_t msg;
-        if (message_bus_pop_outbound(&msg, UINT32_MAX) != ESP_OK) continue;
-
-        ESP_LOGI(TAG, "Dispatching response to %s:%s", msg.channel, msg.chat_id);
+    telegram_send_message(msg->chat_id, msg->content);
+}
 
-        if (strcmp(msg.channel, MIMI_CHAN_TELEGRAM) == 0) {
-            telegram_send_message(msg.chat_id, msg.content);
-        } else if (strcmp(msg.channel, MIMI_CHAN_WEBSOCKET) == 0) {
-            ws_server_send(msg.chat_id, msg.content);
-        } else if (strcmp(msg.channel, MIMI_CHAN_SYSTEM) == 0) {
-            ESP_LOGI(TAG, "System message [%s]: %.128s", msg.chat_id, msg.content);
-        } else {
-            ESP_LOGW(TAG, "Unknown channel: %s", msg.channel);
-        }
+static void outbound_websocket(const mimi_msg_t *msg)
+{
+    ws_server_send(msg->chat_id, msg->content);
+}
 
-        free(msg.content);
-    }
+static void outbound_system(const mimi_msg_t *msg)
+{
+    ESP_LOGI(TAG, "System message [%s]: %.128s", msg->chat_id, msg->content);
 }
 
 void app_main(void)
@@ -139,6 +133,8 @@ void app_main(void)
     ESP_ERROR_CHECK(skill_loader_init());
     ESP_ERROR_CHECK(session_mgr_init());
     ESP_ERROR_CHECK(wifi_manager_init());
+    ESP_ERROR_CHECK(tls_cache_init());
+    ESP_ERROR_CHECK(http_transport_init());
     ESP_ERROR_CHECK(http_proxy_init());
     ESP_ERROR_CHECK(telegram_bot_init());
     ESP_ERROR_CHECK(llm_proxy_init());
@@ -159,19 +155,21 @@ void app_main(void)
         if (wifi_manager_wait_connected(30000) == ESP_OK) {
             ESP_LOGI(TAG, "WiFi connected: %s", wifi_manager_get_ip());
 
+            /* Outbound routing, one worker per channel */
+            ESP_ERROR_CHECK(message_bus_subscribe_outbound(MIMI_CHAN_TELEGRAM, outbound_telegram));
+            ESP_ERROR_CHECK(message_bus_subscribe_outbound(MIMI_CHAN_WEBSOCKET, outbound_websocket));
+            ESP_ERROR_CHECK(message_bus_subscribe_outbound(MIMI_CHAN_SYSTEM, outbound_system));
+
             /* Start network-dependent services */
+            ESP_ERROR_CHECK(http_transport_start());
             ESP_ERROR_CHECK(telegram_bot_start());
+            ESP_ERROR_CHECK(llm_proxy_start());
             ESP_ERROR_CHECK(agent_loop_start());
+            ESP_ERROR_CHECK(compactor_start());
             cron_service_start();
             heartbeat_start();
             ESP_ERROR_CHECK(ws_server_start());
 
-            /* Outbound dispatch task */
-            xTaskCreatePinnedToCore(
-                outbound_dispatch_task, "outbound",
-                MIMI_OUTBOUND_STACK, NULL,
-                MIMI_OUTBOUND_PRIO, NULL, MIMI_OUTBOUND_CORE);
-
             ESP_LOGI(TAG, "All services started!");
         } else {
             ESP_LOGW(TAG, "WiFi connection timeout. Check MIMI_SECRET_WIFI_SSID in mimi_secrets.h");
@@ -25,6 +25,12 @@
 #ifndef MIMI_SECRET_MODEL_PROVIDER
 #define MIMI_SECRET_MODEL_PROVIDER  "anthropic"
 #endif
+#ifndef MIMI_SECRET_FALLBACK_API_KEY
+#define MIMI_SECRET_FALLBACK_API_KEY ""
+#endif
+#ifndef MIMI_SECRET_FALLBACK_MODEL
+#define MIMI_SECRET_FALLBACK_MODEL  ""
+#endif
 #ifndef MIMI_SECRET_PROXY_HOST
 #define MIMI_SECRET_PROXY_HOST      ""
 #endif
@@ -43,17 +49,34 @@
 /* Telegram Bot */
 #define MIMI_TG_POLL_TIMEOUT_S       30
 #define MIMI_TG_MAX_MSG_LEN          4096
-#define MIMI_TG_POLL_STACK           (12 * 1024)
-#define MIMI_TG_POLL_PRIO            5
-#define MIMI_TG_POLL_CORE            0
+#define MIMI_TG_UPDATES_STACK        (6 * 1024) /* parses getUpdates, pushes to the bus */
+#define MIMI_TG_UPDATES_PRIO         5
+#define MIMI_TG_UPDATES_CORE         0
 
 /* Agent Loop */
 #define MIMI_AGENT_STACK             (24 * 1024)
 #define MIMI_AGENT_PRIO              6
 #define MIMI_AGENT_CORE              1
-#define MIMI_AGENT_MAX_HISTORY       20
+#define MIMI_AGENT_WORKERS           2        /* chats processed in parallel */
+#define MIMI_AGENT_WORKER_QUEUE_LEN  4
+#define MIMI_AGENT_DISPATCH_STACK    (4 * 1024)
+#define MIMI_AGENT_ADMIT_MIN_PSRAM   (512 * 1024)  /* free PSRAM needed to start another turn */
+#define MIMI_AGENT_MAX_HISTORY       40       /* upper bound; the token budget decides */
 #define MIMI_AGENT_MAX_TOOL_ITER     10
 #define MIMI_MAX_TOOL_CALLS          4
+#define MIMI_AGENT_PIPELINE_TOOLS    1        /* start tools while the response streams */
+#define MIMI_TOOL_RUNNER_WORKERS     2        /* one per core */
+#define MIMI_TOOL_RUNNER_STACK       (12 * 1024)
+#define MIMI_TOOL_RUNNER_PRIO        5
+#define MIMI_TOOL_TIMEOUT_MS         45000
+#define MIMI_TOOL_RUNNER_SPARES      2        /* extra workers while others are stuck in timed-out tools */
+#define MIMI_COMPACTOR_STACK         (12 * 1024)
+#define MIMI_COMPACTOR_PRIO          2
+#define MIMI_COMPACTOR_CORE          0
+#define MIMI_COMPACTOR_QUEUE_LEN     4
+#define MIMI_COMPACTOR_RETRY_MS      (10 * 60 * 1000)  /* pause after a failed summary */
+#define MIMI_SUMMARY_INPUT_TOKENS    8000     /* transcript sent for summarising */
+#define MIMI_SUMMARY_MAX_BYTES       (4 * 1024)
 
 /* Timezone (POSIX TZ format) */
 #define MIMI_TIMEZONE                "PST8PDT,M3.2.0,M11.1.0"
@@ -64,11 +87,54 @@
 #define MIMI_LLM_MAX_TOKENS          4096
 #define MIMI_LLM_API_URL             "https://api.anthropic.com/v1/messages"
 #define MIMI_OPENAI_API_URL          "https://api.openai.com/v1/chat/completions"
+#define MIMI_OPENAI_DEFAULT_MODEL    "gpt-4o"  /* fallback model when none is set */
 #define MIMI_LLM_API_VERSION         "2023-06-01"
 #define MIMI_LLM_STREAM_BUF_SIZE     (32 * 1024)
+#define MIMI_LLM_STREAM              1        /* agent turns use server-sent events */
+#define MIMI_LLM_PROMPT_CACHE        1        /* Anthropic cache_control breakpoints */
+#define MIMI_LLM_TIMEOUT_MS          120000   /* gap allowed between response bytes */
+#define MIMI_LLM_WARM_STACK          (8 * 1024)
+#define MIMI_LLM_WARM_PRIO           4
+#define MIMI_LLM_WARM_CORE           0
+#define MIMI_LLM_MAX_ATTEMPTS        4        /* per call, across both providers */
+#define MIMI_LLM_BACKOFF_BASE_MS     500      /* retry delay doubles from here, with jitter */
+#define MIMI_LLM_BACKOFF_MAX_MS      8000
+#define MIMI_LLM_RETRY_AFTER_MAX_MS  30000    /* a longer Retry-After fails the call instead */
+#define MIMI_LLM_BREAKER_FAILS       3        /* failed attempts in a row that open a breaker */
+#define MIMI_LLM_BREAKER_OPEN_MS     60000    /* open breaker skips the provider this long */
+#define MIMI_LLM_HEDGE_MS            0        /* non-streaming calls: duplicate after this long without a reply; 0 = off */
+#define MIMI_LLM_LATENCY_SAMPLES     64       /* recent first-byte times behind the percentiles */
+
+/* HTTP / TLS */
+#define MIMI_HTTP_CONNECT_TIMEOUT_MS 15000
+#define MIMI_HTTP_CONN_POOL          6        /* kept-alive connections (LLM workers + compactor, Telegram, tools) */
+#define MIMI_HTTP_KEEPALIVE_MS       50000    /* close a kept connection idle this long */
+#define MIMI_PROXY_TUNNEL_POOL       4        /* idle CONNECT tunnels kept for reuse */
+#define MIMI_TLS_CACHE_HOSTS         6        /* hosts whose last session is kept for resumption */
+#define MIMI_HTTP_IO_STACK           (10 * 1024) /* handshakes + completion callbacks */
+#define MIMI_HTTP_IO_PRIO            5
+#define MIMI_HTTP_IO_CORE            0
+#define MIMI_HTTP_IO_QUEUE_LEN       8        /* submitted requests not yet picked up */
+#define MIMI_HTTP_IO_POLL_MS         50       /* select() slice: submissions and timeouts */
+#define MIMI_HTTP_ACCEPT_GZIP        1        /* offer gzip/deflate; bodies are inflated as they arrive */
+#define MIMI_HTTP_ENC_ENDPOINTS      8        /* endpoints whose wire vs decoded bytes are counted */
 
 /* Message Bus */
-#define MIMI_BUS_QUEUE_LEN           8
+#define MIMI_BUS_QUEUE_LEN           8        /* per inbound lane and outbound channel */
+#define MIMI_BUS_MAX_CHANNELS        4        /* outbound subscribers */
+#define MIMI_BUS_WEIGHT_INTERACTIVE  8        /* inbound lane weights per round */
+#define MIMI_BUS_WEIGHT_SCHEDULED    2
+#define MIMI_BUS_WEIGHT_SYSTEM       1
+#define MIMI_BUS_STARVE_MS           120000   /* background wait before it is served next */
+#define MIMI_BUS_SPILL_HIGH          6        /* lane depth that diverts pushes to flash */
+#define MIMI_BUS_SPILL_LOW           2        /* lane depth that starts draining flash */
+#define MIMI_BUS_SPILL_MAX_BYTES     (64 * 1024)
+#define MIMI_BUS_SPILL_FILE          "/spiffs/bus/spill.bin"
+#define MIMI_BUS_SPILL_POS_FILE      "/spiffs/bus/spill.pos"
+#define MIMI_MSG_BUF_SMALL_SIZE      256      /* message payload slabs (PSRAM) */
+#define MIMI_MSG_BUF_SMALL_COUNT     32
+#define MIMI_MSG_BUF_LARGE_SIZE      4096
+#define MIMI_MSG_BUF_LARGE_COUNT     16
 #define MIMI_OUTBOUND_STACK          (8 * 1024)
 #define MIMI_OUTBOUND_PRIO           5
 #define MIMI_OUTBOUND_CORE           0
@@ -83,7 +149,31 @@
 #define MIMI_USER_FILE               "/spiffs/config/USER.md"
 #define MIMI_AGENTS_FILE             "/spiffs/config/AGENTS.md"
 #define MIMI_CONTEXT_BUF_SIZE        (16 * 1024)
-#define MIMI_SESSION_MAX_MSGS        20
+#define MIMI_CONTEXT_TOKEN_BUDGET    16000    /* estimated input tokens per turn */
+#define MIMI_CONTEXT_BOOTSTRAP_MAX   (12 * 1024)  /* cached prompt section capacities */
+#define MIMI_CONTEXT_MEMORY_MAX      (4 * 1024)
+#define MIMI_CONTEXT_NOTES_MAX       (4 * 1024)
+#define MIMI_CONTEXT_SKILLS_MAX      (2 * 1024)
+#define MIMI_TOKEN_SHARE_BOOTSTRAP   15       /* % of the budget per prompt section */
+#define MIMI_TOKEN_SHARE_MEMORY      15
+#define MIMI_TOKEN_SHARE_NOTES       10
+#define MIMI_TOKEN_SHARE_SKILLS      5
+#define MIMI_TOKEN_CHARS_PER_TOKEN   4        /* estimator: ASCII letters per token */
+#define MIMI_TOKEN_MSG_OVERHEAD      4        /* estimator: framing per message */
+#define MIMI_SESSION_MAX_MSGS        40
+#define MIMI_SESSION_COMPACT_MSGS    200      /* entries before a session file is compacted */
+#define MIMI_SESSION_KEEP_MSGS       40       /* newest entries kept by compaction */
+#define MIMI_SESSION_FOLD_MAX_BYTES  (16 * 1024)  /* summary plus the entries compaction folds in */
+#define MIMI_SESSION_SUMMARY_TRIGGER 60       /* entries before old turns are summarised */
+#define MIMI_SESSION_SUMMARY_KEEP    30       /* newest entries kept verbatim */
+#define MIMI_SESSION_SUMMARY_PREFIX  "[Summary of our earlier conversation]\n"
+#define MIMI_SESSION_CACHE_CHATS     8        /* hot chat histories kept in PSRAM */
+#define MIMI_SESSION_FLUSH_MS        2000     /* write-behind group commit interval */
+#define MIMI_SESSION_FLUSH_BATCH     8        /* pending appends that trigger an early flush */
+#define MIMI_SESSION_PENDING_MAX     64       /* unwritten appends kept while flash writes fail */
+#define MIMI_SESSION_FLUSH_STACK     (6 * 1024)
+#define MIMI_SESSION_FLUSH_PRIO      3
+#define MIMI_SESSION_FLUSH_CORE      0
 
 /* Skills */
 #define MIMI_SKILLS_PREFIX           "/spiffs/skills/"
@@ -120,5 +210,7 @@
 #define MIMI_NVS_KEY_API_KEY         "api_key"
 #define MIMI_NVS_KEY_MODEL           "model"
 #define MIMI_NVS_KEY_PROVIDER        "provider"
+#define MIMI_NVS_KEY_FB_API_KEY      "fb_api_key"
+#define MIMI_NVS_KEY_FB_MODEL        "fb_model"
 #define MIMI_NVS_KEY_PROXY_HOST      "host"
 #define MIMI_NVS_KEY_PROXY_PORT      "port"
@@ -0,0 +1,120 @@
+#include "http_rx.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+
+void http_rx_init(http_rx_t *rx, bool head_request, http_header_cb_t on_header,
+                  http_body_cb_t on_body, void *ctx)
+{
+    memset(rx, 0, sizeof(*rx));
+    rx->content_length = -1;
+    rx->no_body = head_request;
+    rx->on_header = on_header;
+    rx->on_body = on_body;
+    rx->ctx = ctx;
+}
+
+static void http_rx_header(http_rx_t *rx, char *line)
+{
+    char *colon = strchr(line, ':');
+    if (!colon) return;
+    *colon = '\0';
+    const char *value = colon + 1;
+    while (*value == ' ' || *value == '\t') value++;
+
+    if (strcasecmp(line, "Transfer-Encoding") == 0) {
+        rx->chunked = strcasestr(value, "chunked") != NULL;
+    } else if (strcasecmp(line, "Content-Length") == 0) {
+        rx->content_length = atol(value);
+    } else if (strcasecmp(line, "Connection") == 0) {
+        rx->close = strcasestr(value, "close") != NULL;
+    } else if (strcasecmp(line, "Content-Encoding") == 0) {
+        if (strcasestr(value, "gzip")) {
+            rx->enc = HTTP_ENC_GZIP;
+        } else if (strcasestr(value, "deflate")) {
+            rx->enc = HTTP_ENC_DEFLATE;
+        }
+    }
+    if (rx->on_header) rx->on_header(line, value, rx->ctx);
+}
+
+static esp_err_t http_rx_line(http_rx_t *rx)
+{
+    char *line = rx->line;
+
+    switch (rx->state) {
+    case HTTP_RX_STATUS: {
+        if (strncmp(line, "HTTP/", 5) != 0) return ESP_ERR_INVALID_RESPONSE;
+        const char *sp = strchr(line, ' ');
+        rx->status = sp ? atoi(sp + 1) : 0;
+        rx->state = HTTP_RX_HEADERS;
+        break;
+    }
+    case HTTP_RX_HEADERS:
+        if (line[0] != '\0') {
+            http_rx_header(rx, line);
+        } else if (rx->status >= 100 && rx->status < 200) {
+            /* Interim response: the real one follows */
+            rx->state = HTTP_RX_STATUS;
+            rx->chunked = false;
+            rx->content_length = -1;
+            rx->enc = HTTP_ENC_IDENTITY;
+        } else if (rx->no_body || rx->status == 204 || rx->status == 304) {
+            rx->state = HTTP_RX_DONE;
+        } else if (rx->chunked) {
+            rx->state = HTTP_RX_CHUNK_SIZE;
+        } else if (rx->content_length == 0) {
+            rx->state = HTTP_RX_DONE;
+        } else {
+            rx->remaining = rx->content_length > 0 ? (size_t)rx->content_length : SIZE_MAX;
+            rx->state = HTTP_RX_BODY;
+        }
+        break;
+    case HTTP_RX_CHUNK_SIZE:
+        rx->remaining = strtoul(line, NULL, 16);
+        rx->state = rx->remaining ? HTTP_RX_CHUNK_DATA : HTTP_RX_TRAILERS;
+        break;
+    case HTTP_RX_CHUNK_END:
+        rx->state = HTTP_RX_CHUNK_SIZE;
+        break;
+    case HTTP_RX_TRAILERS:
+        if (line[0] == '\0') rx->state = HTTP_RX_DONE;
+        break;
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_rx_feed(http_rx_t *rx, const char *data, size_t len)
+{
+    while (len > 0 && rx->state != HTTP_RX_DONE) {
+        if (rx->state == HTTP_RX_BODY || rx->state == HTTP_RX_CHUNK_DATA) {
+            size_t n = len < rx->remaining ? len : rx->remaining;
+            rx->wire_bytes += n;
+            esp_err_t err = rx->on_body ? rx->on_body(data, n, rx->status, rx->ctx) : ESP_OK;
+            if (err != ESP_OK) return err;
+            data += n;
+            len -= n;
+            rx->remaining -= n;
+            if (rx->remaining == 0) {
+                rx->state = (rx->state == HTTP_RX_BODY) ? HTTP_RX_DONE : HTTP_RX_CHUNK_END;
+            }
+            continue;
+        }
+
+        char c = *data++;
+        len--;
+        if (c == '\n') {
+            rx->line[rx->line_len] = '\0';
+            rx->line_len = 0;
+            esp_err_t err = http_rx_line(rx);
+            if (err != ESP_OK) return err;
+        } else if (c != '\r' && rx->line_len < sizeof(rx->line) - 1) {
+            rx->line[rx->line_len++] = c;
+        }
+    }
+    return ESP_OK;
+}
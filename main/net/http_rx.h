@@ -0,0 +1,65 @@
+#pragma once
+
+#include "esp_err.h"
+#include "http_transport.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Incremental HTTP/1.1 response decoder, shared by the transport and the
+ * host tests.
+ *
+ * Bytes go in as they come off the connection, split anywhere. The status
+ * line and headers are parsed, 1xx interim responses skipped, and chunked
+ * transfer-encoding undone, so on_body sees the body as the server encoded
+ * it (Content-Encoding is recorded in enc, not undone). HTTP_RX_DONE marks
+ * the end of a response on a connection that stays open; a body without
+ * Content-Length or chunking stays in HTTP_RX_BODY until the connection
+ * closes.
+ */
+
+typedef enum {
+    HTTP_ENC_IDENTITY = 0,
+    HTTP_ENC_GZIP,
+    HTTP_ENC_DEFLATE,
+} http_enc_t;
+
+typedef enum {
+    HTTP_RX_STATUS = 0,
+    HTTP_RX_HEADERS,
+    HTTP_RX_CHUNK_SIZE,
+    HTTP_RX_CHUNK_DATA,
+    HTTP_RX_CHUNK_END,
+    HTTP_RX_TRAILERS,
+    HTTP_RX_BODY,
+    HTTP_RX_DONE,
+} http_rx_state_t;
+
+typedef struct {
+    http_rx_state_t state;
+    int status;
+    bool chunked;
+    bool no_body;           /* HEAD request: headers only */
+    long content_length;    /* -1 = body runs until the connection closes */
+    bool close;             /* server sent Connection: close */
+    size_t remaining;       /* bytes left in current chunk / body */
+    http_enc_t enc;
+    size_t wire_bytes;      /* body bytes received */
+    char line[256];
+    size_t line_len;
+    http_header_cb_t on_header;
+    http_body_cb_t on_body;
+    void *ctx;
+} http_rx_t;
+
+/** Start decoding a response; callbacks may be NULL and share ctx. */
+void http_rx_init(http_rx_t *rx, bool head_request, http_header_cb_t on_header,
+                  http_body_cb_t on_body, void *ctx);
+
+/**
+ * Decode len more bytes. Bytes after the end of the response are ignored.
+ *
+ * @return ESP_ERR_INVALID_RESPONSE on a malformed status line, or the
+ *         first error from on_body
+ */
+esp_err_t http_rx_feed(http_rx_t *rx, const char *data, size_t len);
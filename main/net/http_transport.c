@@ -0,0 +1,1142 @@
+#include "http_transport.h"
+#include "http_rx.h"
+#include "mimi_config.h"
+#include "net/tls_cache.h"
+#include "proxy/http_proxy.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include "esp_log.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_tls.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+static const char *TAG = "http";
+
+#define HTTP_HEAD_MAX   1024
+#define HTTP_READ_BUF   2048
+
+/* ── Content-Encoding: gzip / deflate ─────────────────────────── */
+
+/*
+ * Compressed bodies are inflated as they arrive by the tinfl decoder in
+ * ROM. It writes into a 32 KB circular dictionary, and each stretch it
+ * fills goes to the sink before it can be overwritten, so a body is never
+ * held whole in either form. gzip members have their header skipped and
+ * their CRC and length checked; deflate takes zlib-wrapped or raw streams.
+ */
+
+#define GZ_FHCRC        0x02
+#define GZ_FEXTRA       0x04
+#define GZ_FNAME        0x08
+#define GZ_FCOMMENT     0x10
+
+typedef enum {
+    INF_HEADER = 0,         /* gzip member header, or the first two deflate bytes */
+    INF_DATA,
+    INF_TRAILER,            /* gzip CRC32 + ISIZE */
+    INF_DONE,
+} inflate_state_t;
+
+typedef struct {
+    inflate_state_t state;
+    http_enc_t enc;
+    int tinfl_flags;
+    uint8_t head[10];       /* gzip fixed header */
+    uint8_t trailer[8];
+    size_t got;             /* bytes of head / trailer so far */
+    size_t pending;         /* deflate: bytes of head still to inflate */
+    uint8_t fields;         /* optional gzip header fields still to skip */
+    size_t skip;
+    uint32_t crc;
+    uint32_t size;
+    size_t dict_ofs;
+    tinfl_decompressor d;
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+} http_inflate_t;
+
+static http_inflate_t *inflate_new(http_enc_t enc)
+{
+    http_inflate_t *inf = heap_caps_malloc(sizeof(http_inflate_t), MALLOC_CAP_SPIRAM);
+    if (!inf) return NULL;
+    memset(inf, 0, offsetof(http_inflate_t, d));
+    inf->enc = enc;
+    tinfl_init(&inf->d);
+    return inf;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* One byte of the gzip member header (RFC 1952) */
+static esp_err_t gzip_header(http_inflate_t *inf, uint8_t c)
+{
+    if (inf->got < sizeof(inf->head)) {
+        inf->head[inf->got++] = c;
+        if (inf->got < sizeof(inf->head)) return ESP_OK;
+        if (inf->head[0] != 0x1f || inf->head[1] != 0x8b || inf->head[2] != 8) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        inf->fields = inf->head[3] & (GZ_FHCRC | GZ_FEXTRA | GZ_FNAME | GZ_FCOMMENT);
+    } else if (inf->fields & GZ_FEXTRA) {
+        /* XLEN, little-endian, then XLEN bytes */
+        if (inf->got < sizeof(inf->head) + 2) {
+            inf->skip |= (size_t)c << (8 * (inf->got++ - sizeof(inf->head)));
+            if (inf->got == sizeof(inf->head) + 2 && inf->skip == 0) inf->fields &= ~GZ_FEXTRA;
+        } else if (--inf->skip == 0) {
+            inf->fields &= ~GZ_FEXTRA;
+        }
+    } else if (inf->fields & GZ_FNAME) {
+        if (c == 0) inf->fields &= ~GZ_FNAME;
+    } else if (inf->fields & GZ_FCOMMENT) {
+        if (c == 0) inf->fields &= ~GZ_FCOMMENT;
+    } else if (++inf->skip == 2) {
+        inf->fields &= ~GZ_FHCRC;
+    }
+    if (!inf->fields) {
+        inf->state = INF_DATA;
+        inf->got = 0;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t gzip_trailer(http_inflate_t *inf, uint8_t c)
+{
+    inf->trailer[inf->got++] = c;
+    if (inf->got < sizeof(inf->trailer)) return ESP_OK;
+    if (le32(inf->trailer) != inf->crc || le32(inf->trailer + 4) != inf->size) {
+        ESP_LOGE(TAG, "gzip body fails its CRC / length check");
+        return ESP_ERR_INVALID_CRC;
+    }
+    inf->state = INF_DONE;
+    return ESP_OK;
+}
+
+/* Inflate len compressed bytes into sink; anything after the stream is ignored */
+static esp_err_t inflate_feed(http_inflate_t *inf, const uint8_t *in, size_t len,
+                              http_body_cb_t sink, int status, void *ctx)
+{
+    bool more_out = false;
+    while ((len > 0 || more_out || inf->pending) && inf->state != INF_DONE) {
+        if (inf->state == INF_HEADER && inf->enc == HTTP_ENC_DEFLATE) {
+            /*
+             * A zlib header is CMF, FLG with CM = 8, CINFO <= 7 and
+             * CMF * 256 + FLG a multiple of 31; anything else is a raw
+             * deflate block. The two bytes may arrive in separate reads.
+             */
+            inf->head[inf->got++] = *in++;
+            len--;
+            if (inf->got < 2) continue;
+            uint8_t cmf = inf->head[0], flg = inf->head[1];
+            if ((cmf & 0x0f) == 8 && (cmf >> 4) <= 7 && ((cmf << 8) | flg) % 31 == 0) {
+                inf->tinfl_flags = TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+            }
+            inf->pending = 2;
+            inf->state = INF_DATA;
+            continue;
+        }
+        if (inf->state != INF_DATA) {
+            esp_err_t err = inf->state == INF_HEADER ? gzip_header(inf, *in) : gzip_trailer(inf, *in);
+            if (err != ESP_OK) return err;
+            in++;
+            len--;
+            continue;
+        }
+
+        /* The deflate header bytes held back above go first */
+        const uint8_t *src = inf->pending ? inf->head + 2 - inf->pending : in;
+        size_t in_n = inf->pending ? inf->pending : len;
+        size_t out_n = sizeof(inf->dict) - inf->dict_ofs;
+        uint8_t *out = inf->dict + inf->dict_ofs;
+        tinfl_status st = tinfl_decompress(&inf->d, src, &in_n, inf->dict, out, &out_n,
+                                           inf->tinfl_flags | TINFL_FLAG_HAS_MORE_INPUT);
+        if (inf->pending) {
+            inf->pending -= in_n;
+        } else {
+            in += in_n;
+            len -= in_n;
+        }
+        if (out_n > 0) {
+            if (inf->enc == HTTP_ENC_GZIP) {
+                inf->crc = esp_rom_crc32_le(inf->crc, out, out_n);
+                inf->size += out_n;
+            }
+            inf->dict_ofs = (inf->dict_ofs + out_n) & (sizeof(inf->dict) - 1);
+            esp_err_t err = sink((const char *)out, out_n, status, ctx);
+            if (err != ESP_OK) return err;
+        }
+        if (st < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupt compressed body (tinfl status %d)", (int)st);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        more_out = st == TINFL_STATUS_HAS_MORE_OUTPUT;
+        if (st == TINFL_STATUS_DONE) inf->state = inf->enc == HTTP_ENC_GZIP ? INF_TRAILER : INF_DONE;
+    }
+    return ESP_OK;
+}
+
+/* ── Response decoding ────────────────────────────────────────── */
+
+/*
+ * http_rx undoes the framing; a content-encoded body then goes through
+ * the inflater before it reaches the caller.
+ */
+
+typedef struct {
+    char head[HTTP_HEAD_MAX];
+    char buf[HTTP_READ_BUF];
+    http_rx_t rx;
+    http_inflate_t *inf;    /* while inflating the body */
+    size_t body_bytes;      /* body bytes passed on */
+    const http_request_t *req;
+} http_exchange_t;
+
+/* http_body_cb_t between the decoder (ctx) and the caller's sink */
+static esp_err_t rx_emit(const char *data, size_t len, int status, void *ctx)
+{
+    http_exchange_t *x = (http_exchange_t *)ctx;
+    x->body_bytes += len;
+    return x->req->on_body ? x->req->on_body(data, len, status, x->req->ctx) : ESP_OK;
+}
+
+/* The body as the server sent it, inflated on the way if encoded */
+static esp_err_t rx_body(const char *data, size_t len, int status, void *ctx)
+{
+    http_exchange_t *x = (http_exchange_t *)ctx;
+    if (x->rx.enc == HTTP_ENC_IDENTITY || !x->req->on_body) return rx_emit(data, len, status, x);
+    if (!x->inf) x->inf = inflate_new(x->rx.enc);
+    if (!x->inf) return ESP_ERR_NO_MEM;
+    return inflate_feed(x->inf, (const uint8_t *)data, len, rx_emit, status, x);
+}
+
+static void rx_header(const char *name, const char *value, void *ctx)
+{
+    http_exchange_t *x = (http_exchange_t *)ctx;
+    if (x->req->on_header) x->req->on_header(name, value, x->req->ctx);
+}
+
+/* Start decoding the response to req; exchange_end() finishes it */
+static void exchange_begin(http_exchange_t *x, const http_request_t *req)
+{
+    x->req = req;
+    x->inf = NULL;
+    x->body_bytes = 0;
+    http_rx_init(&x->rx, strcmp(req->method, "HEAD") == 0, rx_header, rx_body, x);
+}
+
+static esp_err_t exchange_feed(http_exchange_t *x, const char *data, size_t len)
+{
+    esp_err_t err = http_rx_feed(&x->rx, data, len);
+    if (err == ESP_OK && x->rx.state == HTTP_RX_DONE && x->inf && x->inf->state != INF_DONE) {
+        ESP_LOGE(TAG, "Compressed body from %s ends mid-stream", x->req->host);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return err;
+}
+
+/* ── Compression stats ────────────────────────────────────────── */
+
+typedef struct {
+    http_enc_stats_t st;
+    int64_t last_used_us;   /* 0 = free entry */
+} enc_entry_t;
+
+static enc_entry_t s_enc[MIMI_HTTP_ENC_ENDPOINTS];
+static portMUX_TYPE s_enc_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* Host and last path segment only: Telegram paths carry the bot token */
+static void endpoint_name(const http_request_t *req, char *out, size_t size)
+{
+    const char *path = req->path;
+    size_t end = strcspn(path, "?");
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') start--;
+    snprintf(out, size, "%s/%.*s", req->host, (int)(end - start), path + start);
+}
+
+/* Count a finished response and free its inflater */
+static void exchange_end(http_exchange_t *x)
+{
+    free(x->inf);
+    x->inf = NULL;
+    if (!x->req || x->rx.wire_bytes == 0) return;
+
+    char name[sizeof(s_enc[0].st.endpoint)];
+    endpoint_name(x->req, name, sizeof(name));
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_enc_mux);
+    enc_entry_t *e = NULL, *lru = &s_enc[0];
+    for (int i = 0; i < MIMI_HTTP_ENC_ENDPOINTS && !e; i++) {
+        if (s_enc[i].last_used_us && strcmp(s_enc[i].st.endpoint, name) == 0) e = &s_enc[i];
+        if (s_enc[i].last_used_us < lru->last_used_us) lru = &s_enc[i];
+    }
+    if (!e) {
+        e = lru;
+        memset(e, 0, sizeof(*e));
+        memcpy(e->st.endpoint, name, sizeof(name));
+    }
+    e->last_used_us = now_us;
+    e->st.responses++;
+    if (x->rx.enc != HTTP_ENC_IDENTITY) e->st.compressed++;
+    e->st.wire_bytes += x->rx.wire_bytes;
+    e->st.body_bytes += x->body_bytes;
+    portEXIT_CRITICAL(&s_enc_mux);
+}
+
+int http_transport_get_enc_stats(http_enc_stats_t *out, int max)
+{
+    int n = 0;
+    portENTER_CRITICAL(&s_enc_mux);
+    for (int i = 0; i < MIMI_HTTP_ENC_ENDPOINTS && n < max; i++) {
+        if (s_enc[i].last_used_us) out[n++] = s_enc[i].st;
+    }
+    portEXIT_CRITICAL(&s_enc_mux);
+
+    for (int i = 1; i < n; i++) {
+        http_enc_stats_t v = out[i];
+        int j = i;
+        for (; j > 0 && out[j - 1].wire_bytes < v.wire_bytes; j--) out[j] = out[j - 1];
+        out[j] = v;
+    }
+    return n;
+}
+
+/* ── Connections ──────────────────────────────────────────────── */
+
+/*
+ * Direct connections stay open between requests, so consecutive calls to
+ * the same host pay for one handshake at most. A kept connection the
+ * server has closed in the meantime is detected before any response byte
+ * arrives, and the request is resent on a fresh connection. Proxied
+ * requests get the same treatment from http_proxy's tunnel pool.
+ *
+ * Open connections are non-blocking: reads return what the TLS layer can
+ * decrypt and callers wait in select(), so a TLS record that arrives in
+ * pieces never blocks a read.
+ */
+
+typedef struct {
+    esp_tls_t *tls;         /* direct connection; NULL = slot empty */
+    proxy_conn_t *proxy;    /* CONNECT tunnel instead (pooled by http_proxy) */
+    char host[64];
+    int port;
+    bool busy;              /* in use by a request or being connected */
+    bool warming;           /* being connected ahead of its request */
+    int64_t idle_since_us;
+} http_conn_t;
+
+static http_conn_t s_conns[MIMI_HTTP_CONN_POOL];
+static SemaphoreHandle_t s_conn_lock;
+
+esp_err_t http_transport_init(void)
+{
+    s_conn_lock = xSemaphoreCreateMutex();
+    return s_conn_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static bool conn_pooled(const http_conn_t *c)
+{
+    return c >= s_conns && c < s_conns + MIMI_HTTP_CONN_POOL;
+}
+
+static esp_tls_t *conn_connect(const char *host, int port, bool tls)
+{
+    esp_tls_cfg_t cfg = {
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = MIMI_HTTP_CONNECT_TIMEOUT_MS,
+        .is_plain_tcp = !tls,
+    };
+    esp_tls_t *t = esp_tls_init();
+    if (!t) return NULL;
+    int ret = tls ? tls_cache_connect(host, port, &cfg, t)
+                  : esp_tls_conn_new_sync(host, strlen(host), port, &cfg, t);
+    if (ret != 1) {
+        ESP_LOGE(TAG, "Connect to %s:%d failed", host, port);
+        esp_tls_conn_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+/* A handshake driven step by step on http_io */
+typedef struct {
+    esp_tls_cfg_t cfg;          /* read by esp_tls at every step */
+    tls_cache_attempt_t resume;
+    int64_t start_us;
+} conn_handshake_t;
+
+/* Start a connection for conn_handshake() to complete; NULL on failure */
+static esp_tls_t *conn_connect_start(const http_request_t *req, conn_handshake_t *hs)
+{
+    hs->cfg = (esp_tls_cfg_t){
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        /* How long each step may wait in select() for the TCP connect */
+        .timeout_ms = 1,
+        .non_block = true,
+        .is_plain_tcp = !req->tls,
+    };
+    hs->start_us = esp_timer_get_time();
+    esp_tls_t *t = esp_tls_init();
+    if (t && req->tls) tls_cache_begin(req->host, req->port, &hs->cfg, &hs->resume);
+    return t;
+}
+
+/* Records how a handshake ended: 1 connected, anything else failed or given up */
+static void conn_handshake_end(esp_tls_t *t, const http_request_t *req, conn_handshake_t *hs, int ret)
+{
+    if (req->tls) tls_cache_end(req->host, req->port, &hs->cfg, t, ret, &hs->resume);
+    if (ret != 1) ESP_LOGE(TAG, "Connect to %s:%d failed", req->host, req->port);
+}
+
+/* One step without blocking: 0 while in progress, 1 connected, -1 failed */
+static int conn_handshake(esp_tls_t *t, const http_request_t *req, conn_handshake_t *hs)
+{
+    int ret = esp_tls_conn_new_async(req->host, strlen(req->host), req->port, &hs->cfg, t);
+    if (ret == 0) return 0;
+    conn_handshake_end(t, req, hs, ret);
+    return ret == 1 ? 1 : -1;
+}
+
+/* The TCP connect is waited for by writability, the TLS handshake by reads */
+static bool conn_handshake_wants_write(esp_tls_t *t)
+{
+    esp_tls_conn_state_t state;
+    return esp_tls_get_conn_state(t, &state) == ESP_OK && state == ESP_TLS_CONNECTING;
+}
+
+/*
+ * A kept socket the server closed reads as EOF or an error without
+ * blocking. Pending bytes (e.g. TLS session tickets) are left to the
+ * stale-connection retry.
+ */
+static bool conn_alive(esp_tls_t *t)
+{
+    int sock = -1;
+    if (esp_tls_get_conn_sockfd(t, &sock) != ESP_OK || sock < 0) return false;
+    char c;
+    int n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+static bool conn_is(const http_conn_t *c, const char *host, int port)
+{
+    return c->port == port && strcmp(c->host, host) == 0;
+}
+
+/*
+ * Take an open connection to host:port, or claim a slot for a new one
+ * (c->tls NULL). With wait, a handshake already started by a pre-warm is
+ * waited for rather than duplicated. Returns NULL when every slot is busy.
+ */
+static http_conn_t *conn_acquire(const char *host, int port, bool warm, bool wait)
+{
+    http_conn_t *hit = NULL, *slot = NULL;
+    esp_tls_t *drop = NULL;
+    int64_t deadline_us = esp_timer_get_time() + MIMI_HTTP_CONNECT_TIMEOUT_MS * 1000LL;
+
+    xSemaphoreTake(s_conn_lock, portMAX_DELAY);
+    while (1) {
+        int64_t now_us = esp_timer_get_time();
+        bool warming = false;
+        slot = NULL;
+        for (int i = 0; i < MIMI_HTTP_CONN_POOL && !hit; i++) {
+            http_conn_t *c = &s_conns[i];
+            bool fresh = now_us - c->idle_since_us < MIMI_HTTP_KEEPALIVE_MS * 1000LL;
+            if (c->tls && !c->busy && fresh && conn_is(c, host, port)) {
+                hit = c;
+            } else if (c->warming && conn_is(c, host, port)) {
+                warming = true;
+            } else if (!c->busy && (!slot || !c->tls)) {
+                slot = c;
+            }
+        }
+        if (hit || !warming || !wait || now_us >= deadline_us) break;
+        xSemaphoreGive(s_conn_lock);
+        vTaskDelay(pdMS_TO_TICKS(20));
+        xSemaphoreTake(s_conn_lock, portMAX_DELAY);
+    }
+    if (!hit && slot) {
+        /* Reuse the slot; an expired or foreign connection is closed */
+        drop = slot->tls;
+        slot->tls = NULL;
+        strncpy(slot->host, host, sizeof(slot->host) - 1);
+        slot->host[sizeof(slot->host) - 1] = '\0';
+        slot->port = port;
+        hit = slot;
+    }
+    if (hit) {
+        hit->busy = true;
+        hit->warming = warm;
+    }
+    xSemaphoreGive(s_conn_lock);
+
+    if (drop) esp_tls_conn_destroy(drop);
+    return hit;
+}
+
+/* Connections outside the pool are never kept */
+static void conn_release(http_conn_t *c, bool keep)
+{
+    if (c->proxy) {
+        proxy_conn_release(c->proxy, keep);
+        c->proxy = NULL;
+    }
+    if ((!keep || !conn_pooled(c)) && c->tls) {
+        esp_tls_conn_destroy(c->tls);
+        c->tls = NULL;
+    }
+    if (!conn_pooled(c)) return;
+
+    xSemaphoreTake(s_conn_lock, portMAX_DELAY);
+    c->idle_since_us = esp_timer_get_time();
+    c->busy = false;
+    c->warming = false;
+    xSemaphoreGive(s_conn_lock);
+}
+
+/* What a kept connection the server already dropped fails with */
+static bool conn_was_reset(ssize_t ret, int err)
+{
+    return ret == MBEDTLS_ERR_NET_CONN_RESET || err == ECONNRESET || err == EPIPE;
+}
+
+static int conn_sockfd(http_conn_t *c)
+{
+    int sock = -1;
+    if (c->proxy) return proxy_conn_sockfd(c->proxy);
+    if (esp_tls_get_conn_sockfd(c->tls, &sock) != ESP_OK) return -1;
+    return sock;
+}
+
+/* Decrypted bytes waiting in the TLS layer, invisible to select() */
+static int conn_pending(http_conn_t *c)
+{
+    if (c->proxy) return proxy_conn_pending(c->proxy);
+    return (int)esp_tls_get_bytes_avail(c->tls);
+}
+
+static void conn_set_nonblock(http_conn_t *c)
+{
+    int sock = conn_sockfd(c);
+    if (sock < 0) return;
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags >= 0 && !(flags & O_NONBLOCK)) fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Wait until c is readable (or writable); false after timeout_ms */
+static bool conn_wait(http_conn_t *c, bool write, int timeout_ms)
+{
+    int sock = conn_sockfd(c);
+    if (sock < 0) return false;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    return select(sock + 1, write ? NULL : &fds, write ? &fds : NULL, NULL, &tv) > 0;
+}
+
+static bool conn_would_block(ssize_t ret, int err)
+{
+    return ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE ||
+           err == EAGAIN || err == EWOULDBLOCK;
+}
+
+/*
+ * A request is written in one go: a full socket buffer is waited out, up
+ * to the connect timeout for a peer that takes nothing.
+ */
+static esp_err_t conn_write(const char *data, size_t len, void *ctx)
+{
+    http_conn_t *c = (http_conn_t *)ctx;
+    while (len > 0) {
+        errno = 0;
+        ssize_t n = c->proxy ? proxy_conn_write(c->proxy, data, len)
+                             : esp_tls_conn_write(c->tls, data, len);
+        int err = errno;
+        if (n <= 0 && conn_would_block(n, err)) {
+            if (!conn_wait(c, true, MIMI_HTTP_CONNECT_TIMEOUT_MS)) return ESP_ERR_HTTP_WRITE_DATA;
+            continue;
+        }
+        if (n <= 0) {
+            return conn_was_reset(n, err) ? ESP_ERR_HTTP_CONNECTION_CLOSED
+                                          : ESP_ERR_HTTP_WRITE_DATA;
+        }
+        data += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+/* conn_read() results besides a byte count; 0 is the end of the stream */
+#define CONN_AGAIN      (-1)    /* nothing to decrypt yet: wait in select() */
+#define CONN_TIMEOUT    (-2)    /* conn_read_wait(): nothing within the timeout */
+#define CONN_RESET      (-3)    /* the peer reset the connection */
+#define CONN_ERROR      (-4)
+
+/* Never blocks */
+static int conn_read(http_conn_t *c, char *buf, size_t len)
+{
+    errno = 0;
+    ssize_t n = c->proxy ? proxy_conn_read(c->proxy, buf, len)
+                         : esp_tls_conn_read(c->tls, buf, len);
+    int err = errno;
+    if (n > 0) return (int)n;
+    /* A close without close_notify ends the stream all the same */
+    if (n == 0 || n == MBEDTLS_ERR_SSL_CONN_EOF) return 0;
+    if (conn_was_reset(n, err)) return CONN_RESET;
+    if (conn_would_block(n, err)) return CONN_AGAIN;
+    return CONN_ERROR;
+}
+
+/* conn_read() for a caller that waits: CONN_TIMEOUT once timeout_ms passed */
+static int conn_read_wait(http_conn_t *c, char *buf, size_t len, int timeout_ms)
+{
+    int64_t deadline_us = esp_timer_get_time() + timeout_ms * 1000LL;
+    while (1) {
+        int n = conn_read(c, buf, len);
+        if (n != CONN_AGAIN) return n;
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0 || !conn_wait(c, false, (int)(left_us / 1000))) return CONN_TIMEOUT;
+    }
+}
+
+/*
+ * A live connection for req: a kept one, or a new one whose connect time
+ * goes into res. spare holds connections that are not pooled (proxied
+ * ones, or when every slot is busy). Given hs, a new direct connection is
+ * only started and ESP_ERR_HTTP_CONNECTING returned: conn_handshake()
+ * completes it.
+ */
+static esp_err_t conn_open(const http_request_t *req, http_conn_t *spare,
+                           http_conn_t **out, http_result_t *res, conn_handshake_t *hs)
+{
+    bool proxied = http_proxy_is_enabled();
+    http_conn_t *c = proxied ? NULL : conn_acquire(req->host, req->port, false, !hs);
+    if (!c) {
+        memset(spare, 0, sizeof(*spare));
+        c = spare;
+    }
+
+    int64_t connect_start_us = esp_timer_get_time();
+    if (proxied) {
+        /* http_proxy checks and replaces kept tunnels itself */
+        c->proxy = proxy_conn_open(req->host, req->port, MIMI_HTTP_CONNECT_TIMEOUT_MS);
+        res->reused = c->proxy && proxy_conn_reused(c->proxy);
+    } else {
+        res->reused = c->tls != NULL;
+        if (res->reused && !conn_alive(c->tls)) {
+            esp_tls_conn_destroy(c->tls);
+            c->tls = NULL;
+            res->reused = false;
+            res->stale++;
+        }
+        if (!res->reused && hs) {
+            c->tls = conn_connect_start(req, hs);
+            if (c->tls) {
+                *out = c;
+                return ESP_ERR_HTTP_CONNECTING;
+            }
+        } else if (!res->reused) {
+            c->tls = conn_connect(req->host, req->port, req->tls);
+        }
+    }
+    if (!c->proxy && !c->tls) {
+        conn_release(c, false);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    if (!res->reused) res->connect_us = esp_timer_get_time() - connect_start_us;
+    conn_set_nonblock(c);
+    *out = c;
+    return ESP_OK;
+}
+
+/* ── Exchange ─────────────────────────────────────────────────── */
+
+typedef enum {
+    SEND_OK = 0,
+    SEND_STALE,             /* closed or reset before any response byte */
+    SEND_FAILED,
+} send_result_t;
+
+/* Counts what the body writer produces against the announced length */
+typedef struct {
+    http_conn_t *conn;
+    size_t written;
+} body_sink_t;
+
+static esp_err_t body_sink(const char *data, size_t len, void *ctx)
+{
+    body_sink_t *bs = (body_sink_t *)ctx;
+    bs->written += len;
+    return conn_write(data, len, bs->conn);
+}
+
+static int build_head(char *head, const http_request_t *req, bool keep_alive)
+{
+    char host[80];
+    bool default_port = req->port == (req->tls ? 443 : 80);
+    if (default_port) {
+        snprintf(host, sizeof(host), "%s", req->host);
+    } else {
+        snprintf(host, sizeof(host), "%s:%d", req->host, req->port);
+    }
+
+    int n = snprintf(head, HTTP_HEAD_MAX, "%s %s HTTP/1.1\r\nHost: %s\r\n%s",
+                     req->method, req->path, host, req->headers ? req->headers : "");
+    if (n > 0 && n < HTTP_HEAD_MAX && MIMI_HTTP_ACCEPT_GZIP && !req->identity) {
+        n += snprintf(head + n, HTTP_HEAD_MAX - n, "Accept-Encoding: gzip, deflate\r\n");
+    }
+    if (n > 0 && n < HTTP_HEAD_MAX && (req->body || req->write_body)) {
+        n += snprintf(head + n, HTTP_HEAD_MAX - n, "Content-Length: %u\r\n",
+                      (unsigned)req->body_len);
+    }
+    if (n > 0 && n < HTTP_HEAD_MAX) {
+        n += snprintf(head + n, HTTP_HEAD_MAX - n, "Connection: %s\r\n\r\n",
+                      keep_alive ? "keep-alive" : "close");
+    }
+    return (n > 0 && n < HTTP_HEAD_MAX) ? n : -1;
+}
+
+static esp_err_t send_request(http_conn_t *c, const http_request_t *req, const char *head, int hlen)
+{
+    esp_err_t err = conn_write(head, hlen, c);
+    if (err != ESP_OK) return err;
+    if (req->write_body) {
+        body_sink_t bs = { .conn = c };
+        err = req->write_body(body_sink, &bs, req->body_ctx);
+        if (err == ESP_OK && bs.written != req->body_len) {
+            ESP_LOGE(TAG, "Body length changed while sending (%d != %d)",
+                     (int)bs.written, (int)req->body_len);
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    } else if (req->body) {
+        err = conn_write(req->body, req->body_len, c);
+    }
+    return err;
+}
+
+static send_result_t exchange(http_conn_t *c, const http_request_t *req, http_exchange_t *x,
+                              int hlen, http_result_t *res, int64_t start_us, esp_err_t *out_err)
+{
+    http_rx_t *rx = &x->rx;
+    *out_err = send_request(c, req, x->head, hlen);
+    if (*out_err == ESP_ERR_HTTP_CONNECTION_CLOSED) return SEND_STALE;
+    if (*out_err != ESP_OK) return SEND_FAILED;
+    res->sent_us = esp_timer_get_time() - start_us;
+
+    while (rx->state != HTTP_RX_DONE) {
+        int n = conn_read_wait(c, x->buf, sizeof(x->buf), req->timeout_ms);
+        if (n == CONN_TIMEOUT) {
+            /* The server may be working on the request: never sent again */
+            ESP_LOGW(TAG, "No response from %s for %d ms", req->host, req->timeout_ms);
+            *out_err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        if (n <= 0 && !res->first_byte_us) {
+            if (n == 0 || n == CONN_RESET) return SEND_STALE;
+            *out_err = ESP_ERR_HTTP_FETCH_HEADER;
+            break;
+        }
+        if (n < 0) {
+            *out_err = ESP_FAIL;
+            break;
+        }
+        if (n == 0) {
+            /* EOF ends a body without a length; anything else is cut short */
+            if (rx->state != HTTP_RX_BODY || rx->content_length >= 0) *out_err = ESP_FAIL;
+            rx->close = true;
+            break;
+        }
+        if (!res->first_byte_us) res->first_byte_us = esp_timer_get_time() - start_us;
+        *out_err = exchange_feed(x, x->buf, n);
+        if (*out_err != ESP_OK) break;
+    }
+    return *out_err == ESP_OK ? SEND_OK : SEND_FAILED;
+}
+
+esp_err_t http_transport_request(const http_request_t *req, http_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    int64_t start_us = esp_timer_get_time();
+
+    http_exchange_t *x = malloc(sizeof(http_exchange_t));
+    if (!x) return ESP_ERR_NO_MEM;
+    int hlen = build_head(x->head, req, true);
+    if (hlen < 0) {
+        ESP_LOGE(TAG, "Request head for %s too long", req->host);
+        free(x);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = ESP_ERR_HTTP_CONNECT;
+    /* A second attempt only follows a kept connection that turned out dead */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        http_conn_t spare, *c;
+        err = conn_open(req, &spare, &c, res, NULL);
+        if (err != ESP_OK) break;
+
+        exchange_begin(x, req);
+        send_result_t sr = exchange(c, req, x, hlen, res, start_us, &err);
+        conn_release(c, sr == SEND_OK && x->rx.state == HTTP_RX_DONE && !x->rx.close);
+        res->status = x->rx.status;
+        exchange_end(x);
+
+        if (sr == SEND_STALE && res->reused) {
+            ESP_LOGW(TAG, "Kept connection to %s was closed by the server, reconnecting",
+                     req->host);
+            res->stale++;
+            err = ESP_ERR_HTTP_FETCH_HEADER;
+            continue;
+        }
+        if (sr == SEND_STALE && err == ESP_OK) err = ESP_ERR_HTTP_FETCH_HEADER;
+        break;
+    }
+    free(x);
+    return err;
+}
+
+esp_err_t http_transport_prewarm(const char *host, int port, bool tls, int64_t *connect_us)
+{
+    *connect_us = 0;
+    if (http_proxy_is_enabled()) return ESP_ERR_NOT_SUPPORTED;
+
+    http_conn_t *c = conn_acquire(host, port, true, false);
+    if (!c) return ESP_ERR_NOT_FOUND;
+    if (c->tls && conn_alive(c->tls)) {
+        /* A fresh connection is already waiting */
+        conn_release(c, true);
+        return ESP_OK;
+    }
+    if (c->tls) {
+        esp_tls_conn_destroy(c->tls);
+        c->tls = NULL;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    c->tls = conn_connect(host, port, tls);
+    if (c->tls) *connect_us = esp_timer_get_time() - start_us;
+    conn_release(c, c->tls != NULL);
+    return *connect_us ? ESP_OK : ESP_ERR_HTTP_CONNECT;
+}
+
+/* ── Reactor ──────────────────────────────────────────────────── */
+
+/*
+ * Submitted requests are driven by the http_io task, which never waits
+ * on one socket: new direct connections are connected and handshaken
+ * with esp_tls_conn_new_async(), responses are read from non-blocking
+ * sockets, and one select() covers every request in flight. A request
+ * waiting for its answer costs its op, not a stack.
+ *
+ * Still done in one go on http_io: the request itself (a full socket
+ * buffer is waited out), the name lookup of a new connection (lwIP
+ * answers cached names at once), and opening a new CONNECT tunnel when a
+ * proxy is set.
+ */
+
+typedef struct http_op {
+    http_request_t req;
+    http_done_cb_t done;
+    void *done_ctx;
+    int64_t not_before_us;
+    int64_t start_us;
+    int64_t last_rx_us;     /* gap timeout runs from here */
+    int hlen;
+    bool retried;
+    bool connecting;        /* handshake of c in progress */
+    conn_handshake_t hs;
+    http_conn_t spare;
+    http_conn_t *c;         /* NULL until a connection is taken */
+    http_result_t res;
+    http_exchange_t x;
+    struct http_op *next;
+} http_op_t;
+
+static QueueHandle_t s_io_queue;
+
+/* Reports the outcome and frees op */
+static void op_finish(http_op_t *op, esp_err_t err, bool keep)
+{
+    if (op->connecting) conn_handshake_end(op->c->tls, &op->req, &op->hs, 0);
+    if (op->c) conn_release(op->c, keep);
+    op->res.status = op->x.rx.status;
+    exchange_end(&op->x);
+    op->done(err, &op->res, op->done_ctx);
+    free(op);
+}
+
+static bool op_cancelled(const http_op_t *op)
+{
+    return op->req.cancel && *op->req.cancel;
+}
+
+static bool op_send(http_op_t *op);
+
+/* Take or start a connection; false once op is finished (and freed) */
+static bool op_start(http_op_t *op)
+{
+    if (!op->start_us) op->start_us = esp_timer_get_time();
+    esp_err_t err = conn_open(&op->req, &op->spare, &op->c, &op->res, &op->hs);
+    if (err == ESP_ERR_HTTP_CONNECTING) {
+        op->connecting = true;
+        return true;
+    }
+    if (err != ESP_OK) {
+        op->c = NULL;
+        op_finish(op, err, false);
+        return false;
+    }
+    return op_send(op);
+}
+
+/* Step the handshake, then send; false once op is finished */
+static bool op_connect(http_op_t *op)
+{
+    int ret = conn_handshake(op->c->tls, &op->req, &op->hs);
+    if (ret == 0) return true;
+    op->connecting = false;
+    if (ret < 0) {
+        op_finish(op, ESP_ERR_HTTP_CONNECT, false);
+        return false;
+    }
+    op->res.connect_us = esp_timer_get_time() - op->hs.start_us;
+    return op_send(op);
+}
+
+/* Send on the connection; false once op is finished */
+static bool op_send(http_op_t *op)
+{
+    esp_err_t err = send_request(op->c, &op->req, op->x.head, op->hlen);
+    if (err != ESP_OK) {
+        conn_release(op->c, false);
+        op->c = NULL;
+        if (err != ESP_ERR_HTTP_CONNECTION_CLOSED || !op->res.reused || op->retried) {
+            op_finish(op, err, false);
+            return false;
+        }
+        op->retried = true;
+        op->res.stale++;
+        return op_start(op);
+    }
+    op->res.sent_us = esp_timer_get_time() - op->start_us;
+    op->last_rx_us = esp_timer_get_time();
+    exchange_begin(&op->x, &op->req);
+    return true;
+}
+
+/* Socket is readable: decode what arrived; false once op is finished */
+static bool op_read(http_op_t *op)
+{
+    http_rx_t *rx = &op->x.rx;
+    do {
+        int n = conn_read(op->c, op->x.buf, sizeof(op->x.buf));
+        /* The rest of a TLS record is still on its way */
+        if (n == CONN_AGAIN) return true;
+        if (n <= 0 && !op->res.first_byte_us) {
+            conn_release(op->c, false);
+            op->c = NULL;
+            /* Only a close or reset is a dropped kept connection */
+            bool stale = n == 0 || n == CONN_RESET;
+            if (stale && op->res.reused && !op->retried) {
+                ESP_LOGW(TAG, "Kept connection to %s was closed by the server, reconnecting",
+                         op->req.host);
+                op->retried = true;
+                op->res.stale++;
+                return op_start(op);
+            }
+            op_finish(op, ESP_ERR_HTTP_FETCH_HEADER, false);
+            return false;
+        }
+        if (n < 0) {
+            op_finish(op, ESP_FAIL, false);
+            return false;
+        }
+        if (n == 0) {
+            /* EOF ends a body without a length; anything else is cut short */
+            bool complete = rx->state == HTTP_RX_BODY && rx->content_length < 0;
+            op_finish(op, complete ? ESP_OK : ESP_FAIL, false);
+            return false;
+        }
+        op->last_rx_us = esp_timer_get_time();
+        if (!op->res.first_byte_us) op->res.first_byte_us = op->last_rx_us - op->start_us;
+        esp_err_t err = exchange_feed(&op->x, op->x.buf, n);
+        if (err != ESP_OK) {
+            op_finish(op, err, false);
+            return false;
+        }
+    } while (rx->state != HTTP_RX_DONE && conn_pending(op->c) > 0);
+
+    if (rx->state != HTTP_RX_DONE) return true;
+    op_finish(op, ESP_OK, !rx->close);
+    return false;
+}
+
+/* One pass over an op in flight; false once it is finished */
+static bool op_poll(http_op_t *op, bool ready, int64_t now_us)
+{
+    if (op->connecting) {
+        if (op_cancelled(op)) {
+            op_finish(op, ESP_ERR_NOT_FINISHED, false);
+            return false;
+        }
+        if (now_us - op->hs.start_us > MIMI_HTTP_CONNECT_TIMEOUT_MS * 1000LL) {
+            ESP_LOGW(TAG, "Connect to %s timed out", op->req.host);
+            op_finish(op, ESP_ERR_HTTP_CONNECT, false);
+            return false;
+        }
+        /* Stepped every pass: a handshake may want to write unannounced */
+        return op_connect(op);
+    }
+    if (ready) return op_read(op);
+    if (op_cancelled(op) && !op->res.first_byte_us) {
+        op_finish(op, ESP_ERR_NOT_FINISHED, false);
+        return false;
+    }
+    if (conn_sockfd(op->c) < 0 || now_us - op->last_rx_us > op->req.timeout_ms * 1000LL) {
+        ESP_LOGW(TAG, "No response from %s for %d ms", op->req.host, op->req.timeout_ms);
+        op_finish(op, ESP_ERR_TIMEOUT, false);
+        return false;
+    }
+    return true;
+}
+
+static void io_task(void *arg)
+{
+    http_op_t *delayed = NULL;      /* submitted, not started yet */
+    http_op_t *active = NULL;       /* connecting, or waiting for the response */
+
+    while (1) {
+        http_op_t *op, *list;
+        while (xQueueReceive(s_io_queue, &op, 0) == pdTRUE) {
+            op->next = delayed;
+            delayed = op;
+        }
+
+        int64_t now_us = esp_timer_get_time();
+        list = delayed;
+        delayed = NULL;
+        while (list) {
+            op = list;
+            list = list->next;
+            if (op_cancelled(op)) {
+                op_finish(op, ESP_ERR_NOT_FINISHED, false);
+            } else if (now_us < op->not_before_us) {
+                op->next = delayed;
+                delayed = op;
+            } else if (op_start(op)) {
+                op->next = active;
+                active = op;
+            }
+        }
+
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        int maxfd = -1;
+        for (op = active; op; op = op->next) {
+            int fd = conn_sockfd(op->c);
+            if (fd < 0) continue;
+            bool write = op->connecting && conn_handshake_wants_write(op->c->tls);
+            FD_SET(fd, write ? &wfds : &rfds);
+            if (fd > maxfd) maxfd = fd;
+        }
+        int ready = 0;
+        if (maxfd >= 0) {
+            struct timeval tv = { .tv_sec = 0, .tv_usec = MIMI_HTTP_IO_POLL_MS * 1000 };
+            ready = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+        } else {
+            /* Nothing to wait on: sleep until a submission or a delay ends */
+            xQueuePeek(s_io_queue, &op, pdMS_TO_TICKS(MIMI_HTTP_IO_POLL_MS));
+        }
+
+        now_us = esp_timer_get_time();
+        list = active;
+        active = NULL;
+        while (list) {
+            op = list;
+            list = list->next;
+            int fd = conn_sockfd(op->c);
+            bool fd_ready = ready > 0 && fd >= 0 && FD_ISSET(fd, &rfds);
+            if (op_poll(op, fd_ready, now_us)) {
+                op->next = active;
+                active = op;
+            }
+        }
+    }
+}
+
+esp_err_t http_transport_start(void)
+{
+    s_io_queue = xQueueCreate(MIMI_HTTP_IO_QUEUE_LEN, sizeof(http_op_t *));
+    if (!s_io_queue) return ESP_ERR_NO_MEM;
+
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        io_task, "http_io", MIMI_HTTP_IO_STACK, NULL,
+        MIMI_HTTP_IO_PRIO, NULL, MIMI_HTTP_IO_CORE);
+    return (ret == pdPASS) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t http_transport_submit(const http_request_t *req, uint32_t delay_ms,
+                                http_done_cb_t done, void *done_ctx)
+{
+    if (!s_io_queue) return ESP_ERR_INVALID_STATE;
+
+    http_op_t *op = calloc(1, sizeof(http_op_t));
+    if (!op) return ESP_ERR_NO_MEM;
+    op->req = *req;
+    op->done = done;
+    op->done_ctx = done_ctx;
+    op->not_before_us = esp_timer_get_time() + delay_ms * 1000LL;
+    op->hlen = build_head(op->x.head, req, true);
+    if (op->hlen < 0) {
+        ESP_LOGE(TAG, "Request head for %s too long", req->host);
+        free(op);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (xQueueSend(s_io_queue, &op, 0) != pdTRUE) {
+        free(op);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* ── Response buffer ──────────────────────────────────────────── */
+
+esp_err_t http_buf_sink(const char *data, size_t len, int status, void *ctx)
+{
+    http_buf_t *b = (http_buf_t *)ctx;
+    if (b->len + len > b->max) return ESP_ERR_INVALID_SIZE;
+    if (b->len + len >= b->cap) {
+        size_t cap = b->cap ? b->cap : 1024;
+        while (cap <= b->len + len) cap *= 2;
+        if (cap > b->max + 1) cap = b->max + 1;
+        char *tmp = heap_caps_realloc(b->data, cap, MALLOC_CAP_SPIRAM);
+        if (!tmp) return ESP_ERR_NO_MEM;
+        b->data = tmp;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+    return ESP_OK;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * HTTP/1.1 client shared by the LLM proxy, Telegram and the tools.
+ *
+ * Direct requests go over esp_tls connections kept alive per host:port
+ * (handshakes resume through tls_cache). With a proxy configured the
+ * request goes through a CONNECT tunnel instead; framing, decoding and
+ * callbacks are the same either way. Content-Length and chunked bodies
+ * are decoded as they arrive and handed to a sink, so what a response
+ * costs in memory is up to the caller. Requests offer gzip; compressed
+ * bodies are inflated on the way, so the sink always sees the plain body.
+ *
+ * Requests are either made by the calling task (http_transport_request)
+ * or submitted to the http_io task, which connects them without blocking,
+ * waits for all submitted responses with one select() and reports each
+ * through a callback.
+ */
+
+/** Receives body bytes as they arrive; anything but ESP_OK aborts. */
+typedef esp_err_t (*http_body_cb_t)(const char *data, size_t len, int status, void *ctx);
+
+/** Receives each response header. */
+typedef void (*http_header_cb_t)(const char *name, const char *value, void *ctx);
+
+/** Writes request body bytes into the connection. */
+typedef esp_err_t (*http_sink_t)(const char *data, size_t len, void *sink_ctx);
+
+/** Streams exactly body_len request body bytes through sink. */
+typedef esp_err_t (*http_body_writer_t)(http_sink_t sink, void *sink_ctx, void *ctx);
+
+typedef struct {
+    const char *method;             /* "GET", "POST", "HEAD" */
+    const char *host;
+    int port;
+    bool tls;
+    const char *path;
+    const char *headers;            /* extra lines, each ending in "\r\n"; may be NULL */
+    const char *body;               /* request body, or NULL */
+    size_t body_len;
+    http_body_writer_t write_body;  /* streams the body instead of body */
+    void *body_ctx;
+    int timeout_ms;                 /* gap allowed between response bytes */
+    http_header_cb_t on_header;     /* optional */
+    http_body_cb_t on_body;         /* NULL discards the body */
+    void *ctx;
+    volatile bool *cancel;          /* submitted requests: set to abandon it; may be NULL */
+    bool identity;                  /* don't offer gzip, e.g. for event streams */
+} http_request_t;
+
+/** Outcome of one exchange; times are from the start of the call. */
+typedef struct {
+    int status;
+    bool reused;                    /* sent over a kept connection */
+    int stale;                      /* kept connections found closed by the server */
+    int64_t connect_us;             /* connect + handshake, 0 when reused */
+    int64_t sent_us;                /* request fully written */
+    int64_t first_byte_us;          /* first response byte, 0 = none */
+} http_result_t;
+
+/**
+ * Completion of a submitted request, called on the http_io task. err is
+ * as http_transport_request() would return; res is only valid during the
+ * call. Keep it short: other responses wait meanwhile.
+ */
+typedef void (*http_done_cb_t)(esp_err_t err, const http_result_t *res, void *ctx);
+
+/** Create the connection pool lock. */
+esp_err_t http_transport_init(void);
+
+/** Start the http_io task that runs submitted requests. */
+esp_err_t http_transport_start(void);
+
+/**
+ * Send a request and decode its response into the callbacks. A kept
+ * connection the server closed before answering is replaced and the
+ * request sent again.
+ *
+ * @return ESP_OK when a complete response was received, whatever its status
+ */
+esp_err_t http_transport_request(const http_request_t *req, http_result_t *res);
+
+/**
+ * Run a request on the http_io task, delay_ms from now, and call done
+ * with the outcome. req is copied, but what it points to (strings, body,
+ * ctx) must stay valid until done is called. Connecting and sending are
+ * done on http_io; neither the handshake nor the wait for the response
+ * costs a task of its own.
+ *
+ * Setting *req->cancel abandons the request within MIMI_HTTP_IO_POLL_MS
+ * unless its response is already arriving; done then gets
+ * ESP_ERR_NOT_FINISHED.
+ *
+ * @return ESP_OK if queued; done is then called exactly once
+ */
+esp_err_t http_transport_submit(const http_request_t *req, uint32_t delay_ms,
+                                http_done_cb_t done, void *done_ctx);
+
+/**
+ * Open a pooled connection to host:port ahead of the request that will
+ * use it; a request arriving meanwhile waits for this handshake.
+ *
+ * @param connect_us  handshake time, 0 if a live connection was already kept
+ * @return ESP_ERR_NOT_SUPPORTED when requests go through the proxy
+ */
+esp_err_t http_transport_prewarm(const char *host, int port, bool tls, int64_t *connect_us);
+
+/* ── Compression stats ────────────────────────────────────────── */
+
+/** Body bytes per endpoint: as received vs after inflating. */
+typedef struct {
+    char endpoint[64];              /* host + last path segment, e.g. "api.telegram.org/getUpdates" */
+    uint32_t responses;
+    uint32_t compressed;            /* responses that came gzip / deflate encoded */
+    uint64_t wire_bytes;            /* body bytes received (without chunk framing) */
+    uint64_t body_bytes;            /* body bytes handed to the caller */
+} http_enc_stats_t;
+
+/** Copy the counters of up to max endpoints, busiest first; returns how many. */
+int http_transport_get_enc_stats(http_enc_stats_t *out, int max);
+
+/* ── Response buffer ──────────────────────────────────────────── */
+
+/** Body accumulator for responses that are parsed as a whole. */
+typedef struct {
+    char *data;         /* NUL-terminated, PSRAM; caller frees */
+    size_t len;
+    size_t cap;
+    size_t max;         /* larger bodies fail with ESP_ERR_INVALID_SIZE */
+} http_buf_t;
+
+/** http_body_cb_t that appends to an http_buf_t (ctx). */
+esp_err_t http_buf_sink(const char *data, size_t len, int status, void *ctx);
@@ -0,0 +1,190 @@
+#include "tls_cache.h"
+#include "mimi_config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "tls_cache";
+
+/*
+ * A cached session can be offered to several handshakes at once while a
+ * newer one replaces it, so it is reference counted and freed by its
+ * last user.
+ */
+typedef struct tls_session_ref {
+    esp_tls_client_session_t *session;
+    int refs;
+} session_ref_t;
+
+typedef struct {
+    char host[64];
+    int port;
+    session_ref_t *ref;         /* NULL = nothing to offer */
+    uint32_t full_avg_us;       /* moving average of full handshakes */
+    int64_t last_used_us;       /* 0 = free entry */
+} cache_entry_t;
+
+static cache_entry_t s_entries[MIMI_TLS_CACHE_HOSTS];
+static tls_cache_stats_t s_stats;
+static SemaphoreHandle_t s_lock;
+
+esp_err_t tls_cache_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    return s_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* Under s_lock; returns the session to free once unlocked, if any */
+static esp_tls_client_session_t *ref_put(session_ref_t *ref)
+{
+    if (!ref || --ref->refs > 0) return NULL;
+    esp_tls_client_session_t *session = ref->session;
+    free(ref);
+    return session;
+}
+
+static void session_free(esp_tls_client_session_t *session)
+{
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (session) esp_tls_free_client_session(session);
+#endif
+}
+
+static cache_entry_t *entry_find(const char *host, int port)
+{
+    for (int i = 0; i < MIMI_TLS_CACHE_HOSTS; i++) {
+        cache_entry_t *e = &s_entries[i];
+        if (e->last_used_us && e->port == port && strcmp(e->host, host) == 0) return e;
+    }
+    return NULL;
+}
+
+/* Existing entry, else a free or the least recently used one (evicted) */
+static cache_entry_t *entry_claim(const char *host, int port, esp_tls_client_session_t **evicted)
+{
+    cache_entry_t *e = entry_find(host, port);
+    if (e) return e;
+
+    e = &s_entries[0];
+    for (int i = 1; i < MIMI_TLS_CACHE_HOSTS; i++) {
+        if (s_entries[i].last_used_us < e->last_used_us) e = &s_entries[i];
+    }
+    *evicted = ref_put(e->ref);
+    memset(e, 0, sizeof(*e));
+    strncpy(e->host, host, sizeof(e->host) - 1);
+    e->port = port;
+    return e;
+}
+
+void tls_cache_begin(const char *host, int port, esp_tls_cfg_t *cfg, tls_cache_attempt_t *a)
+{
+    memset(a, 0, sizeof(*a));
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (s_lock) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        cache_entry_t *e = entry_find(host, port);
+        if (e && e->ref) {
+            a->offered = e->ref;
+            a->offered->refs++;
+            a->full_avg_us = e->full_avg_us;
+        }
+        xSemaphoreGive(s_lock);
+    }
+    cfg->client_session = a->offered ? a->offered->session : NULL;
+#endif
+    a->start_us = esp_timer_get_time();
+}
+
+void tls_cache_end(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls, int ret,
+                   tls_cache_attempt_t *a)
+{
+    session_ref_t *offered = a->offered;
+    uint32_t full_avg_us = a->full_avg_us;
+    int64_t us = esp_timer_get_time() - a->start_us;
+    a->offered = NULL;
+
+    esp_tls_client_session_t *fresh = NULL;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    cfg->client_session = NULL;
+    if (ret == 1) fresh = esp_tls_get_client_session(tls);
+#endif
+
+    /* Without a certificate chain to verify, resumption is far quicker */
+    bool resumed = ret == 1 && offered && full_avg_us && us < full_avg_us / 2;
+    session_ref_t *ref = fresh ? calloc(1, sizeof(session_ref_t)) : NULL;
+    esp_tls_client_session_t *drop[3] = { NULL, NULL, NULL };
+    if (fresh && !ref) drop[2] = fresh;
+
+    if (!s_lock) {
+        free(ref);
+        session_free(fresh);
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    drop[0] = ref_put(offered);
+    if (ret != 1) {
+        s_stats.failed++;
+        /* A session the server chokes on is not offered again */
+        cache_entry_t *e = entry_find(host, port);
+        if (e && offered && e->ref == offered) {
+            drop[1] = ref_put(e->ref);
+            e->ref = NULL;
+        }
+    } else {
+        cache_entry_t *e = entry_claim(host, port, &drop[1]);
+        e->last_used_us = esp_timer_get_time();
+        if (resumed) {
+            s_stats.resumed++;
+            s_stats.resumed_us += us;
+            s_stats.saved_us += full_avg_us - us;
+        } else {
+            s_stats.full++;
+            s_stats.full_us += us;
+            e->full_avg_us = e->full_avg_us ? (3 * e->full_avg_us + (uint32_t)us) / 4 : (uint32_t)us;
+        }
+        if (ref) {
+            /* The newest session replaces the one offered */
+            drop[2] = ref_put(e->ref);
+            ref->session = fresh;
+            ref->refs = 1;
+            e->ref = ref;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int i = 0; i < 3; i++) session_free(drop[i]);
+
+    if (ret == 1) {
+        ESP_LOGI(TAG, "%s:%d %s handshake in %d ms", host, port,
+                 resumed ? "resumed" : "full", (int)(us / 1000));
+    }
+}
+
+int tls_cache_connect(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls)
+{
+    tls_cache_attempt_t a;
+    tls_cache_begin(host, port, cfg, &a);
+    int ret = esp_tls_conn_new_sync(host, strlen(host), port, cfg, tls);
+    tls_cache_end(host, port, cfg, tls, ret, &a);
+    return ret;
+}
+
+void tls_cache_get_stats(tls_cache_stats_t *out)
+{
+    if (!s_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    out->hosts = 0;
+    for (int i = 0; i < MIMI_TLS_CACHE_HOSTS; i++) {
+        if (s_entries[i].ref) out->hosts++;
+    }
+    xSemaphoreGive(s_lock);
+}
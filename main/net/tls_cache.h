@@ -0,0 +1,61 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_tls.h"
+#include <stdint.h>
+
+/**
+ * TLS session cache shared by all outbound HTTPS connections.
+ *
+ * The session of the last full handshake with each host:port is kept and
+ * offered on the next connection, so reconnects use an abbreviated
+ * handshake (no certificate chain to send and verify). A handshake that
+ * offered a session and took less than half the host's average full
+ * handshake is counted as resumed; the difference is counted as saved.
+ *
+ * Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS; without it every handshake
+ * is full and only counted.
+ */
+
+typedef struct {
+    uint32_t full;          /* handshakes with certificate exchange */
+    uint32_t resumed;       /* abbreviated handshakes from a cached session */
+    uint32_t failed;
+    uint64_t full_us;       /* total time of full handshakes */
+    uint64_t resumed_us;    /* total time of resumed handshakes */
+    uint64_t saved_us;      /* estimated time saved by resumption */
+    int hosts;              /* hosts with a cached session */
+} tls_cache_stats_t;
+
+/** A handshake between tls_cache_begin() and tls_cache_end(). */
+typedef struct {
+    struct tls_session_ref *offered;    /* session offered, NULL = none */
+    uint32_t full_avg_us;
+    int64_t start_us;
+} tls_cache_attempt_t;
+
+/** Create the cache lock. */
+esp_err_t tls_cache_init(void);
+
+/**
+ * esp_tls_conn_new_sync() with session resumption: offers the cached
+ * session for host:port, records the handshake and keeps the new session.
+ * cfg->client_session is set by this call. tls may already carry a
+ * connected socket (e.g. a CONNECT tunnel).
+ *
+ * @return 1 on success, as esp_tls_conn_new_sync()
+ */
+int tls_cache_connect(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls);
+
+/**
+ * The same for a handshake driven with esp_tls_conn_new_async(): begin
+ * offers the cached session through cfg->client_session, end takes
+ * esp_tls's result (1 = connected, anything else failed or abandoned),
+ * records the handshake and keeps the new session. cfg must not change
+ * in between.
+ */
+void tls_cache_begin(const char *host, int port, esp_tls_cfg_t *cfg, tls_cache_attempt_t *a);
+void tls_cache_end(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls, int ret,
+                   tls_cache_attempt_t *a);
+
+void tls_cache_get_stats(tls_cache_stats_t *out);
@@ -1,4 +1,5 @@
 #include "ota_manager.h"
+#include "memory/session_mgr.h"
 
 #include "esp_log.h"
 #include "esp_ota_ops.h"
@@ -26,6 +27,9 @@ esp_err_t ota_update_from_url(const char *url)
     esp_err_t ret = esp_https_ota(&ota_config);
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "OTA successful, restarting...");
+        if (session_flush() != ESP_OK) {
+            ESP_LOGW(TAG, "Some session entries could not be saved");
+        }
         esp_restart();
     } else {
         ESP_LOGE(TAG, "OTA failed: %s", esp_err_to_name(ret));
@@ -9,9 +9,13 @@
 #include <unistd.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "esp_tls.h"
 #include "esp_crt_bundle.h"
+#include "net/tls_cache.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "proxy";
 
@@ -23,9 +27,15 @@ __attribute__((constructor)) static void proxy_log_level(void)
 
 static char     s_proxy_host[64] = {0};
 static uint16_t s_proxy_port     = 0;
+static SemaphoreHandle_t s_pool_lock;   /* idle tunnels + stats */
+
+static void pool_flush(void);
 
 esp_err_t http_proxy_init(void)
 {
+    s_pool_lock = xSemaphoreCreateMutex();
+    if (!s_pool_lock) return ESP_ERR_NO_MEM;
+
     /* Start with build-time defaults */
     if (MIMI_SECRET_PROXY_HOST[0] != '\0' && MIMI_SECRET_PROXY_PORT[0] != '\0') {
         strncpy(s_proxy_host, MIMI_SECRET_PROXY_HOST, sizeof(s_proxy_host) - 1);
@@ -64,6 +74,7 @@ esp_err_t http_proxy_set(const char *host, uint16_t port)
     ESP_ERROR_CHECK(nvs_commit(nvs));
     nvs_close(nvs);
 
+    pool_flush();
     strncpy(s_proxy_host, host, sizeof(s_proxy_host) - 1);
     s_proxy_port = port;
     ESP_LOGI(TAG, "Proxy set to %s:%d", s_proxy_host, s_proxy_port);
@@ -81,6 +92,7 @@ esp_err_t http_proxy_clear(void)
 
     s_proxy_host[0] = '\0';
     s_proxy_port = 0;
+    pool_flush();
     ESP_LOGI(TAG, "Proxy cleared");
     return ESP_OK;
 }
@@ -92,27 +104,66 @@ bool http_proxy_is_enabled(void)
 
 /* ── Proxied TLS connection ───────────────────────────────────── */
 
+/*
+ * Tunnels (TCP to the proxy + CONNECT + TLS to the target) are kept after
+ * a request when the response left them reusable. Up to
+ * MIMI_PROXY_TUNNEL_POOL idle tunnels are kept across all hosts, each for
+ * MIMI_HTTP_KEEPALIVE_MS; proxy_conn_open() hands out a live one for the
+ * same host:port before building a new one.
+ */
+
 struct proxy_conn {
     int         sock;   /* raw TCP socket (for timeout control) */
     esp_tls_t  *tls;    /* esp_tls handle owns TLS + socket lifecycle */
+    char        host[64];
+    int         port;
+    bool        reused;
+    uint32_t    generation;     /* proxy config it was opened through */
+    int64_t     idle_since_us;
 };
 
-/* Read a line from socket (up to CR-LF). Returns length or -1. */
-static int sock_read_line(int fd, char *buf, int max, int timeout_ms)
+static proxy_conn_t *s_idle[MIMI_PROXY_TUNNEL_POOL];
+static uint32_t s_generation;   /* bumped when the proxy changes */
+static proxy_stats_t s_stats;
+
+static void pool_flush(void)
 {
-    int pos = 0;
-    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
-    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    proxy_conn_t *drop[MIMI_PROXY_TUNNEL_POOL];
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    s_generation++;
+    memcpy(drop, s_idle, sizeof(drop));
+    memset(s_idle, 0, sizeof(s_idle));
+    xSemaphoreGive(s_pool_lock);
+    for (int i = 0; i < MIMI_PROXY_TUNNEL_POOL; i++) proxy_conn_close(drop[i]);
+}
+
+/* ── Buffered socket reader ───────────────────────────────────── */
 
-    while (pos < max - 1) {
-        char c;
-        int r = recv(fd, &c, 1, 0);
-        if (r <= 0) return -1;
-        if (c == '\n') { buf[pos] = '\0'; return pos; }
-        if (c != '\r') buf[pos++] = c;
+typedef struct {
+    int fd;
+    int pos;
+    int len;
+    char buf[512];
+} sock_reader_t;
+
+/* Read a line (up to LF, CR dropped). Returns length or -1. */
+static int reader_line(sock_reader_t *r, char *line, int max)
+{
+    int n = 0;
+    while (1) {
+        if (r->pos == r->len) {
+            int got = recv(r->fd, r->buf, sizeof(r->buf), 0);
+            if (got <= 0) return -1;
+            r->pos = 0;
+            r->len = got;
+        }
+        char c = r->buf[r->pos++];
+        if (c == '\n') {
+            line[n] = '\0';
+            return n;
+        }
+        if (c != '\r' && n < max - 1) line[n++] = c;
     }
-    buf[pos] = '\0';
-    return pos;
 }
 
 /* Open TCP + CONNECT tunnel, returns socket fd or -1 */
@@ -150,8 +201,9 @@ static int open_connect_tunnel(const char *host, int port, int timeout_ms)
         ESP_LOGE(TAG, "Failed to send CONNECT"); close(sock); return -1;
     }
 
+    sock_reader_t r = { .fd = sock };
     char line[256];
-    if (sock_read_line(sock, line, sizeof(line), timeout_ms) < 0) {
+    if (reader_line(&r, line, sizeof(line)) < 0) {
         ESP_LOGE(TAG, "No response from proxy"); close(sock); return -1;
     }
     if (strstr(line, "200") == NULL) {
@@ -159,12 +211,54 @@ static int open_connect_tunnel(const char *host, int port, int timeout_ms)
     }
 
     /* Consume remaining response headers */
-    while (sock_read_line(sock, line, sizeof(line), timeout_ms) > 0) { }
+    int n;
+    while ((n = reader_line(&r, line, sizeof(line))) > 0) { }
+    if (n < 0) {
+        ESP_LOGE(TAG, "CONNECT response cut short"); close(sock); return -1;
+    }
+    /* The target speaks only after our ClientHello */
+    if (r.pos != r.len) {
+        ESP_LOGE(TAG, "Unexpected bytes after CONNECT response"); close(sock); return -1;
+    }
 
     ESP_LOGI(TAG, "CONNECT tunnel established to %s:%d", host, port);
     return sock;
 }
 
+/* An idle tunnel the proxy or target closed reads as EOF without blocking */
+static bool tunnel_alive(proxy_conn_t *conn)
+{
+    char c;
+    int n = recv(conn->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+static proxy_conn_t *pool_take(const char *host, int port)
+{
+    int64_t now_us = esp_timer_get_time();
+    while (1) {
+        proxy_conn_t *conn = NULL;
+        xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+        for (int i = 0; i < MIMI_PROXY_TUNNEL_POOL && !conn; i++) {
+            if (s_idle[i] && s_idle[i]->port == port && strcmp(s_idle[i]->host, host) == 0) {
+                conn = s_idle[i];
+                s_idle[i] = NULL;
+            }
+        }
+        xSemaphoreGive(s_pool_lock);
+        if (!conn) return NULL;
+
+        if (now_us - conn->idle_since_us < MIMI_HTTP_KEEPALIVE_MS * 1000LL && tunnel_alive(conn)) {
+            conn->reused = true;
+            return conn;
+        }
+        xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+        s_stats.stale++;
+        xSemaphoreGive(s_pool_lock);
+        proxy_conn_close(conn);
+    }
+}
+
 proxy_conn_t *proxy_conn_open(const char *host, int port, int timeout_ms)
 {
     if (!http_proxy_is_enabled()) {
@@ -172,18 +266,30 @@ proxy_conn_t *proxy_conn_open(const char *host, int port, int timeout_ms)
         return NULL;
     }
 
+    proxy_conn_t *conn = pool_take(host, port);
+    if (conn) {
+        xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+        s_stats.reused++;
+        xSemaphoreGive(s_pool_lock);
+        return conn;
+    }
+
+    int64_t start_us = esp_timer_get_time();
     int sock = open_connect_tunnel(host, port, timeout_ms);
-    if (sock < 0) return NULL;
+    if (sock < 0) goto fail;
 
-    proxy_conn_t *conn = calloc(1, sizeof(*conn));
-    if (!conn) { close(sock); return NULL; }
+    conn = calloc(1, sizeof(*conn));
+    if (!conn) { close(sock); goto fail; }
     conn->sock = sock;
+    conn->generation = s_generation;
+    strncpy(conn->host, host, sizeof(conn->host) - 1);
+    conn->port = port;
 
     /* ── TLS handshake via esp_tls over tunnel ───────────────── */
     conn->tls = esp_tls_init();
     if (!conn->tls) {
         ESP_LOGE(TAG, "esp_tls_init failed");
-        close(sock); free(conn); return NULL;
+        close(sock); free(conn); goto fail;
     }
 
     /* Inject our CONNECT-tunnel socket and skip TCP connect phase */
@@ -195,49 +301,80 @@ proxy_conn_t *proxy_conn_open(const char *host, int port, int timeout_ms)
         .timeout_ms = timeout_ms,
     };
 
-    int ret = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, conn->tls);
+    int ret = tls_cache_connect(host, port, &cfg, conn->tls);
     if (ret <= 0) {
         ESP_LOGE(TAG, "TLS handshake failed over proxy tunnel");
         esp_tls_conn_destroy(conn->tls);
         /* esp_tls_conn_destroy closes the socket */
         free(conn);
-        return NULL;
+        goto fail;
     }
 
-    ESP_LOGI(TAG, "TLS handshake OK with %s:%d via proxy", host, port);
+    int64_t us = esp_timer_get_time() - start_us;
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    s_stats.opened++;
+    s_stats.open_us += us;
+    xSemaphoreGive(s_pool_lock);
+    ESP_LOGI(TAG, "TLS handshake OK with %s:%d via proxy in %d ms", host, port, (int)(us / 1000));
     return conn;
+
+fail:
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    s_stats.failed++;
+    xSemaphoreGive(s_pool_lock);
+    return NULL;
+}
+
+bool proxy_conn_reused(const proxy_conn_t *conn)
+{
+    return conn->reused;
+}
+
+int proxy_conn_sockfd(const proxy_conn_t *conn)
+{
+    return conn->sock;
+}
+
+int proxy_conn_pending(proxy_conn_t *conn)
+{
+    return (int)esp_tls_get_bytes_avail(conn->tls);
 }
 
 int proxy_conn_write(proxy_conn_t *conn, const char *data, int len)
 {
-    int written = 0;
-    while (written < len) {
-        ssize_t ret = esp_tls_conn_write(conn->tls, data + written, len - written);
-        if (ret > 0) {
-            written += (int)ret;
-        } else if (ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
-            continue;
-        } else {
-            ESP_LOGE(TAG, "esp_tls_conn_write error: %d", (int)ret);
-            return -1;
-        }
-    }
-    return written;
+    return (int)esp_tls_conn_write(conn->tls, data, len);
 }
 
-int proxy_conn_read(proxy_conn_t *conn, char *buf, int len, int timeout_ms)
+int proxy_conn_read(proxy_conn_t *conn, char *buf, int len)
 {
-    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
-    setsockopt(conn->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return (int)esp_tls_conn_read(conn->tls, buf, len);
+}
 
-    ssize_t ret = esp_tls_conn_read(conn->tls, buf, len);
-    if (ret == ESP_TLS_ERR_SSL_WANT_READ) return 0;
-    if (ret == 0) return 0;
-    if (ret < 0) {
-        ESP_LOGE(TAG, "esp_tls_conn_read error: %d", (int)ret);
-        return -1;
+void proxy_conn_release(proxy_conn_t *conn, bool keep)
+{
+    if (!conn) return;
+    if (!keep || conn->generation != s_generation) {
+        proxy_conn_close(conn);
+        return;
+    }
+
+    conn->reused = false;
+    conn->idle_since_us = esp_timer_get_time();
+    proxy_conn_t *drop = conn;
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    /* A free slot, else the longest idle tunnel makes room */
+    int slot = -1;
+    for (int i = 0; i < MIMI_PROXY_TUNNEL_POOL; i++) {
+        if (!s_idle[i]) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 || s_idle[i]->idle_since_us < s_idle[slot]->idle_since_us) slot = i;
     }
-    return (int)ret;
+    drop = s_idle[slot];
+    s_idle[slot] = conn;
+    xSemaphoreGive(s_pool_lock);
+    proxy_conn_close(drop);
 }
 
 void proxy_conn_close(proxy_conn_t *conn)
@@ -248,3 +385,14 @@ void proxy_conn_close(proxy_conn_t *conn)
     }
     free(conn);
 }
+
+void http_proxy_get_stats(proxy_stats_t *out)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    *out = s_stats;
+    out->idle = 0;
+    for (int i = 0; i < MIMI_PROXY_TUNNEL_POOL; i++) {
+        if (s_idle[i]) out->idle++;
+    }
+    xSemaphoreGive(s_pool_lock);
+}
@@ -3,6 +3,7 @@
 #include "esp_err.h"
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * Initialize proxy module.
@@ -28,8 +29,18 @@ esp_err_t http_proxy_clear(void);
 
 typedef struct proxy_conn proxy_conn_t;
 
+typedef struct {
+    uint32_t opened;        /* new tunnels: TCP + CONNECT + TLS */
+    uint32_t reused;        /* kept tunnels handed out again */
+    uint32_t stale;         /* kept tunnels found closed or expired */
+    uint32_t failed;
+    uint64_t open_us;       /* total time spent opening new tunnels */
+    int idle;               /* tunnels kept right now */
+} proxy_stats_t;
+
 /**
- * Open an HTTPS connection through the configured proxy.
+ * Open an HTTPS connection through the configured proxy: a kept tunnel to
+ * host:port if a live one is idle, otherwise
  * 1) TCP connect to proxy
  * 2) Send HTTP CONNECT to target host:port
  * 3) TLS handshake over the tunnel
@@ -38,11 +49,35 @@ typedef struct proxy_conn proxy_conn_t;
  */
 proxy_conn_t *proxy_conn_open(const char *host, int port, int timeout_ms);
 
-/** Write raw bytes through the TLS tunnel. Returns bytes written or -1. */
+/** True if the tunnel was kept from an earlier request. */
+bool proxy_conn_reused(const proxy_conn_t *conn);
+
+/** Socket under the tunnel, for waiting on it with select(). */
+int proxy_conn_sockfd(const proxy_conn_t *conn);
+
+/** Decrypted bytes already buffered; readable although the socket is not. */
+int proxy_conn_pending(proxy_conn_t *conn);
+
+/*
+ * The caller owns the tunnel's socket once it is open, and may make it
+ * non-blocking: reads and writes are one esp_tls_conn_read/write() call
+ * each and return what it does (bytes, 0 at end of stream, or an esp_tls
+ * error such as ESP_TLS_ERR_SSL_WANT_READ).
+ */
+
+/** Write raw bytes through the TLS tunnel; may write fewer than len. */
 int proxy_conn_write(proxy_conn_t *conn, const char *data, int len);
 
-/** Read raw bytes from the TLS tunnel. Returns bytes read or -1. */
-int proxy_conn_read(proxy_conn_t *conn, char *buf, int len, int timeout_ms);
+/** Read raw bytes from the TLS tunnel. */
+int proxy_conn_read(proxy_conn_t *conn, char *buf, int len);
+
+/**
+ * Done with the connection: keep it for the next request to the same
+ * host:port (the last response ended cleanly), or close it.
+ */
+void proxy_conn_release(proxy_conn_t *conn, bool keep);
 
 /** Close and free the connection. */
 void proxy_conn_close(proxy_conn_t *conn);
+
+void http_proxy_get_stats(proxy_stats_t *out);
@@ -1,170 +1,55 @@
 #include "telegram_bot.h"
 #include "mimi_config.h"
 #include "bus/message_bus.h"
-#include "proxy/http_proxy.h"
+#include "net/http_transport.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "esp_crt_bundle.h"
 #include "nvs.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 
 static const char *TAG = "telegram";
 
 static char s_bot_token[128] = MIMI_SECRET_TG_TOKEN;
 static int64_t s_update_offset = 0;
 
-/* HTTP response accumulator */
-typedef struct {
-    char *buf;
-    size_t len;
-    size_t cap;
-} http_resp_t;
-
-static esp_err_t http_event_handler(esp_http_client_event_t *evt)
-{
-    http_resp_t *resp = (http_resp_t *)evt->user_data;
-    if (evt->event_id == HTTP_EVENT_ON_DATA) {
-        if (resp->len + evt->data_len >= resp->cap) {
-            size_t new_cap = resp->cap * 2;
-            if (new_cap < resp->len + evt->data_len + 1) {
-                new_cap = resp->len + evt->data_len + 1;
-            }
-            char *tmp = realloc(resp->buf, new_cap);
-            if (!tmp) return ESP_ERR_NO_MEM;
-            resp->buf = tmp;
-            resp->cap = new_cap;
-        }
-        memcpy(resp->buf + resp->len, evt->data, evt->data_len);
-        resp->len += evt->data_len;
-        resp->buf[resp->len] = '\0';
-    }
-    return ESP_OK;
-}
-
-/* ── Proxy path: manual HTTP over CONNECT tunnel ────────────── */
-
-static char *tg_api_call_via_proxy(const char *path, const char *post_data)
-{
-    proxy_conn_t *conn = proxy_conn_open("api.telegram.org", 443,
-                                          (MIMI_TG_POLL_TIMEOUT_S + 5) * 1000);
-    if (!conn) return NULL;
-
-    /* Build HTTP request */
-    char header[512];
-    int hlen;
-    if (post_data) {
-        hlen = snprintf(header, sizeof(header),
-            "POST /bot%s/%s HTTP/1.1\r\n"
-            "Host: api.telegram.org\r\n"
-            "Content-Type: application/json\r\n"
-            "Content-Length: %d\r\n"
-            "Connection: close\r\n\r\n",
-            s_bot_token, path, (int)strlen(post_data));
-    } else {
-        hlen = snprintf(header, sizeof(header),
-            "GET /bot%s/%s HTTP/1.1\r\n"
-            "Host: api.telegram.org\r\n"
-            "Connection: close\r\n\r\n",
-            s_bot_token, path);
-    }
-
-    if (proxy_conn_write(conn, header, hlen) < 0) {
-        proxy_conn_close(conn);
-        return NULL;
-    }
-    if (post_data && proxy_conn_write(conn, post_data, strlen(post_data)) < 0) {
-        proxy_conn_close(conn);
-        return NULL;
-    }
+#define TG_API_HOST     "api.telegram.org"
+#define TG_RESP_MAX     (64 * 1024)
 
-    /* Read response — accumulate until connection close */
-    size_t cap = 4096, len = 0;
-    char *buf = calloc(1, cap);
-    if (!buf) { proxy_conn_close(conn); return NULL; }
-
-    int timeout = (MIMI_TG_POLL_TIMEOUT_S + 5) * 1000;
-    while (1) {
-        if (len + 1024 >= cap) {
-            cap *= 2;
-            char *tmp = realloc(buf, cap);
-            if (!tmp) break;
-            buf = tmp;
-        }
-        int n = proxy_conn_read(conn, buf + len, cap - len - 1, timeout);
-        if (n <= 0) break;
-        len += n;
-    }
-    buf[len] = '\0';
-    proxy_conn_close(conn);
-
-    /* Skip HTTP headers — find \r\n\r\n */
-    char *body = strstr(buf, "\r\n\r\n");
-    if (!body) { free(buf); return NULL; }
-    body += 4;
-
-    /* Return just the body */
-    char *result = strdup(body);
-    free(buf);
-    return result;
-}
-
-/* ── Direct path: esp_http_client ───────────────────────────── */
-
-static char *tg_api_call_direct(const char *method, const char *post_data)
+/* Same request with or without the proxy; returns the body, caller frees */
+static char *tg_api_call(const char *method, const char *post_data)
 {
-    char url[256];
-    snprintf(url, sizeof(url), "https://api.telegram.org/bot%s/%s", s_bot_token, method);
-
-    http_resp_t resp = {
-        .buf = calloc(1, 4096),
-        .len = 0,
-        .cap = 4096,
-    };
-    if (!resp.buf) return NULL;
-
-    esp_http_client_config_t config = {
-        .url = url,
-        .event_handler = http_event_handler,
-        .user_data = &resp,
+    char path[256];
+    snprintf(path, sizeof(path), "/bot%s/%s", s_bot_token, method);
+
+    http_buf_t resp = { .max = TG_RESP_MAX };
+    http_request_t req = {
+        .method = post_data ? "POST" : "GET",
+        .host = TG_API_HOST,
+        .port = 443,
+        .tls = true,
+        .path = path,
+        .headers = post_data ? "Content-Type: application/json\r\n" : NULL,
+        .body = post_data,
+        .body_len = post_data ? strlen(post_data) : 0,
         .timeout_ms = (MIMI_TG_POLL_TIMEOUT_S + 5) * 1000,
-        .buffer_size = 2048,
-        .buffer_size_tx = 2048,
-        .crt_bundle_attach = esp_crt_bundle_attach,
+        .on_body = http_buf_sink,
+        .ctx = &resp,
     };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) {
-        free(resp.buf);
-        return NULL;
-    }
-
-    if (post_data) {
-        esp_http_client_set_method(client, HTTP_METHOD_POST);
-        esp_http_client_set_header(client, "Content-Type", "application/json");
-        esp_http_client_set_post_field(client, post_data, strlen(post_data));
-    }
-
-    esp_err_t err = esp_http_client_perform(client);
-    esp_http_client_cleanup(client);
+    http_result_t res;
+    esp_err_t err = http_transport_request(&req, &res);
+    if (err == ESP_OK && !resp.data) err = ESP_ERR_INVALID_RESPONSE;
 
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
-        free(resp.buf);
+        free(resp.data);
         return NULL;
     }
-
-    return resp.buf;
-}
-
-static char *tg_api_call(const char *method, const char *post_data)
-{
-    if (http_proxy_is_enabled()) {
-        return tg_api_call_via_proxy(method, post_data);
-    }
-    return tg_api_call_direct(method, post_data);
+    return resp.data;
 }
 
 static void process_updates(const char *json_str)
@@ -217,42 +102,121 @@ static void process_updates(const char *json_str)
         mimi_msg_t msg = {0};
         strncpy(msg.channel, MIMI_CHAN_TELEGRAM, sizeof(msg.channel) - 1);
         strncpy(msg.chat_id, chat_id_str, sizeof(msg.chat_id) - 1);
-        msg.content = strdup(text->valuestring);
-        if (msg.content) {
-            message_bus_push_inbound(&msg);
+        msg.content = msg_buf_strdup(text->valuestring);
+        if (msg.content && message_bus_push_inbound(&msg) != ESP_OK) {
+            msg_buf_release(msg.content);
         }
     }
 
     cJSON_Delete(root);
 }
 
-static void telegram_poll_task(void *arg)
+/*
+ * Long polling runs on the http_io task: each getUpdates is submitted,
+ * and its completion hands the body to the tg_updates task, which parses
+ * it, pushes the messages and submits the next poll. The 30 s wait holds
+ * a connection, but no task; a push that spills to SPIFFS when the
+ * inbound lane is full stalls tg_updates, not every other response.
+ */
+
+/* A finished getUpdates, from http_io to tg_updates */
+typedef struct {
+    char *body;         /* NULL when nothing arrived; tg_updates frees */
+    bool ok;            /* complete 200 response */
+    esp_err_t err;
+} poll_result_t;
+
+static char s_poll_path[256];
+static http_request_t s_poll_req;
+static http_buf_t s_poll_buf;
+static bool s_started;      /* telegram_bot_start() was called */
+static bool s_polling;
+static portMUX_TYPE s_poll_mux = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t s_updates_queue;
+
+static void poll_done(esp_err_t err, const http_result_t *res, void *ctx);
+
+static void poll_submit(uint32_t delay_ms)
 {
-    ESP_LOGI(TAG, "Telegram polling task started");
+    if (s_bot_token[0] == '\0') {
+        ESP_LOGW(TAG, "No bot token configured, polling stopped");
+        portENTER_CRITICAL(&s_poll_mux);
+        s_polling = false;
+        portEXIT_CRITICAL(&s_poll_mux);
+        return;
+    }
 
-    while (1) {
-        if (s_bot_token[0] == '\0') {
-            ESP_LOGW(TAG, "No bot token configured, waiting...");
-            vTaskDelay(pdMS_TO_TICKS(5000));
-            continue;
-        }
+    snprintf(s_poll_path, sizeof(s_poll_path),
+             "/bot%s/getUpdates?offset=%" PRId64 "&timeout=%d",
+             s_bot_token, s_update_offset, MIMI_TG_POLL_TIMEOUT_S);
+    s_poll_buf = (http_buf_t){ .max = TG_RESP_MAX };
+    s_poll_req = (http_request_t){
+        .method = "GET",
+        .host = TG_API_HOST,
+        .port = 443,
+        .tls = true,
+        .path = s_poll_path,
+        .timeout_ms = (MIMI_TG_POLL_TIMEOUT_S + 5) * 1000,
+        .on_body = http_buf_sink,
+        .ctx = &s_poll_buf,
+    };
 
-        char params[128];
-        snprintf(params, sizeof(params),
-                 "getUpdates?offset=%" PRId64 "&timeout=%d",
-                 s_update_offset, MIMI_TG_POLL_TIMEOUT_S);
+    esp_err_t err = http_transport_submit(&s_poll_req, delay_ms, poll_done, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot queue getUpdates: %s", esp_err_to_name(err));
+        portENTER_CRITICAL(&s_poll_mux);
+        s_polling = false;
+        portEXIT_CRITICAL(&s_poll_mux);
+    }
+}
 
-        char *resp = tg_api_call(params, NULL);
-        if (resp) {
-            process_updates(resp);
-            free(resp);
+static void poll_done(esp_err_t err, const http_result_t *res, void *ctx)
+{
+    poll_result_t r = {
+        .body = s_poll_buf.data,
+        .ok = err == ESP_OK && res->status == 200 && s_poll_buf.data,
+        .err = err,
+    };
+    s_poll_buf.data = NULL;
+    /* One poll is in flight at a time, so the queue always has room */
+    if (xQueueSend(s_updates_queue, &r, 0) != pdTRUE) {
+        free(r.body);
+        poll_submit(3000);
+    }
+}
+
+static void updates_task(void *arg)
+{
+    while (1) {
+        poll_result_t r;
+        if (xQueueReceive(s_updates_queue, &r, portMAX_DELAY) != pdTRUE) continue;
+
+        if (r.body) {
+            process_updates(r.body);
         } else {
-            /* Back off on error */
-            vTaskDelay(pdMS_TO_TICKS(3000));
+            ESP_LOGE(TAG, "getUpdates failed: %s", esp_err_to_name(r.err));
         }
+        free(r.body);
+
+        /* Back off on error */
+        poll_submit(r.ok ? 0 : 3000);
     }
 }
 
+/* Starts the polling chain unless it is already running */
+static esp_err_t poll_start(void)
+{
+    portENTER_CRITICAL(&s_poll_mux);
+    bool running = s_polling;
+    s_polling = true;
+    portEXIT_CRITICAL(&s_poll_mux);
+    if (running) return ESP_OK;
+
+    ESP_LOGI(TAG, "Telegram long polling started");
+    poll_submit(0);
+    return ESP_OK;
+}
+
 /* --- Public API --- */
 
 esp_err_t telegram_bot_init(void)
@@ -280,12 +244,19 @@ esp_err_t telegram_bot_init(void)
 
 esp_err_t telegram_bot_start(void)
 {
-    BaseType_t ret = xTaskCreatePinnedToCore(
-        telegram_poll_task, "tg_poll",
-        MIMI_TG_POLL_STACK, NULL,
-        MIMI_TG_POLL_PRIO, NULL, MIMI_TG_POLL_CORE);
+    s_updates_queue = xQueueCreate(1, sizeof(poll_result_t));
+    if (!s_updates_queue) return ESP_ERR_NO_MEM;
+    if (xTaskCreatePinnedToCore(updates_task, "tg_updates", MIMI_TG_UPDATES_STACK, NULL,
+                                MIMI_TG_UPDATES_PRIO, NULL, MIMI_TG_UPDATES_CORE) != pdPASS) {
+        return ESP_FAIL;
+    }
 
-    return (ret == pdPASS) ? ESP_OK : ESP_FAIL;
+    s_started = true;
+    if (s_bot_token[0] == '\0') {
+        ESP_LOGW(TAG, "No bot token configured, polling starts once one is set");
+        return ESP_OK;
+    }
+    return poll_start();
 }
 
 esp_err_t telegram_send_message(const char *chat_id, const char *text)
@@ -381,5 +352,5 @@ esp_err_t telegram_set_token(const char *token)
 
     strncpy(s_bot_token, token, sizeof(s_bot_token) - 1);
     ESP_LOGI(TAG, "Telegram bot token saved");
-    return ESP_OK;
+    return s_started ? poll_start() : ESP_OK;
 }
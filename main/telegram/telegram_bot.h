@@ -8,7 +8,9 @@
 esp_err_t telegram_bot_init(void);
 
 /**
- * Start the Telegram polling task (long polling on Core 0).
+ * Start long polling for updates on the http_io task (see
+ * http_transport_submit); the tg_updates task handles what arrives.
+ * Without a token, polling starts once one is set.
  */
 esp_err_t telegram_bot_start(void);
 
@@ -21,7 +23,8 @@ esp_err_t telegram_bot_start(void);
 esp_err_t telegram_send_message(const char *chat_id, const char *text);
 
 /**
- * Save the Telegram bot token to NVS.
+ * Save the Telegram bot token to NVS and start polling if it was waiting
+ * for one.
  */
 esp_err_t telegram_set_token(const char *token);
 
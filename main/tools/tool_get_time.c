@@ -1,14 +1,13 @@
 #include "tool_get_time.h"
 #include "mimi_config.h"
-#include "proxy/http_proxy.h"
+#include "net/http_transport.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/time.h>
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "esp_crt_bundle.h"
 
 static const char *TAG = "tool_time";
 
@@ -61,81 +60,33 @@ static bool parse_and_set_time(const char *date_str, char *out, size_t out_size)
     return true;
 }
 
-/* Fetch time via proxy: HEAD request to api.telegram.org, parse Date header */
-static esp_err_t fetch_time_via_proxy(char *out, size_t out_size)
+static void on_header(const char *name, const char *value, void *ctx)
 {
-    proxy_conn_t *conn = proxy_conn_open("api.telegram.org", 443, 10000);
-    if (!conn) return ESP_ERR_HTTP_CONNECT;
-
-    const char *req =
-        "HEAD / HTTP/1.1\r\n"
-        "Host: api.telegram.org\r\n"
-        "Connection: close\r\n\r\n";
-
-    if (proxy_conn_write(conn, req, strlen(req)) < 0) {
-        proxy_conn_close(conn);
-        return ESP_ERR_HTTP_WRITE_DATA;
+    if (strcasecmp(name, "Date") == 0) {
+        strncpy((char *)ctx, value, 63);
     }
-
-    char buf[1024];
-    int total = 0;
-    while (total < (int)sizeof(buf) - 1) {
-        int n = proxy_conn_read(conn, buf + total, sizeof(buf) - 1 - total, 10000);
-        if (n <= 0) break;
-        total += n;
-        buf[total] = '\0';
-        if (strstr(buf, "\r\n\r\n")) break;
-    }
-    proxy_conn_close(conn);
-
-    /* Find Date header */
-    char *date_hdr = strcasestr(buf, "\r\nDate: ");
-    if (!date_hdr) return ESP_ERR_NOT_FOUND;
-    date_hdr += 8;
-
-    char *eol = strstr(date_hdr, "\r\n");
-    if (!eol) return ESP_ERR_NOT_FOUND;
-
-    char date_val[64];
-    size_t dlen = eol - date_hdr;
-    if (dlen >= sizeof(date_val)) return ESP_ERR_NOT_FOUND;
-    memcpy(date_val, date_hdr, dlen);
-    date_val[dlen] = '\0';
-
-    if (!parse_and_set_time(date_val, out, out_size)) return ESP_FAIL;
-    return ESP_OK;
 }
 
-/* Fetch time via direct HTTPS */
-static esp_err_t fetch_time_direct(char *out, size_t out_size)
+/* HEAD request to api.telegram.org, parse the Date header */
+static esp_err_t fetch_time(char *out, size_t out_size)
 {
-    esp_http_client_config_t config = {
-        .url = "https://api.telegram.org/",
-        .method = HTTP_METHOD_HEAD,
+    char date_val[64] = {0};
+    http_request_t req = {
+        .method = "HEAD",
+        .host = "api.telegram.org",
+        .port = 443,
+        .tls = true,
+        .path = "/",
         .timeout_ms = 10000,
-        .crt_bundle_attach = esp_crt_bundle_attach,
+        .on_header = on_header,
+        .ctx = date_val,
     };
+    http_result_t res;
+    esp_err_t err = http_transport_request(&req, &res);
+    if (err != ESP_OK) return err;
+    if (date_val[0] == '\0') return ESP_ERR_NOT_FOUND;
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) return ESP_FAIL;
-
-    esp_err_t err = esp_http_client_perform(client);
-    if (err != ESP_OK) {
-        esp_http_client_cleanup(client);
-        return err;
-    }
-
-    /* Get Date header */
-    char date_val[64] = {0};
-    err = esp_http_client_get_header(client, "Date", (char **)&date_val);
-    /* esp_http_client_get_header returns pointer, not copy */
-    char *date_ptr = NULL;
-    esp_http_client_get_header(client, "Date", &date_ptr);
-    esp_http_client_cleanup(client);
-
-    if (!date_ptr || date_ptr[0] == '\0') return ESP_ERR_NOT_FOUND;
-
-    if (!parse_and_set_time(date_ptr, out, out_size)) return ESP_FAIL;
+    if (!parse_and_set_time(date_val, out, out_size)) return ESP_FAIL;
     return ESP_OK;
 }
 
@@ -143,12 +94,7 @@ esp_err_t tool_get_time_execute(const char *input_json, char *output, size_t out
 {
     ESP_LOGI(TAG, "Fetching current time...");
 
-    esp_err_t err;
-    if (http_proxy_is_enabled()) {
-        err = fetch_time_via_proxy(output, output_size);
-    } else {
-        err = fetch_time_direct(output, output_size);
-    }
+    esp_err_t err = fetch_time(output, output_size);
 
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Time: %s", output);
@@ -6,6 +6,8 @@
 
 #include <string.h>
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 
 static const char *TAG = "tools";
@@ -15,6 +17,15 @@ static const char *TAG = "tools";
 static mimi_tool_t s_tools[MAX_TOOLS];
 static int s_tool_count = 0;
 static char *s_tools_json = NULL;  /* cached JSON array string */
+static SemaphoreHandle_t s_exclusive_lock;
+
+static const mimi_tool_t *find_tool(const char *name)
+{
+    for (int i = 0; i < s_tool_count; i++) {
+        if (strcmp(s_tools[i].name, name) == 0) return &s_tools[i];
+    }
+    return NULL;
+}
 
 static void register_tool(const mimi_tool_t *tool)
 {
@@ -54,6 +65,9 @@ esp_err_t tool_registry_init(void)
 {
     s_tool_count = 0;
 
+    s_exclusive_lock = xSemaphoreCreateMutex();
+    if (!s_exclusive_lock) return ESP_ERR_NO_MEM;
+
     /* Register web_search */
     tool_web_search_init();
 
@@ -89,6 +103,7 @@ esp_err_t tool_registry_init(void)
             "\"properties\":{\"path\":{\"type\":\"string\",\"description\":\"Absolute path starting with /spiffs/\"}},"
             "\"required\":[\"path\"]}",
         .execute = tool_read_file_execute,
+        .path_arg = "path",
     };
     register_tool(&rf);
 
@@ -102,6 +117,8 @@ esp_err_t tool_registry_init(void)
             "\"content\":{\"type\":\"string\",\"description\":\"File content to write\"}},"
             "\"required\":[\"path\",\"content\"]}",
         .execute = tool_write_file_execute,
+        .exclusive = true,
+        .path_arg = "path",
     };
     register_tool(&wf);
 
@@ -116,6 +133,8 @@ esp_err_t tool_registry_init(void)
             "\"new_string\":{\"type\":\"string\",\"description\":\"Replacement text\"}},"
             "\"required\":[\"path\",\"old_string\",\"new_string\"]}",
         .execute = tool_edit_file_execute,
+        .exclusive = true,
+        .path_arg = "path",
     };
     register_tool(&ef);
 
@@ -128,6 +147,8 @@ esp_err_t tool_registry_init(void)
             "\"properties\":{\"prefix\":{\"type\":\"string\",\"description\":\"Optional path prefix filter, e.g. /spiffs/memory/\"}},"
             "\"required\":[]}",
         .execute = tool_list_dir_execute,
+        .path_arg = "prefix",
+        .path_prefix = true,
     };
     register_tool(&ld);
 
@@ -148,6 +169,7 @@ esp_err_t tool_registry_init(void)
             "},"
             "\"required\":[\"name\",\"schedule_type\",\"message\"]}",
         .execute = tool_cron_add_execute,
+        .exclusive = true,
     };
     register_tool(&ca);
 
@@ -172,6 +194,7 @@ esp_err_t tool_registry_init(void)
             "\"properties\":{\"job_id\":{\"type\":\"string\",\"description\":\"The 8-character job ID to remove\"}},"
             "\"required\":[\"job_id\"]}",
         .execute = tool_cron_remove_execute,
+        .exclusive = true,
     };
     register_tool(&cr);
 
@@ -189,14 +212,35 @@ const char *tool_registry_get_tools_json(void)
 esp_err_t tool_registry_execute(const char *name, const char *input_json,
                                 char *output, size_t output_size)
 {
-    for (int i = 0; i < s_tool_count; i++) {
-        if (strcmp(s_tools[i].name, name) == 0) {
-            ESP_LOGI(TAG, "Executing tool: %s", name);
-            return s_tools[i].execute(input_json, output, output_size);
-        }
+    const mimi_tool_t *tool = find_tool(name);
+    if (!tool) {
+        ESP_LOGW(TAG, "Unknown tool: %s", name);
+        snprintf(output, output_size, "Error: unknown tool '%s'", name);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(TAG, "Executing tool: %s", name);
+    if (!tool->exclusive) {
+        return tool->execute(input_json, output, output_size);
     }
+    xSemaphoreTake(s_exclusive_lock, portMAX_DELAY);
+    esp_err_t err = tool->execute(input_json, output, output_size);
+    xSemaphoreGive(s_exclusive_lock);
+    return err;
+}
 
-    ESP_LOGW(TAG, "Unknown tool: %s", name);
-    snprintf(output, output_size, "Error: unknown tool '%s'", name);
-    return ESP_ERR_NOT_FOUND;
+void tool_registry_access(const char *name, const char *input_json, tool_access_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    const mimi_tool_t *tool = find_tool(name);
+    if (!tool) return;
+
+    out->exclusive = tool->exclusive;
+    out->prefix = tool->path_prefix;
+    if (!tool->path_arg) return;
+
+    cJSON *input = input_json ? cJSON_Parse(input_json) : NULL;
+    const char *path = cJSON_GetStringValue(cJSON_GetObjectItem(input, tool->path_arg));
+    if (path) snprintf(out->path, sizeof(out->path), "%s", path);
+    cJSON_Delete(input);
 }
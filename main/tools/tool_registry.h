@@ -2,14 +2,26 @@
 
 #include "esp_err.h"
 #include <stddef.h>
+#include <stdbool.h>
 
 typedef struct {
     const char *name;
     const char *description;
     const char *input_schema_json;  /* JSON Schema string for input */
     esp_err_t (*execute)(const char *input_json, char *output, size_t output_size);
+    bool exclusive;                 /* mutates shared state: never runs concurrently
+                                       with another exclusive tool */
+    const char *path_arg;           /* input member naming the file it touches, or NULL */
+    bool path_prefix;               /* path_arg is a prefix covering every file under it */
 } mimi_tool_t;
 
+/** What one call touches, for ordering the calls of a response. */
+typedef struct {
+    bool exclusive;
+    bool prefix;                    /* path covers every file under it */
+    char path[64];                  /* file named by the input, "" if none */
+} tool_access_t;
+
 /**
  * Initialize tool registry and register all built-in tools.
  */
@@ -22,7 +34,8 @@ esp_err_t tool_registry_init(void);
 const char *tool_registry_get_tools_json(void);
 
 /**
- * Execute a tool by name.
+ * Execute a tool by name. Safe to call from several tasks at once;
+ * exclusive tools are serialized.
  *
  * @param name         Tool name (e.g. "web_search")
  * @param input_json   JSON string of tool input
@@ -32,3 +45,9 @@ const char *tool_registry_get_tools_json(void);
  */
 esp_err_t tool_registry_execute(const char *name, const char *input_json,
                                 char *output, size_t output_size);
+
+/**
+ * Describe what a call of tool `name` with this input touches. An
+ * unknown tool or unparseable input touches nothing.
+ */
+void tool_registry_access(const char *name, const char *input_json, tool_access_t *out);
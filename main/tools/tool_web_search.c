@@ -1,13 +1,10 @@
 #include "tool_web_search.h"
 #include "mimi_config.h"
-#include "proxy/http_proxy.h"
+#include "net/http_transport.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "esp_crt_bundle.h"
-#include "esp_heap_caps.h"
 #include "nvs.h"
 #include "cJSON.h"
 
@@ -18,28 +15,6 @@ static char s_search_key[128] = {0};
 #define SEARCH_BUF_SIZE     (16 * 1024)
 #define SEARCH_RESULT_COUNT 5
 
-/* ── Response accumulator ─────────────────────────────────────── */
-
-typedef struct {
-    char *data;
-    size_t len;
-    size_t cap;
-} search_buf_t;
-
-static esp_err_t http_event_handler(esp_http_client_event_t *evt)
-{
-    search_buf_t *sb = (search_buf_t *)evt->user_data;
-    if (evt->event_id == HTTP_EVENT_ON_DATA) {
-        size_t needed = sb->len + evt->data_len;
-        if (needed < sb->cap) {
-            memcpy(sb->data + sb->len, evt->data, evt->data_len);
-            sb->len += evt->data_len;
-            sb->data[sb->len] = '\0';
-        }
-    }
-    return ESP_OK;
-}
-
 /* ── Init ─────────────────────────────────────────────────────── */
 
 esp_err_t tool_web_search_init(void)
@@ -130,96 +105,34 @@ static void format_results(cJSON *root, char *output, size_t output_size)
     }
 }
 
-/* ── Direct HTTPS request ─────────────────────────────────────── */
+/* ── HTTPS request ────────────────────────────────────────────── */
 
-static esp_err_t search_direct(const char *url, search_buf_t *sb)
+static esp_err_t search_request(const char *path, http_buf_t *sb)
 {
-    esp_http_client_config_t config = {
-        .url = url,
-        .event_handler = http_event_handler,
-        .user_data = sb,
+    char headers[192];
+    snprintf(headers, sizeof(headers),
+             "Accept: application/json\r\n"
+             "X-Subscription-Token: %s\r\n", s_search_key);
+
+    http_request_t req = {
+        .method = "GET",
+        .host = "api.search.brave.com",
+        .port = 443,
+        .tls = true,
+        .path = path,
+        .headers = headers,
         .timeout_ms = 15000,
-        .buffer_size = 4096,
-        .crt_bundle_attach = esp_crt_bundle_attach,
+        .on_body = http_buf_sink,
+        .ctx = sb,
     };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) return ESP_FAIL;
-
-    esp_http_client_set_header(client, "Accept", "application/json");
-    esp_http_client_set_header(client, "X-Subscription-Token", s_search_key);
-
-    esp_err_t err = esp_http_client_perform(client);
-    int status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
-
+    http_result_t res;
+    esp_err_t err = http_transport_request(&req, &res);
     if (err != ESP_OK) return err;
-    if (status != 200) {
-        ESP_LOGE(TAG, "Search API returned %d", status);
-        return ESP_FAIL;
-    }
-    return ESP_OK;
-}
-
-/* ── Proxy HTTPS request ──────────────────────────────────────── */
-
-static esp_err_t search_via_proxy(const char *path, search_buf_t *sb)
-{
-    proxy_conn_t *conn = proxy_conn_open("api.search.brave.com", 443, 15000);
-    if (!conn) return ESP_ERR_HTTP_CONNECT;
-
-    char header[512];
-    int hlen = snprintf(header, sizeof(header),
-        "GET %s HTTP/1.1\r\n"
-        "Host: api.search.brave.com\r\n"
-        "Accept: application/json\r\n"
-        "X-Subscription-Token: %s\r\n"
-        "Connection: close\r\n\r\n",
-        path, s_search_key);
-
-    if (proxy_conn_write(conn, header, hlen) < 0) {
-        proxy_conn_close(conn);
-        return ESP_ERR_HTTP_WRITE_DATA;
-    }
-
-    /* Read full response */
-    char tmp[4096];
-    size_t total = 0;
-    while (1) {
-        int n = proxy_conn_read(conn, tmp, sizeof(tmp), 15000);
-        if (n <= 0) break;
-        size_t copy = (total + n < sb->cap - 1) ? (size_t)n : sb->cap - 1 - total;
-        if (copy > 0) {
-            memcpy(sb->data + total, tmp, copy);
-            total += copy;
-        }
-    }
-    sb->data[total] = '\0';
-    sb->len = total;
-    proxy_conn_close(conn);
-
-    /* Check status */
-    int status = 0;
-    if (total > 5 && strncmp(sb->data, "HTTP/", 5) == 0) {
-        const char *sp = strchr(sb->data, ' ');
-        if (sp) status = atoi(sp + 1);
-    }
-
-    /* Strip headers */
-    char *body = strstr(sb->data, "\r\n\r\n");
-    if (body) {
-        body += 4;
-        size_t blen = total - (body - sb->data);
-        memmove(sb->data, body, blen);
-        sb->len = blen;
-        sb->data[sb->len] = '\0';
-    }
-
-    if (status != 200) {
-        ESP_LOGE(TAG, "Search API returned %d via proxy", status);
+    if (res.status != 200) {
+        ESP_LOGE(TAG, "Search API returned %d", res.status);
         return ESP_FAIL;
     }
-    return ESP_OK;
+    return sb->data ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
 }
 
 /* ── Execute ──────────────────────────────────────────────────── */
@@ -256,24 +169,9 @@ esp_err_t tool_web_search_execute(const char *input_json, char *output, size_t o
     snprintf(path, sizeof(path),
              "/res/v1/web/search?q=%s&count=%d", encoded_query, SEARCH_RESULT_COUNT);
 
-    /* Allocate response buffer from PSRAM */
-    search_buf_t sb = {0};
-    sb.data = heap_caps_calloc(1, SEARCH_BUF_SIZE, MALLOC_CAP_SPIRAM);
-    if (!sb.data) {
-        snprintf(output, output_size, "Error: Out of memory");
-        return ESP_ERR_NO_MEM;
-    }
-    sb.cap = SEARCH_BUF_SIZE;
-
-    /* Make HTTP request */
-    esp_err_t err;
-    if (http_proxy_is_enabled()) {
-        err = search_via_proxy(path, &sb);
-    } else {
-        char url[512];
-        snprintf(url, sizeof(url), "https://api.search.brave.com%s", path);
-        err = search_direct(url, &sb);
-    }
+    /* Response grows in PSRAM up to SEARCH_BUF_SIZE */
+    http_buf_t sb = { .max = SEARCH_BUF_SIZE };
+    esp_err_t err = search_request(path, &sb);
 
     if (err != ESP_OK) {
         free(sb.data);
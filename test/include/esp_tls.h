@@ -0,0 +1,134 @@
+#pragma once
+
+/*
+ * Host stand-in for ESP-IDF's esp_tls.h over plain TCP: connections are
+ * never encrypted, whatever is_plain_tcp says, so the transport can be
+ * run against a local server. Reads and writes are recv() and send(), as
+ * esp_tls does for plain TCP; nothing is buffered above the socket, so
+ * esp_tls_get_bytes_avail() is always 0.
+ */
+
+#include "esp_err.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define ESP_TLS_ERR_SSL_WANT_READ   -0x6900
+#define ESP_TLS_ERR_SSL_WANT_WRITE  -0x6880
+
+typedef enum {
+    ESP_TLS_INIT = 0,
+    ESP_TLS_CONNECTING,
+    ESP_TLS_HANDSHAKE,
+    ESP_TLS_FAIL,
+    ESP_TLS_DONE,
+} esp_tls_conn_state_t;
+
+typedef struct esp_tls {
+    int sockfd;
+    esp_tls_conn_state_t conn_state;
+} esp_tls_t;
+
+typedef struct esp_tls_client_session esp_tls_client_session_t;
+
+typedef struct {
+    esp_err_t (*crt_bundle_attach)(void *conf);
+    int timeout_ms;
+    bool non_block;
+    bool is_plain_tcp;
+    esp_tls_client_session_t *client_session;
+} esp_tls_cfg_t;
+
+static inline esp_tls_t *esp_tls_init(void)
+{
+    esp_tls_t *tls = calloc(1, sizeof(esp_tls_t));
+    if (tls) tls->sockfd = -1;
+    return tls;
+}
+
+/* Start a connect to host:port; 1 connected, 0 in progress, -1 failed */
+static inline int esp_tls_host_connect(const char *host, int hostlen, int port, bool non_block,
+                                       esp_tls_t *tls)
+{
+    char name[256], service[8];
+    snprintf(name, sizeof(name), "%.*s", hostlen, host);
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *ai;
+    if (getaddrinfo(name, service, &hints, &ai) != 0) return -1;
+    tls->sockfd = socket(ai->ai_family, ai->ai_socktype, 0);
+    if (tls->sockfd >= 0 && non_block) fcntl(tls->sockfd, F_SETFL, O_NONBLOCK);
+    int ret = tls->sockfd >= 0 ? connect(tls->sockfd, ai->ai_addr, ai->ai_addrlen) : -1;
+    freeaddrinfo(ai);
+    if (ret == 0) return 1;
+    return errno == EINPROGRESS ? 0 : -1;
+}
+
+static inline int esp_tls_conn_new_sync(const char *host, int hostlen, int port,
+                                        const esp_tls_cfg_t *cfg, esp_tls_t *tls)
+{
+    int ret = esp_tls_host_connect(host, hostlen, port, false, tls);
+    tls->conn_state = ret == 1 ? ESP_TLS_DONE : ESP_TLS_FAIL;
+    return ret == 1 ? 1 : -1;
+}
+
+static inline int esp_tls_conn_new_async(const char *host, int hostlen, int port,
+                                         const esp_tls_cfg_t *cfg, esp_tls_t *tls)
+{
+    if (tls->conn_state == ESP_TLS_INIT) {
+        int ret = esp_tls_host_connect(host, hostlen, port, true, tls);
+        tls->conn_state = ret == 1 ? ESP_TLS_DONE : ret == 0 ? ESP_TLS_CONNECTING : ESP_TLS_FAIL;
+    } else if (tls->conn_state == ESP_TLS_CONNECTING) {
+        struct pollfd p = { .fd = tls->sockfd, .events = POLLOUT };
+        if (poll(&p, 1, 0) <= 0) return 0;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(tls->sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+        tls->conn_state = err ? ESP_TLS_FAIL : ESP_TLS_DONE;
+    }
+    return tls->conn_state == ESP_TLS_DONE ? 1 : tls->conn_state == ESP_TLS_FAIL ? -1 : 0;
+}
+
+static inline ssize_t esp_tls_conn_read(esp_tls_t *tls, void *data, size_t len)
+{
+    return recv(tls->sockfd, data, len, 0);
+}
+
+static inline ssize_t esp_tls_conn_write(esp_tls_t *tls, const void *data, size_t len)
+{
+    return send(tls->sockfd, data, len, MSG_NOSIGNAL);
+}
+
+static inline ssize_t esp_tls_get_bytes_avail(esp_tls_t *tls)
+{
+    return 0;
+}
+
+static inline esp_err_t esp_tls_get_conn_sockfd(esp_tls_t *tls, int *sockfd)
+{
+    if (!tls) return ESP_ERR_INVALID_ARG;
+    *sockfd = tls->sockfd;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_tls_get_conn_state(esp_tls_t *tls, esp_tls_conn_state_t *state)
+{
+    if (!tls) return ESP_ERR_INVALID_ARG;
+    *state = tls->conn_state;
+    return ESP_OK;
+}
+
+static inline int esp_tls_conn_destroy(esp_tls_t *tls)
+{
+    if (!tls) return -1;
+    if (tls->sockfd >= 0) close(tls->sockfd);
+    free(tls);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Host stand-in for FreeRTOS.h on pthreads: a 1 kHz tick, and critical
+ * sections as mutexes (the host has no interrupts to mask).
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux)         pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)          pthread_mutex_unlock(mux)
+
+/* Absolute deadline ticks from now, for the timed waits */
+static inline struct timespec rtos_deadline(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/* Host stand-in for FreeRTOS queue.h: a ring of fixed-size items */
+
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t len;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+} rtos_queue_t;
+
+typedef rtos_queue_t *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    QueueHandle_t q = calloc(1, sizeof(*q) + (size_t)len * item_size);
+    if (!q) return NULL;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    q->len = len;
+    q->item_size = item_size;
+    return q;
+}
+
+/* Wait with q locked until ready() holds; false after ticks */
+static inline bool rtos_queue_wait(QueueHandle_t q, bool (*ready)(QueueHandle_t), TickType_t ticks)
+{
+    struct timespec ts = rtos_deadline(ticks);
+    while (!ready(q)) {
+        if (ticks == 0) return false;
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&q->changed, &q->lock);
+        } else if (pthread_cond_timedwait(&q->changed, &q->lock, &ts) != 0) {
+            return ready(q);
+        }
+    }
+    return true;
+}
+
+static inline bool rtos_queue_has_room(QueueHandle_t q) { return q->count < q->len; }
+static inline bool rtos_queue_has_item(QueueHandle_t q) { return q->count > 0; }
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = rtos_queue_wait(q, rtos_queue_has_room, ticks);
+    if (ok) {
+        memcpy(q->items + (size_t)((q->head + q->count) % q->len) * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t rtos_queue_take(QueueHandle_t q, void *out, TickType_t ticks, bool remove)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = rtos_queue_wait(q, rtos_queue_has_item, ticks);
+    if (ok) {
+        memcpy(out, q->items + (size_t)q->head * q->item_size, q->item_size);
+        if (remove) {
+            q->head = (q->head + 1) % q->len;
+            q->count--;
+            pthread_cond_broadcast(&q->changed);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *out, TickType_t ticks)
+{
+    return rtos_queue_take(q, out, ticks, true);
+}
+
+static inline BaseType_t xQueuePeek(QueueHandle_t q, void *out, TickType_t ticks)
+{
+    return rtos_queue_take(q, out, ticks, false);
+}
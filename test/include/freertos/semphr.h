@@ -0,0 +1,27 @@
+#pragma once
+
+/* Host stand-in for FreeRTOS semphr.h: mutexes only */
+
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t m = malloc(sizeof(*m));
+    if (m) pthread_mutex_init(m, NULL);
+    return m;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) return pthread_mutex_lock(m) == 0;
+    struct timespec ts = rtos_deadline(ticks);
+    return pthread_mutex_timedlock(m, &ts) == 0;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+    return pthread_mutex_unlock(m) == 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/* Host stand-in for FreeRTOS task.h: tasks are detached threads */
+
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef pthread_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+typedef struct {
+    TaskFunction_t fn;
+    void *arg;
+} rtos_task_start_t;
+
+static inline void *rtos_task_main(void *p)
+{
+    rtos_task_start_t start = *(rtos_task_start_t *)p;
+    free(p);
+    start.fn(start.arg);
+    return NULL;
+}
+
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                                 uint32_t stack, void *arg, UBaseType_t prio,
+                                                 TaskHandle_t *handle, BaseType_t core)
+{
+    rtos_task_start_t *start = malloc(sizeof(*start));
+    if (!start) return pdFALSE;
+    start->fn = fn;
+    start->arg = arg;
+    pthread_t t;
+    if (pthread_create(&t, NULL, rtos_task_main, start) != 0) {
+        free(start);
+        return pdFALSE;
+    }
+    pthread_detach(t);
+    return pdPASS;
+}
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+    usleep(ticks * 1000);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+/* Host stand-in for mbedtls/net_sockets.h: the error http_transport checks for */
+
+#define MBEDTLS_ERR_NET_CONN_RESET              -0x0050
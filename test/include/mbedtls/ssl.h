@@ -0,0 +1,5 @@
+#pragma once
+
+/* Host stand-in for mbedtls/ssl.h: the error http_transport checks for */
+
+#define MBEDTLS_ERR_SSL_CONN_EOF                -0x7280
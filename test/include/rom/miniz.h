@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+ * Host stand-in for the tinfl decoder in ESP32 ROM, on the host's zlib:
+ * the types, flags and tinfl_decompress() contract http_transport uses.
+ * Each call inflates what fits between out_next and the end of the
+ * dictionary. zlib keeps its own window, so out_start is not read; its
+ * state lives in an arena inside the decompressor, so freeing the
+ * decompressor frees everything, as with tinfl.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE                      32768
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER            1
+#define TINFL_FLAG_HAS_MORE_INPUT               2
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+#define TINFL_FLAG_COMPUTE_ADLER32              8
+
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    mz_uint32 m_state;      /* 0 until the first call sets up z */
+    z_stream z;
+    size_t used;
+    uint8_t arena[64 * 1024];
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->m_state = 0; } while (0)
+
+static inline voidpf tinfl_zalloc(voidpf opaque, uInt n, uInt size)
+{
+    tinfl_decompressor *r = (tinfl_decompressor *)opaque;
+    size_t bytes = ((size_t)n * size + 15) & ~(size_t)15;
+    if (r->used + bytes > sizeof(r->arena)) return Z_NULL;
+    r->used += bytes;
+    return r->arena + r->used - bytes;
+}
+
+static inline void tinfl_zfree(voidpf opaque, voidpf p)
+{
+}
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *in,
+                                            size_t *in_size, mz_uint8 *out_start,
+                                            mz_uint8 *out_next, size_t *out_size,
+                                            const mz_uint32 flags)
+{
+    if (r->m_state == 0) {
+        memset(&r->z, 0, sizeof(r->z));
+        r->used = 0;
+        r->z.zalloc = tinfl_zalloc;
+        r->z.zfree = tinfl_zfree;
+        r->z.opaque = r;
+        int bits = (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15;
+        if (inflateInit2(&r->z, bits) != Z_OK) return TINFL_STATUS_FAILED;
+        r->m_state = 1;
+    }
+    r->z.next_in = (Bytef *)in;
+    r->z.avail_in = (uInt)*in_size;
+    r->z.next_out = out_next;
+    r->z.avail_out = (uInt)*out_size;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_size -= r->z.avail_in;
+    *out_size -= r->z.avail_out;
+    if (ret == Z_STREAM_END) return TINFL_STATUS_DONE;
+    if (ret != Z_OK && ret != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+    return r->z.avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
@@ -0,0 +1,317 @@
+/*
+ * http_rx framing: what a response decodes to, however it is split.
+ *
+ * Content-Length and chunked responses are fed whole, byte by byte, in
+ * two pieces split at every offset and in three pieces split at every
+ * pair of offsets, so every chunk-size line, CRLF and header is also cut
+ * across reads. Each way must give the same status, headers and body and
+ * end in HTTP_RX_DONE. Content-encoded bodies come out as sent: inflating
+ * them is up to http_transport.
+ *
+ * The benchmark decodes a Telegram-sized response (nine headers, 2 KB of
+ * JSON) arriving in TCP-segment-sized reads.
+ */
+
+#include "net/http_rx.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+typedef struct {
+    char headers[512];      /* "name=value;" per header */
+    char body[4096];
+    size_t body_len;
+    int calls;
+    esp_err_t fail_with;    /* returned by on_body once calls reaches fail_at */
+    int fail_at;
+} result_t;
+
+static void on_header(const char *name, const char *value, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    size_t n = strlen(r->headers);
+    snprintf(r->headers + n, sizeof(r->headers) - n, "%s=%s;", name, value);
+}
+
+static esp_err_t on_body(const char *data, size_t len, int status, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (r->fail_with && ++r->calls >= r->fail_at) return r->fail_with;
+    if (r->body_len + len > sizeof(r->body)) return ESP_ERR_INVALID_SIZE;
+    memcpy(r->body + r->body_len, data, len);
+    r->body_len += len;
+    return ESP_OK;
+}
+
+/* Decode wire in pieces ending at cuts[], then the rest */
+static esp_err_t decode(http_rx_t *rx, const char *wire, size_t len, const size_t *cuts, int ncuts,
+                        bool head, result_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    http_rx_init(rx, head, on_header, on_body, r);
+    size_t from = 0;
+    for (int i = 0; i <= ncuts; i++) {
+        size_t to = i < ncuts ? cuts[i] : len;
+        esp_err_t err = http_rx_feed(rx, wire + from, to - from);
+        if (err != ESP_OK) return err;
+        from = to;
+    }
+    return ESP_OK;
+}
+
+static bool same(const http_rx_t *rx, const result_t *r, const http_rx_t *want_rx,
+                 const result_t *want)
+{
+    return rx->state == want_rx->state && rx->status == want_rx->status &&
+           rx->wire_bytes == want_rx->wire_bytes && rx->close == want_rx->close &&
+           strcmp(r->headers, want->headers) == 0 && r->body_len == want->body_len &&
+           memcmp(r->body, want->body, r->body_len) == 0;
+}
+
+/* Whole, byte by byte, and at every one and two cuts: all the same as whole */
+static void check_splits(const char *wire, bool head)
+{
+    size_t len = strlen(wire);
+    static result_t want, r;
+    http_rx_t want_rx, rx;
+    CHECK(decode(&want_rx, wire, len, NULL, 0, head, &want) == ESP_OK);
+
+    size_t *bytes = malloc(len * sizeof(size_t));
+    for (size_t i = 0; i < len; i++) bytes[i] = i + 1;
+    CHECK(decode(&rx, wire, len, bytes, (int)len - 1, head, &r) == ESP_OK);
+    CHECK(same(&rx, &r, &want_rx, &want));
+    free(bytes);
+
+    int bad = 0;
+    for (size_t i = 0; i <= len; i++) {
+        for (size_t j = i; j <= len; j++) {
+            size_t cuts[2] = { i, j };
+            if (decode(&rx, wire, len, cuts, 2, head, &r) != ESP_OK ||
+                !same(&rx, &r, &want_rx, &want)) {
+                bad++;
+            }
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static void test_content_length(void)
+{
+    static const char wire[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "content-length: 27\r\n"
+        "\r\n"
+        "{\"ok\":true,\"result\":[1,2]}\n";
+    http_rx_t rx;
+    result_t r;
+    CHECK(decode(&rx, wire, strlen(wire), NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE);
+    CHECK(rx.status == 200);
+    CHECK(rx.content_length == 27);
+    CHECK(rx.wire_bytes == 27);
+    CHECK(!rx.chunked && !rx.close);
+    CHECK(rx.enc == HTTP_ENC_IDENTITY);
+    CHECK_STR(r.headers, "Content-Type=application/json;content-length=27;");
+    CHECK(r.body_len == 27 && memcmp(r.body, "{\"ok\":true,\"result\":[1,2]}\n", 27) == 0);
+    check_splits(wire, false);
+
+    /* Nothing after the end of the response is taken */
+    char twice[512];
+    snprintf(twice, sizeof(twice), "%sHTTP/1.1 500 Oops\r\n\r\n", wire);
+    CHECK(decode(&rx, twice, strlen(twice), NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.status == 200 && r.body_len == 27);
+
+    /* Bare LF line endings */
+    static const char lf[] = "HTTP/1.0 200 OK\nContent-Length: 2\n\nhi";
+    CHECK(decode(&rx, lf, strlen(lf), NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE && r.body_len == 2 && memcmp(r.body, "hi", 2) == 0);
+}
+
+static void test_chunked(void)
+{
+    static const char wire[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "7;name=value\r\n"
+        "Mozilla\r\n"
+        "11\r\n"
+        "Developer Network\r\n"
+        "1\r\n"
+        "!\r\n"
+        "0\r\n"
+        "Expires: never\r\n"
+        "\r\n";
+    http_rx_t rx;
+    result_t r;
+    CHECK(decode(&rx, wire, strlen(wire), NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE);
+    CHECK(rx.chunked && rx.close);
+    CHECK(rx.wire_bytes == 25);
+    CHECK(r.body_len == 25 && memcmp(r.body, "MozillaDeveloper Network!", 25) == 0);
+    /* Trailers are not headers */
+    CHECK_STR(r.headers, "Transfer-Encoding=chunked;Connection=close;");
+    check_splits(wire, false);
+
+    /* Upper-case hex, a chunk larger than any piece */
+    char big[1200];
+    int n = snprintf(big, sizeof(big), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "3E8\r\n");
+    for (int i = 0; i < 1000; i++) big[n++] = 'a' + i % 26;
+    n += snprintf(big + n, sizeof(big) - n, "\r\n0\r\n\r\n");
+    size_t cuts[] = { 10, 70, 71, 72, 500, 1071 };
+    CHECK(decode(&rx, big, n, cuts, 6, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE && r.body_len == 1000);
+    CHECK(r.body[0] == 'a' && r.body[999] == 'a' + 999 % 26);
+
+    /* Cut before the last chunk: not done */
+    CHECK(decode(&rx, wire, strlen(wire) - 5, NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state != HTTP_RX_DONE);
+}
+
+static void test_no_body(void)
+{
+    http_rx_t rx;
+    result_t r;
+
+    /* HEAD: Content-Length describes the body a GET would get */
+    static const char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 1234\r\n\r\n";
+    CHECK(decode(&rx, head, strlen(head), NULL, 0, true, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE && r.body_len == 0);
+    check_splits(head, true);
+
+    static const char *const empty[] = {
+        "HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n",
+        "HTTP/1.1 304 Not Modified\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(empty) / sizeof(empty[0]); i++) {
+        CHECK(decode(&rx, empty[i], strlen(empty[i]), NULL, 0, false, &r) == ESP_OK);
+        CHECK(rx.state == HTTP_RX_DONE && r.body_len == 0 && rx.wire_bytes == 0);
+    }
+
+    /* 1xx interim responses are skipped, encodings and all */
+    static const char interim[] =
+        "HTTP/1.1 100 Continue\r\n\r\n"
+        "HTTP/1.1 103 Early Hints\r\nContent-Encoding: gzip\r\nLink: </a.css>\r\n\r\n"
+        "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+    CHECK(decode(&rx, interim, strlen(interim), NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE && rx.status == 201);
+    CHECK(rx.enc == HTTP_ENC_IDENTITY);
+    CHECK(r.body_len == 2 && memcmp(r.body, "ok", 2) == 0);
+    check_splits(interim, false);
+}
+
+static void test_until_close(void)
+{
+    static const char wire[] = "HTTP/1.0 200 OK\r\nContent-Encoding: deflate\r\n\r\nraw bytes";
+    http_rx_t rx;
+    result_t r;
+    CHECK(decode(&rx, wire, strlen(wire), NULL, 0, false, &r) == ESP_OK);
+    /* Only the connection closing ends it */
+    CHECK(rx.state == HTTP_RX_BODY && rx.content_length == -1);
+    CHECK(rx.enc == HTTP_ENC_DEFLATE);
+    CHECK(r.body_len == 9 && memcmp(r.body, "raw bytes", 9) == 0);
+}
+
+static void test_errors(void)
+{
+    http_rx_t rx;
+    result_t r;
+
+    static const char *const bad[] = {
+        "garbage\r\n",
+        "\r\n",
+        "SMTP/1.1 200 OK\r\n",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        CHECK(decode(&rx, bad[i], strlen(bad[i]), NULL, 0, false, &r) == ESP_ERR_INVALID_RESPONSE);
+    }
+
+    /* The sink's error stops decoding */
+    static const char wire[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                               "2\r\nab\r\n2\r\ncd\r\n0\r\n\r\n";
+    size_t cuts[] = { 50, 57 };
+    memset(&r, 0, sizeof(r));
+    r.fail_with = ESP_ERR_NO_MEM;
+    r.fail_at = 2;
+    http_rx_init(&rx, false, NULL, on_body, &r);
+    CHECK(http_rx_feed(&rx, wire, cuts[0]) == ESP_OK);
+    CHECK(http_rx_feed(&rx, wire + cuts[0], strlen(wire) - cuts[0]) == ESP_ERR_NO_MEM);
+    CHECK(r.calls == 2 && rx.state != HTTP_RX_DONE);
+
+    /* An overlong header line is cut, not overflowed, and decoding goes on */
+    char longh[1200];
+    int n = snprintf(longh, sizeof(longh), "HTTP/1.1 200 OK\r\nX-Long: ");
+    while (n < 1100) longh[n++] = 'x';
+    n += snprintf(longh + n, sizeof(longh) - n, "\r\nContent-Length: 3\r\n\r\nabc");
+    CHECK(decode(&rx, longh, n, NULL, 0, false, &r) == ESP_OK);
+    CHECK(rx.state == HTTP_RX_DONE && r.body_len == 3);
+    CHECK(strlen(r.headers) == sizeof(rx.line) - 1 + strlen("Content-Length=3;"));
+}
+
+/* What api.telegram.org sends back for a getUpdates with a few messages */
+static size_t telegram_response(char *out, size_t size, bool chunked)
+{
+    static const char head[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx/1.18.0\r\n"
+        "Date: Sat, 18 Oct 2026 09:12:44 GMT\r\n"
+        "Content-Type: application/json\r\n"
+        "Connection: keep-alive\r\n"
+        "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+        "Access-Control-Expose-Headers: Content-Length,Content-Type,Date,Server,Connection\r\n";
+    const size_t body = 2048, chunk = 512;
+    size_t n = snprintf(out, size, "%s%s\r\n\r\n", head,
+                        chunked ? "Transfer-Encoding: chunked" : "Content-Length: 2048");
+    for (size_t off = 0; off < body; off += chunk) {
+        if (chunked) n += snprintf(out + n, size - n, "%zx\r\n", chunk);
+        for (size_t i = 0; i < chunk; i++) out[n++] = "{\"update_id\":1,\"text\":\"hi\"}"[i % 27];
+        if (chunked) n += snprintf(out + n, size - n, "\r\n");
+    }
+    if (chunked) n += snprintf(out + n, size - n, "0\r\n\r\n");
+    return n;
+}
+
+static void bench_decode(void)
+{
+    static char wire[4096];
+    static result_t r;
+    const size_t segment = 1460;
+    const int rounds = 200000;
+    for (int chunked = 0; chunked < 2; chunked++) {
+        size_t len = telegram_response(wire, sizeof(wire), chunked);
+        http_rx_t rx;
+        double t0 = test_now_us();
+        for (int i = 0; i < rounds; i++) {
+            r.body_len = 0;
+            http_rx_init(&rx, false, NULL, on_body, &r);
+            for (size_t off = 0; off < len; off += segment) {
+                http_rx_feed(&rx, wire + off, len - off < segment ? len - off : segment);
+            }
+        }
+        double us = (test_now_us() - t0) / rounds;
+        CHECK(rx.state == HTTP_RX_DONE && r.body_len == 2048);
+        printf("  %-14s %4zu bytes in %zu B reads: %5.2f us\n",
+               chunked ? "chunked" : "content-length", len, segment, us);
+    }
+}
+
+int main(void)
+{
+    test_content_length();
+    test_chunked();
+    test_no_body();
+    test_until_close();
+    test_errors();
+
+    printf("decode, per response:\n");
+    bench_decode();
+
+    return test_done("test_http_rx");
+}
@@ -0,0 +1,630 @@
+/*
+ * http_transport against a local HTTP server: connection reuse, and what
+ * happens when the server drops a kept connection.
+ *
+ * The server runs on a thread on 127.0.0.1 and answers each request as
+ * the test scripts it, writing responses in small pieces with pauses so
+ * the client reads headers, chunk-size lines and bodies across several
+ * reads. The esp_tls stand-in connects over plain TCP, so TLS, session
+ * resumption and the proxy path are not covered here. The ROM inflater
+ * is stood in for by the host's zlib.
+ *
+ * Checked for both the calling-task path (http_transport_request) and the
+ * http_io reactor (http_transport_submit):
+ * - Content-Length and chunked responses arrive whole;
+ * - consecutive requests share one connection;
+ * - a kept connection the server closed while idle is replaced before
+ *   sending; one closed or reset after the request was sent gets the
+ *   request again on a new connection, once;
+ * - a fresh connection that fails, and a timeout, are never resent.
+ * - gzip, zlib-wrapped and raw deflate bodies are inflated with every
+ *   header split across reads; raw streams that start like a zlib header
+ *   are told apart by FCHECK and CINFO; a bad gzip CRC and a cut stream
+ *   fail.
+ *
+ * The benchmark times requests over a kept connection against a new
+ * connection each. Loopback connects in microseconds; on the device a
+ * new connection adds a TLS handshake, so the gap there is far larger.
+ */
+
+#include "net/http_transport.h"
+#include "net/tls_cache.h"
+#include "proxy/http_proxy.h"
+#include "test_util.h"
+#include "esp_http_client.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* ── Stand-ins for the modules the transport calls ─────────────── */
+
+int tls_cache_connect(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls)
+{
+    return esp_tls_conn_new_sync(host, strlen(host), port, cfg, tls);
+}
+
+void tls_cache_begin(const char *host, int port, esp_tls_cfg_t *cfg, tls_cache_attempt_t *a) {}
+void tls_cache_end(const char *host, int port, esp_tls_cfg_t *cfg, esp_tls_t *tls, int ret,
+                   tls_cache_attempt_t *a) {}
+
+bool http_proxy_is_enabled(void) { return false; }
+proxy_conn_t *proxy_conn_open(const char *host, int port, int timeout_ms) { return NULL; }
+bool proxy_conn_reused(const proxy_conn_t *conn) { return false; }
+int proxy_conn_sockfd(const proxy_conn_t *conn) { return -1; }
+int proxy_conn_pending(proxy_conn_t *conn) { return 0; }
+int proxy_conn_write(proxy_conn_t *conn, const char *data, int len) { return -1; }
+int proxy_conn_read(proxy_conn_t *conn, char *buf, int len) { return -1; }
+void proxy_conn_release(proxy_conn_t *conn, bool keep) {}
+
+/* ── Local server ──────────────────────────────────────────────── */
+
+typedef enum {
+    REPLY_KEEP,             /* answered, connection stays open */
+    REPLY_CLOSE,            /* close (after answering, or instead) */
+    REPLY_RESET,            /* close with a RST */
+} reply_t;
+
+/* Answer request number req (from 0, over all connections) on fd */
+typedef reply_t (*reply_fn_t)(int fd, int req);
+
+#define SRV_CONNS   8
+
+static struct {
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    atomic_bool stop;
+    reply_fn_t reply;
+    atomic_int conns;       /* accepted */
+    atomic_int requests;
+} s_srv;
+
+typedef struct {
+    int fd;
+    char buf[2048];
+    size_t len;
+} srv_conn_t;
+
+static void srv_close(srv_conn_t *c, bool reset)
+{
+    if (reset) {
+        struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(c->fd);
+    c->fd = -1;
+}
+
+/* Read what arrived on c and answer each complete request head */
+static void srv_read(srv_conn_t *c)
+{
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+    if (n <= 0) {
+        srv_close(c, false);
+        return;
+    }
+    c->len += n;
+    char *end;
+    while (c->fd >= 0 && (end = memmem(c->buf, c->len, "\r\n\r\n", 4))) {
+        size_t used = end + 4 - c->buf;
+        memmove(c->buf, c->buf + used, c->len - used);
+        c->len -= used;
+        reply_t r = s_srv.reply(c->fd, atomic_fetch_add(&s_srv.requests, 1));
+        if (r != REPLY_KEEP) srv_close(c, r == REPLY_RESET);
+    }
+}
+
+static void *srv_main(void *arg)
+{
+    srv_conn_t conns[SRV_CONNS];
+    for (int i = 0; i < SRV_CONNS; i++) conns[i].fd = -1;
+
+    while (!atomic_load(&s_srv.stop)) {
+        struct pollfd fds[SRV_CONNS + 1] = { { .fd = s_srv.listen_fd, .events = POLLIN } };
+        for (int i = 0; i < SRV_CONNS; i++) fds[i + 1] = (struct pollfd){ conns[i].fd, POLLIN, 0 };
+        if (poll(fds, SRV_CONNS + 1, 10) <= 0) continue;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(s_srv.listen_fd, NULL, NULL);
+            for (int i = 0; i < SRV_CONNS && fd >= 0; i++) {
+                if (conns[i].fd >= 0) continue;
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                conns[i].fd = fd;
+                conns[i].len = 0;
+                atomic_fetch_add(&s_srv.conns, 1);
+                fd = -1;
+            }
+            if (fd >= 0) close(fd);
+        }
+        for (int i = 0; i < SRV_CONNS; i++) {
+            if (conns[i].fd >= 0 && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                srv_read(&conns[i]);
+            }
+        }
+    }
+    for (int i = 0; i < SRV_CONNS; i++) {
+        if (conns[i].fd >= 0) close(conns[i].fd);
+    }
+    return NULL;
+}
+
+/* A new server on a port of its own, so no kept connection carries over */
+static void srv_start(reply_fn_t reply)
+{
+    s_srv.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    CHECK(bind(s_srv.listen_fd, (struct sockaddr *)&addr, len) == 0);
+    CHECK(listen(s_srv.listen_fd, 8) == 0);
+    getsockname(s_srv.listen_fd, (struct sockaddr *)&addr, &len);
+    s_srv.port = ntohs(addr.sin_port);
+    s_srv.reply = reply;
+    atomic_store(&s_srv.stop, false);
+    atomic_store(&s_srv.conns, 0);
+    atomic_store(&s_srv.requests, 0);
+    pthread_create(&s_srv.thread, NULL, srv_main, NULL);
+}
+
+static void srv_stop(void)
+{
+    atomic_store(&s_srv.stop, true);
+    pthread_join(s_srv.thread, NULL);
+    close(s_srv.listen_fd);
+}
+
+/* Write data in pieces of step bytes, pausing so each is read on its own */
+static void send_bytes(int fd, const void *data, size_t len, size_t step)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+        size_t n = len < step ? len : step;
+        send(fd, p, n, MSG_NOSIGNAL);
+        p += n;
+        len -= n;
+        if (len > 0) usleep(1000);
+    }
+}
+
+static void send_slowly(int fd, const char *s, size_t step)
+{
+    send_bytes(fd, s, strlen(s), step);
+}
+
+static const char BODY[] = "{\"ok\":true,\"result\":[]}";
+
+static reply_t reply_length(int fd, int req)
+{
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\n\r\n", strlen(BODY));
+    send_slowly(fd, head, 16);
+    send_slowly(fd, BODY, 7);
+    return REPLY_KEEP;
+}
+
+/* The pieces cut chunk-size lines and their CRLFs */
+static reply_t reply_chunked(int fd, int req)
+{
+    static const char *const pieces[] = {
+        "HTTP/1.1 200 OK\r\nTransfer-", "Encoding: chunked\r\n\r\n0", "b\r", "\n{\"ok\":true,",
+        "\r\n", "c\r\n\"result\":[]}\r\n", "0", "\r\n\r", "\n",
+    };
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        send_slowly(fd, pieces[i], 64);
+        usleep(1000);
+    }
+    return REPLY_KEEP;
+}
+
+/* ── Client side ───────────────────────────────────────────────── */
+
+typedef struct {
+    esp_err_t err;
+    http_result_t res;
+    http_buf_t body;
+    atomic_bool done;       /* submitted request reported */
+} outcome_t;
+
+static http_request_t get_request(outcome_t *out, int timeout_ms)
+{
+    memset(out, 0, sizeof(*out));
+    out->body.max = 4096;
+    return (http_request_t){
+        .method = "GET",
+        .host = "127.0.0.1",
+        .port = s_srv.port,
+        .tls = false,
+        .path = "/bot/getUpdates",
+        .timeout_ms = timeout_ms,
+        .on_body = http_buf_sink,
+        .ctx = &out->body,
+    };
+}
+
+static void get(outcome_t *out, int timeout_ms)
+{
+    http_request_t req = get_request(out, timeout_ms);
+    out->err = http_transport_request(&req, &out->res);
+}
+
+/* Completion of a submitted request, on http_io */
+static void on_done(esp_err_t err, const http_result_t *res, void *ctx)
+{
+    outcome_t *out = (outcome_t *)ctx;
+    out->res = *res;
+    out->err = err;
+    atomic_store(&out->done, true);
+}
+
+/* The same through http_io; the request must outlive the call */
+static void submit(outcome_t *out, int timeout_ms)
+{
+    static http_request_t req;
+    req = get_request(out, timeout_ms);
+    CHECK(http_transport_submit(&req, 0, on_done, out) == ESP_OK);
+    for (int ms = 0; !atomic_load(&out->done) && ms < 5000; ms++) usleep(1000);
+    CHECK(atomic_load(&out->done));
+}
+
+typedef void (*request_fn_t)(outcome_t *out, int timeout_ms);
+
+static bool got_body(const outcome_t *o)
+{
+    return o->err == ESP_OK && o->res.status == 200 && o->body.data &&
+           strcmp(o->body.data, BODY) == 0;
+}
+
+/* ── Tests ─────────────────────────────────────────────────────── */
+
+static void test_keep_alive(request_fn_t request, reply_fn_t reply)
+{
+    srv_start(reply);
+    outcome_t o;
+
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    CHECK(!o.res.reused && o.res.stale == 0);
+    CHECK(o.res.connect_us > 0 && o.res.first_byte_us >= o.res.sent_us);
+    free(o.body.data);
+
+    for (int i = 0; i < 3; i++) {
+        request(&o, 2000);
+        CHECK(got_body(&o));
+        CHECK(o.res.reused && o.res.connect_us == 0);
+        free(o.body.data);
+    }
+    CHECK(atomic_load(&s_srv.conns) == 1);
+    CHECK(atomic_load(&s_srv.requests) == 4);
+    srv_stop();
+}
+
+/* Answers, then closes: the client finds out while the connection is idle */
+static reply_t reply_then_close(int fd, int req)
+{
+    reply_length(fd, req);
+    return REPLY_CLOSE;
+}
+
+static void test_closed_while_idle(request_fn_t request)
+{
+    srv_start(reply_then_close);
+    outcome_t o;
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    free(o.body.data);
+    usleep(20000);
+
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    CHECK(!o.res.reused && o.res.stale == 1 && o.res.connect_us > 0);
+    CHECK(atomic_load(&s_srv.conns) == 2);
+    CHECK(atomic_load(&s_srv.requests) == 2);
+    free(o.body.data);
+    srv_stop();
+}
+
+/* The second request arrives on a connection the server is dropping */
+static reply_t reply_drop_second(int fd, int req)
+{
+    if (req == 1) return REPLY_CLOSE;
+    reply_length(fd, req);
+    return REPLY_KEEP;
+}
+
+static reply_t reply_reset_second(int fd, int req)
+{
+    if (req == 1) return REPLY_RESET;
+    reply_length(fd, req);
+    return REPLY_KEEP;
+}
+
+static void test_resend(request_fn_t request, reply_fn_t reply)
+{
+    srv_start(reply);
+    outcome_t o;
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    free(o.body.data);
+
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    CHECK(o.res.stale == 1 && !o.res.reused);
+    CHECK(atomic_load(&s_srv.conns) == 2);
+    CHECK(atomic_load(&s_srv.requests) == 3);
+    free(o.body.data);
+    srv_stop();
+}
+
+/* Never resent: a new connection that fails, and a server that is slow */
+static reply_t reply_drop_first(int fd, int req)
+{
+    if (req == 0) return REPLY_CLOSE;
+    reply_length(fd, req);
+    return REPLY_KEEP;
+}
+
+static reply_t reply_silent_second(int fd, int req)
+{
+    if (req != 1) reply_length(fd, req);
+    return REPLY_KEEP;
+}
+
+static void test_no_resend(request_fn_t request)
+{
+    srv_start(reply_drop_first);
+    outcome_t o;
+    request(&o, 2000);
+    CHECK(o.err == ESP_ERR_HTTP_FETCH_HEADER);
+    CHECK(!o.res.reused && o.res.stale == 0);
+    CHECK(atomic_load(&s_srv.requests) == 1);
+    free(o.body.data);
+    srv_stop();
+
+    srv_start(reply_silent_second);
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    free(o.body.data);
+    request(&o, 200);
+    CHECK(o.err == ESP_ERR_TIMEOUT);
+    CHECK(o.res.reused && o.res.stale == 0);
+    CHECK(atomic_load(&s_srv.requests) == 2);
+    free(o.body.data);
+    /* A timed-out connection is not kept */
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    CHECK(!o.res.reused);
+    CHECK(atomic_load(&s_srv.conns) == 2);
+    free(o.body.data);
+    srv_stop();
+}
+
+/* Connection: close, a body cut short, and a body ended by the close */
+static reply_t reply_close_header(int fd, int req)
+{
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nConnection: close\r\n"
+             "Content-Length: %zu\r\n\r\n%s", strlen(BODY), BODY);
+    send_slowly(fd, head, 64);
+    return REPLY_KEEP;
+}
+
+static reply_t reply_cut_short(int fd, int req)
+{
+    send_slowly(fd, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n{\"ok\":", 64);
+    return REPLY_CLOSE;
+}
+
+static reply_t reply_until_close(int fd, int req)
+{
+    send_slowly(fd, "HTTP/1.0 200 OK\r\n\r\n", 64);
+    send_slowly(fd, BODY, 5);
+    return REPLY_CLOSE;
+}
+
+static void test_close(request_fn_t request)
+{
+    outcome_t o;
+    srv_start(reply_close_header);
+    for (int i = 0; i < 2; i++) {
+        request(&o, 2000);
+        CHECK(got_body(&o));
+        CHECK(!o.res.reused && o.res.stale == 0);
+        free(o.body.data);
+    }
+    CHECK(atomic_load(&s_srv.conns) == 2);
+    srv_stop();
+
+    srv_start(reply_cut_short);
+    request(&o, 2000);
+    CHECK(o.err == ESP_FAIL);
+    free(o.body.data);
+    srv_stop();
+
+    srv_start(reply_until_close);
+    request(&o, 2000);
+    CHECK(got_body(&o));
+    free(o.body.data);
+    srv_stop();
+}
+
+/* ── Compressed bodies ─────────────────────────────────────────── */
+
+/* 59 bytes: a stored block of this length makes the FLG byte pass FCHECK after 0x88 */
+static const char PLAIN[] = "{\"ok\":true,\"result\":[{\"update_id\":7,\"text\":\"hello there\"}]}";
+
+static struct {
+    const char *encoding;
+    uint8_t data[256];
+    size_t len;
+} s_enc;
+
+/* PLAIN compressed by zlib: window bits 31 for gzip, 15 zlib-wrapped, -15 raw */
+static void encode(const char *encoding, int bits)
+{
+    z_stream z = {0};
+    CHECK(deflateInit2(&z, 9, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    z.next_in = (Bytef *)PLAIN;
+    z.avail_in = strlen(PLAIN);
+    z.next_out = s_enc.data;
+    z.avail_out = sizeof(s_enc.data);
+    CHECK(deflate(&z, Z_FINISH) == Z_STREAM_END);
+    s_enc.encoding = encoding;
+    s_enc.len = z.total_out;
+    deflateEnd(&z);
+}
+
+/*
+ * PLAIN as a raw deflate stream whose first byte is first: a stored block
+ * with the spare header bits set, then an empty final block. With 0x08 or
+ * 0x88 it starts like a zlib header (CM = 8) that is not one.
+ */
+static void encode_stored(uint8_t first)
+{
+    size_t n = strlen(PLAIN), len = 0;
+    s_enc.data[len++] = first;
+    s_enc.data[len++] = n & 0xff;
+    s_enc.data[len++] = n >> 8;
+    s_enc.data[len++] = ~n & 0xff;
+    s_enc.data[len++] = (~n >> 8) & 0xff;
+    memcpy(s_enc.data + len, PLAIN, n);
+    len += n;
+    s_enc.data[len++] = 0x03;
+    s_enc.data[len++] = 0x00;
+    s_enc.encoding = "deflate";
+    s_enc.len = len;
+}
+
+/* Byte by byte, so every header is split across reads */
+static reply_t reply_encoded(int fd, int req)
+{
+    char head[160];
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Encoding: %s\r\n"
+             "Content-Length: %zu\r\n\r\n", s_enc.encoding, s_enc.len);
+    send_slowly(fd, head, 64);
+    send_bytes(fd, s_enc.data, s_enc.len, 1);
+    return REPLY_KEEP;
+}
+
+static void get_encoded(request_fn_t request, outcome_t *o)
+{
+    srv_start(reply_encoded);
+    request(o, 2000);
+    srv_stop();
+}
+
+static void test_encoded(request_fn_t request)
+{
+    static const struct { const char *encoding; int bits; } streams[] = {
+        { "gzip", 31 }, { "deflate", 15 }, { "deflate", -15 },
+    };
+    outcome_t o;
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+        encode(streams[i].encoding, streams[i].bits);
+        get_encoded(request, &o);
+        CHECK(o.err == ESP_OK && o.body.data && strcmp(o.body.data, PLAIN) == 0);
+        free(o.body.data);
+    }
+
+    /* CM = 8 but FCHECK fails, and CINFO > 7 with FCHECK passing: raw */
+    CHECK(((0x08 << 8) | strlen(PLAIN)) % 31 != 0);
+    CHECK(((0x88 << 8) | strlen(PLAIN)) % 31 == 0);
+    static const uint8_t firsts[] = { 0x08, 0x88 };
+    for (size_t i = 0; i < sizeof(firsts); i++) {
+        encode_stored(firsts[i]);
+        get_encoded(request, &o);
+        CHECK(o.err == ESP_OK && o.body.data && strcmp(o.body.data, PLAIN) == 0);
+        free(o.body.data);
+    }
+
+    /* A gzip CRC that does not match, and a stream cut short */
+    encode("gzip", 31);
+    s_enc.data[s_enc.len - 8] ^= 1;
+    get_encoded(request, &o);
+    CHECK(o.err == ESP_ERR_INVALID_CRC);
+    free(o.body.data);
+
+    encode("deflate", 15);
+    s_enc.len -= 6;
+    get_encoded(request, &o);
+    CHECK(o.err == ESP_ERR_INVALID_RESPONSE);
+    free(o.body.data);
+}
+
+static void run(const char *name, request_fn_t request)
+{
+    int before = s_failures;
+    test_keep_alive(request, reply_length);
+    test_keep_alive(request, reply_chunked);
+    test_closed_while_idle(request);
+    test_resend(request, reply_drop_second);
+    test_resend(request, reply_reset_second);
+    test_no_resend(request);
+    test_close(request);
+    test_encoded(request);
+    printf("  %s: %s\n", name, s_failures == before ? "ok" : "FAILED");
+}
+
+/* ── Benchmark ─────────────────────────────────────────────────── */
+
+static reply_t reply_fast(int fd, int req)
+{
+    char resp[160];
+    snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n%s",
+             strlen(BODY), BODY);
+    send(fd, resp, strlen(resp), MSG_NOSIGNAL);
+    return REPLY_KEEP;
+}
+
+static reply_t reply_fast_close(int fd, int req)
+{
+    char resp[160];
+    snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\nConnection: close\r\n"
+             "Content-Length: %zu\r\n\r\n%s", strlen(BODY), BODY);
+    send(fd, resp, strlen(resp), MSG_NOSIGNAL);
+    return REPLY_CLOSE;
+}
+
+static void bench_reuse(void)
+{
+    const int rounds = 2000;
+    reply_fn_t replies[] = { reply_fast, reply_fast_close };
+    const char *names[] = { "kept connection", "new connection" };
+    for (int k = 0; k < 2; k++) {
+        srv_start(replies[k]);
+        outcome_t o;
+        int ok = 0;
+        double t0 = test_now_us();
+        for (int i = 0; i < rounds && ok == i; i++) {
+            get(&o, 2000);
+            ok += got_body(&o);
+            free(o.body.data);
+        }
+        double us = (test_now_us() - t0) / rounds;
+        CHECK(ok == rounds);
+        printf("  %-16s %6.1f us per request, %d connections\n",
+               names[k], us, atomic_load(&s_srv.conns));
+        srv_stop();
+    }
+}
+
+int main(void)
+{
+    CHECK(http_transport_init() == ESP_OK);
+    CHECK(http_transport_start() == ESP_OK);
+
+    printf("against a local server:\n");
+    run("http_transport_request", get);
+    run("http_transport_submit", submit);
+
+    printf("loopback, per request:\n");
+    bench_reuse();
+
+    return test_done("test_http_transport");
+}
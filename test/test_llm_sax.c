@@ -0,0 +1,569 @@
+/*
+ * llm_sax, checked through what llm_chat_json() gets out of a
+ * non-streamed response.
+ *
+ * Recorded Anthropic and OpenAI message bodies are fed split at every
+ * byte offset, byte by byte, in odd slices and whole. The events are
+ * folded into text, tool calls, stop reason and usage the way the
+ * json_on_* handlers in llm_proxy.c do, so a key, number, escape or
+ * surrogate pair cut between two reads is covered, including the
+ * 27-byte "cache_creation_input_tokens". Every truncation must fail
+ * llm_sax_finish(), as must malformed bodies.
+ *
+ * The benchmark parses a 16 KB response as it arrives against buffering
+ * it whole and building a tree, as the cJSON path did. cJSON does not
+ * build on the host, so the tree is made by a minimal stand-in that
+ * allocates a node per value and copies strings out: a lower bound for
+ * cJSON_Parse() in time and memory.
+ */
+
+#include "llm/llm_sax.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+#define MAX_CALLS 4
+
+static const char ANTHROPIC_BODY[] =
+    "{\"id\":\"msg_01XFDUDYJgAACzvnptvVoYEL\",\"type\":\"message\",\"role\":\"assistant\","
+    "\"model\":\"claude-sonnet-4-5\",\"content\":["
+    "{\"type\":\"text\",\"text\":\"Caf\\u00e9 \\ud83d\\ude00 \\\"Paris\\\" \\\\ line\\nnext\\t"
+    "\\u2014 \xe2\x80\x94 tab\\/slash\"},"
+    "{\"type\":\"server_tool_use\",\"id\":\"srvtoolu_1\",\"name\":\"web_fetch\","
+    "\"input\":{\"url\":\"https://example.com\"}},"
+    "{\"type\":\"tool_use\",\"id\":\"toolu_01A09q90qw90lq917835lq9\",\"name\":\"web_search\","
+    "\"input\":{\"query\":\"weather \\\"Paris\\\"\",\"opts\":{\"n\":3,\"tags\":[\"a\",\"}]\"],"
+    "\"fresh\":true,\"since\":null,\"w\":-1.5e-3}}},"
+    "{\"type\":\"tool_use\",\"id\":\"toolu_02\",\"name\":\"get_current_time\",\"input\":{}}"
+    "],\"stop_reason\":\"tool_use\",\"stop_sequence\":null,"
+    "\"usage\":{\"input_tokens\":2095,\"cache_creation_input_tokens\":1834,"
+    "\"cache_read_input_tokens\":12288,\"output_tokens\":503,"
+    "\"server_tool_use\":{\"web_fetch_requests\":1}}}\n";
+
+static const char OPENAI_BODY[] =
+    "{\n  \"id\": \"chatcmpl-B9MHDbslfkBeAs8l4bebGdFOJ6PeG\",\n  \"object\": \"chat.completion\",\n"
+    "  \"created\": 1741570283,\n  \"model\": \"gpt-4o-2024-08-06\",\n  \"choices\": [\n    {\n"
+    "      \"index\": 0,\n      \"message\": {\n        \"role\": \"assistant\",\n"
+    "        \"content\": \"Checking the news \\u2014 and the time.\",\n"
+    "        \"tool_calls\": [\n"
+    "          {\"id\": \"call_a\", \"type\": \"function\", \"function\": {\"name\": \"web_search\", "
+    "\"arguments\": \"{\\\"query\\\":\\\"news\\\"}\"}},\n"
+    "          {\"id\": \"call_b\", \"type\": \"function\", \"function\": {\"name\": \"get_current_time\", "
+    "\"arguments\": \"{}\"}}\n        ],\n        \"refusal\": null\n      },\n"
+    "      \"logprobs\": null,\n      \"finish_reason\": \"tool_calls\"\n    }\n  ],\n"
+    "  \"usage\": {\n    \"prompt_tokens\": 1117,\n    \"completion_tokens\": 46,\n"
+    "    \"total_tokens\": 1163,\n    \"prompt_tokens_details\": {\"cached_tokens\": 1024, "
+    "\"audio_tokens\": 0}\n  }\n}\n";
+
+typedef struct {
+    char id[64];
+    char name[32];
+    char input[256];
+} call_t;
+
+typedef struct {
+    bool openai;
+    char text[256];
+    call_t calls[MAX_CALLS];
+    int call_count;
+    int open_call;              /* -1 if none */
+    char block_type[24];
+    char stop[24];
+    int input_tokens, cache_read, cache_write, output_tokens;
+    int prompt_tokens;
+    bool empty_part;            /* an empty string part before the last */
+} result_t;
+
+static void append(char *dst, size_t size, const char *data, size_t len)
+{
+    size_t n = strlen(dst);
+    if (len > size - 1 - n) len = size - 1 - n;
+    memcpy(dst + n, data, len);
+    dst[n + len] = '\0';
+}
+
+static call_t *open_call(result_t *r)
+{
+    if (r->open_call < 0 && r->call_count < MAX_CALLS) r->open_call = r->call_count++;
+    return r->open_call >= 0 ? &r->calls[r->open_call] : NULL;
+}
+
+static void on_start(llm_sax_t *p, bool is_array, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (is_array) return;
+    if (r->openai) {
+        if (llm_sax_path_is(p, "choices.0.message.tool_calls.*")) open_call(r);
+    } else if (llm_sax_path_is(p, "content.*")) {
+        r->block_type[0] = '\0';
+    } else if (llm_sax_path_is(p, "content.*.input")) {
+        if (open_call(r)) llm_sax_capture(p);
+    }
+}
+
+static void on_end(llm_sax_t *p, bool is_array, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (is_array || r->open_call < 0) return;
+    if (r->openai) {
+        if (llm_sax_path_is(p, "choices.0.message.tool_calls.*")) r->open_call = -1;
+    } else if (llm_sax_path_is(p, "content.*")) {
+        /* Only tool_use blocks become calls */
+        if (strcmp(r->block_type, "tool_use") != 0) {
+            memset(&r->calls[r->open_call], 0, sizeof(call_t));
+            r->call_count--;
+        }
+        r->open_call = -1;
+    }
+}
+
+static void on_string(llm_sax_t *p, const char *data, size_t len, bool done, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    call_t *c;
+    if (!done && len == 0) r->empty_part = true;
+
+    if (r->openai) {
+        if (llm_sax_path_is(p, "choices.0.message.content")) {
+            append(r->text, sizeof(r->text), data, len);
+        } else if (llm_sax_path_is(p, "choices.0.finish_reason")) {
+            append(r->stop, sizeof(r->stop), data, len);
+        } else if (r->open_call >= 0) {
+            c = &r->calls[r->open_call];
+            if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.id")) {
+                append(c->id, sizeof(c->id), data, len);
+            } else if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.function.name")) {
+                append(c->name, sizeof(c->name), data, len);
+            } else if (llm_sax_path_is(p, "choices.0.message.tool_calls.*.function.arguments")) {
+                append(c->input, sizeof(c->input), data, len);
+            }
+        }
+        return;
+    }
+
+    if (llm_sax_path_is(p, "content.*.text")) {
+        append(r->text, sizeof(r->text), data, len);
+    } else if (llm_sax_path_is(p, "content.*.type")) {
+        append(r->block_type, sizeof(r->block_type), data, len);
+    } else if (llm_sax_path_is(p, "content.*.id")) {
+        if ((c = open_call(r))) append(c->id, sizeof(c->id), data, len);
+    } else if (llm_sax_path_is(p, "content.*.name")) {
+        if ((c = open_call(r))) append(c->name, sizeof(c->name), data, len);
+    } else if (llm_sax_path_is(p, "stop_reason")) {
+        append(r->stop, sizeof(r->stop), data, len);
+    }
+}
+
+static void on_scalar(llm_sax_t *p, const char *tok, size_t len, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (r->openai) {
+        if (llm_sax_path_is(p, "usage.prompt_tokens")) {
+            r->prompt_tokens = atoi(tok);
+        } else if (llm_sax_path_is(p, "usage.completion_tokens")) {
+            r->output_tokens = atoi(tok);
+        } else if (llm_sax_path_is(p, "usage.prompt_tokens_details.cached_tokens")) {
+            r->cache_read = atoi(tok);
+        }
+        return;
+    }
+    if (llm_sax_path_is(p, "usage.input_tokens")) {
+        r->input_tokens = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.cache_read_input_tokens")) {
+        r->cache_read = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.cache_creation_input_tokens")) {
+        r->cache_write = atoi(tok);
+    } else if (llm_sax_path_is(p, "usage.output_tokens")) {
+        r->output_tokens = atoi(tok);
+    }
+}
+
+static void on_raw(llm_sax_t *p, const char *data, size_t len, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (r->open_call >= 0) {
+        call_t *c = &r->calls[r->open_call];
+        append(c->input, sizeof(c->input), data, len);
+    }
+}
+
+static const llm_sax_handler_t HANDLER = {
+    .on_start = on_start,
+    .on_end = on_end,
+    .on_string = on_string,
+    .on_scalar = on_scalar,
+    .on_raw = on_raw,
+};
+
+/*
+ * Feed the body in step-byte slices, or (step 0) in three parts cut at
+ * split and split2. Returns the result of llm_sax_finish().
+ */
+static esp_err_t feed(const char *body, size_t len, bool openai,
+                      size_t split, size_t split2, size_t step, result_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->openai = openai;
+    r->open_call = -1;
+
+    llm_sax_t sax;
+    llm_sax_init(&sax, &HANDLER, r);
+    esp_err_t err = ESP_OK;
+    if (step) {
+        for (size_t off = 0; off < len && err == ESP_OK; off += step) {
+            err = llm_sax_feed(&sax, body + off, off + step <= len ? step : len - off);
+        }
+    } else {
+        err = llm_sax_feed(&sax, body, split);
+        if (err == ESP_OK) err = llm_sax_feed(&sax, body + split, split2 - split);
+        if (err == ESP_OK) err = llm_sax_feed(&sax, body + split2, len - split2);
+    }
+    if (err == ESP_OK) err = llm_sax_finish(&sax);
+    CHECK(err != ESP_OK || sax.bytes == len);
+    return err;
+}
+
+static bool anthropic_ok(const result_t *r)
+{
+    return strcmp(r->text, "Caf\xc3\xa9 \xf0\x9f\x98\x80 \"Paris\" \\ line\nnext\t"
+                           "\xe2\x80\x94 \xe2\x80\x94 tab/slash") == 0 &&
+           r->call_count == 2 && r->open_call == -1 &&
+           strcmp(r->calls[0].id, "toolu_01A09q90qw90lq917835lq9") == 0 &&
+           strcmp(r->calls[0].name, "web_search") == 0 &&
+           strcmp(r->calls[0].input, "{\"query\":\"weather \\\"Paris\\\"\",\"opts\":{\"n\":3,"
+                                     "\"tags\":[\"a\",\"}]\"],\"fresh\":true,\"since\":null,"
+                                     "\"w\":-1.5e-3}}") == 0 &&
+           strcmp(r->calls[1].id, "toolu_02") == 0 &&
+           strcmp(r->calls[1].name, "get_current_time") == 0 &&
+           strcmp(r->calls[1].input, "{}") == 0 &&
+           strcmp(r->stop, "tool_use") == 0 &&
+           r->input_tokens == 2095 && r->cache_write == 1834 &&
+           r->cache_read == 12288 && r->output_tokens == 503 && !r->empty_part;
+}
+
+static bool openai_ok(const result_t *r)
+{
+    return strcmp(r->text, "Checking the news \xe2\x80\x94 and the time.") == 0 &&
+           r->call_count == 2 && r->open_call == -1 &&
+           strcmp(r->calls[0].id, "call_a") == 0 &&
+           strcmp(r->calls[0].name, "web_search") == 0 &&
+           strcmp(r->calls[0].input, "{\"query\":\"news\"}") == 0 &&
+           strcmp(r->calls[1].id, "call_b") == 0 &&
+           strcmp(r->calls[1].name, "get_current_time") == 0 &&
+           strcmp(r->calls[1].input, "{}") == 0 &&
+           strcmp(r->stop, "tool_calls") == 0 &&
+           r->prompt_tokens == 1117 && r->cache_read == 1024 && r->output_tokens == 46 &&
+           !r->empty_part;
+}
+
+/* Every split point, every pair of split points 1..9 bytes apart, slices, whole */
+static void test_provider(const char *name, const char *body, bool openai,
+                          bool (*ok)(const result_t *))
+{
+    static result_t r;
+    size_t len = strlen(body);
+    int bad = 0;
+
+    for (size_t split = 0; split <= len; split++) {
+        for (size_t gap = 0; gap < 10 && split + gap <= len; gap++) {
+            if (feed(body, len, openai, split, split + gap, 0, &r) != ESP_OK || !ok(&r)) {
+                if (bad++ == 0) {
+                    fprintf(stderr, "%s: split at %zu+%zu fails\n", name, split, gap);
+                }
+            }
+        }
+    }
+    CHECK(bad == 0);
+
+    const size_t steps[] = { 1, 2, 3, 7, 64, 1460 };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        CHECK(feed(body, len, openai, 0, 0, steps[i], &r) == ESP_OK);
+        CHECK(ok(&r));
+    }
+
+    /* A body cut short anywhere is an error, never a partial success */
+    bad = 0;
+    for (size_t cut = 0; cut < len - 1; cut++) {
+        if (feed(body, cut, openai, cut / 2, cut / 2, 0, &r) == ESP_OK) {
+            if (bad++ == 0) fprintf(stderr, "%s: truncated at %zu parses\n", name, cut);
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static esp_err_t parse(const char *json)
+{
+    result_t r;
+    return feed(json, strlen(json), false, 0, 0, 1, &r);
+}
+
+static void test_malformed(void)
+{
+    static const char *bad[] = {
+        "", "   ", "{", "{\"a\"}", "{\"a\":}", "{\"a\" 1}", "{\"a\":1,}", "[1,]", "[1 2]",
+        "{\"a\":1]", "[1}", "{1:2}", "\"open", "\"\\x\"", "\"\\u12g4\"", "tru", "nul",
+        "01x", "1.2.3", "-", "{\"a\":1}}", "{\"a\":1} x", "[true false]",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (parse(bad[i]) == ESP_OK) fprintf(stderr, "accepted: %s\n", bad[i]);
+        CHECK(parse(bad[i]) != ESP_OK);
+    }
+
+    static const char *good[] = {
+        "{}", "[]", "0", "-1.5e+10", "true", " null ", "\"\"", "[[],{},[{}]]",
+        "{\"a\":{\"b\":[1,{\"c\":\"d\"}]}}\r\n",
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        CHECK(parse(good[i]) == ESP_OK);
+    }
+
+    /* Nesting up to the limit, and one past it */
+    char deep[2 * LLM_SAX_MAX_DEPTH + 3];
+    for (int depth = LLM_SAX_MAX_DEPTH; depth <= LLM_SAX_MAX_DEPTH + 1; depth++) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        deep[2 * depth] = '\0';
+        CHECK((parse(deep) == ESP_OK) == (depth <= LLM_SAX_MAX_DEPTH));
+    }
+}
+
+/* A key too long for a frame matches "*" only, not a truncated name */
+static void test_long_key(void)
+{
+    const char *body = "{\"usage\":{\"cache_creation_input_tokens_by_ttl_and_model\":7,"
+                       "\"cache_creation_input_tokens\":9}}";
+    result_t r;
+    CHECK(feed(body, strlen(body), false, 0, 0, 5, &r) == ESP_OK);
+    CHECK(r.cache_write == 9);
+}
+
+/* A long string arrives in chunks, done only on the last */
+typedef struct {
+    char text[2048];
+    int parts;
+    int done_parts;
+} str_parts_t;
+
+static void on_string_parts(llm_sax_t *p, const char *data, size_t len, bool done, void *ctx)
+{
+    str_parts_t *s = (str_parts_t *)ctx;
+    CHECK(len <= LLM_SAX_CHUNK);
+    append(s->text, sizeof(s->text), data, len);
+    s->parts++;
+    if (done) s->done_parts++;
+}
+
+static void test_chunks(void)
+{
+    static const llm_sax_handler_t h = { .on_string = on_string_parts };
+    char body[1100];
+    char want[1100];
+    body[0] = '"';
+    for (int i = 0; i < 1000; i++) body[1 + i] = want[i] = (char)('a' + i % 26);
+    want[1000] = '\0';
+    strcpy(body + 1001, "\"");
+
+    for (size_t step = 1; step <= 300; step += 37) {
+        str_parts_t s = {0};
+        llm_sax_t sax;
+        llm_sax_init(&sax, &h, &s);
+        for (size_t off = 0; off < strlen(body); off += step) {
+            size_t n = strlen(body) - off < step ? strlen(body) - off : step;
+            CHECK(llm_sax_feed(&sax, body + off, n) == ESP_OK);
+        }
+        CHECK(llm_sax_finish(&sax) == ESP_OK);
+        CHECK_STR(s.text, want);
+        CHECK(s.done_parts == 1);
+        CHECK(s.parts >= 1000 / LLM_SAX_CHUNK);
+    }
+}
+
+/* ── Benchmark ─────────────────────────────────────────────────── */
+
+/* Stand-in for cJSON_Parse(): a node per value, every string copied out */
+typedef struct node {
+    struct node *next, *child;
+    char *key;
+    char *str;
+    double num;
+} node_t;
+
+static size_t s_tree_bytes;
+
+static void *tree_alloc(size_t n)
+{
+    s_tree_bytes += n;
+    return malloc(n);
+}
+
+static const char *skip_ws(const char *s)
+{
+    while (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t') s++;
+    return s;
+}
+
+static const char *parse_str(const char *s, char **out)
+{
+    const char *end = ++s;
+    size_t n = 0;
+    while (*end && *end != '"') {
+        if (*end == '\\') end++;
+        end++;
+        n++;
+    }
+    char *o = tree_alloc(n + 1);
+    *out = o;
+    while (*s && *s != '"') {
+        if (*s != '\\') {
+            *o++ = *s++;
+            continue;
+        }
+        s++;
+        switch (*s) {
+        case 'n': *o++ = '\n'; break;
+        case 't': *o++ = '\t'; break;
+        case 'u': *o++ = '?'; s += 4; break;
+        default:  *o++ = *s; break;
+        }
+        s++;
+    }
+    *o = '\0';
+    return *s == '"' ? s + 1 : NULL;
+}
+
+static const char *parse_node(const char *s, node_t **out)
+{
+    node_t *n = tree_alloc(sizeof(node_t));
+    memset(n, 0, sizeof(*n));
+    *out = n;
+    s = skip_ws(s);
+    if (*s == '{' || *s == '[') {
+        char close = *s == '{' ? '}' : ']';
+        node_t **tail = &n->child;
+        s = skip_ws(s + 1);
+        while (s && *s != close) {
+            char *key = NULL;
+            if (close == '}') {
+                s = parse_str(s, &key);
+                if (!s || *(s = skip_ws(s)) != ':') return NULL;
+                s++;
+            }
+            s = parse_node(s, tail);
+            if (!s) return NULL;
+            (*tail)->key = key;
+            tail = &(*tail)->next;
+            s = skip_ws(s);
+            if (*s == ',') s = skip_ws(s + 1);
+        }
+        return s ? s + 1 : NULL;
+    }
+    if (*s == '"') return parse_str(s, &n->str);
+    char *end;
+    n->num = strtod(s, &end);
+    if (end == s) {
+        while (*end >= 'a' && *end <= 'z') end++;
+    }
+    return end;
+}
+
+static void tree_free(node_t *n)
+{
+    while (n) {
+        node_t *next = n->next;
+        tree_free(n->child);
+        free(n->key);
+        free(n->str);
+        free(n);
+        n = next;
+    }
+}
+
+static char *bench_body(size_t *len)
+{
+    size_t cap = 24 * 1024;
+    char *b = malloc(cap);
+    size_t n = snprintf(b, cap, "{\"id\":\"msg_01\",\"type\":\"message\",\"role\":\"assistant\","
+                                "\"content\":[{\"type\":\"text\",\"text\":\"");
+    while (n < 12 * 1024) {
+        n += snprintf(b + n, cap - n, "Here is step %zu of the plan: check the \\\"config\\\" "
+                                      "file, then restart.\\n", n);
+    }
+    n += snprintf(b + n, cap - n, "\"},{\"type\":\"tool_use\",\"id\":\"toolu_01\","
+                                  "\"name\":\"write_file\",\"input\":{\"path\":\"/spiffs/n.md\","
+                                  "\"content\":\"");
+    while (n < 16 * 1024) {
+        n += snprintf(b + n, cap - n, "- item %zu\\n", n);
+    }
+    n += snprintf(b + n, cap - n, "\"}}],\"stop_reason\":\"tool_use\",\"usage\":{"
+                                  "\"input_tokens\":5120,\"cache_creation_input_tokens\":0,"
+                                  "\"cache_read_input_tokens\":4096,\"output_tokens\":3900}}");
+    *len = n;
+    return b;
+}
+
+static void bench_parse(void)
+{
+    size_t len;
+    char *body = bench_body(&len);
+    const size_t slice = 1460;       /* one TCP segment per read */
+    const int rounds = 500;
+    result_t *r = malloc(sizeof(*r));
+
+    double t0 = test_now_us();
+    for (int i = 0; i < rounds; i++) {
+        memset(r, 0, sizeof(*r));
+        r->open_call = -1;
+        llm_sax_t sax;
+        llm_sax_init(&sax, &HANDLER, r);
+        for (size_t off = 0; off < len; off += slice) {
+            llm_sax_feed(&sax, body + off, off + slice <= len ? slice : len - off);
+        }
+        CHECK(llm_sax_finish(&sax) == ESP_OK);
+    }
+    double t1 = test_now_us();
+    CHECK(r->output_tokens == 3900 && r->call_count == 1);
+
+    size_t peak = 0;
+    for (int i = 0; i < rounds; i++) {
+        /* Grow a buffer read by read, then parse it whole */
+        size_t cap = 2048, used = 0;
+        char *buf = malloc(cap);
+        for (size_t off = 0; off < len; off += slice) {
+            size_t n = off + slice <= len ? slice : len - off;
+            if (used + n + 1 > cap) {
+                while (used + n + 1 > cap) cap *= 2;
+                buf = realloc(buf, cap);
+            }
+            memcpy(buf + used, body + off, n);
+            used += n;
+        }
+        buf[used] = '\0';
+        s_tree_bytes = 0;
+        node_t *root = NULL;
+        CHECK(parse_node(buf, &root) != NULL);
+        if (cap + s_tree_bytes > peak) peak = cap + s_tree_bytes;
+        tree_free(root);
+        free(buf);
+    }
+    double t2 = test_now_us();
+
+    printf("  %zu byte response in %zu byte reads: incremental %6.1f us, %zu bytes state; "
+           "buffered + tree %6.1f us, %zu bytes peak\n",
+           len, slice, (t1 - t0) / rounds, sizeof(llm_sax_t), (t2 - t1) / rounds, peak);
+    free(r);
+    free(body);
+}
+
+int main(void)
+{
+    test_provider("anthropic", ANTHROPIC_BODY, false, anthropic_ok);
+    test_provider("openai", OPENAI_BODY, true, openai_ok);
+    test_malformed();
+    test_long_key();
+    test_chunks();
+
+    printf("non-streamed response parse:\n");
+    bench_parse();
+
+    return test_done("test_llm_sax");
+}
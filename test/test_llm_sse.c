@@ -0,0 +1,435 @@
+/*
+ * llm_sse framing, checked through what the agent gets out of a stream.
+ *
+ * Recorded Anthropic and OpenAI streams are fed split at every byte
+ * offset, byte by byte, and whole. The data of each event is decoded with
+ * llm_sax (the cJSON handlers in llm_proxy.c do not build on the host) and
+ * folded into text, tool calls and the stop reason the way
+ * stream_event_anthropic() and stream_event_openai() do.
+ */
+
+#include "llm/llm_sse.h"
+#include "llm/llm_sax.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+#define MAX_CALLS 4
+
+static const char ANTHROPIC_STREAM[] =
+    "event: message_start\n"
+    "data: {\"type\":\"message_start\",\"message\":{\"id\":\"msg_01\",\"type\":\"message\","
+    "\"role\":\"assistant\",\"content\":[],\"usage\":{\"input_tokens\":25,\"output_tokens\":1}}}\n"
+    "\n"
+    "event: content_block_start\n"
+    "data: {\"type\":\"content_block_start\",\"index\":0,\"content_block\":{\"type\":\"text\",\"text\":\"\"}}\n"
+    "\n"
+    "event: ping\n"
+    "data: {\"type\": \"ping\"}\n"
+    "\n"
+    "event: content_block_delta\n"
+    "data: {\"type\":\"content_block_delta\",\"index\":0,\"delta\":{\"type\":\"text_delta\",\"text\":\"Let me check \"}}\n"
+    "\n"
+    "event: content_block_delta\n"
+    "data: {\"type\":\"content_block_delta\",\"index\":0,\"delta\":{\"type\":\"text_delta\","
+    "\"text\":\"the weather \\u2014 \\\"Paris\\\".\"}}\n"
+    "\n"
+    "event: content_block_stop\n"
+    "data: {\"type\":\"content_block_stop\",\"index\":0}\n"
+    "\n"
+    "event: content_block_start\n"
+    "data: {\"type\":\"content_block_start\",\"index\":1,\"content_block\":{\"type\":\"tool_use\","
+    "\"id\":\"toolu_01\",\"name\":\"web_search\",\"input\":{}}}\n"
+    "\n"
+    "event: content_block_delta\n"
+    "data: {\"type\":\"content_block_delta\",\"index\":1,\"delta\":{\"type\":\"input_json_delta\",\"partial_json\":\"\"}}\n"
+    "\n"
+    "event: content_block_delta\n"
+    "data: {\"type\":\"content_block_delta\",\"index\":1,\"delta\":{\"type\":\"input_json_delta\","
+    "\"partial_json\":\"{\\\"query\\\": \\\"wea\"}}\n"
+    "\n"
+    "event: content_block_delta\n"
+    "data: {\"type\":\"content_block_delta\",\"index\":1,\"delta\":{\"type\":\"input_json_delta\","
+    "\"partial_json\":\"ther Paris\\\"}\"}}\n"
+    "\n"
+    "event: content_block_stop\n"
+    "data: {\"type\":\"content_block_stop\",\"index\":1}\n"
+    "\n"
+    "event: content_block_start\n"
+    "data: {\"type\":\"content_block_start\",\"index\":2,\"content_block\":{\"type\":\"tool_use\","
+    "\"id\":\"toolu_02\",\"name\":\"get_time\",\"input\":{}}}\n"
+    "\n"
+    "event: content_block_stop\n"
+    "data: {\"type\":\"content_block_stop\",\"index\":2}\n"
+    "\n"
+    "event: message_delta\n"
+    "data: {\"type\":\"message_delta\",\"delta\":{\"stop_reason\":\"tool_use\",\"stop_sequence\":null},"
+    "\"usage\":{\"output_tokens\":89}}\n"
+    "\n"
+    "event: message_stop\n"
+    "data: {\"type\":\"message_stop\"}\n"
+    "\n";
+
+static const char OPENAI_STREAM[] =
+    "data: {\"id\":\"chatcmpl-1\",\"object\":\"chat.completion.chunk\",\"choices\":[{\"index\":0,"
+    "\"delta\":{\"role\":\"assistant\",\"content\":\"\"},\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"Checking \"},\"finish_reason\":null}]}\n"
+    "\n"
+    ": keep-alive\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"the news.\"},\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":0,\"id\":\"call_a\","
+    "\"type\":\"function\",\"function\":{\"name\":\"web_search\",\"arguments\":\"\"}}]},"
+    "\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":0,"
+    "\"function\":{\"arguments\":\"{\\\"query\\\":\"}}]},\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":0,"
+    "\"function\":{\"arguments\":\"\\\"news\\\"}\"}}]},\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":1,\"id\":\"call_b\","
+    "\"type\":\"function\",\"function\":{\"name\":\"get_time\",\"arguments\":\"{}\"}}]},"
+    "\"finish_reason\":null}]}\n"
+    "\n"
+    "data: {\"choices\":[{\"index\":0,\"delta\":{},\"finish_reason\":\"tool_calls\"}]}\n"
+    "\n"
+    "data: {\"choices\":[],\"usage\":{\"prompt_tokens\":10,\"completion_tokens\":5}}\n"
+    "\n"
+    "data: [DONE]\n"
+    "\n";
+
+typedef struct {
+    char id[64];
+    char name[32];
+    char input[256];
+} call_t;
+
+typedef struct {
+    bool openai;
+    int events;
+    bool event_mismatch;        /* Anthropic: "event:" differs from the data's type */
+    char text[512];
+    call_t calls[MAX_CALLS];
+    int call_count;
+    int open_call;              /* -1 if none */
+    int oa_index;               /* OpenAI tool_calls[].index of open_call */
+    bool tool_use;
+    bool finished;
+    bool bad_json;
+
+    /* Fields of the event being decoded */
+    char type[32];
+    char block_type[32];
+    char id[64];
+    char name[32];
+    char stop[32];
+    int tc_index;
+    bool tc_seen;
+} result_t;
+
+static void append(char *dst, size_t size, const char *data, size_t len)
+{
+    size_t n = strlen(dst);
+    if (len > size - 1 - n) len = size - 1 - n;
+    memcpy(dst + n, data, len);
+    dst[n + len] = '\0';
+}
+
+static void open_call(result_t *r, const char *id, const char *name)
+{
+    r->open_call = -1;
+    if (r->call_count >= MAX_CALLS) return;
+    call_t *c = &r->calls[r->call_count];
+    snprintf(c->id, sizeof(c->id), "%s", id);
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    r->open_call = r->call_count++;
+}
+
+static void close_call(result_t *r)
+{
+    if (r->open_call < 0) return;
+    call_t *c = &r->calls[r->open_call];
+    /* Tools without arguments stream no input deltas at all */
+    if (!c->input[0]) strcpy(c->input, "{}");
+    r->open_call = -1;
+}
+
+static void input(result_t *r, const char *data, size_t len)
+{
+    if (r->open_call < 0) return;
+    call_t *c = &r->calls[r->open_call];
+    append(c->input, sizeof(c->input), data, len);
+}
+
+/* OpenAI: a new tool_calls[].index starts a new call */
+static void oa_sync(result_t *r)
+{
+    if (r->tc_index == r->oa_index) return;
+    close_call(r);
+    r->oa_index = r->tc_index;
+    open_call(r, r->id, r->name);
+}
+
+static void on_string(llm_sax_t *p, const char *data, size_t len, bool done, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (!r->openai) {
+        if (llm_sax_path_is(p, "type")) {
+            append(r->type, sizeof(r->type), data, len);
+        } else if (llm_sax_path_is(p, "delta.text")) {
+            append(r->text, sizeof(r->text), data, len);
+        } else if (llm_sax_path_is(p, "delta.partial_json")) {
+            input(r, data, len);
+        } else if (llm_sax_path_is(p, "content_block.type")) {
+            append(r->block_type, sizeof(r->block_type), data, len);
+        } else if (llm_sax_path_is(p, "content_block.id")) {
+            append(r->id, sizeof(r->id), data, len);
+        } else if (llm_sax_path_is(p, "content_block.name")) {
+            append(r->name, sizeof(r->name), data, len);
+        } else if (llm_sax_path_is(p, "delta.stop_reason")) {
+            append(r->stop, sizeof(r->stop), data, len);
+        }
+        return;
+    }
+    if (llm_sax_path_is(p, "choices.0.delta.content")) {
+        append(r->text, sizeof(r->text), data, len);
+    } else if (llm_sax_path_is(p, "choices.0.delta.tool_calls.*.id")) {
+        append(r->id, sizeof(r->id), data, len);
+    } else if (llm_sax_path_is(p, "choices.0.delta.tool_calls.*.function.name")) {
+        append(r->name, sizeof(r->name), data, len);
+    } else if (llm_sax_path_is(p, "choices.0.delta.tool_calls.*.function.arguments")) {
+        oa_sync(r);
+        input(r, data, len);
+    } else if (llm_sax_path_is(p, "choices.0.finish_reason")) {
+        append(r->stop, sizeof(r->stop), data, len);
+    }
+}
+
+static void on_scalar(llm_sax_t *p, const char *tok, size_t len, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    if (r->openai && llm_sax_path_is(p, "choices.0.delta.tool_calls.*.index")) {
+        r->tc_index = atoi(tok);
+        r->tc_seen = true;
+    }
+}
+
+static const llm_sax_handler_t HANDLER = {
+    .on_string = on_string,
+    .on_scalar = on_scalar,
+};
+
+static void on_event(const char *event, char *data, size_t len, void *ctx)
+{
+    result_t *r = (result_t *)ctx;
+    r->events++;
+    CHECK(strlen(data) == len);
+
+    if (strcmp(data, "[DONE]") == 0) {
+        r->finished = true;
+        return;
+    }
+
+    r->type[0] = r->block_type[0] = r->id[0] = r->name[0] = r->stop[0] = '\0';
+    r->tc_seen = false;
+    llm_sax_t sax;
+    llm_sax_init(&sax, &HANDLER, r);
+    if (llm_sax_feed(&sax, data, len) != ESP_OK || llm_sax_finish(&sax) != ESP_OK) {
+        r->bad_json = true;
+        return;
+    }
+
+    if (r->openai) {
+        if (r->tc_seen) oa_sync(r);
+        if (r->stop[0]) {
+            close_call(r);
+            r->tool_use = strcmp(r->stop, "tool_calls") == 0 || r->call_count > 0;
+            r->finished = true;
+        }
+        return;
+    }
+
+    if (strcmp(event, r->type) != 0) r->event_mismatch = true;
+    if (strcmp(r->type, "content_block_start") == 0 && strcmp(r->block_type, "tool_use") == 0) {
+        open_call(r, r->id, r->name);
+    } else if (strcmp(r->type, "content_block_stop") == 0) {
+        close_call(r);
+    } else if (r->stop[0]) {
+        r->tool_use = strcmp(r->stop, "tool_use") == 0;
+    } else if (strcmp(r->type, "message_stop") == 0) {
+        r->finished = true;
+    }
+}
+
+/* Feed the stream in step-byte slices, or (step 0) in two parts at split */
+static int feed(const char *stream, bool openai, size_t split, size_t step, result_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->openai = openai;
+    r->open_call = -1;
+    r->oa_index = -1;
+
+    llm_sse_t sse;
+    llm_sse_init(&sse, 1024, on_event, r);
+    size_t len = strlen(stream);
+    esp_err_t err = ESP_OK;
+    if (step) {
+        for (size_t off = 0; off < len && err == ESP_OK; off += step) {
+            err = llm_sse_feed(&sse, stream + off, off + step <= len ? step : len - off);
+        }
+    } else {
+        err = llm_sse_feed(&sse, stream, split);
+        if (err == ESP_OK) err = llm_sse_feed(&sse, stream + split, len - split);
+    }
+    int dropped = sse.dropped;
+    llm_sse_free(&sse);
+    return err == ESP_OK ? dropped : -1;
+}
+
+static bool anthropic_ok(const result_t *r)
+{
+    return r->events == 15 && !r->event_mismatch && !r->bad_json &&
+           strcmp(r->text, "Let me check the weather \xe2\x80\x94 \"Paris\".") == 0 &&
+           r->call_count == 2 &&
+           strcmp(r->calls[0].id, "toolu_01") == 0 &&
+           strcmp(r->calls[0].name, "web_search") == 0 &&
+           strcmp(r->calls[0].input, "{\"query\": \"weather Paris\"}") == 0 &&
+           strcmp(r->calls[1].id, "toolu_02") == 0 &&
+           strcmp(r->calls[1].name, "get_time") == 0 &&
+           strcmp(r->calls[1].input, "{}") == 0 &&
+           r->open_call == -1 && r->tool_use && r->finished;
+}
+
+static bool openai_ok(const result_t *r)
+{
+    return r->events == 10 && !r->bad_json &&
+           strcmp(r->text, "Checking the news.") == 0 &&
+           r->call_count == 2 &&
+           strcmp(r->calls[0].id, "call_a") == 0 &&
+           strcmp(r->calls[0].name, "web_search") == 0 &&
+           strcmp(r->calls[0].input, "{\"query\":\"news\"}") == 0 &&
+           strcmp(r->calls[1].id, "call_b") == 0 &&
+           strcmp(r->calls[1].name, "get_time") == 0 &&
+           strcmp(r->calls[1].input, "{}") == 0 &&
+           r->open_call == -1 && r->tool_use && r->finished;
+}
+
+/* Every split point, byte by byte, odd slices and the whole stream at once */
+static void test_provider(const char *name, const char *stream, bool openai,
+                          bool (*ok)(const result_t *))
+{
+    static result_t r;
+    size_t len = strlen(stream);
+    int bad = 0;
+
+    for (size_t split = 0; split <= len; split++) {
+        if (feed(stream, openai, split, 0, &r) != 0 || !ok(&r)) {
+            if (bad++ == 0) fprintf(stderr, "%s: split at %zu fails\n", name, split);
+        }
+    }
+    CHECK(bad == 0);
+
+    const size_t steps[] = { 1, 2, 3, 7, 64 };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        CHECK(feed(stream, openai, 0, steps[i], &r) == 0);
+        CHECK(ok(&r));
+    }
+}
+
+/* The same stream with CRLF line ends */
+static char *to_crlf(const char *stream)
+{
+    char *out = malloc(strlen(stream) * 2 + 1);
+    char *o = out;
+    for (const char *s = stream; *s; s++) {
+        if (*s == '\n') *o++ = '\r';
+        *o++ = *s;
+    }
+    *o = '\0';
+    return out;
+}
+
+typedef struct {
+    int count;
+    char event[4][32];
+    char data[4][64];
+} raw_events_t;
+
+static void on_raw_event(const char *event, char *data, size_t len, void *ctx)
+{
+    raw_events_t *ev = (raw_events_t *)ctx;
+    if (ev->count < 4) {
+        snprintf(ev->event[ev->count], sizeof(ev->event[0]), "%s", event);
+        snprintf(ev->data[ev->count], sizeof(ev->data[0]), "%s", data);
+    }
+    ev->count++;
+}
+
+static void test_fields(void)
+{
+    raw_events_t ev = {0};
+    llm_sse_t sse;
+    llm_sse_init(&sse, 256, on_raw_event, &ev);
+    const char *s =
+        ": comment\n"
+        "id: 7\n"
+        "retry: 1000\n"
+        "event: multi\n"
+        "data: first\n"
+        "data:second\n"
+        "data\n"
+        "\n"
+        "event: no_data\n"
+        "\n"
+        "data: after\n"
+        "\n";
+    CHECK(llm_sse_feed(&sse, s, strlen(s)) == ESP_OK);
+    CHECK(ev.count == 2);
+    CHECK_STR(ev.event[0], "multi");
+    CHECK_STR(ev.data[0], "first\nsecond\n");
+    /* The event name does not carry over to the next event */
+    CHECK_STR(ev.event[1], "");
+    CHECK_STR(ev.data[1], "after");
+    llm_sse_free(&sse);
+}
+
+static void test_overflow(void)
+{
+    raw_events_t ev = {0};
+    llm_sse_t sse;
+    llm_sse_init(&sse, 32, on_raw_event, &ev);
+
+    char big[128];
+    memset(big, 'x', sizeof(big));
+    /* An oversized line, then an event whose lines fit but whose data does not */
+    CHECK(llm_sse_feed(&sse, "data: ", 6) == ESP_OK);
+    CHECK(llm_sse_feed(&sse, big, sizeof(big)) == ESP_OK);
+    CHECK(llm_sse_feed(&sse, "\n\n", 2) == ESP_OK);
+    const char *s = "data: 0123456789012345\ndata: 0123456789012345\n\ndata: ok\n\n";
+    CHECK(llm_sse_feed(&sse, s, strlen(s)) == ESP_OK);
+
+    CHECK(sse.dropped == 2);
+    CHECK(ev.count == 1);
+    CHECK_STR(ev.data[0], "ok");
+    llm_sse_free(&sse);
+}
+
+int main(void)
+{
+    test_provider("anthropic", ANTHROPIC_STREAM, false, anthropic_ok);
+    test_provider("openai", OPENAI_STREAM, true, openai_ok);
+
+    char *crlf = to_crlf(ANTHROPIC_STREAM);
+    test_provider("anthropic crlf", crlf, false, anthropic_ok);
+    free(crlf);
+    crlf = to_crlf(OPENAI_STREAM);
+    test_provider("openai crlf", crlf, true, openai_ok);
+    free(crlf);
+
+    test_fields();
+    test_overflow();
+    return test_done("test_llm_sse");
+}
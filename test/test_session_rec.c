@@ -0,0 +1,385 @@
+/*
+ * Session file format: the record codec, and the tail index against a
+ * full scan.
+ *
+ * Records must round-trip every varint width, empty and large content,
+ * and bytes JSON would have to escape. A long chat is written the way the
+ * flusher writes it, then its newest messages are loaded both by seeking
+ * to the indexed tail and by scanning every record, as load_from_flash()
+ * did before the index. Both must give the same messages, also with a
+ * stale or missing index and a torn tail. Compaction's fold must leave a
+ * trace of every dropped message within its size, cut on UTF-8 boundaries.
+ *
+ * The benchmarks compare size and decode time with the JSON lines the
+ * records replaced. cJSON does not build on the host, so the JSON side
+ * is decoded by a minimal field scanner: a lower bound for cJSON_Parse().
+ */
+
+#include "memory/session_rec.h"
+#include "mimi_config.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define KEEP    40
+
+static char s_path[64], s_idx[64];
+
+static long fsize(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+static void message(char *buf, size_t size, int i)
+{
+    snprintf(buf, size, "message %d: %.*s", i, 40 + (i * 37) % 200,
+             "The quick brown fox jumps over the lazy dog while the session grows. "
+             "Every turn appends one user and one assistant record to the file. "
+             "Loading history only needs the newest ones, so the index lets it seek. "
+             "A scan has to step over every header in front of them instead.");
+}
+
+/* Append records first..last-1 as one group commit, optionally indexed */
+static void append(int first, int last, bool indexed)
+{
+    FILE *f = fopen(s_path, "ab");
+    fseek(f, 0, SEEK_END);
+    long off = ftell(f);
+    FILE *ix = indexed ? fopen(s_idx, "ab") : NULL;
+    char text[320];
+    for (int i = first; i < last; i++) {
+        message(text, sizeof(text), i);
+        uint32_t off32 = (uint32_t)off;
+        size_t n = session_rec_write(f, i % 2 ? SESSION_ROLE_ASSISTANT : SESSION_ROLE_USER,
+                                     1700000000u + i, text);
+        CHECK(n > 0);
+        if (ix) fwrite(&off32, sizeof(off32), 1, ix);
+        off += n;
+    }
+    fclose(f);
+    if (ix) fclose(ix);
+}
+
+/* Load the newest KEEP messages from offset on; returns the first message number */
+static int load_tail(long offset, int *count)
+{
+    FILE *f = fopen(s_path, "rb");
+    fseek(f, offset, SEEK_SET);
+    static char ring[KEEP][320];
+    int n = 0;
+    int role;
+    uint32_t ts, len;
+    while (session_rec_read_header(f, &role, &ts, &len)) {
+        if (len >= sizeof(ring[0]) || fread(ring[n % KEEP], 1, len, f) != len) break;
+        ring[n % KEEP][len] = '\0';
+        n++;
+    }
+    fclose(f);
+
+    *count = n < KEEP ? n : KEEP;
+    const char *oldest = ring[n < KEEP ? 0 : n % KEEP];
+    return atoi(oldest + strlen("message "));
+}
+
+static void test_codec(void)
+{
+    static const uint32_t stamps[] = { 0, 1, 127, 128, 16383, 16384, 2097151, 2097152,
+                                       268435455, 268435456, 0xFFFFFFFFu };
+    static char big[20000];
+    for (size_t i = 0; i < sizeof(big) - 1; i++) big[i] = (char)('a' + i % 26);
+    const char *contents[] = {
+        "", "x", "quote \" backslash \\ newline \n tab \t", "caf\xC3\xA9 \xE2\x80\x94 \xF0\x9F\x98\x97",
+        "\xA5\x01 looks like a header", big,
+    };
+    const int n_stamps = sizeof(stamps) / sizeof(stamps[0]);
+    const int n_contents = sizeof(contents) / sizeof(contents[0]);
+
+    remove(s_path);
+    FILE *f = fopen(s_path, "wb");
+    long expect = 0;
+    for (int i = 0; i < n_stamps; i++) {
+        for (int j = 0; j < n_contents; j++) {
+            size_t n = session_rec_write(f, (i + j) % SESSION_ROLE_COUNT, stamps[i], contents[j]);
+            CHECK(n > strlen(contents[j]));
+            expect += n;
+        }
+    }
+    fclose(f);
+    CHECK(fsize(s_path) == expect);
+
+    f = fopen(s_path, "rb");
+    static char text[sizeof(big)];
+    for (int i = 0; i < n_stamps; i++) {
+        for (int j = 0; j < n_contents; j++) {
+            int role;
+            uint32_t ts, len;
+            CHECK(session_rec_read_header(f, &role, &ts, &len));
+            CHECK(role == (i + j) % SESSION_ROLE_COUNT);
+            CHECK(ts == stamps[i]);
+            CHECK(len == strlen(contents[j]));
+            CHECK(len < sizeof(text) && fread(text, 1, len, f) == len);
+            text[len] = '\0';
+            CHECK_STR(text, contents[j]);
+        }
+    }
+    int role;
+    uint32_t ts, len;
+    CHECK(!session_rec_read_header(f, &role, &ts, &len));
+    fclose(f);
+
+    /* Bad magic, unknown role, truncated varint */
+    static const struct { const char *bytes; size_t len; } bad[] = {
+        { "\x5A\x00\x00\x00", 4 }, { "\xA5\x04\x00\x00", 4 }, { "\xA5\x00\x80", 3 },
+    };
+    for (int i = 0; i < 3; i++) {
+        f = fopen(s_path, "wb");
+        fwrite(bad[i].bytes, 1, bad[i].len, f);
+        fclose(f);
+        f = fopen(s_path, "rb");
+        CHECK(!session_rec_read_header(f, &role, &ts, &len));
+        fclose(f);
+    }
+
+    CHECK(session_role_code("assistant") == SESSION_ROLE_ASSISTANT);
+    CHECK(session_role_code("summary") == SESSION_ROLE_SUMMARY);
+    CHECK(session_role_code("tool") == -1);
+}
+
+static bool utf8_valid(const char *s)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    while (*p) {
+        int n = *p < 0x80 ? 0 : (*p & 0xE0) == 0xC0 ? 1 : (*p & 0xF0) == 0xE0 ? 2 :
+                (*p & 0xF8) == 0xF0 ? 3 : -1;
+        if (n < 0) return false;
+        p++;
+        for (int i = 0; i < n; i++, p++) {
+            if ((*p & 0xC0) != 0x80) return false;
+        }
+    }
+    return true;
+}
+
+static void test_fold(void)
+{
+    /* A previous summary longer than its half, then a chat at the backstop */
+    static char prev[12001];
+    for (int i = 0; i + 2 < (int)sizeof(prev); i += 3) memcpy(prev + i, "\xE2\x80\x94", 3);
+    const int total = MIMI_SESSION_COMPACT_MSGS + 1;
+    const int dropped = total - KEEP;
+    remove(s_path);
+    FILE *f = fopen(s_path, "wb");
+    session_rec_write(f, SESSION_ROLE_SUMMARY, 1700000000u, prev);
+    fclose(f);
+    append(0, total - 1, false);
+
+    static char out[MIMI_SESSION_FOLD_MAX_BYTES];
+    for (int room = 64; room <= (int)sizeof(out); room *= 2) {
+        out[0] = '\0';
+        f = fopen(s_path, "rb");
+        CHECK(session_rec_fold(f, dropped, out, room));
+        CHECK(strlen(out) < (size_t)room);
+        CHECK(utf8_valid(out));
+
+        /* Left at the first kept record */
+        int role;
+        uint32_t ts, len;
+        char text[320];
+        CHECK(session_rec_read_header(f, &role, &ts, &len));
+        CHECK(len < sizeof(text) && fread(text, 1, len, f) == len);
+        text[len] = '\0';
+        CHECK(atoi(text + strlen("message ")) == dropped - 1);
+        fclose(f);
+    }
+
+    /* At full size the summary keeps its start and every message its number */
+    CHECK(strncmp(out, prev, 300) == 0);
+    char *notes = strstr(out, "\n\nUser: message 0:");
+    CHECK(notes != NULL);
+    for (int i = 0; i < dropped - 1 && notes; i++) {
+        char want[48];
+        snprintf(want, sizeof(want), "%s: message %d:", i % 2 ? "Assistant" : "User", i);
+        notes = strstr(notes, want);
+        CHECK(notes != NULL);
+    }
+
+    /* Folded after existing text; a torn file fails */
+    strcpy(out, "kept ");
+    f = fopen(s_path, "rb");
+    CHECK(session_rec_fold(f, 2, out, sizeof(out)));
+    CHECK(strncmp(out, "kept ", 5) == 0);
+    CHECK(!session_rec_fold(f, total, out, sizeof(out)));
+    fclose(f);
+}
+
+/* First of the newest KEEP of n messages */
+static int newest(int n)
+{
+    return n > KEEP ? n - KEEP : 0;
+}
+
+static void test_tail(int total)
+{
+    remove(s_path);
+    remove(s_idx);
+    append(0, total, true);
+
+    int count;
+    long off = session_index_tail_offset(s_path, s_idx, fsize(s_path), KEEP);
+    CHECK(total > KEEP ? off > 0 : off == 0);
+    CHECK(load_tail(off, &count) == newest(total));
+    CHECK(count == (total < KEEP ? total : KEEP));
+    CHECK(load_tail(0, &count) == newest(total));
+
+    /* Appended without index entries: still after the indexed tail */
+    append(total, total + 3, false);
+    off = session_index_tail_offset(s_path, s_idx, fsize(s_path), KEEP);
+    CHECK(load_tail(off, &count) == newest(total + 3));
+
+    /* Index lost: rebuilt with one scan */
+    remove(s_idx);
+    off = session_index_tail_offset(s_path, s_idx, fsize(s_path), KEEP);
+    CHECK(fsize(s_idx) == (long)((total + 3) * sizeof(uint32_t)));
+    CHECK(load_tail(off, &count) == newest(total + 3));
+
+    /* Torn tail: the partial record is not indexed */
+    FILE *f = fopen(s_path, "ab");
+    fwrite("\xA5\x01\x80\x80", 1, 4, f);
+    fclose(f);
+    CHECK(session_index_rebuild(s_path, s_idx) == total + 3);
+    off = session_index_tail_offset(s_path, s_idx, fsize(s_path), KEEP);
+    CHECK(load_tail(off, &count) == newest(total + 3));
+}
+
+/* A legacy line as the JSON-lines store wrote it */
+static void json_line(FILE *f, const char *role, const char *content, uint32_t ts)
+{
+    fprintf(f, "{\"role\":\"%s\",\"content\":\"", role);
+    for (const unsigned char *c = (const unsigned char *)content; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(f, "\\%c", *c);
+        else if (*c == '\n') fputs("\\n", f);
+        else if (*c < 0x20) fprintf(f, "\\u%04x", *c);
+        else fputc(*c, f);
+    }
+    fprintf(f, "\",\"ts\":%u}\n", (unsigned)ts);
+}
+
+/* Pull "content" out of a line: what any JSON parser has to do at least */
+static size_t json_content(const char *line, char *out)
+{
+    const char *p = strstr(line, "\"content\":\"");
+    if (!p) return 0;
+    size_t n = 0;
+    for (p += 11; *p && *p != '"'; p++) {
+        if (*p == '\\') {
+            p++;
+            if (*p == 'n') out[n++] = '\n';
+            else if (*p == 'u') { out[n++] = (char)strtol(p + 1, NULL, 16); p += 4; }
+            else out[n++] = *p;
+        } else {
+            out[n++] = *p;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* Bytes on flash and decode time of a chat, records against JSON lines */
+static void bench_codec(int total)
+{
+    char json_path[80];
+    snprintf(json_path, sizeof(json_path), "%s.jsonl", s_path);
+    remove(s_path);
+    remove(s_idx);
+    append(0, total, false);
+
+    FILE *f = fopen(json_path, "w");
+    char text[320];
+    for (int i = 0; i < total; i++) {
+        message(text, sizeof(text), i);
+        json_line(f, i % 2 ? "assistant" : "user", text, 1700000000u + i);
+    }
+    fclose(f);
+
+    const int rounds = 200;
+    size_t rec_bytes = 0, json_bytes = 0;
+    double t0 = test_now_us();
+    for (int r = 0; r < rounds; r++) {
+        f = fopen(s_path, "rb");
+        int role;
+        uint32_t ts, len;
+        while (session_rec_read_header(f, &role, &ts, &len) && fread(text, 1, len, f) == len) {
+            text[len] = '\0';
+            rec_bytes += len;
+        }
+        fclose(f);
+    }
+    double t1 = test_now_us();
+    for (int r = 0; r < rounds; r++) {
+        f = fopen(json_path, "r");
+        char *line = NULL;
+        size_t cap = 0;
+        while (getline(&line, &cap, f) > 0) json_bytes += json_content(line, text);
+        free(line);
+        fclose(f);
+    }
+    double t2 = test_now_us();
+    CHECK(rec_bytes == json_bytes);
+
+    printf("  %5d messages: records %7ld bytes, %6.1f us; JSON lines %7ld bytes, %6.1f us\n",
+           total, fsize(s_path), (t1 - t0) / rounds, fsize(json_path), (t2 - t1) / rounds);
+    remove(json_path);
+}
+
+/* History load time for a chat of total records, indexed and scanned */
+static void bench_load(int total)
+{
+    remove(s_path);
+    remove(s_idx);
+    append(0, total, true);
+
+    const int rounds = 200;
+    int count;
+    double t0 = test_now_us();
+    for (int i = 0; i < rounds; i++) {
+        long off = session_index_tail_offset(s_path, s_idx, fsize(s_path), KEEP);
+        CHECK(load_tail(off, &count) == total - KEEP);
+    }
+    double t1 = test_now_us();
+    for (int i = 0; i < rounds; i++) {
+        CHECK(load_tail(0, &count) == total - KEEP);
+    }
+    double t2 = test_now_us();
+
+    printf("  %5d records, %7ld bytes: indexed tail %6.1f us, full scan %7.1f us\n",
+           total, fsize(s_path), (t1 - t0) / rounds, (t2 - t1) / rounds);
+}
+
+int main(void)
+{
+    snprintf(s_path, sizeof(s_path), "/tmp/test_session_rec.%d.bin", (int)getpid());
+    snprintf(s_idx, sizeof(s_idx), "/tmp/test_session_rec.%d.idx", (int)getpid());
+
+    test_codec();
+    test_fold();
+    test_tail(KEEP / 2);
+    test_tail(KEEP);
+    test_tail(500);
+
+    printf("whole chat decode:\n");
+    bench_codec(MIMI_SESSION_COMPACT_MSGS);
+    printf("history load, newest %d messages:\n", KEEP);
+    bench_load(60);
+    bench_load(MIMI_SESSION_COMPACT_MSGS);
+    bench_load(2000);     /* what compaction keeps a file from reaching */
+
+    remove(s_path);
+    remove(s_idx);
+    return test_done("test_session_rec");
+}
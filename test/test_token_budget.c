@@ -0,0 +1,275 @@
+/*
+ * Token estimate and budget, and what the prompt section cache saves.
+ *
+ * token_truncate() must return a prefix that never ends inside a UTF-8
+ * sequence and whose estimate fits, for every budget; the estimate must
+ * count words, punctuation and non-ASCII code points as documented.
+ *
+ * The benchmark builds the file-backed prompt sections the way
+ * context_build_system_prompt() does: cold, by reading every section file
+ * as it did on each turn before the cache, and warm, by copying the cached
+ * text. Both then charge the sections to the budget with the same cuts.
+ * Host files sit in the page cache, so the cold numbers are a lower bound;
+ * SPIFFS reads on the device cost far more.
+ */
+
+#include "agent/token_budget.h"
+#include "mimi_config.h"
+#include "test_util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void test_estimate(void)
+{
+    CHECK(token_estimate("", 0) == 0);
+    CHECK(token_estimate("   \n\t", 5) == 0);
+    CHECK(token_estimate("a", 1) == 1);
+    CHECK(token_estimate("abcd", 4) == 1);
+    CHECK(token_estimate("abcde", 5) == 2);
+    CHECK(token_estimate("hello world", 11) == 4);
+    CHECK(token_estimate("a,b.", 4) == 4);
+    CHECK(token_estimate("{\"k\":1}", 7) == 7);
+    /* One per code point, whatever its width */
+    CHECK(token_estimate("caf\xC3\xA9", 5) == 2);
+    CHECK(token_estimate("\xE4\xBD\xA0\xE5\xA5\xBD", 6) == 2);
+    CHECK(token_estimate("\xF0\x9F\x98\x97", 4) == 1);
+    /* Additive over a space */
+    const char *text = "The quick brown fox, 42 times.";
+    CHECK(token_estimate(text, strlen(text)) ==
+          token_estimate(text, 9) + token_estimate(text + 10, strlen(text) - 10));
+}
+
+static bool cuts_sequence(const char *text, size_t len, size_t cut)
+{
+    return cut < len && ((unsigned char)text[cut] & 0xC0) == 0x80;
+}
+
+static void test_truncate(void)
+{
+    static char text[4096];
+    static const char *pieces[] = {
+        "word ", "longerword ", "x", ", ", ".\n", "caf\xC3\xA9 ", "\xE4\xBD\xA0\xE5\xA5\xBD",
+        "\xF0\x9F\x98\x97", "{\"key\": [1, 2]} ", "\n\n",
+    };
+    size_t len = 0;
+    unsigned seed = 1;
+    while (len < sizeof(text) - 32) {
+        seed = seed * 1103515245u + 12345u;
+        const char *p = pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+        memcpy(text + len, p, strlen(p));
+        len += strlen(p);
+    }
+    text[len] = '\0';
+
+    int total = token_estimate(text, len);
+    CHECK(token_truncate(text, len, 0) == 0);
+    CHECK(token_truncate(text, len, -5) == 0);
+    CHECK(token_truncate(text, len, total) == len);
+    CHECK(token_truncate(text, len, total + 100) == len);
+
+    size_t prev = 0;
+    for (int max = 1; max < total; max++) {
+        size_t cut = token_truncate(text, len, max);
+        CHECK(cut < len);
+        CHECK(!cuts_sequence(text, len, cut));
+        CHECK(token_estimate(text, cut) <= max);
+        /* A clean break may give back some room, never most of it */
+        CHECK(cut >= prev / 2);
+        prev = cut;
+    }
+
+    /* With no space to break at, the cut falls between code points */
+    static const char cjk[] = "\xE4\xBD\xA0\xE5\xA5\xBD\xF0\x9F\x98\x97\xC3\xA9\xE4\xB8\x96"
+                              "\xE7\x95\x8C\xF0\x9F\x98\x97\xC3\xA9";
+    for (int max = 1; max < token_estimate(cjk, sizeof(cjk) - 1); max++) {
+        size_t cut = token_truncate(cjk, sizeof(cjk) - 1, max);
+        CHECK(!cuts_sequence(cjk, sizeof(cjk) - 1, cut));
+        CHECK(token_estimate(cjk, cut) == max);
+    }
+
+    /* Prefers ending at a space */
+    const char *words = "alpha beta gamma delta epsilon";
+    size_t cut = token_truncate(words, strlen(words), 5);
+    CHECK(cut > 0 && (words[cut] == ' ' || words[cut] == '\0'));
+}
+
+static void test_budget(void)
+{
+    token_budget_t b;
+    token_budget_init(&b);
+    CHECK(b.total == MIMI_CONTEXT_TOKEN_BUDGET);
+    CHECK(b.limit[TOKEN_SEC_MEMORY] == MIMI_CONTEXT_TOKEN_BUDGET * MIMI_TOKEN_SHARE_MEMORY / 100);
+    CHECK(b.limit[TOKEN_SEC_HISTORY] == 0);
+    CHECK(token_budget_remaining(&b) == b.total);
+    b.used[TOKEN_SEC_BASE] = 100;
+    b.used[TOKEN_SEC_HISTORY] = 250;
+    CHECK(token_budget_remaining(&b) == b.total - 350);
+    CHECK_STR(token_section_name(TOKEN_SEC_NOTES), "notes");
+    CHECK_STR(token_section_name(TOKEN_SEC_COUNT), "?");
+}
+
+/* ── Prompt sections, cold and warm ────────────────────────────── */
+
+typedef struct {
+    const char *name;
+    token_section_t sec;
+    int files;
+    int file_bytes;
+    size_t cap;
+} section_spec_t;
+
+/* Roughly a device a few weeks in: personality and rules, a grown
+ * MEMORY.md, three daily notes and a handful of skills */
+static const section_spec_t s_specs[] = {
+    { "bootstrap", TOKEN_SEC_BOOTSTRAP, 3, 1500, MIMI_CONTEXT_BOOTSTRAP_MAX },
+    { "skills",    TOKEN_SEC_SKILLS,    8, 200,  MIMI_CONTEXT_SKILLS_MAX },
+    { "memory",    TOKEN_SEC_MEMORY,    1, 3000, MIMI_CONTEXT_MEMORY_MAX },
+    { "notes",     TOKEN_SEC_NOTES,     3, 800,  MIMI_CONTEXT_NOTES_MAX },
+};
+#define N_SECTIONS  (sizeof(s_specs) / sizeof(s_specs[0]))
+
+static char s_dir[64];
+static char *s_cached[N_SECTIONS];
+static size_t s_cached_len[N_SECTIONS];
+
+static void file_path(char *buf, size_t size, int sec, int i)
+{
+    snprintf(buf, size, "%s/%s_%d.md", s_dir, s_specs[sec].name, i);
+}
+
+static void write_files(void)
+{
+    static const char *line = "- The user prefers short answers and metric units; "
+                              "remind them about the weekly backup on Fridays.\n";
+    for (size_t s = 0; s < N_SECTIONS; s++) {
+        for (int i = 0; i < s_specs[s].files; i++) {
+            char path[96];
+            file_path(path, sizeof(path), s, i);
+            FILE *f = fopen(path, "w");
+            for (int n = 0; n < s_specs[s].file_bytes; n += strlen(line)) fputs(line, f);
+            fclose(f);
+        }
+    }
+}
+
+/* What append_file() does for each section file */
+static size_t load_section(int sec, char *buf, size_t size)
+{
+    size_t off = 0;
+    for (int i = 0; i < s_specs[sec].files && off < size - 1; i++) {
+        char path[96];
+        file_path(path, sizeof(path), sec, i);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        off += snprintf(buf + off, size - off, "\n## %s %d\n\n", s_specs[sec].name, i);
+        if (off >= size - 1) {
+            off = size - 1;
+        } else {
+            off += fread(buf + off, 1, size - off - 1, f);
+        }
+        fclose(f);
+    }
+    buf[off] = '\0';
+    return off;
+}
+
+/* What fit_section() does: charge the text, cutting it to the section's room */
+static size_t fit(char *buf, size_t start, size_t end, token_budget_t *b, token_section_t sec)
+{
+    size_t len = end - start;
+    int tokens = token_estimate(buf + start, len);
+    int room = b->limit[sec] - b->used[sec];
+    if (b->limit[sec] > 0 && tokens > room) {
+        len = token_truncate(buf + start, len, room > 0 ? room : 0);
+        tokens = token_estimate(buf + start, len);
+        buf[start + len] = '\0';
+    }
+    b->used[sec] += tokens;
+    return start + len;
+}
+
+static size_t build(char *buf, size_t size, bool warm, token_budget_t *b)
+{
+    token_budget_init(b);
+    size_t off = 0;
+    for (size_t s = 0; s < N_SECTIONS; s++) {
+        size_t start = off;
+        if (warm) {
+            size_t n = s_cached_len[s] < size - 1 - off ? s_cached_len[s] : size - 1 - off;
+            memcpy(buf + off, s_cached[s], n);
+            off += n;
+            buf[off] = '\0';
+        } else {
+            size_t cap = s_specs[s].cap < size - off ? s_specs[s].cap : size - off;
+            off += load_section(s, buf + off, cap);
+        }
+        off = fit(buf, start, off, b, s_specs[s].sec);
+    }
+    return off;
+}
+
+static void bench_prompt(void)
+{
+    snprintf(s_dir, sizeof(s_dir), "/tmp/test_token_budget.%d", (int)getpid());
+    CHECK(mkdir(s_dir, 0700) == 0);
+    write_files();
+
+    for (size_t s = 0; s < N_SECTIONS; s++) {
+        s_cached[s] = malloc(s_specs[s].cap);
+        s_cached_len[s] = load_section(s, s_cached[s], s_specs[s].cap);
+    }
+
+    /* Same prompt either way */
+    static char cold[MIMI_CONTEXT_BUF_SIZE], warm[MIMI_CONTEXT_BUF_SIZE];
+    token_budget_t bc, bw;
+    size_t cold_len = build(cold, sizeof(cold), false, &bc);
+    size_t warm_len = build(warm, sizeof(warm), true, &bw);
+    CHECK(cold_len == warm_len && memcmp(cold, warm, cold_len) == 0);
+    CHECK(memcmp(bc.used, bw.used, sizeof(bc.used)) == 0);
+
+    const int rounds = 2000;
+    double t0 = test_now_us();
+    for (int r = 0; r < rounds; r++) build(cold, sizeof(cold), false, &bc);
+    double t1 = test_now_us();
+    for (int r = 0; r < rounds; r++) build(warm, sizeof(warm), true, &bw);
+    double t2 = test_now_us();
+
+    int files = 0;
+    for (size_t s = 0; s < N_SECTIONS; s++) files += s_specs[s].files;
+    printf("  %zu sections, %d files, %zu bytes, ~%d tokens: "
+           "cold %6.1f us, warm %5.1f us\n",
+           N_SECTIONS, files, warm_len, bw.total - token_budget_remaining(&bw),
+           (t1 - t0) / rounds, (t2 - t1) / rounds);
+
+    /* The estimate alone, per KB of prompt */
+    t0 = test_now_us();
+    volatile int sink = 0;
+    for (int r = 0; r < rounds; r++) sink += token_estimate(warm, warm_len);
+    t1 = test_now_us();
+    printf("  token_estimate: %.2f us per KB\n", (t1 - t0) / rounds / (warm_len / 1024.0));
+
+    for (size_t s = 0; s < N_SECTIONS; s++) free(s_cached[s]);
+    for (size_t s = 0; s < N_SECTIONS; s++) {
+        for (int i = 0; i < s_specs[s].files; i++) {
+            char path[96];
+            file_path(path, sizeof(path), s, i);
+            remove(path);
+        }
+    }
+    rmdir(s_dir);
+}
+
+int main(void)
+{
+    test_estimate();
+    test_truncate();
+    test_budget();
+
+    printf("prompt sections, per build:\n");
+    bench_prompt();
+
+    return test_done("test_token_budget");
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * Minimal checks for the host tests: a failed CHECK prints its location
+ * and the test keeps going; test_done() gives the exit status.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int s_checks;
+static int s_failures;
+
+#define CHECK(cond) do {                                                    \
+        s_checks++;                                                         \
+        if (!(cond)) {                                                      \
+            s_failures++;                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_STR(a, b) do {                                                \
+        const char *a_ = (a), *b_ = (b);                                    \
+        s_checks++;                                                         \
+        if (!a_ || !b_ || strcmp(a_, b_) != 0) {                            \
+            s_failures++;                                                   \
+            fprintf(stderr, "%s:%d: \"%s\" != \"%s\"\n", __FILE__, __LINE__, \
+                    a_ ? a_ : "(null)", b_ ? b_ : "(null)");                \
+        }                                                                   \
+    } while (0)
+
+/* Print the summary; the exit status for main() */
+static inline int test_done(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, s_checks, s_failures);
+    return s_failures ? 1 : 0;
+}
+
+/* Monotonic clock for the benchmarks */
+static inline double test_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}